@@ -416,9 +416,9 @@ void app_service_loop(spawned_children *kid, int read_fd, int write_fd) {
     bool   succeeded = false;
     string in;
     string out;
-    string str_app_req;
-    int    n = sized_pipe_read(read_fd, &str_app_req);
-    if (n <= 0) {
+    string       str_app_req;
+    frame_stream from_app(read_fd);
+    if (!framed_read(from_app, max_app_service_message_size, &str_app_req)) {
       continue;
     }
     app_request req;
@@ -467,8 +467,8 @@ finishreq:
              __func__,
              __LINE__);
     }
-    if (write(write_fd, (byte *)str_app_rsp.data(), str_app_rsp.size())
-        < (int)str_app_rsp.size()) {
+    frame_stream to_app(write_fd);
+    if (!framed_write(to_app, str_app_rsp.size(), (byte *)str_app_rsp.data())) {
       printf("Response write failed\n");
     }
 
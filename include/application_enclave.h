@@ -46,6 +46,10 @@ using std::string;
 #ifndef _APPLICATION_ENCLAVE_H__
 #  define _APPLICATION_ENCLAVE_H__
 
+// Requests and responses between an application and its app_service travel
+// as frames (see framed_write in support.h) of at most this size.
+const uint64_t max_app_service_message_size = 256 * 1024 * 1024;
+
 bool application_Init(const string &parent_enclave_type,
                       int           read_fd,
                       int           write_fd);
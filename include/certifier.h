@@ -23,6 +23,9 @@
 
 #include <string>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -95,6 +98,13 @@ class predicate_dominance {
   predicate_dominance *first_child_;
   predicate_dominance *next_;
 
+  // Filled in by compile(): predicate ids and a transitive closure with
+  // bit j of row i set when predicate i dominates predicate j.
+  std::unordered_map<string, int> ids_;
+  int                             num_ids_;
+  int                             words_per_row_;
+  uint64_t *                      closure_;
+
   predicate_dominance();
   ~predicate_dominance();
 
@@ -104,17 +114,48 @@ class predicate_dominance {
   predicate_dominance *find_node(const string &pred);
   bool                 insert(const string &parent, const string &descendant);
   bool                 is_child(const string &descendant);
+
+  // Compiles the tree below this node so dominates() is a table lookup.
+  // A compiled tree isn't changed by dominates(), so threads can share
+  // it.  insert() drops the table.
+  bool compile();
+  void clear_compiled();
+  int  predicate_id(const string &pred) const;
+  bool dominates_id(int parent, int descendant) const;
 };
 bool dominates(predicate_dominance &root,
                const string &       parent,
                const string &       descendant);
 
+// The standard is-trusted tree, built and compiled once and shared.
+// nullptr if it can't be built.
+predicate_dominance *default_dominance_tree();
+
 // Certifier proofs
 // -------------------------------------------------------------
 
 bool statement_already_proved(const vse_clause & cl,
                               proved_statements *are_proved);
 
+// Clause fingerprints of a proved_statements, kept alongside it so that
+// "is this already proved" is a hash lookup.  Add clauses through add(),
+// or call sync() after appending to the proved_statements directly.
+// contains() agrees with statement_already_proved.
+class proved_index {
+ public:
+  proved_index(proved_statements *are_proved);
+
+  bool contains(const vse_clause &cl);
+  void add(const vse_clause &cl);
+  void sync();
+
+ private:
+  proved_statements *             are_proved_;
+  int                             num_indexed_;
+  std::unordered_set<std::string> fingerprints_;
+};
+bool statement_already_proved(const vse_clause &cl, proved_index &index);
+
 bool construct_vse_attestation_statement(const key_message &attest_key,
                                          const key_message &auth_key,
                                          const string &     measurement,
@@ -171,6 +212,46 @@ bool verify_proof(key_message &        policy_pk,
                   proved_statements *  are_proved);
 bool add_fact_from_signed_claim(const signed_claim_message &signedClaim,
                                 proved_statements *         already_proved);
+
+// The trusted platform and measurement lists, indexed once per policy
+// load: measurement bytes, and the fingerprint of a platform key, map to
+// the first "policy-key says ... is-trusted" claim about them.  The
+// sequences must outlive the index.  Read only once built, so it can be
+// shared between threads.
+class trusted_policy_index {
+ public:
+  trusted_policy_index();
+
+  bool build(const signed_claim_sequence &trusted_platforms,
+             const signed_claim_sequence &trusted_measurements);
+
+  const signed_claim_message *find_measurement(const string &m) const;
+  const signed_claim_message *find_platform(const key_message &k) const;
+  int                         num_measurements() const;
+  int                         num_platforms() const;
+
+ private:
+  std::unordered_map<string, const signed_claim_message *> measurements_;
+  std::unordered_map<string, const signed_claim_message *> platforms_;
+};
+
+bool get_signed_measurement_claim_from_trusted_list(
+    string &               expected_measurement,
+    signed_claim_sequence &trusted_measurements,
+    signed_claim_message * claim);
+bool get_signed_platform_claim_from_trusted_list(
+    const key_message &    expected_key,
+    signed_claim_sequence &trusted_platforms,
+    signed_claim_message * claim);
+bool get_signed_measurement_claim_from_trusted_list(
+    const string &              expected_measurement,
+    const trusted_policy_index &index,
+    signed_claim_message *      claim);
+bool get_signed_platform_claim_from_trusted_list(
+    const key_message &         expected_key,
+    const trusted_policy_index &index,
+    signed_claim_message *      claim);
+
 bool add_newfacts_for_sdk_platform_attestation(
     key_message &          policy_pk,
     signed_claim_sequence &trusted_platforms,
@@ -181,6 +262,14 @@ bool add_new_facts_for_abbreviatedplatformattestation(
     signed_claim_sequence &trusted_platforms,
     signed_claim_sequence &trusted_measurements,
     proved_statements *    already_proved);
+bool add_newfacts_for_sev_attestation(const trusted_policy_index &index,
+                                      proved_statements *already_proved);
+bool add_newfacts_for_sdk_platform_attestation(
+    const trusted_policy_index &index,
+    proved_statements *         already_proved);
+bool add_new_facts_for_abbreviatedplatformattestation(
+    const trusted_policy_index &index,
+    proved_statements *         already_proved);
 bool construct_proof_from_sev_evidence(key_message &      policy_pk,
                                        const string &     purpose,
                                        proved_statements *already_proved,
@@ -211,18 +300,168 @@ bool validate_evidence(const string &         evidence_descriptor,
                        const string &         purpose,
                        evidence_package &     evp,
                        key_message &          policy_pk);
+// As above, with the trusted lists already indexed.
+bool construct_proof_from_request(
+    const string &              evidence_descriptor,
+    key_message &               policy_pk,
+    const string &              purpose,
+    const trusted_policy_index &index,
+    evidence_package &          evp,
+    proved_statements *         already_proved,
+    vse_clause *                to_prove,
+    proof *                     pf);
+bool validate_evidence(const string &              evidence_descriptor,
+                       const trusted_policy_index &index,
+                       const string &              purpose,
+                       evidence_package &          evp,
+                       key_message &               policy_pk);
+
+// Stages of validate_evidence: axiom and dominance setup, checking the
+// evidence's signatures and certificate chains, proof construction and
+// proof verification.
+const int num_validation_stages = 4;
+const int validation_stage_setup = 0;
+const int validation_stage_evidence = 1;
+const int validation_stage_construct = 2;
+const int validation_stage_verify = 3;
+const char *validation_stage_name(int stage);
+
+class evidence_verdict {
+ public:
+  evidence_verdict();
+
+  bool   valid;
+  int    failed_stage;  // -1 if valid
+  double stage_ms[num_validation_stages];
+};
+
+// validate_evidence for each of num_packages requests on up to num_threads
+// threads (all cores if num_threads is 0), sharing index.  verdicts[i] is
+// set for packages[i].  Returns the number that validated.
+int validate_evidence_batch(int                         num_packages,
+                            const string *              evidence_descriptors,
+                            const string *              purposes,
+                            evidence_package *          packages,
+                            const trusted_policy_index &index,
+                            key_message &               policy_pk,
+                            int                         num_threads,
+                            evidence_verdict *          verdicts);
 
 bool get_platform_from_sev_attest(const sev_attestation_message &sev_att,
                                   entity_message *               ent);
 bool get_measurement_from_sev_attest(const sev_attestation_message &sev_att,
                                      entity_message *               ent);
+
+// Compiled form of a policy's "policy-key says platform[...]
+// has-trusted-platform-property" and "policy-key says measurement
+// is-trusted" rules.  Platform rules are indexed by platform type and by
+// one anchoring property: an "=" property goes into an equality index
+// keyed by name and value and a ">=" property into a threshold-sorted
+// index keyed by name.  Only the rules reachable from the attested
+// properties are checked in full.  The matcher refers to the claims in
+// the compiled policy, which must outlive it.
+class platform_policy_matcher {
+ public:
+  platform_policy_matcher();
+
+  bool compile(const key_message &          policy_pk,
+               const signed_claim_sequence &policy);
+
+  // Index in the policy of the first satisfying claim, or -1.
+  int match_platform(const platform &p) const;
+  int match_measurement(const string &m) const;
+
+  // Keeps the first satisfying platform and measurement claims and every
+  // claim that is neither, in policy order.
+  bool filter(const string &         measurement,
+              const platform &       p,
+              signed_claim_sequence *filtered_policy) const;
+
+  int num_platform_rules() const;
+  int num_measurement_rules() const;
+
+ private:
+  struct platform_rule {
+    int      claim;
+    platform plat;
+  };
+
+  const signed_claim_sequence *policy_;
+  std::vector<platform_rule>   rules_;
+  std::vector<int>             other_claims_;
+  int                          num_measurement_rules_;
+
+  std::unordered_map<string, int>              measurements_;
+  std::unordered_map<string, std::vector<int>> equal_;
+  std::unordered_map<string, std::vector<std::pair<uint64_t, int>>> at_least_;
+  std::unordered_map<string, std::vector<int>> unconstrained_;
+
+  bool rule_satisfied(int rule, const platform &p) const;
+};
+
 bool filter_sev_policy(const sev_attestation_message &sev_att,
                        const key_message &            policy_pk,
                        const signed_claim_sequence &  policy,
                        signed_claim_sequence *        filtered_policy);
+bool filter_sev_policy(const sev_attestation_message &sev_att,
+                       const platform_policy_matcher &matcher,
+                       signed_claim_sequence *        filtered_policy);
 bool init_policy(signed_claim_sequence &policy,
                  key_message &          policy_pk,
                  proved_statements *    already_proved);
+
+// A compiled policy: the clauses of a checked signed_claim_sequence, their
+// fingerprints and a measurement index, laid out to be mapped read-only
+// and signed as a whole with the policy key.  write_policy_snapshot checks
+// every claim once; a loader only checks the snapshot's signature, so
+// verifiers start quickly and share the mapped pages.  policy_version lets
+// a loader refuse an older snapshot.  Loaded snapshots stay mapped, so a
+// snapshot file must never be modified in place: write_policy_snapshot
+// writes a temporary file and renames it over file_name, and anything
+// else that installs snapshots must do the same.
+const uint32_t policy_snapshot_format_version = 1;
+
+bool write_policy_snapshot(const signed_claim_sequence &policy,
+                           const key_message &          policy_key,
+                           uint64_t                     policy_version,
+                           const string &               file_name);
+
+class policy_snapshot {
+ public:
+  policy_snapshot();
+  ~policy_snapshot();
+
+  bool load(const string &     file_name,
+            const key_message &policy_pk,
+            uint64_t           min_policy_version = 0);
+  void unload();
+
+  uint64_t policy_version() const;
+  int      num_clauses() const;
+  bool     clause(int i, vse_clause *cl) const;
+  bool     signed_claim(int i, signed_claim_message *sc) const;
+  // False once the first of the compiled claims has expired.
+  bool valid_now() const;
+
+  // Index of the clause, or -1.
+  int find_clause(const vse_clause &cl) const;
+  // Index of "policy-key says measurement is-trusted", or -1.
+  int find_measurement(const string &m) const;
+
+ private:
+  const byte *base_;
+  size_t      size_;
+
+  bool check(const key_message &policy_pk, uint64_t min_policy_version) const;
+
+  policy_snapshot(const policy_snapshot &) = delete;
+  policy_snapshot &operator=(const policy_snapshot &) = delete;
+};
+
+// The snapshot's claims were checked when it was written and its
+// signature when it was loaded.
+bool init_policy(const policy_snapshot &snapshot,
+                 proved_statements *    already_proved);
 bool construct_proof_from_sev_evidence_with_plat(
     const string &     evidence_descriptor,
     key_message &      policy_pk,
@@ -244,6 +483,11 @@ bool validate_evidence_from_policy(const string &         evidence_descriptor,
                                    const string &         purpose,
                                    evidence_package &     evp,
                                    key_message &          policy_pk);
+bool validate_evidence_from_policy(const string &evidence_descriptor,
+                                   const platform_policy_matcher &matcher,
+                                   const string &                 purpose,
+                                   evidence_package &             evp,
+                                   key_message &                  policy_pk);
 
 // -------------------------------------------------------------------
 
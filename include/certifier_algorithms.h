@@ -27,6 +27,7 @@ extern const char *Enc_method_aes_256_cbc;
 extern const char *Enc_method_aes_256_cbc_hmac_sha256;
 extern const char *Enc_method_aes_256_cbc_hmac_sha384;
 extern const char *Enc_method_aes_256_gcm;
+extern const char *Enc_method_ecc_256;
 extern const char *Enc_method_ecc_256_private;
 extern const char *Enc_method_ecc_256_public;
 extern const char *Enc_method_ecc_256_sha256_pkcs_sign;
@@ -17,6 +17,13 @@
 #define _CERTIFIER_FRAMEWORK_H__
 
 #include <string>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <openssl/ssl.h>
 #include <openssl/rsa.h>
 #include <openssl/x509.h>
@@ -329,6 +336,83 @@ class certifiers {
   void print_certifiers_entry();
 };
 
+// TLS session resumption
+// -------------------------------------------------------------------
+
+// Client side cache of TLS 1.3 session tickets.  Entries are keyed by
+// host, port, peer policy cert and our own auth cert, so a ticket is
+// only offered to the peer, and under the identity, it came from.
+// Tickets are taken out of the cache when used, since TLS 1.3 tickets
+// are single use.  The server sends fresh ones on each connection.
+// When full, the least recently stored ticket is dropped.  One cache can
+// be shared by channels on different threads.
+class client_session_cache {
+ public:
+  client_session_cache(int max_entries);
+  ~client_session_cache();
+
+  void     clear();
+  int      num_entries();
+  uint64_t lookups();
+  uint64_t resumptions();
+  uint64_t full_handshakes();
+
+  // Used by secure_authenticated_channel.  take_session returns a
+  // session the caller must free, or nullptr.  put_session takes
+  // ownership of s.
+  SSL_SESSION *take_session(const string &key);
+  void         put_session(const string &key, SSL_SESSION *s);
+  void         record_handshake(bool resumed);
+
+ private:
+  class entry {
+   public:
+    string       key_;
+    SSL_SESSION *session_;
+  };
+
+  int                                           max_entries_;
+  uint64_t                                      lookups_;
+  uint64_t                                      resumptions_;
+  uint64_t                                      full_handshakes_;
+  std::list<entry>                              lru_;
+  std::map<string, std::list<entry>::iterator> sessions_;
+  std::mutex                                    mtx_;
+};
+
+// Server side session ticket keys.  The newest key encrypts new
+// tickets.  Older keys, up to max_keys in all, are still accepted.
+// Call rotate() periodically, e.g. from a timer thread, to limit how
+// long a stolen key is useful.
+class session_ticket_keys {
+ public:
+  static const int key_name_size = 16;
+  static const int cipher_key_size = 32;
+  static const int hmac_key_size = 32;
+
+  session_ticket_keys(int max_keys);
+  ~session_ticket_keys();
+
+  bool     rotate();
+  int      num_keys();
+  uint64_t tickets_issued();
+  uint64_t tickets_accepted();
+  uint64_t tickets_rejected();
+
+  // Used by the OpenSSL ticket callback.
+  bool current_key(byte *name, byte *cipher_key, byte *hmac_key);
+  bool find_key(const byte *name, byte *cipher_key, byte *hmac_key);
+
+ private:
+  int        max_keys_;
+  int        num_keys_;
+  byte *     keys_;
+  uint64_t   tickets_issued_;
+  uint64_t   tickets_accepted_;
+  uint64_t   tickets_rejected_;
+  std::mutex mtx_;
+};
+
 class secure_authenticated_channel {
  public:
   string          role_;
@@ -345,9 +429,24 @@ class secure_authenticated_channel {
   X509 *          peer_cert_;
   string          peer_id_;
 
+  client_session_cache *session_cache_;
+  string                session_key_;
+  bool                  use_ktls_;
+
   secure_authenticated_channel(string &role);  // role is client or server
   ~secure_authenticated_channel();
 
+  // Client only; call before init_client_ssl to resume earlier sessions
+  // with the same peer.
+  void set_session_cache(client_session_cache *cache);
+
+  // Asks OpenSSL to hand record encryption to the kernel (kTLS) once the
+  // handshake is done.  Call before the handshake.  Where the kernel or
+  // OpenSSL lacks kTLS the channel works as it would without it.
+  void set_ktls(bool enable);
+  bool ktls_send_active();
+  bool ktls_recv_active();
+
   bool load_client_certs_and_key();
 
   bool init_client_ssl(const string &host_name,
@@ -361,6 +460,17 @@ class secure_authenticated_channel {
                        key_message & private_key,
                        const string &private_key_cert);
 
+  // The steps of init_client_ssl, for callers that connect and run the
+  // handshake themselves (see async_channel_driver).  prepare_client_ssl
+  // builds the SSL_CTX and loads the keys, attach_client_socket creates
+  // the SSL object on a connected socket and complete_client_handshake
+  // records the peer once SSL_connect succeeds.
+  bool prepare_client_ssl(string &      asn1_root_cert,
+                          key_message & private_key,
+                          const string &private_key_cert);
+  void attach_client_socket(const string &host_name, int port, int sock);
+  void complete_client_handshake();
+
   void server_channel_accept_and_auth(
       void (*func)(secure_authenticated_channel &));
 
@@ -369,6 +479,13 @@ class secure_authenticated_channel {
   int  write(int size, byte *b);
   void close();
   bool get_peer_id(string *out_peer_id);
+
+  // Sends a file as one frame (see framed_write).  With kTLS the payload
+  // goes from the page cache to the socket with SSL_sendfile; otherwise
+  // it is copied through a record-sized buffer.
+  bool send_file(const string &file_name);
+  // Writes the next frame to file_name; fails if it exceeds max_size.
+  bool receive_file(const string &file_name, uint64_t max_size);
 };
 
 bool server_dispatch(const string &host_name,
@@ -377,6 +494,386 @@ bool server_dispatch(const string &host_name,
                      key_message & private_key,
                      const string &private_key_cert,
                      void (*)(secure_authenticated_channel &));
+
+// Client connection pool
+// -------------------------------------------------------------------
+
+// Keeps authenticated client channels to each peer open between
+// exchanges.  A thread calls acquire() to get a channel, which is an
+// idle one if a healthy one is available or a new connection if not.
+// It returns the channel with release() when it is done.  Idle channels
+// are checked before reuse.  A channel whose peer has closed it, has
+// unread application data, or has been idle too long is dropped.  At
+// most max_idle_per_peer channels are kept idle for each host and port.
+class client_channel_pool {
+ public:
+  client_channel_pool(int max_idle_per_peer);
+  ~client_channel_pool();
+
+  bool init(string &      asn1_root_cert,
+            key_message & private_key,
+            const string &private_key_cert);
+
+  // Optional.  New connections resume TLS sessions from cache.
+  void set_session_cache(client_session_cache *cache);
+  // Idle channels older than this are closed rather than reused.  0, the
+  // default, means no limit.
+  void set_max_idle_seconds(int seconds);
+
+  secure_authenticated_channel *acquire(const string &host_name, int port);
+  // If reusable is false, e.g. after a failed read or write, the channel
+  // is closed.
+  void release(secure_authenticated_channel *channel, bool reusable);
+  void close_idle();
+
+  int      num_idle();
+  int      num_in_use();
+  uint64_t connections_opened();
+  uint64_t reuses();
+  uint64_t health_check_failures();
+
+ private:
+  class idle_channel;
+
+  int                   max_idle_per_peer_;
+  int                   max_idle_seconds_;
+  bool                  initialized_;
+  string                asn1_root_cert_;
+  key_message           private_key_;
+  string                private_key_cert_;
+  client_session_cache *session_cache_;
+  uint64_t              connections_opened_;
+  uint64_t              reuses_;
+  uint64_t              health_check_failures_;
+
+  std::map<string, std::deque<idle_channel *>>     idle_;
+  std::map<secure_authenticated_channel *, string> in_use_;
+  std::mutex                                       mtx_;
+};
+
+// Thread-pooled server
+// -------------------------------------------------------------------
+
+class server_worker_stats {
+ public:
+  int      worker_id_;
+  uint64_t connections_handled_;
+  uint64_t handshake_failures_;
+  uint64_t busy_usec_;
+
+  server_worker_stats();
+};
+
+// Accepts connections on one thread and hands the sockets to a fixed
+// pool of workers through a bounded queue.  Each worker runs the TLS
+// handshake and the application callback, so a slow peer only ties up
+// its own worker.  When the queue is full, the acceptor stops accepting
+// and new connections wait in the listen backlog.
+class server_dispatch_pool {
+ public:
+  server_dispatch_pool(int num_workers, int max_queued_connections);
+  ~server_dispatch_pool();
+
+  // Opens the listening socket and builds the server SSL_CTX.  If port
+  // is 0, an ephemeral port is chosen; port() returns it.
+  bool init(const string &host_name,
+            int           port,
+            string &      asn1_root_cert,
+            key_message & private_key,
+            const string &private_key_cert,
+            void (*func)(secure_authenticated_channel &));
+
+  // Enables ticket key rotation.  Call before init(); keys must outlive
+  // the pool.
+  void set_ticket_keys(session_ticket_keys *keys);
+
+  // Requests kTLS on accepted channels.  Call before init().
+  void set_ktls(bool enable);
+
+  // Starts the workers and runs the accept loop until stop() is called.
+  bool run();
+  void stop();
+
+  int      port();
+  int      num_workers();
+  int      queued_connections();
+  uint64_t queue_full_waits();
+  bool     get_worker_stats(int worker, server_worker_stats *out);
+
+ private:
+  int                  num_workers_;
+  int                  max_queued_;
+  bool                 initialized_;
+  bool                 stopping_;
+  int                  listen_sock_;
+  SSL_CTX *            ctx_;
+  session_ticket_keys *ticket_keys_;
+  bool                 ktls_;
+  int                  port_;
+  uint64_t             queue_full_waits_;
+  server_worker_stats *stats_;
+  std::thread **       workers_;
+  std::deque<int>      queue_;
+
+  void (*func_)(secure_authenticated_channel &);
+
+  std::mutex              mtx_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+
+  void worker_loop(int worker);
+};
+
+bool server_dispatch(const string &host_name,
+                     int           port,
+                     string &      asn1_root_cert,
+                     key_message & private_key,
+                     const string &private_key_cert,
+                     void (*)(secure_authenticated_channel &),
+                     int num_workers,
+                     int max_queued_connections);
+
+// Event-driven server
+// -------------------------------------------------------------------
+
+// Runs non-blocking TLS handshakes and sized reads/writes for many
+// connections on a few epoll loop threads.  func is called once for
+// each complete sized message (the sized_ssl_read/sized_ssl_write
+// framing).  A non-empty *response is sent back using the same framing.
+// If func returns false, the connection is closed.  The channel passed
+// to func is authenticated, so get_peer_id() works.  func must not call
+// read() or write() on it, and must not block for long, because it runs
+// on a loop thread shared with other connections.
+class event_dispatch_server {
+ public:
+  event_dispatch_server(int num_loops);
+  ~event_dispatch_server();
+
+  // If port is 0, an ephemeral port is chosen; port() returns it.
+  bool init(const string &host_name,
+            int           port,
+            string &      asn1_root_cert,
+            key_message & private_key,
+            const string &private_key_cert,
+            bool (*func)(secure_authenticated_channel &,
+                         const string &request,
+                         string *      response));
+
+  // Largest message accepted from a peer; longer ones close the
+  // connection.  The default is 64MB.
+  void set_max_message_size(int size);
+
+  // Enables ticket key rotation.  Call before init(); keys must outlive
+  // the server.
+  void set_ticket_keys(session_ticket_keys *keys);
+
+  // Runs the loops until stop() is called.
+  bool run();
+  void stop();
+
+  int      port();
+  int      num_loops();
+  int      connections_open();
+  uint64_t connections_accepted();
+  uint64_t handshake_failures();
+  uint64_t messages_handled();
+
+ private:
+  class connection;
+  class loop_state;
+
+  int                  num_loops_;
+  int                  max_message_size_;
+  bool                 initialized_;
+  std::atomic<bool>    stopping_;
+  int                  listen_sock_;
+  int                  wake_fd_;
+  int                  port_;
+  SSL_CTX *            ctx_;
+  session_ticket_keys *ticket_keys_;
+  loop_state *         loops_;
+
+  bool (*func_)(secure_authenticated_channel &,
+                const string &request,
+                string *      response);
+
+  void event_loop(int loop);
+  bool watch_listen_socket(loop_state *ls);
+  void pause_accepting(loop_state *ls);
+  void accept_connections(loop_state *ls);
+  bool service_connection(loop_state *ls, connection *c);
+  bool deliver_messages(loop_state *ls, connection *c);
+  void close_connection(loop_state *ls, connection *c);
+};
+
+// Asynchronous client channels
+// -------------------------------------------------------------------
+
+// Runs many client channels on the calling thread over non-blocking
+// sockets.  connect, write and read start an operation and return at
+// once; its callback runs from run_once() when it completes or fails.
+// Operations on one channel complete in the order they were started.
+// Callbacks may start further operations or close the channel.
+class async_channel_driver {
+ public:
+  typedef void (*connect_callback)(void *                        arg,
+                                   secure_authenticated_channel *channel,
+                                   bool                          ok);
+  typedef void (*write_callback)(void *                        arg,
+                                 secure_authenticated_channel *channel,
+                                 bool                          ok);
+  typedef void (*read_callback)(void *                        arg,
+                                secure_authenticated_channel *channel,
+                                bool                          ok,
+                                const string &                message);
+
+  async_channel_driver();
+  ~async_channel_driver();
+
+  bool init();
+
+  // Largest message accepted from a peer; the default is 64MB.
+  void set_max_message_size(int size);
+
+  // Starts the connect and handshake.  Name lookup still blocks.  The
+  // driver owns the returned channel until close().  Returns nullptr,
+  // without calling cb, if the connection can't be started.
+  secure_authenticated_channel *connect(const string &   host_name,
+                                        int              port,
+                                        string &         asn1_root_cert,
+                                        key_message &    private_key,
+                                        const string &   private_key_cert,
+                                        connect_callback cb,
+                                        void *           arg);
+
+  // Sends a sized message, in the format channel.read() expects.
+  bool write(secure_authenticated_channel *channel,
+             int                           size,
+             byte *                        b,
+             write_callback                cb,
+             void *                        arg);
+  // Receives the next sized message.
+  bool read(secure_authenticated_channel *channel, read_callback cb, void *arg);
+
+  // Fails the channel's outstanding operations and frees it.
+  void close(secure_authenticated_channel *channel);
+
+  // Waits up to timeout_ms (-1 for no limit) for progress and runs the
+  // callbacks that are due.
+  bool run_once(int timeout_ms);
+  // Runs until no operation is outstanding.
+  bool run();
+
+  int num_channels();
+  int outstanding();
+
+ private:
+  class entry;
+
+  int                                               epoll_fd_;
+  int                                               max_message_size_;
+  bool                                              in_run_;
+  int                                               outstanding_;
+  std::map<secure_authenticated_channel *, entry *> entries_;
+  std::deque<entry *>                               ready_;
+  std::deque<entry *>                               closed_;
+
+  void make_ready(entry *e);
+  void advance(entry *e);
+  int  deliver_message(entry *e);
+  void fail(entry *e);
+  void set_events(entry *e, uint32_t events);
+  void free_entry(entry *e);
+};
+
+// Stream multiplexing
+// -------------------------------------------------------------------
+
+// Carries many independent message streams over one authenticated
+// channel, so concurrent conversations between two peers share a single
+// connection and handshake.  Messages are cut into frames of at most
+// mux_max_frame_payload bytes, and frames of different streams are
+// interleaved.  Each stream has its own send window: once a stream has
+// an unread message queued at the peer, a sender may have at most
+// stream_window further bytes in flight on it.
+//
+// Streams opened by the initiator have odd ids, the other side's even
+// ones.  A thread owned by the mux does all I/O on the channel;
+// open_stream, accept_stream, send, receive and close_stream may be
+// called from any number of threads.
+const int mux_max_frame_payload = 16372;
+
+class channel_mux {
+ public:
+  channel_mux(secure_authenticated_channel *channel, bool initiator);
+  ~channel_mux();
+
+  // Call before start(); both sides should agree.  The default is 256KB.
+  void set_stream_window(int size);
+  // Largest message accepted from the peer and most streams open at
+  // once.  A peer that goes past either fails the mux, and send and
+  // open_stream refuse to.  Call before start(); both sides should agree.
+  // The defaults are 64MB and 1024 streams.
+  void set_max_message_size(int size);
+  void set_max_streams(int num);
+
+  bool start();
+  // Stops the I/O thread; calls still waiting fail.  The channel is
+  // left open and blocking.
+  void stop();
+
+  int open_stream();
+  // Waits for the peer to open a stream.  Returns -1 once the mux has
+  // stopped or failed.
+  int accept_stream();
+
+  bool send(int stream, int size, byte *b);
+  // Waits for the next message on stream.  Returns false once the peer
+  // has closed the stream and all its messages have been read, or if
+  // the mux fails.
+  bool receive(int stream, string *out);
+  // Tells the peer no more messages will be sent on stream.
+  void close_stream(int stream);
+
+  bool     failed();
+  int      num_streams();
+  uint64_t frames_sent();
+  uint64_t frames_received();
+
+ private:
+  class stream;
+
+  secure_authenticated_channel *channel_;
+  bool                          initiator_;
+  int                           stream_window_;
+  int                           max_message_size_;
+  int                           max_streams_;
+  int                           next_stream_;
+  int                           last_peer_stream_;
+  int                           wake_fd_;
+  int                           saved_flags_;
+  bool                          stopping_;
+  bool                          failed_;
+  uint64_t                      frames_sent_;
+  uint64_t                      frames_received_;
+  std::thread *                 io_thread_;
+  std::map<int, stream *>       streams_;
+  std::deque<int>               accept_queue_;
+  std::deque<int>               send_order_;
+  string                        control_out_;
+
+  std::mutex              mtx_;
+  std::condition_variable cv_;
+
+  void    io_loop();
+  void    wake();
+  stream *new_stream(int id);
+  void    queue_frame(stream *s, int type, int flags, int size, const byte *b);
+  void    queue_window_update(int id, uint32_t increment);
+  bool    take_output(string *out);
+  bool    handle_frame(int id, int type, int flags, int size, const byte *b);
+  void    release_stream(int id);
+};
 }  // namespace framework
 }  // namespace certifier
 
@@ -25,5 +25,6 @@
 #include "store_tests.h"
 #include "x509_tests.h"
 #include "support_tests.h"
+#include "channel_tests.h"
 
 #endif  // __CERTIFIER_TESTS_H__
@@ -23,4 +23,5 @@
 %include "store_tests.h"
 %include "support_tests.h"
 %include "x509_tests.h"
+%include "channel_tests.h"
 
@@ -60,6 +60,176 @@ bool authenticated_decrypt(const char *alg,
                            byte *      out,
                            int *       out_size);
 
+// As above, binding aad (e.g. enclave type, tag or version) into the mac
+// or tag without encrypting or sending it.
+bool authenticated_encrypt_with_aad(const char *alg,
+                                    byte *      in,
+                                    int         in_len,
+                                    const byte *aad,
+                                    int         aad_len,
+                                    byte *      key,
+                                    byte *      iv,
+                                    byte *      out,
+                                    int *       out_size);
+bool authenticated_decrypt_with_aad(const char *alg,
+                                    byte *      in,
+                                    int         in_len,
+                                    const byte *aad,
+                                    int         aad_len,
+                                    byte *      key,
+                                    byte *      out,
+                                    int *       out_size);
+
+// In place, with no second buffer.  See crypto_context for the layout
+// of buf.
+bool authenticated_encrypt_in_place(const char *alg,
+                                    byte *      key,
+                                    byte *      iv,
+                                    const byte *aad,
+                                    int         aad_len,
+                                    byte *      buf,
+                                    int         in_len,
+                                    int         buf_size,
+                                    int *       out_size);
+bool authenticated_decrypt_in_place(const char *alg,
+                                    byte *      key,
+                                    const byte *aad,
+                                    int         aad_len,
+                                    byte *      buf,
+                                    int         in_len,
+                                    int *       out_size);
+
+// Largest key any supported symmetric algorithm takes (aes-256-cbc with
+// hmac-sha384).
+const int max_symmetric_key_size = 96;
+
+// A keyed cipher context.  init() expands the key and sets up the cipher
+// and HMAC contexts once; each call after that only re-keys the iv, so a
+// context must be used by one thread at a time.  authenticated_encrypt()
+// output is laid out as in the free function: iv, ciphertext, then the
+// mac or gcm tag.  encrypt() and decrypt() are unauthenticated
+// aes-256-cbc under the first 32 bytes of the key.
+class crypto_context {
+ public:
+  crypto_context();
+  ~crypto_context();
+
+  bool init(const char *alg_name, const byte *key);
+  bool same_key(const char *alg_name, const byte *key) const;
+
+  bool encrypt(byte *in, int in_len, byte *iv, byte *out, int *out_size);
+  bool decrypt(byte *in, int in_len, byte *iv, byte *out, int *out_size);
+
+  // aad, if any, is authenticated but not encrypted or sent; decrypt must
+  // be given the same aad.
+  bool authenticated_encrypt(byte *      in,
+                             int         in_len,
+                             byte *      iv,
+                             byte *      out,
+                             int *       out_size,
+                             const byte *aad = nullptr,
+                             int         aad_len = 0);
+  bool authenticated_decrypt(byte *      in,
+                             int         in_len,
+                             byte *      out,
+                             int *       out_size,
+                             const byte *aad = nullptr,
+                             int         aad_len = 0);
+
+  // In place: the plaintext starts at buf + block_size, leaving room for
+  // the iv, and buf_size must leave room for padding and the mac.  On
+  // return buf holds iv, ciphertext and mac.  Decrypt leaves the
+  // plaintext at buf + block_size.
+  bool authenticated_encrypt_in_place(byte *      iv,
+                                      byte *      buf,
+                                      int         in_len,
+                                      int         buf_size,
+                                      int *       out_size,
+                                      const byte *aad = nullptr,
+                                      int         aad_len = 0);
+  bool authenticated_decrypt_in_place(byte *      buf,
+                                      int         in_len,
+                                      int *       out_size,
+                                      const byte *aad = nullptr,
+                                      int         aad_len = 0);
+
+  // Streaming authenticated encryption, same layout as above.  Input may
+  // come in chunks of any size.  Each update() writes at most in_len +
+  // block_size bytes; final() writes at most 2 * block_size bytes plus
+  // the mac.  encrypt_init() writes the iv.  Plaintext from
+  // decrypt_update() is not authenticated until decrypt_final() succeeds.
+  // A context must not be used for anything else while a stream is open.
+  bool encrypt_init(byte *      iv,
+                    byte *      out,
+                    int *       out_size,
+                    const byte *aad = nullptr,
+                    int         aad_len = 0);
+  bool encrypt_update(const byte *in, int in_len, byte *out, int *out_size);
+  bool encrypt_final(byte *out, int *out_size);
+  bool decrypt_init(const byte *aad = nullptr, int aad_len = 0);
+  bool decrypt_update(const byte *in, int in_len, byte *out, int *out_size);
+  bool decrypt_final(byte *out, int *out_size);
+
+ private:
+  crypto_context(const crypto_context &) = delete;
+  crypto_context &operator=(const crypto_context &) = delete;
+  void            clear();
+  bool            authenticated() const;
+  bool            start_mac(const byte *aad, int aad_len);
+  bool            finish_mac(int aad_len, byte *mac, unsigned int *mac_size);
+
+  string          alg_;
+  bool            gcm_;
+  int             blk_size_;
+  int             key_size_;
+  int             mac_size_;
+  const EVP_MD *  md_;
+  byte            key_[max_symmetric_key_size];
+  EVP_CIPHER_CTX *enc_ctx_;
+  EVP_CIPHER_CTX *dec_ctx_;
+  HMAC_CTX *      hmac_ctx_;
+
+  // Stream state.  A decrypt stream collects the iv first and always
+  // holds back the last mac_size_ bytes, since they may be the tag.
+  int    stream_op_;
+  string stream_aad_;
+  int    stream_aad_len_;
+  int    stream_iv_len_;
+  byte   stream_iv_[block_size];
+  int    pending_len_;
+  byte   pending_[EVP_MAX_MD_SIZE];
+};
+
+// Returns the calling thread's context for alg_name and key, building it
+// on first use.  Each thread keeps its few most recently used keys, which
+// is what authenticated_encrypt() and authenticated_decrypt() run on.
+//
+// A cached context holds a copy of its key until it's pushed out by
+// newer keys, the thread's contexts are cleared or the thread exits.
+// clear_thread_crypto_contexts() wipes and frees the calling thread's
+// contexts; other threads keep theirs.  set_thread_crypto_caching(false)
+// makes every thread's encrypt and decrypt calls clear their contexts
+// when they return, so keys last no longer than the call.  Callers of
+// thread_crypto_context() itself should then clear when they're done.
+crypto_context *thread_crypto_context(const char *alg_name, const byte *key);
+void            clear_thread_crypto_contexts();
+void            set_thread_crypto_caching(bool cache);
+int             num_thread_crypto_contexts();
+
+// Streams a whole file through a crypto_context in fixed size chunks, so
+// memory use doesn't depend on the file size.  The output file has the
+// same layout as authenticated_encrypt().  A failed decrypt removes the
+// output file.
+bool authenticated_encrypt_file(const char *  alg_name,
+                                const byte *  key,
+                                byte *        iv,
+                                const string &in_file_name,
+                                const string &out_file_name);
+bool authenticated_decrypt_file(const char *  alg_name,
+                                const byte *  key,
+                                const string &in_file_name,
+                                const string &out_file_name);
+
 EC_KEY *generate_new_ecc_key(int num_bits);
 EC_KEY *key_to_ECC(const key_message &kr);
 bool    ECC_to_key(const EC_KEY *e, key_message *k);
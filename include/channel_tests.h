@@ -0,0 +1,43 @@
+//  Copyright (c) 2021-23, VMware Inc, and the Certifier Authors.  All rights
+//  reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __CHANNEL_TESTS_H__
+#define __CHANNEL_TESTS_H__
+
+bool test_server_dispatch_pool(bool print_all);
+
+bool test_event_dispatch_server(bool print_all);
+bool test_event_dispatch_accept_backoff(bool print_all);
+
+bool test_server_connection_setup(bool print_all);
+
+bool test_session_resumption(bool print_all);
+
+bool test_client_channel_pool(bool print_all);
+
+bool test_sized_io(bool print_all);
+
+bool test_framed_io(bool print_all);
+
+bool test_ktls_send_file(bool print_all);
+
+bool test_async_channel_driver(bool print_all);
+
+bool test_channel_mux(bool print_all);
+bool test_channel_mux_limits(bool print_all);
+
+bool test_channel_auth_key_types(bool print_all);
+
+#endif  // __CHANNEL_TESTS_H__
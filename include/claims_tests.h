@@ -20,8 +20,26 @@ bool test_claims_1(bool print_all);
 
 bool test_signed_claims(bool print_all);
 
+bool test_verify_signed_claims(bool print_all);
+
+bool test_verify_and_parse_claim(bool print_all);
+
+bool test_fingerprints(bool print_all);
+
+bool test_proved_index(bool print_all);
+
+bool test_trusted_policy_index(bool print_all);
+
+bool test_platform_policy_matcher(bool print_all);
+
+bool test_verified_claim_cache(bool print_all);
+
+bool test_policy_snapshot(bool print_all);
+
 bool test_predicate_dominance(bool print_all);
 
+bool test_dominance_table(bool print_all);
+
 bool test_certify_steps(bool print_all);
 
 bool test_full_certification(bool print_all);
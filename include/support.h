@@ -20,6 +20,9 @@
 
 #include <string>
 #include <memory>
+#include <list>
+#include <map>
+#include <mutex>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -112,6 +115,7 @@ bool same_measurement(const string &m1, const string &m2);
 bool same_entity(const entity_message &e1, const entity_message &e2);
 bool same_property(const property &p1, const property &p2);
 bool same_properties(const properties &p1, const properties &p2);
+const property *find_property(const string &name, const properties &p);
 bool satisfying_property(const property &p1, const property &p2);
 bool satisfying_properties(const properties &p1, const properties &p2);
 bool same_platform(const platform &p1, const platform &p2);
@@ -119,6 +123,39 @@ bool satisfying_platform(const platform &p1, const platform &p2);
 bool same_environment(const environment &e1, const environment &e2);
 bool same_vse_claim(const vse_clause &c1, const vse_clause &c2);
 
+// Canonical fingerprints: SHA-256 over a deterministic, length-prefixed
+// encoding of the fields same_key, same_entity and same_vse_claim look at.
+// A clause's fingerprint is built from those of its parts.  Equal
+// fingerprints mean same_key, same_entity or same_vse_claim holds; the
+// reverse can fail only for platforms, where same_platform ignores a
+// missing attest key, extra properties and all but the first property
+// with a given name.  Key names and formats and RSA and ECC private
+// components don't contribute; symmetric keys are hashed by their key
+// bits, so don't publish their fingerprints.  Fails for key types
+// same_key doesn't handle.
+const int fingerprint_size = 32;
+bool      key_fingerprint(const key_message &k, string *fp);
+bool      entity_fingerprint(const entity_message &e, string *fp);
+bool      vse_clause_fingerprint(const vse_clause &c, string *fp);
+
+// Remembers the fingerprints of messages by address, so each is computed
+// once.  The messages must outlive the memo and not change while it's in
+// use.  Not thread safe.
+class fingerprint_memo {
+ public:
+  const string *key(const key_message &k);
+  const string *entity(const entity_message &e);
+  const string *clause(const vse_clause &c);
+
+  void clear();
+  int  size();
+
+ private:
+  std::map<const key_message *, string>    keys_;
+  std::map<const entity_message *, string> entities_;
+  std::map<const vse_clause *, string>     clauses_;
+};
+
 bool generate_new_rsa_key(int num_bits, RSA *r);
 bool key_to_RSA(const key_message &k, RSA *r);
 bool RSA_to_key(const RSA *r, key_message *k);
@@ -176,14 +213,91 @@ bool make_signed_claim(const char *          alg,
                        signed_claim_message *out);
 bool verify_signed_claim(const signed_claim_message &claim,
                          const key_message &         key);
+// As above, also returning the claim parsed while verifying it, so callers
+// don't decode serialized_claim_message again.
+bool verify_signed_claim_and_parse(const signed_claim_message &signed_claim,
+                                   const key_message &         key,
+                                   claim_message *             claim);
+
+// Verifies claims on up to num_threads threads (all cores if num_threads
+// is 0), each against key or, if key is nullptr, against the claim's own
+// signing key.  results[i] is set to whether claims[i] verified and, if
+// parsed isn't nullptr, parsed[i] to its claim.  Returns the number that
+// verified.
+int verify_signed_claims(int                                num_claims,
+                         const signed_claim_message *const *claims,
+                         const key_message *                key,
+                         int                                num_threads,
+                         bool *                             results,
+                         claim_message *                    parsed = nullptr);
+int verify_signed_claim_sequence(const signed_claim_sequence &seq,
+                                 const key_message *          key,
+                                 int                          num_threads,
+                                 bool *                       results,
+                                 claim_message *              parsed = nullptr);
+
+// Batches with fewer claims than this per thread use fewer threads.
+const int min_claims_per_verify_thread = 8;
+
 bool get_vse_clause_from_signed_claim(const signed_claim_message &scm,
                                       vse_clause *                c);
 
+// Sized messages: a native int size, then the payload.  Reads and writes
+// fail on messages larger than max_sized_message_size, and reads grow
+// their buffer as the payload arrives rather than trusting the size.
+const int max_sized_message_size = 256 * 1024 * 1024;
+
 int sized_pipe_read(int fd, string *out);
 int sized_pipe_write(int fd, int size, byte *buf);
 int sized_ssl_read(SSL *ssl, string *out);
 int sized_ssl_write(SSL *ssl, int size, byte *buf);
 
+// Framed messages.  Unlike the sized_* format above, which prefixes a
+// native int, a frame header is endian-safe, versioned and carries a 64-bit
+// payload size:
+//    "CFRM" | version (1) | flags (1) | reserved (2) | size (8, big-endian)
+// Flags and reserved bytes are zero in version 1.
+const int  frame_header_size = 16;
+const byte frame_version = 1;
+
+bool encode_frame_header(uint64_t size, byte *header);
+bool decode_frame_header(const byte *header, uint64_t *size);
+
+// A blocking pipe, socket or SSL connection that frames move over.
+class frame_stream {
+ public:
+  frame_stream(int fd);
+  frame_stream(SSL *ssl);
+  bool read_all(byte *buf, int size);
+  bool write_all(const byte *buf, int size);
+
+ private:
+  int  fd_;
+  SSL *ssl_;
+};
+
+// Whole frames.  framed_read fails on frames larger than max_size, and
+// grows its buffer as the payload arrives rather than trusting the size.
+bool framed_write(frame_stream &s, uint64_t size, const byte *buf);
+bool framed_read(frame_stream &s, uint64_t max_size, string *out);
+
+// Streaming.  A writer sends the header and then exactly size payload bytes
+// in as many framed_write_data calls as it likes.  A reader takes the header
+// and then pulls the payload into its own buffer with framed_read_data or
+// has it handed, chunk_size bytes at a time, to func with
+// framed_read_chunks.
+typedef bool (*frame_chunk_func)(void *arg, int size, const byte *chunk);
+bool framed_write_header(frame_stream &s, uint64_t size);
+bool framed_write_data(frame_stream &s, int size, const byte *buf);
+bool framed_read_header(frame_stream &s, uint64_t *size);
+bool framed_read_data(frame_stream &s, int size, byte *buf);
+bool framed_read_chunks(frame_stream &   s,
+                        uint64_t         size,
+                        int              chunk_size,
+                        byte *           chunk,
+                        frame_chunk_func func,
+                        void *           arg);
+
 class cert_keys_seen {
  public:
   string       issuer_name_;
@@ -204,6 +318,116 @@ class cert_keys_seen_list {
 
 key_message *get_issuer_key(X509 *x, cert_keys_seen_list &list);
 EVP_PKEY *   pkey_from_key(const key_message &k);
+
+// Parsed keys, keyed by a SHA-256 digest of the key type and format and
+// every key component, private ones included.  Holds at most max_entries
+// keys and evicts the least recently used.  Safe to share between
+// threads.
+//
+// A cached private key stays in memory until it's evicted, clear() is
+// called or the cache goes away, and key_cache() lasts as long as the
+// process.  Call clear() once private keys are no longer needed, or
+// set_cache_private_keys(false) to parse them on every use instead;
+// set_max_entries(0) turns the cache off altogether.
+class pkey_cache {
+ public:
+  pkey_cache(int max_entries);
+  ~pkey_cache();
+
+  // Returns a new reference the caller must EVP_PKEY_free, or nullptr if
+  // k can't be translated.
+  EVP_PKEY *get(const key_message &k);
+
+  void     clear();
+  void     set_max_entries(int max_entries);
+  // Turning this off also drops the private keys already cached.
+  void     set_cache_private_keys(bool cache);
+  int      num_entries();
+  uint64_t hits();
+  uint64_t misses();
+
+ private:
+  class entry {
+   public:
+    string    digest_;
+    EVP_PKEY *pkey_;
+    bool      private_;
+  };
+  void evict_to(int n);
+
+  int                                           max_entries_;
+  bool                                          cache_private_keys_;
+  uint64_t                                      hits_;
+  uint64_t                                      misses_;
+  std::list<entry>                              lru_;
+  std::map<string, std::list<entry>::iterator> index_;
+  std::mutex                                    mtx_;
+};
+
+const int default_pkey_cache_size = 64;
+
+// The cache every signing and verification path uses.
+pkey_cache &key_cache();
+
+// New references from key_cache(); free with EVP_PKEY_free, RSA_free or
+// EC_KEY_free.  nullptr if k isn't that kind of key.
+EVP_PKEY *cached_pkey_from_key(const key_message &k);
+RSA *     cached_rsa_from_key(const key_message &k);
+EC_KEY *  cached_ecc_from_key(const key_message &k);
+
+// Claims that verified, keyed by a SHA-256 digest of the serialized claim,
+// its signature and signing algorithm and the verifying key's fingerprint
+// and format.
+// A hit skips the signature check but still checks the claim's validity
+// period.  Holds at most max_entries claims and evicts the least recently
+// used.  Safe to share between threads.
+class verified_claim_cache {
+ public:
+  verified_claim_cache(int max_entries);
+
+  // verify_signed_claim_and_parse, through the cache.  If cl isn't
+  // nullptr, the claim must be a vse-clause and cl is set to it.
+  bool verify(const signed_claim_message &sc,
+              const key_message &         key,
+              claim_message *             c,
+              vse_clause *                cl = nullptr);
+
+  // Call these when the policy is reloaded or a key is withdrawn.
+  void clear();
+  int  invalidate_key(const key_message &key);
+
+  void     set_max_entries(int max_entries);
+  int      num_entries();
+  uint64_t hits();
+  uint64_t misses();
+
+ private:
+  class entry {
+   public:
+    string        digest_;
+    string        key_fingerprint_;
+    claim_message claim_;
+    bool          has_clause_;
+    vse_clause    clause_;
+    time_point    not_before_;
+    time_point    not_after_;
+  };
+  void evict_to(int n);
+  bool lookup(const string &digest, entry *found);
+
+  int                                           max_entries_;
+  uint64_t                                      hits_;
+  uint64_t                                      misses_;
+  std::list<entry>                              lru_;
+  std::map<string, std::list<entry>::iterator> index_;
+  std::mutex                                    mtx_;
+};
+
+const int default_verified_claim_cache_size = 1024;
+
+// The cache verify_signed_claim_and_parse uses.
+verified_claim_cache &claim_cache();
+
 bool         x509_to_public_key(X509 *x, key_message *k);
 bool         construct_vse_attestation_from_cert(const key_message &subj,
                                                  const key_message &signer,
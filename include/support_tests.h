@@ -22,6 +22,12 @@ bool test_encrypt(bool print_all);
 
 bool test_authenticated_encrypt(bool print_all);
 
+bool test_crypto_context(bool print_all);
+
+bool test_streaming_encrypt(bool print_all);
+
+bool test_aead_in_place(bool print_all);
+
 bool test_public_keys(bool print_all);
 
 bool test_digest(bool print_all);
@@ -32,6 +38,8 @@ bool test_time(bool print_all);
 
 bool test_key_translation(bool print_all);
 
+bool test_pkey_cache(bool print_all);
+
 bool test_artifact(bool print_all);
 
 bool test_local_certify(bool print_all);
@@ -40,4 +48,6 @@ bool test_new_local_certify(bool print_all);
 
 bool test_partial_local_certify(bool print_all);
 
+bool test_validate_evidence_batch(bool print_all);
+
 #endif  // __SUPPORT_TESTS_H__
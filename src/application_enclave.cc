@@ -54,18 +54,19 @@ bool application_GetParentEvidence(string *out) {
   req.set_function("getparentevidence");
   string req_str;
   req.SerializeToString(&req_str);
-  if (sized_pipe_write(writer, req_str.size(), (byte *)req_str.data()) < 0) {
-    printf("%s() error, line %d, application_Init, sized_pipe_write failed\n",
+  frame_stream to_parent(writer);
+  if (!framed_write(to_parent, req_str.size(), (byte *)req_str.data())) {
+    printf("%s() error, line %d, application_Init, framed_write failed\n",
            __func__,
            __LINE__);
     return false;
   }
 
   // response
-  string rsp_str;
-  int    n = sized_pipe_read(reader, &rsp_str);
-  if (n < 0) {
-    printf("%s() error, line %d, application_Init, sized_pipe_read failed\n",
+  frame_stream from_parent(reader);
+  string       rsp_str;
+  if (!framed_read(from_parent, max_app_service_message_size, &rsp_str)) {
+    printf("%s() error, line %d, application_Init, framed_read failed\n",
            __func__,
            __LINE__);
     return false;
@@ -87,9 +88,6 @@ bool application_GetParentEvidence(string *out) {
   return true;
 }
 
-const int buffer_pad = 2048;
-const int platform_statement_size = 4096;
-
 bool application_Seal(int in_size, byte *in, int *size_out, byte *out) {
   app_request  req;
   app_response rsp;
@@ -102,25 +100,23 @@ bool application_Seal(int in_size, byte *in, int *size_out, byte *out) {
   req.add_args(req_arg_str);
   string req_str;
   req.SerializeToString(&req_str);
-  if (sized_pipe_write(writer, req_str.size(), (byte *)req_str.data()) < 0) {
-    printf("%s() error, line %d, application_Seal: sized_pipe_write failed\n",
+  frame_stream to_parent(writer);
+  if (!framed_write(to_parent, req_str.size(), (byte *)req_str.data())) {
+    printf("%s() error, line %d, application_Seal: framed_write failed\n",
            __func__,
            __LINE__);
     return false;
   }
 
   // response
-  int  t_size = in_size + buffer_pad;
-  byte t_out[t_size];
-  int  n = read(reader, t_out, t_size);
-  if (n < 0) {
-    printf("%s() error, line %d, application_Seal: read failed\n",
+  frame_stream from_parent(reader);
+  string       rsp_str;
+  if (!framed_read(from_parent, max_app_service_message_size, &rsp_str)) {
+    printf("%s() error, line %d, application_Seal: framed_read failed\n",
            __func__,
            __LINE__);
     return false;
   }
-  string rsp_str;
-  rsp_str.assign((char *)t_out, n);
   if (!rsp.ParseFromString(rsp_str)) {
     printf("%s() error, line %d, application_Seal: Can't parse response\n",
            __func__,
@@ -164,26 +160,23 @@ bool application_Unseal(int in_size, byte *in, int *size_out, byte *out) {
   req.add_args(req_arg_str);
   string req_str;
   req.SerializeToString(&req_str);
-  if (sized_pipe_write(writer, req_str.size(), (byte *)req_str.data()) < 0) {
-    printf("%s() error, line %d, application_Unseal: sized_pipe_write failed\n",
+  frame_stream to_parent(writer);
+  if (!framed_write(to_parent, req_str.size(), (byte *)req_str.data())) {
+    printf("%s() error, line %d, application_Unseal: framed_write failed\n",
            __func__,
            __LINE__);
     return false;
   }
 
   // response
-  int  t_size = in_size + buffer_pad;
-  byte t_out[t_size];
-  int  n = read(reader, t_out, t_size);
-  if (n < 0) {
-    printf("%s() error, line %d, application_Unseal: read failed\n",
+  frame_stream from_parent(reader);
+  string       rsp_str;
+  if (!framed_read(from_parent, max_app_service_message_size, &rsp_str)) {
+    printf("%s() error, line %d, application_Unseal: framed_read failed\n",
            __func__,
            __LINE__);
     return false;
   }
-
-  string rsp_str;
-  rsp_str.assign((char *)t_out, n);
   if (!rsp.ParseFromString(rsp_str)) {
     printf("%s() error, line %d, application_Unseal: Can't parse response\n",
            __func__,
@@ -228,31 +221,28 @@ bool application_Attest(int in_size, byte *in, int *size_out, byte *out) {
   req.add_args(req_arg_str);
   string req_str;
   req.SerializeToString(&req_str);
-  if (sized_pipe_write(writer, req_str.size(), (byte *)req_str.data()) < 0) {
-    printf("%s() error, line %d, application_Attest: sized_pipe_write failed\n",
+  frame_stream to_parent(writer);
+  if (!framed_write(to_parent, req_str.size(), (byte *)req_str.data())) {
+    printf("%s() error, line %d, application_Attest: framed_write failed\n",
            __func__,
            __LINE__);
     return false;
   }
 
   // response
-  int  t_size = in_size + buffer_pad;
-  byte t_out[t_size];
-  int  n = read(reader, t_out, t_size);
-  if (n < 0) {
-    printf("%s() error, line %d, application_Attest: read failed\n",
+  frame_stream from_parent(reader);
+  string       rsp_str;
+  if (!framed_read(from_parent, max_app_service_message_size, &rsp_str)) {
+    printf("%s() error, line %d, application_Attest: framed_read failed\n",
            __func__,
            __LINE__);
     return false;
   }
-
-  string rsp_str;
-  rsp_str.assign((char *)t_out, n);
   if (!rsp.ParseFromString(rsp_str)) {
     printf("%s() error, line %d, application_Attest, can't parse response %d\n",
            __func__,
            __LINE__,
-           n);
+           (int)rsp_str.size());
     return false;
   }
 
@@ -292,27 +282,25 @@ bool application_GetPlatformStatement(int *size_out, byte *out) {
   req.set_function("getplatformstatement");
   string req_str;
   req.SerializeToString(&req_str);
-  if (sized_pipe_write(writer, req_str.size(), (byte *)req_str.data()) < 0) {
+  frame_stream to_parent(writer);
+  if (!framed_write(to_parent, req_str.size(), (byte *)req_str.data())) {
     printf("%s() error, line %d, application_GetPlatformStatement: "
-           "sized_pipe_write failed\n",
+           "framed_write failed\n",
            __func__,
            __LINE__);
     return false;
   }
 
   // response
-  int  t_size = platform_statement_size;
-  byte t_out[t_size];
-  int  n = read(reader, t_out, t_size);
-  if (n < 0) {
-    printf("%s() error, line %d, application_GetPlatformStatement: bad read\n",
+  frame_stream from_parent(reader);
+  string       rsp_str;
+  if (!framed_read(from_parent, max_app_service_message_size, &rsp_str)) {
+    printf("%s() error, line %d, application_GetPlatformStatement: "
+           "framed_read failed\n",
            __func__,
            __LINE__);
     return false;
   }
-
-  string rsp_str;
-  rsp_str.assign((char *)t_out, n);
   if (!rsp.ParseFromString(rsp_str)) {
     printf("%s() error, line %d, application_GetPlatformStatement: bad "
            "ParseFromString\n",
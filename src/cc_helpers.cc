@@ -17,6 +17,13 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <atomic>
+#include <chrono>
+#include <set>
 #include <openssl/ssl.h>
 #include <openssl/rsa.h>
 #include <openssl/x509.h>
@@ -24,6 +31,9 @@
 #include <openssl/rand.h>
 #include <openssl/hmac.h>
 #include <openssl/err.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(BORING_SSL)
+#  include <openssl/core_names.h>
+#endif
 
 #include "support.h"
 #include "certifier.h"
@@ -1049,6 +1059,13 @@ bool certifier::framework::cc_trust_data::generate_auth_key(bool regen) {
              __LINE__);
       return false;
     }
+  } else if (public_key_algorithm_ == Enc_method_ecc_256) {
+    if (!make_certifier_ecc_key(256, &private_auth_key_)) {
+      printf("%s() error, line %d, Can't generate App private key\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
   } else if (public_key_algorithm_ == Enc_method_ecc_384) {
     if (!make_certifier_ecc_key(384, &private_auth_key_)) {
       printf("%s() error, line %d, Can't generate App private key\n",
@@ -1101,6 +1118,13 @@ bool certifier::framework::cc_trust_data::generate_service_key(bool regen) {
              __LINE__);
       return false;
     }
+  } else if (public_key_algorithm_ == Enc_method_ecc_256) {
+    if (!make_certifier_ecc_key(256, &private_service_key_)) {
+      printf("%s() error, line %d, Can't generate App private key\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
   } else if (public_key_algorithm_ == Enc_method_ecc_384) {
     if (!make_certifier_ecc_key(384, &private_service_key_)) {
       printf("%s() error, line %d, Can't generate App private key\n",
@@ -2159,15 +2183,12 @@ bool load_server_certs_and_key(X509 *        root_cert,
                                const string &private_key_cert,
                                SSL_CTX *     ctx) {
 
-  // load auth key, policy_cert and certificate chain
-  // Todo: Add other key types
-  RSA *r = RSA_new();
-  if (!key_to_RSA(private_key, r)) {
-    printf("%s() error, line %d, key_to_RSA failed\n", __func__, __LINE__);
+  // load auth key (RSA or ECC), policy_cert and certificate chain
+  EVP_PKEY *auth_private_key = cached_pkey_from_key(private_key);
+  if (auth_private_key == nullptr) {
+    printf("%s() error, line %d, pkey_from_key failed\n", __func__, __LINE__);
     return false;
   }
-  EVP_PKEY *auth_private_key = EVP_PKEY_new();
-  EVP_PKEY_set1_RSA(auth_private_key, r);
 
   X509 *x509_auth_key_cert = X509_new();
   if (!asn1_to_x509(private_key_cert, x509_auth_key_cert)) {
@@ -2175,28 +2196,32 @@ bool load_server_certs_and_key(X509 *        root_cert,
            __func__,
            __LINE__,
            (int)private_key_cert.size());
+    X509_free(x509_auth_key_cert);
+    EVP_PKEY_free(auth_private_key);
     return false;
   }
 
+  // The SSL_CTX takes its own references to the key, cert and chain.
+  bool            ret = false;
   STACK_OF(X509) *stack = sk_X509_new_null();
   if (sk_X509_push(stack, root_cert) == 0) {
     printf("%s() error, line %d, sk_X509_push failed\n", __func__, __LINE__);
-    return false;
+    goto done;
   }
 
 #ifdef BORING_SSL
   if (!SSL_CTX_use_certificate(ctx, x509_auth_key_cert)) {
     printf("%s() error, line %d, use cert failed\n", __func__, __LINE__);
-    return false;
+    goto done;
   }
   if (!SSL_CTX_use_PrivateKey(ctx, auth_private_key)) {
     printf("%s() error, line %d, use priv key failed\n", __func__, __LINE__);
-    return false;
+    goto done;
   }
 
   if (!SSL_CTX_set1_chain(ctx, stack)) {
     printf("%s() error, line %d, set1 chain error\n", __func__, __LINE__);
-    return false;
+    goto done;
   }
 #else
   if (SSL_CTX_use_cert_and_key(ctx,
@@ -2215,7 +2240,7 @@ bool load_server_certs_and_key(X509 *        root_cert,
     print_key(private_key);
     printf("\n");
 #  endif
-    return false;
+    goto done;
   }
 #endif
 
@@ -2223,7 +2248,7 @@ bool load_server_certs_and_key(X509 *        root_cert,
     printf("%s() error, line %d, SSL_CTX_check_private_key failed\n",
            __func__,
            __LINE__);
-    return false;
+    goto done;
   }
   SSL_CTX_add_client_CA(ctx, root_cert);
 
@@ -2233,54 +2258,376 @@ bool load_server_certs_and_key(X509 *        root_cert,
   SSL_CTX_add1_to_CA_list(ctx, root_cert);
 
 #  ifdef DEBUG
-  const STACK_OF(X509_NAME) *ca_list = SSL_CTX_get0_CA_list(ctx);
-  printf("CA names to offer\n");
-  if (ca_list != nullptr) {
-    for (int i = 0; i < sk_X509_NAME_num(ca_list); i++) {
-      X509_NAME *name = sk_X509_NAME_value(ca_list, i);
-      print_cn_name(name);
+  {
+    const STACK_OF(X509_NAME) *ca_list = SSL_CTX_get0_CA_list(ctx);
+    printf("CA names to offer\n");
+    if (ca_list != nullptr) {
+      for (int i = 0; i < sk_X509_NAME_num(ca_list); i++) {
+        X509_NAME *name = sk_X509_NAME_value(ca_list, i);
+        print_cn_name(name);
+      }
     }
   }
 #  endif
 #endif  // BORING_SSL
+  ret = true;
 
-  return true;
+done:
+  sk_X509_free(stack);
+  X509_free(x509_auth_key_cert);
+  EVP_PKEY_free(auth_private_key);
+  return ret;
 }
 
-bool certifier::framework::server_dispatch(
-    const string &host_name,
-    int           port,
-    string &      asn1_root_cert,
-    key_message & private_key,
-    const string &private_key_cert,
-    void (*func)(secure_authenticated_channel &)) {
+// TLS session resumption
+// -------------------------------------------------------------------
 
-  OPENSSL_init_ssl(0, NULL);
-  SSL_load_error_strings();
+certifier::framework::client_session_cache::client_session_cache(
+    int max_entries) {
+  max_entries_ = max_entries > 0 ? max_entries : 1;
+  lookups_ = 0;
+  resumptions_ = 0;
+  full_handshakes_ = 0;
+}
 
-  X509 *root_cert = X509_new();
-  if (!asn1_to_x509(asn1_root_cert, root_cert)) {
-    printf("%s() error, line %d, Can't convert cert\n", __func__, __LINE__);
+certifier::framework::client_session_cache::~client_session_cache() {
+  clear();
+}
+
+void certifier::framework::client_session_cache::clear() {
+  mtx_.lock();
+  for (std::list<entry>::iterator it = lru_.begin(); it != lru_.end(); ++it)
+    SSL_SESSION_free(it->session_);
+  lru_.clear();
+  sessions_.clear();
+  mtx_.unlock();
+}
+
+int certifier::framework::client_session_cache::num_entries() {
+  mtx_.lock();
+  int n = (int)sessions_.size();
+  mtx_.unlock();
+  return n;
+}
+
+uint64_t certifier::framework::client_session_cache::lookups() {
+  mtx_.lock();
+  uint64_t n = lookups_;
+  mtx_.unlock();
+  return n;
+}
+
+uint64_t certifier::framework::client_session_cache::resumptions() {
+  mtx_.lock();
+  uint64_t n = resumptions_;
+  mtx_.unlock();
+  return n;
+}
+
+uint64_t certifier::framework::client_session_cache::full_handshakes() {
+  mtx_.lock();
+  uint64_t n = full_handshakes_;
+  mtx_.unlock();
+  return n;
+}
+
+SSL_SESSION *certifier::framework::client_session_cache::take_session(
+    const string &key) {
+  SSL_SESSION *s = nullptr;
+
+  mtx_.lock();
+  lookups_++;
+  std::map<string, std::list<entry>::iterator>::iterator it =
+      sessions_.find(key);
+  if (it != sessions_.end()) {
+    s = it->second->session_;
+    lru_.erase(it->second);
+    sessions_.erase(it);
+  }
+  mtx_.unlock();
+
+  if (s != nullptr && !SSL_SESSION_is_resumable(s)) {
+    SSL_SESSION_free(s);
+    s = nullptr;
+  }
+  return s;
+}
+
+void certifier::framework::client_session_cache::put_session(
+    const string &key,
+    SSL_SESSION * s) {
+  SSL_SESSION *old = nullptr;
+
+  // Newest at the front, so the back is the one to evict.
+  mtx_.lock();
+  std::map<string, std::list<entry>::iterator>::iterator it =
+      sessions_.find(key);
+  if (it != sessions_.end()) {
+    old = it->second->session_;
+    it->second->session_ = s;
+    lru_.splice(lru_.begin(), lru_, it->second);
+  } else {
+    if ((int)lru_.size() >= max_entries_) {
+      old = lru_.back().session_;
+      sessions_.erase(lru_.back().key_);
+      lru_.pop_back();
+    }
+    entry e;
+    e.key_ = key;
+    e.session_ = s;
+    lru_.push_front(e);
+    sessions_[key] = lru_.begin();
+  }
+  mtx_.unlock();
+
+  if (old != nullptr)
+    SSL_SESSION_free(old);
+}
+
+void certifier::framework::client_session_cache::record_handshake(
+    bool resumed) {
+  mtx_.lock();
+  if (resumed)
+    resumptions_++;
+  else
+    full_handshakes_++;
+  mtx_.unlock();
+}
+
+certifier::framework::session_ticket_keys::session_ticket_keys(int max_keys) {
+  max_keys_ = max_keys > 0 ? max_keys : 1;
+  num_keys_ = 0;
+  keys_ =
+      new byte[max_keys_ * (key_name_size + cipher_key_size + hmac_key_size)];
+  tickets_issued_ = 0;
+  tickets_accepted_ = 0;
+  tickets_rejected_ = 0;
+  if (!rotate()) {
+    printf("%s() error, line %d, can't make ticket key\n", __func__, __LINE__);
+  }
+}
+
+certifier::framework::session_ticket_keys::~session_ticket_keys() {
+  memset(keys_,
+         0,
+         max_keys_ * (key_name_size + cipher_key_size + hmac_key_size));
+  delete[] keys_;
+  keys_ = nullptr;
+}
+
+// Slot 0 is the current key.
+bool certifier::framework::session_ticket_keys::rotate() {
+  const int slot_size = key_name_size + cipher_key_size + hmac_key_size;
+  byte      new_key[slot_size];
+
+  if (RAND_bytes(new_key, slot_size) != 1) {
+    printf("%s() error, line %d, RAND_bytes failed\n", __func__, __LINE__);
     return false;
   }
+  mtx_.lock();
+  memmove(keys_ + slot_size, keys_, (max_keys_ - 1) * slot_size);
+  memcpy(keys_, new_key, slot_size);
+  if (num_keys_ < max_keys_)
+    num_keys_++;
+  mtx_.unlock();
+  memset(new_key, 0, slot_size);
+  return true;
+}
 
-  // Get a socket.
-  int sock = -1;
-  if (!open_server_socket(host_name, port, &sock)) {
-    printf("%s() error, line %d, Can't open server socket to %s:%d\n",
-           __func__,
-           __LINE__,
-           host_name.c_str(),
-           port);
+int certifier::framework::session_ticket_keys::num_keys() {
+  mtx_.lock();
+  int n = num_keys_;
+  mtx_.unlock();
+  return n;
+}
+
+uint64_t certifier::framework::session_ticket_keys::tickets_issued() {
+  mtx_.lock();
+  uint64_t n = tickets_issued_;
+  mtx_.unlock();
+  return n;
+}
+
+uint64_t certifier::framework::session_ticket_keys::tickets_accepted() {
+  mtx_.lock();
+  uint64_t n = tickets_accepted_;
+  mtx_.unlock();
+  return n;
+}
+
+uint64_t certifier::framework::session_ticket_keys::tickets_rejected() {
+  mtx_.lock();
+  uint64_t n = tickets_rejected_;
+  mtx_.unlock();
+  return n;
+}
+
+bool certifier::framework::session_ticket_keys::current_key(byte *name,
+                                                            byte *cipher_key,
+                                                            byte *hmac_key) {
+  mtx_.lock();
+  memcpy(name, keys_, key_name_size);
+  memcpy(cipher_key, keys_ + key_name_size, cipher_key_size);
+  memcpy(hmac_key, keys_ + key_name_size + cipher_key_size, hmac_key_size);
+  tickets_issued_++;
+  mtx_.unlock();
+  return true;
+}
+
+bool certifier::framework::session_ticket_keys::find_key(const byte *name,
+                                                         byte *cipher_key,
+                                                         byte *hmac_key) {
+  const int slot_size = key_name_size + cipher_key_size + hmac_key_size;
+
+  mtx_.lock();
+  for (int i = 0; i < num_keys_; i++) {
+    byte *slot = keys_ + i * slot_size;
+    if (memcmp(slot, name, key_name_size) == 0) {
+      memcpy(cipher_key, slot + key_name_size, cipher_key_size);
+      memcpy(hmac_key, slot + key_name_size + cipher_key_size, hmac_key_size);
+      tickets_accepted_++;
+      mtx_.unlock();
+      return true;
+    }
+  }
+  tickets_rejected_++;
+  mtx_.unlock();
+  return false;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(BORING_SSL)
+typedef EVP_MAC_CTX ticket_mac_ctx;
+
+static bool init_ticket_mac(ticket_mac_ctx *mac_ctx, byte *hmac_key) {
+  OSSL_PARAM params[3];
+  params[0] = OSSL_PARAM_construct_octet_string(
+      OSSL_MAC_PARAM_KEY,
+      hmac_key,
+      session_ticket_keys::hmac_key_size);
+  params[1] =
+      OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                       (char *)"SHA256",
+                                       0);
+  params[2] = OSSL_PARAM_construct_end();
+  return EVP_MAC_CTX_set_params(mac_ctx, params) == 1;
+}
+#else
+typedef HMAC_CTX ticket_mac_ctx;
+
+static bool init_ticket_mac(ticket_mac_ctx *mac_ctx, byte *hmac_key) {
+  return HMAC_Init_ex(mac_ctx,
+                      hmac_key,
+                      session_ticket_keys::hmac_key_size,
+                      EVP_sha256(),
+                      nullptr)
+         == 1;
+}
+#endif
+
+// OpenSSL ticket key callback.  Returns 1 when a new ticket is encrypted,
+// 2 when a ticket is accepted, 0 if the ticket key is unknown (full
+// handshake) and -1 on error.  Accepted tickets always get a
+// replacement, since clients only use each ticket once.
+static int ticket_key_callback(SSL *           ssl,
+                               unsigned char * key_name,
+                               unsigned char * iv,
+                               EVP_CIPHER_CTX *cipher_ctx,
+                               ticket_mac_ctx *mac_ctx,
+                               int             enc) {
+  session_ticket_keys *keys =
+      (session_ticket_keys *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  if (keys == nullptr)
+    return -1;
+
+  byte cipher_key[session_ticket_keys::cipher_key_size];
+  byte hmac_key[session_ticket_keys::hmac_key_size];
+  int  ret = -1;
+
+  if (enc) {
+    keys->current_key(key_name, cipher_key, hmac_key);
+    if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) == 1
+        && EVP_EncryptInit_ex(cipher_ctx,
+                              EVP_aes_256_cbc(),
+                              nullptr,
+                              cipher_key,
+                              iv)
+               == 1
+        && init_ticket_mac(mac_ctx, hmac_key)) {
+      ret = 1;
+    }
+  } else {
+    if (!keys->find_key(key_name, cipher_key, hmac_key)) {
+      ret = 0;
+    } else if (init_ticket_mac(mac_ctx, hmac_key)
+               && EVP_DecryptInit_ex(cipher_ctx,
+                                     EVP_aes_256_cbc(),
+                                     nullptr,
+                                     cipher_key,
+                                     iv)
+                      == 1) {
+      ret = 2;
+    }
+  }
+  memset(cipher_key, 0, sizeof(cipher_key));
+  memset(hmac_key, 0, sizeof(hmac_key));
+  return ret;
+}
+
+static void set_ticket_key_callback(SSL_CTX *ctx, session_ticket_keys *keys) {
+  SSL_CTX_set_app_data(ctx, keys);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(BORING_SSL)
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_callback);
+#else
+  SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key_callback);
+#endif
+}
+
+// Called by OpenSSL when a ticket arrives on a client channel.
+static int new_client_session(SSL *ssl, SSL_SESSION *session) {
+  secure_authenticated_channel *channel =
+      (secure_authenticated_channel *)SSL_get_app_data(ssl);
+  if (channel == nullptr || channel->session_cache_ == nullptr)
+    return 0;
+  channel->session_cache_->put_session(channel->session_key_, session);
+  return 1;
+}
+
+static bool make_session_key(const string &host_name,
+                             int           port,
+                             const string &asn1_root_cert,
+                             const string &auth_cert,
+                             string *      key) {
+  string certs(asn1_root_cert);
+  certs.append(auth_cert);
+  byte digest[32];
+  if (!digest_message(Digest_method_sha_256,
+                      (byte *)certs.data(),
+                      certs.size(),
+                      digest,
+                      sizeof(digest))) {
     return false;
   }
+  key->assign(host_name);
+  key->append(":");
+  key->append(std::to_string(port));
+  key->append(":");
+  key->append((char *)digest, sizeof(digest));
+  return true;
+}
+
+// Builds the server side SSL_CTX.  Accepted connections share it, so
+// the root cert, auth cert and private key are only converted once.
+static SSL_CTX *make_server_ssl_ctx(X509 *               root_cert,
+                                    key_message &        private_key,
+                                    const string &       private_key_cert,
+                                    session_ticket_keys *ticket_keys) {
 
   // Set up TLS handshake data.
   SSL_METHOD *method = (SSL_METHOD *)TLS_server_method();
   SSL_CTX *   ctx = SSL_CTX_new(method);
   if (ctx == NULL) {
     printf("%s() error, line %d, SSL_CTX_new failed (1)\n", __func__, __LINE__);
-    return false;
+    return nullptr;
   }
   X509_STORE *cs = SSL_CTX_get_cert_store(ctx);
   X509_STORE_add_cert(cs, root_cert);
@@ -2289,18 +2636,28 @@ bool certifier::framework::server_dispatch(
   if (asn1_to_x509(private_key_cert, x509_auth_cert)) {
     X509_STORE_add_cert(cs, x509_auth_cert);
   }
+  X509_free(x509_auth_cert);
 
   if (!load_server_certs_and_key(root_cert,
                                  private_key,
                                  private_key_cert,
                                  ctx)) {
     printf("%s() error, line %d, SSL_CTX_new failed (2)\n", __func__, __LINE__);
-    return false;
+    SSL_CTX_free(ctx);
+    return nullptr;
   }
 
   const long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION;
   SSL_CTX_set_options(ctx, flags);
 
+  // Resumption with a verified peer cert needs a session id context.
+  const char *sid_ctx = "certifier";
+  SSL_CTX_set_session_id_context(ctx,
+                                 (const unsigned char *)sid_ctx,
+                                 strlen(sid_ctx));
+  if (ticket_keys != nullptr)
+    set_ticket_key_callback(ctx, ticket_keys);
+
 #if 0
   // This is unnecessary usually.
   if(!isRoot()) {
@@ -2317,6 +2674,73 @@ bool certifier::framework::server_dispatch(
   // Debug
   //SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
 #endif
+  return ctx;
+}
+
+// kTLS needs OpenSSL 3 built with it and the kernel tls module; without
+// them these requests are no-ops.
+static void request_ktls_ctx(SSL_CTX *ctx) {
+#ifdef SSL_OP_ENABLE_KTLS
+  SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+}
+
+static void request_ktls(SSL *ssl) {
+#ifdef SSL_OP_ENABLE_KTLS
+  SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#endif
+}
+
+// Handshake and application callback for one accepted socket.  All the
+// certificate and key state comes from ctx.  Returns false if the
+// channel could not be authenticated.
+static bool serve_accepted_connection(
+    SSL_CTX *ctx,
+    int      client,
+    void (*func)(secure_authenticated_channel &)) {
+
+  string                       my_role("server");
+  secure_authenticated_channel nc(my_role);
+  nc.ssl_ = SSL_new(ctx);
+  SSL_set_fd(nc.ssl_, client);
+  nc.sock_ = client;
+  nc.server_channel_accept_and_auth(func);
+  return nc.channel_initialized_;
+}
+
+bool certifier::framework::server_dispatch(
+    const string &host_name,
+    int           port,
+    string &      asn1_root_cert,
+    key_message & private_key,
+    const string &private_key_cert,
+    void (*func)(secure_authenticated_channel &)) {
+
+  OPENSSL_init_ssl(0, NULL);
+  SSL_load_error_strings();
+
+  X509 *root_cert = X509_new();
+  if (!asn1_to_x509(asn1_root_cert, root_cert)) {
+    printf("%s() error, line %d, Can't convert cert\n", __func__, __LINE__);
+    return false;
+  }
+
+  // Get a socket.
+  int sock = -1;
+  if (!open_server_socket(host_name, port, &sock)) {
+    printf("%s() error, line %d, Can't open server socket to %s:%d\n",
+           __func__,
+           __LINE__,
+           host_name.c_str(),
+           port);
+    return false;
+  }
+
+  SSL_CTX *ctx =
+      make_server_ssl_ctx(root_cert, private_key, private_key_cert, nullptr);
+  if (ctx == nullptr) {
+    return false;
+  }
 
   while (1) {
 #ifdef DEBUG
@@ -2325,338 +2749,2582 @@ bool certifier::framework::server_dispatch(
     struct sockaddr_in addr;
     unsigned int       len = sizeof(sockaddr_in);
     int                client = accept(sock, (struct sockaddr *)&addr, &len);
-    string             my_role("server");
-    secure_authenticated_channel nc(my_role);
-    if (!nc.init_server_ssl(host_name,
-                            port,
-                            asn1_root_cert,
-                            private_key,
-                            private_key_cert)) {
+    if (client < 0) {
       continue;
     }
-    nc.ssl_ = SSL_new(ctx);
-    SSL_set_fd(nc.ssl_, client);
-    nc.sock_ = client;
-    nc.server_channel_accept_and_auth(func);
+    serve_accepted_connection(ctx, client, func);
   }
   return true;
 }
 
-certifier::framework::secure_authenticated_channel::
-    secure_authenticated_channel(string &role) {
-  role_ = role;
-  channel_initialized_ = false;
-  ssl_ctx_ = nullptr;
-  store_ctx_ = nullptr;
-  ssl_ = nullptr;
-  sock_ = -1;
-  my_cert_ = nullptr;
-  peer_cert_ = nullptr;
-  peer_id_.clear();
+certifier::framework::server_worker_stats::server_worker_stats() {
+  worker_id_ = 0;
+  connections_handled_ = 0;
+  handshake_failures_ = 0;
+  busy_usec_ = 0;
 }
 
-certifier::framework::secure_authenticated_channel::
-    ~secure_authenticated_channel() {
-  role_.clear();
-  channel_initialized_ = false;
-  // delete?
-  if (ssl_ctx_ != nullptr)
-    SSL_CTX_free(ssl_ctx_);
-  ssl_ctx_ = nullptr;
-  if (store_ctx_ != nullptr)
-    X509_STORE_CTX_free(store_ctx_);
-  store_ctx_ = nullptr;
-  // delete?
-  ssl_ = nullptr;
-  if (sock_ > 0)
-    ::close(sock_);
-  sock_ = -1;
-  // delete?
-  my_cert_ = nullptr;
-  // delete?
-  if (peer_cert_ != nullptr)
-    X509_free(peer_cert_);
-  peer_cert_ = nullptr;
-  peer_id_.clear();
+certifier::framework::server_dispatch_pool::server_dispatch_pool(
+    int num_workers,
+    int max_queued_connections) {
+  num_workers_ = num_workers > 0 ? num_workers : 1;
+  max_queued_ = max_queued_connections > 0 ? max_queued_connections : 1;
+  initialized_ = false;
+  stopping_ = false;
+  listen_sock_ = -1;
+  ctx_ = nullptr;
+  ticket_keys_ = nullptr;
+  ktls_ = false;
+  port_ = 0;
+  func_ = nullptr;
+  queue_full_waits_ = 0;
+  stats_ = new server_worker_stats[num_workers_];
+  workers_ = new std::thread *[num_workers_];
+  for (int i = 0; i < num_workers_; i++) {
+    stats_[i].worker_id_ = i;
+    workers_[i] = nullptr;
+  }
 }
 
-bool certifier::framework::secure_authenticated_channel::init_client_ssl(
+certifier::framework::server_dispatch_pool::~server_dispatch_pool() {
+  stop();
+  for (int i = 0; i < num_workers_; i++) {
+    if (workers_[i] != nullptr) {
+      workers_[i]->join();
+      delete workers_[i];
+      workers_[i] = nullptr;
+    }
+  }
+  delete[] workers_;
+  delete[] stats_;
+  while (!queue_.empty()) {
+    ::close(queue_.front());
+    queue_.pop_front();
+  }
+  if (listen_sock_ >= 0)
+    ::close(listen_sock_);
+  listen_sock_ = -1;
+  if (ctx_ != nullptr)
+    SSL_CTX_free(ctx_);
+  ctx_ = nullptr;
+}
+
+bool certifier::framework::server_dispatch_pool::init(
     const string &host_name,
     int           port,
     string &      asn1_root_cert,
     key_message & private_key,
-    const string &auth_cert) {
+    const string &private_key_cert,
+    void (*func)(secure_authenticated_channel &)) {
 
   OPENSSL_init_ssl(0, NULL);
   SSL_load_error_strings();
 
-  private_key_.CopyFrom(private_key);
-  asn1_root_cert_.assign((char *)asn1_root_cert.data(), asn1_root_cert.size());
-  root_cert_ = X509_new();
-  if (!asn1_to_x509(asn1_root_cert, root_cert_)) {
-    printf("%s() error, line %d, init_client_ssl: root cert invalid\n",
-           __func__,
-           __LINE__);
-    if (asn1_root_cert.size() == 0) {
-      printf("root cert empty\n");
-    } else {
-      print_bytes(asn1_root_cert.size(), (byte *)asn1_root_cert.data());
-      printf("\n");
-    }
+  X509 *root_cert = X509_new();
+  if (!asn1_to_x509(asn1_root_cert, root_cert)) {
+    printf("%s() error, line %d, Can't convert cert\n", __func__, __LINE__);
+    X509_free(root_cert);
     return false;
   }
-
-  const SSL_METHOD *method = TLS_client_method();
-  if (method == nullptr) {
-    printf("%s() error, line %d, Can't get method\n", __func__, __LINE__);
+  ctx_ = make_server_ssl_ctx(root_cert,
+                             private_key,
+                             private_key_cert,
+                             ticket_keys_);
+  X509_free(root_cert);
+  if (ctx_ == nullptr) {
     return false;
   }
+  if (ktls_)
+    request_ktls_ctx(ctx_);
 
-  ssl_ctx_ = SSL_CTX_new(method);
-  if (ssl_ctx_ == nullptr) {
-    printf("%s() error, line %d, Can't get SSL_CTX\n", __func__, __LINE__);
+  if (!open_server_socket(host_name, port, &listen_sock_)) {
+    printf("%s() error, line %d, Can't open server socket to %s:%d\n",
+           __func__,
+           __LINE__,
+           host_name.c_str(),
+           port);
+    return false;
+  }
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof(addr);
+  if (getsockname(listen_sock_, (struct sockaddr *)&addr, &len) != 0) {
+    printf("%s() error, line %d, getsockname failed\n", __func__, __LINE__);
     return false;
   }
 
-  asn1_my_cert_ = auth_cert;
-  X509_STORE *cs = SSL_CTX_get_cert_store(ssl_ctx_);
-  X509_STORE_add_cert(cs, root_cert_);
+  port_ = ntohs(addr.sin_port);
+  func_ = func;
+  initialized_ = true;
+  return true;
+}
 
-  X509 *x509_auth_cert = X509_new();
-  if (asn1_to_x509(auth_cert, x509_auth_cert)) {
-    X509_STORE_add_cert(cs, x509_auth_cert);
-  }
+void certifier::framework::server_dispatch_pool::set_ticket_keys(
+    session_ticket_keys *keys) {
+  ticket_keys_ = keys;
+}
 
-  // For debugging: SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, verify_callback);
-  SSL_CTX_set_verify(ssl_ctx_, SSL_VERIFY_PEER, nullptr);
+void certifier::framework::server_dispatch_pool::set_ktls(bool enable) {
+  ktls_ = enable;
+}
 
-  SSL_CTX_set_verify_depth(ssl_ctx_, 4);
-  const long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION;
-  SSL_CTX_set_options(ssl_ctx_, flags);
+void certifier::framework::server_dispatch_pool::worker_loop(int worker) {
+  for (;;) {
+    std::unique_lock<std::mutex> lk(mtx_);
+    while (queue_.empty() && !stopping_)
+      not_empty_.wait(lk);
+    if (stopping_)
+      return;
+    int client = queue_.front();
+    queue_.pop_front();
+    not_full_.notify_one();
+    lk.unlock();
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    bool ok = serve_accepted_connection(ctx_, client, func_);
+    uint64_t usec = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+    lk.lock();
+    stats_[worker].connections_handled_++;
+    if (!ok)
+      stats_[worker].handshake_failures_++;
+    stats_[worker].busy_usec_ += usec;
+  }
+}
 
-  if (!load_client_certs_and_key()) {
-    printf("%s() error, line %d, load_client_certs_and_key failed\n",
-           __func__,
-           __LINE__);
+bool certifier::framework::server_dispatch_pool::run() {
+  if (!initialized_) {
+    printf("%s() error, line %d, pool not initialized\n", __func__, __LINE__);
     return false;
   }
 
-  if (!open_client_socket(host_name, port, &sock_)) {
-    printf("%s() error, line %d, Can't open client socket\n",
-           __func__,
-           __LINE__);
-    return false;
+  for (int i = 0; i < num_workers_; i++) {
+    workers_[i] =
+        new std::thread(&server_dispatch_pool::worker_loop, this, i);
   }
 
-  ssl_ = SSL_new(ssl_ctx_);
+  for (;;) {
+    struct sockaddr_in addr;
+    socklen_t          len = sizeof(addr);
+    int client = accept(listen_sock_, (struct sockaddr *)&addr, &len);
+
+    std::unique_lock<std::mutex> lk(mtx_);
+    if (stopping_) {
+      if (client >= 0)
+        ::close(client);
+      break;
+    }
+    if (client < 0) {
+      continue;
+    }
+    if ((int)queue_.size() >= max_queued_) {
+      queue_full_waits_++;
+      while ((int)queue_.size() >= max_queued_ && !stopping_)
+        not_full_.wait(lk);
+      if (stopping_) {
+        ::close(client);
+        break;
+      }
+    }
+    queue_.push_back(client);
+    not_empty_.notify_one();
+  }
+
+  for (int i = 0; i < num_workers_; i++) {
+    if (workers_[i] != nullptr) {
+      workers_[i]->join();
+      delete workers_[i];
+      workers_[i] = nullptr;
+    }
+  }
+  return true;
+}
+
+void certifier::framework::server_dispatch_pool::stop() {
+  mtx_.lock();
+  stopping_ = true;
+  not_empty_.notify_all();
+  not_full_.notify_all();
+  mtx_.unlock();
+
+  // Wake the acceptor.
+  if (listen_sock_ >= 0)
+    shutdown(listen_sock_, SHUT_RDWR);
+}
+
+int certifier::framework::server_dispatch_pool::port() {
+  return port_;
+}
+
+int certifier::framework::server_dispatch_pool::num_workers() {
+  return num_workers_;
+}
+
+int certifier::framework::server_dispatch_pool::queued_connections() {
+  mtx_.lock();
+  int n = (int)queue_.size();
+  mtx_.unlock();
+  return n;
+}
+
+uint64_t certifier::framework::server_dispatch_pool::queue_full_waits() {
+  mtx_.lock();
+  uint64_t n = queue_full_waits_;
+  mtx_.unlock();
+  return n;
+}
+
+bool certifier::framework::server_dispatch_pool::get_worker_stats(
+    int                  worker,
+    server_worker_stats *out) {
+  if (worker < 0 || worker >= num_workers_)
+    return false;
+  mtx_.lock();
+  *out = stats_[worker];
+  mtx_.unlock();
+  return true;
+}
+
+bool certifier::framework::server_dispatch(
+    const string &host_name,
+    int           port,
+    string &      asn1_root_cert,
+    key_message & private_key,
+    const string &private_key_cert,
+    void (*func)(secure_authenticated_channel &),
+    int num_workers,
+    int max_queued_connections) {
+
+  server_dispatch_pool pool(num_workers, max_queued_connections);
+  if (!pool.init(host_name,
+                 port,
+                 asn1_root_cert,
+                 private_key,
+                 private_key_cert,
+                 func)) {
+    return false;
+  }
+  return pool.run();
+}
+
+// Event-driven server
+// -------------------------------------------------------------------
+
+class certifier::framework::event_dispatch_server::connection {
+ public:
+  secure_authenticated_channel *channel_;
+  bool                          handshake_done_;
+  uint32_t                      events_;
+  string                        in_;
+  string                        out_;
+  size_t                        out_offset_;
+};
+
+// Owned by one loop thread.  The counters are atomic because the stats
+// calls sum them from other threads.  accepting_ is false while the
+// listen socket is out of this loop's epoll set after accept() ran out
+// of descriptors; it goes back in at resume_accepting_.
+class certifier::framework::event_dispatch_server::loop_state {
+ public:
+  int                                   epoll_fd_;
+  std::thread *                         thread_;
+  std::set<connection *>                connections_;
+  bool                                  accepting_;
+  std::chrono::steady_clock::time_point resume_accepting_;
+  std::atomic<int>                      open_;
+  std::atomic<uint64_t>                 accepted_;
+  std::atomic<uint64_t>                 handshake_failures_;
+  std::atomic<uint64_t>                 messages_;
+
+  loop_state()
+      : epoll_fd_(-1),
+        thread_(nullptr),
+        accepting_(false),
+        open_(0),
+        accepted_(0),
+        handshake_failures_(0),
+        messages_(0) {}
+};
+
+// How long a loop stops accepting after accept() runs out of
+// descriptors, unless one of its connections closes first.
+static const int accept_backoff_ms = 100;
+
+certifier::framework::event_dispatch_server::event_dispatch_server(
+    int num_loops) {
+  num_loops_ = num_loops > 0 ? num_loops : 1;
+  max_message_size_ = 64 * 1024 * 1024;
+  initialized_ = false;
+  stopping_ = false;
+  listen_sock_ = -1;
+  wake_fd_ = -1;
+  port_ = 0;
+  ctx_ = nullptr;
+  ticket_keys_ = nullptr;
+  func_ = nullptr;
+  loops_ = new loop_state[num_loops_];
+}
+
+certifier::framework::event_dispatch_server::~event_dispatch_server() {
+  stop();
+  for (int i = 0; i < num_loops_; i++) {
+    loop_state *ls = &loops_[i];
+    if (ls->thread_ != nullptr) {
+      ls->thread_->join();
+      delete ls->thread_;
+      ls->thread_ = nullptr;
+    }
+    while (!ls->connections_.empty())
+      close_connection(ls, *ls->connections_.begin());
+    if (ls->epoll_fd_ >= 0)
+      ::close(ls->epoll_fd_);
+    ls->epoll_fd_ = -1;
+  }
+  delete[] loops_;
+  if (listen_sock_ >= 0)
+    ::close(listen_sock_);
+  listen_sock_ = -1;
+  if (wake_fd_ >= 0)
+    ::close(wake_fd_);
+  wake_fd_ = -1;
+  if (ctx_ != nullptr)
+    SSL_CTX_free(ctx_);
+  ctx_ = nullptr;
+}
+
+bool certifier::framework::event_dispatch_server::init(
+    const string &host_name,
+    int           port,
+    string &      asn1_root_cert,
+    key_message & private_key,
+    const string &private_key_cert,
+    bool (*func)(secure_authenticated_channel &,
+                 const string &request,
+                 string *      response)) {
+
+  OPENSSL_init_ssl(0, NULL);
+  SSL_load_error_strings();
+
+  X509 *root_cert = X509_new();
+  if (!asn1_to_x509(asn1_root_cert, root_cert)) {
+    printf("%s() error, line %d, Can't convert cert\n", __func__, __LINE__);
+    X509_free(root_cert);
+    return false;
+  }
+  ctx_ = make_server_ssl_ctx(root_cert,
+                             private_key,
+                             private_key_cert,
+                             ticket_keys_);
+  X509_free(root_cert);
+  if (ctx_ == nullptr) {
+    return false;
+  }
+  // Idle connections should not hold on to read and write buffers.
+  SSL_CTX_set_mode(ctx_,
+                   SSL_MODE_ENABLE_PARTIAL_WRITE
+                       | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+                       | SSL_MODE_RELEASE_BUFFERS);
+
+  if (!open_server_socket(host_name, port, &listen_sock_)) {
+    printf("%s() error, line %d, Can't open server socket to %s:%d\n",
+           __func__,
+           __LINE__,
+           host_name.c_str(),
+           port);
+    return false;
+  }
+  if (listen(listen_sock_, SOMAXCONN) != 0
+      || fcntl(listen_sock_, F_SETFL, O_NONBLOCK) != 0) {
+    printf("%s() error, line %d, Can't set up listen socket\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof(addr);
+  if (getsockname(listen_sock_, (struct sockaddr *)&addr, &len) != 0) {
+    printf("%s() error, line %d, getsockname failed\n", __func__, __LINE__);
+    return false;
+  }
+  port_ = ntohs(addr.sin_port);
+
+  // Never read, so once written it wakes every loop.
+  wake_fd_ = eventfd(0, EFD_NONBLOCK);
+  if (wake_fd_ < 0) {
+    printf("%s() error, line %d, eventfd failed\n", __func__, __LINE__);
+    return false;
+  }
+
+  for (int i = 0; i < num_loops_; i++) {
+    loop_state *ls = &loops_[i];
+    ls->epoll_fd_ = epoll_create1(0);
+    if (ls->epoll_fd_ < 0) {
+      printf("%s() error, line %d, epoll_create1 failed\n", __func__, __LINE__);
+      return false;
+    }
+    if (!watch_listen_socket(ls))
+      return false;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &wake_fd_;
+    if (epoll_ctl(ls->epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) != 0) {
+      printf("%s() error, line %d, epoll_ctl failed\n", __func__, __LINE__);
+      return false;
+    }
+  }
+
+  func_ = func;
+  initialized_ = true;
+  return true;
+}
+
+void certifier::framework::event_dispatch_server::set_ticket_keys(
+    session_ticket_keys *keys) {
+  ticket_keys_ = keys;
+}
+
+void certifier::framework::event_dispatch_server::set_max_message_size(
+    int size) {
+  max_message_size_ = size;
+}
+
+bool certifier::framework::event_dispatch_server::watch_listen_socket(
+    loop_state *ls) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+  ev.events |= EPOLLEXCLUSIVE;
+#endif
+  ev.data.ptr = &listen_sock_;
+  if (epoll_ctl(ls->epoll_fd_, EPOLL_CTL_ADD, listen_sock_, &ev) != 0) {
+    printf("%s() error, line %d, epoll_ctl failed\n", __func__, __LINE__);
+    return false;
+  }
+  ls->accepting_ = true;
+  return true;
+}
+
+// The listen socket is level-triggered, so a connection accept() can't
+// take stays ready and would wake the loop again at once.  Take the
+// socket out of this loop until accept_backoff_ms passes or one of the
+// loop's connections closes.
+void certifier::framework::event_dispatch_server::pause_accepting(
+    loop_state *ls) {
+  if (epoll_ctl(ls->epoll_fd_, EPOLL_CTL_DEL, listen_sock_, nullptr) != 0) {
+    printf("%s() error, line %d, epoll_ctl failed\n", __func__, __LINE__);
+    return;
+  }
+  ls->accepting_ = false;
+  ls->resume_accepting_ = std::chrono::steady_clock::now()
+                          + std::chrono::milliseconds(accept_backoff_ms);
+}
+
+void certifier::framework::event_dispatch_server::accept_connections(
+    loop_state *ls) {
+  for (;;) {
+    struct sockaddr_in addr;
+    socklen_t          len = sizeof(addr);
+    int client = accept(listen_sock_, (struct sockaddr *)&addr, &len);
+    if (client < 0) {
+      int err = errno;
+      if (err == EAGAIN || err == EWOULDBLOCK)
+        return;
+      // The connection was reset before we got it, or a signal came in;
+      // there may be more behind it.
+      if (err == EINTR || err == ECONNABORTED || err == EPROTO)
+        continue;
+      if (err != EMFILE && err != ENFILE && err != ENOBUFS && err != ENOMEM) {
+        printf("%s() error, line %d, accept failed: %s\n",
+               __func__,
+               __LINE__,
+               strerror(err));
+      } else {
+        printf("%s() error, line %d, accept out of resources, pausing\n",
+               __func__,
+               __LINE__);
+      }
+      pause_accepting(ls);
+      return;
+    }
+    if (fcntl(client, F_SETFL, O_NONBLOCK) != 0) {
+      ::close(client);
+      continue;
+    }
+
+    string      role("server");
+    connection *c = new connection;
+    c->channel_ = new secure_authenticated_channel(role);
+    c->channel_->ssl_ = SSL_new(ctx_);
+    SSL_set_fd(c->channel_->ssl_, client);
+    SSL_set_accept_state(c->channel_->ssl_);
+    c->channel_->sock_ = client;
+    c->handshake_done_ = false;
+    c->events_ = EPOLLIN;
+    c->out_offset_ = 0;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = c->events_;
+    ev.data.ptr = c;
+    if (epoll_ctl(ls->epoll_fd_, EPOLL_CTL_ADD, client, &ev) != 0) {
+      delete c->channel_;
+      delete c;
+      continue;
+    }
+    ls->connections_.insert(c);
+    ls->open_++;
+    ls->accepted_++;
+  }
+}
+
+void certifier::framework::event_dispatch_server::close_connection(
+    loop_state *ls,
+    connection *c) {
+  epoll_ctl(ls->epoll_fd_, EPOLL_CTL_DEL, c->channel_->sock_, nullptr);
+  ls->connections_.erase(c);
+  ls->open_--;
+  // That freed a descriptor, so try accepting again now.
+  if (!ls->accepting_)
+    ls->resume_accepting_ = std::chrono::steady_clock::now();
+  // The destructor frees the SSL object and closes the socket.
+  delete c->channel_;
+  delete c;
+}
+
+// Hands each complete sized message in c->in_ to func_ and queues the
+// framed responses in c->out_.
+bool certifier::framework::event_dispatch_server::deliver_messages(
+    loop_state *ls,
+    connection *c) {
+  size_t consumed = 0;
+  while (c->in_.size() - consumed >= sizeof(int)) {
+    int size = 0;
+    memcpy(&size, c->in_.data() + consumed, sizeof(int));
+    if (size < 0 || size > max_message_size_) {
+      printf("%s() error, line %d, bad message size %d\n",
+             __func__,
+             __LINE__,
+             size);
+      return false;
+    }
+    if (c->in_.size() - consumed - sizeof(int) < (size_t)size)
+      break;
+    string request(c->in_.data() + consumed + sizeof(int), size);
+    consumed += sizeof(int) + size;
+    ls->messages_++;
+
+    string response;
+    if (!func_(*c->channel_, request, &response))
+      return false;
+    if (!response.empty()) {
+      int out_size = (int)response.size();
+      c->out_.append((char *)&out_size, sizeof(int));
+      c->out_.append(response);
+    }
+  }
+  c->in_.erase(0, consumed);
+  return true;
+}
+
+// Advances the connection as far as it can go without blocking and
+// records which event it is waiting for.  Returns false if the
+// connection should be closed.
+bool certifier::framework::event_dispatch_server::service_connection(
+    loop_state *ls,
+    connection *c) {
+  SSL *    ssl = c->channel_->ssl_;
+  uint32_t want = EPOLLIN;
+  int      ret;
+
+  if (!c->handshake_done_) {
+    ret = SSL_do_handshake(ssl);
+    if (ret != 1) {
+      int err = SSL_get_error(ssl, ret);
+      if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        want = (err == SSL_ERROR_WANT_READ) ? EPOLLIN : EPOLLOUT;
+        goto rearm;
+      }
+      ls->handshake_failures_++;
+      return false;
+    }
+    c->handshake_done_ = true;
+    c->channel_->peer_cert_ = SSL_get_peer_certificate(ssl);
+    if (c->channel_->peer_cert_ != nullptr) {
+      if (!extract_id_from_cert(c->channel_->peer_cert_,
+                                &c->channel_->peer_id_)) {
+        printf("%s() error, line %d, Can't extract id\n", __func__, __LINE__);
+      }
+    }
+    c->channel_->channel_initialized_ = true;
+  }
+
+  for (;;) {
+    // Finish pending output before reading more requests.
+    while (c->out_offset_ < c->out_.size()) {
+      size_t left = c->out_.size() - c->out_offset_;
+      if (left > (size_t)INT_MAX)
+        left = INT_MAX;
+      ret = SSL_write(ssl, c->out_.data() + c->out_offset_, (int)left);
+      if (ret <= 0) {
+        int err = SSL_get_error(ssl, ret);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+          want = (err == SSL_ERROR_WANT_READ) ? EPOLLIN : EPOLLOUT;
+          goto rearm;
+        }
+        return false;
+      }
+      c->out_offset_ += ret;
+    }
+    c->out_.clear();
+    c->out_offset_ = 0;
+
+    byte buf[16384];
+    ret = SSL_read(ssl, buf, sizeof(buf));
+    if (ret <= 0) {
+      int err = SSL_get_error(ssl, ret);
+      if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        want = (err == SSL_ERROR_WANT_READ) ? EPOLLIN : EPOLLOUT;
+        goto rearm;
+      }
+      // Peer closed or protocol error.
+      return false;
+    }
+    c->in_.append((char *)buf, ret);
+    if (!deliver_messages(ls, c))
+      return false;
+  }
+
+rearm:
+  if (want != c->events_) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = want;
+    ev.data.ptr = c;
+    if (epoll_ctl(ls->epoll_fd_, EPOLL_CTL_MOD, c->channel_->sock_, &ev) != 0)
+      return false;
+    c->events_ = want;
+  }
+  return true;
+}
+
+void certifier::framework::event_dispatch_server::event_loop(int loop) {
+  loop_state *       ls = &loops_[loop];
+  const int          max_events = 64;
+  struct epoll_event events[max_events];
+
+  while (!stopping_) {
+    int timeout = -1;
+    if (!ls->accepting_) {
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now();
+      if (now >= ls->resume_accepting_) {
+        if (!watch_listen_socket(ls))
+          ls->resume_accepting_ =
+              now + std::chrono::milliseconds(accept_backoff_ms);
+      }
+      if (!ls->accepting_) {
+        timeout = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                      ls->resume_accepting_ - now)
+                      .count()
+                  + 1;
+      }
+    }
+    int n = epoll_wait(ls->epoll_fd_, events, max_events, timeout);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      printf("%s() error, line %d, epoll_wait failed\n", __func__, __LINE__);
+      return;
+    }
+    for (int i = 0; i < n; i++) {
+      void *p = events[i].data.ptr;
+      if (p == &wake_fd_) {
+        continue;
+      } else if (p == &listen_sock_) {
+        accept_connections(ls);
+      } else {
+        connection *c = (connection *)p;
+        if (!service_connection(ls, c))
+          close_connection(ls, c);
+      }
+    }
+  }
+}
+
+bool certifier::framework::event_dispatch_server::run() {
+  if (!initialized_) {
+    printf("%s() error, line %d, server not initialized\n", __func__, __LINE__);
+    return false;
+  }
+  for (int i = 0; i < num_loops_; i++) {
+    loops_[i].thread_ =
+        new std::thread(&event_dispatch_server::event_loop, this, i);
+  }
+  for (int i = 0; i < num_loops_; i++) {
+    loops_[i].thread_->join();
+    delete loops_[i].thread_;
+    loops_[i].thread_ = nullptr;
+  }
+  return true;
+}
+
+void certifier::framework::event_dispatch_server::stop() {
+  stopping_ = true;
+  if (wake_fd_ >= 0) {
+    uint64_t one = 1;
+    if (::write(wake_fd_, &one, sizeof(one)) < 0) {
+      printf("%s() error, line %d, can't wake loops\n", __func__, __LINE__);
+    }
+  }
+}
+
+int certifier::framework::event_dispatch_server::port() {
+  return port_;
+}
+
+int certifier::framework::event_dispatch_server::num_loops() {
+  return num_loops_;
+}
+
+int certifier::framework::event_dispatch_server::connections_open() {
+  int n = 0;
+  for (int i = 0; i < num_loops_; i++)
+    n += loops_[i].open_;
+  return n;
+}
+
+uint64_t certifier::framework::event_dispatch_server::connections_accepted() {
+  uint64_t n = 0;
+  for (int i = 0; i < num_loops_; i++)
+    n += loops_[i].accepted_;
+  return n;
+}
+
+uint64_t certifier::framework::event_dispatch_server::handshake_failures() {
+  uint64_t n = 0;
+  for (int i = 0; i < num_loops_; i++)
+    n += loops_[i].handshake_failures_;
+  return n;
+}
+
+uint64_t certifier::framework::event_dispatch_server::messages_handled() {
+  uint64_t n = 0;
+  for (int i = 0; i < num_loops_; i++)
+    n += loops_[i].messages_;
+  return n;
+}
+
+certifier::framework::secure_authenticated_channel::
+    secure_authenticated_channel(string &role) {
+  role_ = role;
+  channel_initialized_ = false;
+  ssl_ctx_ = nullptr;
+  store_ctx_ = nullptr;
+  ssl_ = nullptr;
+  sock_ = -1;
+  root_cert_ = nullptr;
+  my_cert_ = nullptr;
+  peer_cert_ = nullptr;
+  peer_id_.clear();
+  session_cache_ = nullptr;
+  use_ktls_ = false;
+}
+
+certifier::framework::secure_authenticated_channel::
+    ~secure_authenticated_channel() {
+  role_.clear();
+  channel_initialized_ = false;
+  // delete?
+  if (ssl_ctx_ != nullptr)
+    SSL_CTX_free(ssl_ctx_);
+  ssl_ctx_ = nullptr;
+  if (store_ctx_ != nullptr)
+    X509_STORE_CTX_free(store_ctx_);
+  store_ctx_ = nullptr;
+  if (ssl_ != nullptr)
+    SSL_free(ssl_);
+  ssl_ = nullptr;
+  if (root_cert_ != nullptr)
+    X509_free(root_cert_);
+  root_cert_ = nullptr;
+  if (sock_ > 0)
+    ::close(sock_);
+  sock_ = -1;
+  // delete?
+  my_cert_ = nullptr;
+  // delete?
+  if (peer_cert_ != nullptr)
+    X509_free(peer_cert_);
+  peer_cert_ = nullptr;
+  peer_id_.clear();
+}
+
+void certifier::framework::secure_authenticated_channel::set_session_cache(
+    client_session_cache *cache) {
+  session_cache_ = cache;
+}
+
+void certifier::framework::secure_authenticated_channel::set_ktls(
+    bool enable) {
+  use_ktls_ = enable;
+}
+
+bool certifier::framework::secure_authenticated_channel::ktls_send_active() {
+  if (ssl_ == nullptr)
+    return false;
+  return BIO_get_ktls_send(SSL_get_wbio(ssl_)) > 0;
+}
+
+bool certifier::framework::secure_authenticated_channel::ktls_recv_active() {
+  if (ssl_ == nullptr)
+    return false;
+  return BIO_get_ktls_recv(SSL_get_rbio(ssl_)) > 0;
+}
+
+bool certifier::framework::secure_authenticated_channel::init_client_ssl(
+    const string &host_name,
+    int           port,
+    string &      asn1_root_cert,
+    key_message & private_key,
+    const string &auth_cert) {
+
+  if (!prepare_client_ssl(asn1_root_cert, private_key, auth_cert))
+    return false;
+
+  int sock = -1;
+  if (!open_client_socket(host_name, port, &sock)) {
+    printf("%s() error, line %d, Can't open client socket\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  attach_client_socket(host_name, port, sock);
+
+  // SSL_connect - initiate the TLS/SSL handshake with an TLS/SSL server
+  int ret = SSL_connect(ssl_);
+  if (ret <= 0) {
+    int err = SSL_get_error(ssl_, ret);
+    printf("%s() error, line %d, ssl_connect failed, ret=%d, err=%d: %s\n",
+           __func__,
+           __LINE__,
+           ret,
+           err,
+           ssl_strerror(err));
+    return false;
+  }
+  complete_client_handshake();
+  return true;
+}
+
+bool certifier::framework::secure_authenticated_channel::prepare_client_ssl(
+    string &      asn1_root_cert,
+    key_message & private_key,
+    const string &auth_cert) {
+
+  OPENSSL_init_ssl(0, NULL);
+  SSL_load_error_strings();
+
+  private_key_.CopyFrom(private_key);
+  asn1_root_cert_.assign((char *)asn1_root_cert.data(), asn1_root_cert.size());
+  root_cert_ = X509_new();
+  if (!asn1_to_x509(asn1_root_cert, root_cert_)) {
+    printf("%s() error, line %d, init_client_ssl: root cert invalid\n",
+           __func__,
+           __LINE__);
+    if (asn1_root_cert.size() == 0) {
+      printf("root cert empty\n");
+    } else {
+      print_bytes(asn1_root_cert.size(), (byte *)asn1_root_cert.data());
+      printf("\n");
+    }
+    return false;
+  }
+
+  const SSL_METHOD *method = TLS_client_method();
+  if (method == nullptr) {
+    printf("%s() error, line %d, Can't get method\n", __func__, __LINE__);
+    return false;
+  }
+
+  ssl_ctx_ = SSL_CTX_new(method);
+  if (ssl_ctx_ == nullptr) {
+    printf("%s() error, line %d, Can't get SSL_CTX\n", __func__, __LINE__);
+    return false;
+  }
+
+  asn1_my_cert_ = auth_cert;
+  X509_STORE *cs = SSL_CTX_get_cert_store(ssl_ctx_);
+  X509_STORE_add_cert(cs, root_cert_);
+
+  X509 *x509_auth_cert = X509_new();
+  if (asn1_to_x509(auth_cert, x509_auth_cert)) {
+    X509_STORE_add_cert(cs, x509_auth_cert);
+  }
+
+  // For debugging: SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, verify_callback);
+  SSL_CTX_set_verify(ssl_ctx_, SSL_VERIFY_PEER, nullptr);
+
+  SSL_CTX_set_verify_depth(ssl_ctx_, 4);
+  const long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION;
+  SSL_CTX_set_options(ssl_ctx_, flags);
+
+  if (session_cache_ != nullptr) {
+    SSL_CTX_set_session_cache_mode(ssl_ctx_,
+                                   SSL_SESS_CACHE_CLIENT
+                                       | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx_, new_client_session);
+  }
+
+  if (!load_client_certs_and_key()) {
+    printf("%s() error, line %d, load_client_certs_and_key failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return true;
+}
+
+void certifier::framework::secure_authenticated_channel::attach_client_socket(
+    const string &host_name,
+    int           port,
+    int           sock) {
+  sock_ = sock;
+  ssl_ = SSL_new(ssl_ctx_);
   SSL_set_fd(ssl_, sock_);
   int res = SSL_set_cipher_list(ssl_, "TLS_AES_256_GCM_SHA384");  // Change?
+  if (use_ktls_)
+    request_ktls(ssl_);
+
+  if (session_cache_ != nullptr
+      && make_session_key(host_name,
+                          port,
+                          asn1_root_cert_,
+                          asn1_my_cert_,
+                          &session_key_)) {
+    SSL_set_app_data(ssl_, this);
+    SSL_SESSION *session = session_cache_->take_session(session_key_);
+    if (session != nullptr) {
+      SSL_set_session(ssl_, session);
+      SSL_SESSION_free(session);
+    }
+  }
+}
+
+void certifier::framework::secure_authenticated_channel::
+    complete_client_handshake() {
+  if (session_cache_ != nullptr)
+    session_cache_->record_handshake(SSL_session_reused(ssl_) == 1);
+
+  // Verify a server certificate was presented during the negotiation
+  peer_cert_ = SSL_get_peer_certificate(ssl_);
+  if (peer_cert_ != nullptr) {
+    peer_id_.clear();
+    if (!extract_id_from_cert(peer_cert_, &peer_id_)) {
+      printf("%s() error, line %d, Can't extract id\n", __func__, __LINE__);
+    }
+  }
+
+#ifdef DEBUG
+  if (peer_cert_) {
+    printf("Client: Peer cert presented in nego\n");
+  } else {
+    printf("Client: No peer cert presented in nego\n");
+  }
+#endif
+  channel_initialized_ = true;
+}
+
+// Loads client side certs and keys.  Note: key for private_key is in
+//    the key.
+bool certifier::framework::secure_authenticated_channel::
+    load_client_certs_and_key() {
+  // RSA or ECC
+  EVP_PKEY *auth_private_key = cached_pkey_from_key(private_key_);
+  if (auth_private_key == nullptr) {
+    printf("%s() error, line %d, Can't convert auth key\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  X509 *x509_auth_key_cert = X509_new();
+  if (!asn1_to_x509(asn1_my_cert_, x509_auth_key_cert)) {
+    printf("%s() error, line %d, can't translate der to X509 %d\n",
+           __func__,
+           __LINE__,
+           (int)asn1_my_cert_.size());
+    X509_free(x509_auth_key_cert);
+    EVP_PKEY_free(auth_private_key);
+    return false;
+  }
+
+  // The SSL_CTX takes its own references to the key and cert.
+  bool            ret = false;
+  STACK_OF(X509) *stack = sk_X509_new_null();
+#if 0
+  if (sk_X509_push(stack, root_cert_) == 0) {
+    printf("load_client_certs_and_key, error 3\n");
+    goto done;
+  }
+#endif
+
+  if (!SSL_CTX_use_certificate(ssl_ctx_, x509_auth_key_cert)) {
+    printf("%s() error, line %d, use cert failed\n", __func__, __LINE__);
+    goto done;
+  }
+  if (!SSL_CTX_use_PrivateKey(ssl_ctx_, auth_private_key)) {
+    printf("%s() error, line %d, use priv key failed\n", __func__, __LINE__);
+    goto done;
+  }
+
+  if (!SSL_CTX_check_private_key(ssl_ctx_)) {
+    printf("%s() error, line %d, private key check failed\n",
+           __func__,
+           __LINE__);
+    goto done;
+  }
+
+#ifdef BORING_SSL
+  SSL_CTX_add1_chain_cert(ssl_ctx_, root_cert_);
+#else
+  if (SSL_CTX_use_cert_and_key(ssl_ctx_,
+                               x509_auth_key_cert,
+                               auth_private_key,
+                               stack,
+                               1)
+      <= 0) {
+    printf("%s() error, line %d, use_cert_and_key failed\n",
+           __func__,
+           __LINE__);
+    goto done;
+  }
+
+  SSL_CTX_add1_to_CA_list(ssl_ctx_, root_cert_);
+
+#  ifdef DEBUG
+  {
+    const STACK_OF(X509_NAME) *ca_list = SSL_CTX_get0_CA_list(ssl_ctx_);
+    printf("CA names to offer\n");
+    if (ca_list != nullptr) {
+      for (int i = 0; i < sk_X509_NAME_num(ca_list); i++) {
+        X509_NAME *name = sk_X509_NAME_value(ca_list, i);
+        print_cn_name(name);
+      }
+    }
+  }
+#  endif  // DEBUG
+#endif    // BORING_SSL
+  ret = true;
+
+done:
+  sk_X509_free(stack);
+  X509_free(x509_auth_key_cert);
+  EVP_PKEY_free(auth_private_key);
+  return ret;
+}
+
+void certifier::framework::secure_authenticated_channel::
+    server_channel_accept_and_auth(
+        void (*func)(secure_authenticated_channel &)) {
+
+  if (use_ktls_)
+    request_ktls(ssl_);
+
+  // accept and carry out auth
+  int res = SSL_accept(ssl_);
+  if (res != 1) {
+    printf("%s() error, line %d, Can't SSL_accept connection"
+           ", res=%d\n",
+           __func__,
+           __LINE__,
+           res);
+    unsigned long code = ERR_get_error();
+    printf("Accept error: %s\n", ERR_lib_error_string(code));
+    print_ssl_error(SSL_get_error(ssl_, res));
+    if (ssl_ != nullptr) {
+      SSL_free(ssl_);
+      ssl_ = nullptr;
+    }
+    return;
+  }
+  sock_ = SSL_get_fd(ssl_);
+
+#ifdef DEBUG
+  printf("Accepted ssl connection using %s \n", SSL_get_cipher(ssl_));
+#endif
+
+  // Verify a client certificate was presented during the negotiation
+  peer_cert_ = SSL_get_peer_certificate(ssl_);
+  if (peer_cert_ != nullptr) {
+    if (!extract_id_from_cert(peer_cert_, &peer_id_)) {
+      printf("%s() error, line %d, Can't extract id\n", __func__, __LINE__);
+    }
+  }
+
+#ifdef DEBUG
+  if (peer_cert_) {
+    printf("server_channel_accept_and_auth: Peer cert presented in nego\n");
+  } else {
+    printf("server_channel_accept_and_auth: No peer cert presented in nego\n");
+  }
+#endif
+
+  channel_initialized_ = true;
+  func(*this);
+  return;
+}
+
+bool certifier::framework::secure_authenticated_channel::init_server_ssl(
+    const string &host_name,
+    int           port,
+    string &      asn1_root_cert,
+    key_message & private_key,
+    const string &auth_cert) {
+  SSL_load_error_strings();
+
+  // set keys and cert
+  private_key_.CopyFrom(private_key);
+  asn1_root_cert_.assign((char *)asn1_root_cert.data(), asn1_root_cert.size());
+  root_cert_ = X509_new();
+  if (!asn1_to_x509(asn1_root_cert, root_cert_)) {
+    printf("%s() error, line %d, Can't translate der to X509\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return true;
+}
+
+int certifier::framework::secure_authenticated_channel::read(int   size,
+                                                             byte *b) {
+  return SSL_read(ssl_, b, size);
+}
+
+int certifier::framework::secure_authenticated_channel::read(string *out) {
+  return sized_ssl_read(ssl_, out);
+}
+
+int certifier::framework::secure_authenticated_channel::write(int   size,
+                                                              byte *b) {
+  return sized_ssl_write(ssl_, size, b);
+}
+
+void certifier::framework::secure_authenticated_channel::close() {
+  if (sock_ >= 0)
+    ::close(sock_);
+  sock_ = -1;
+  if (ssl_ != nullptr) {
+    // Freeing an SSL that was not shut down marks its session bad.
+    // A quiet shutdown keeps it resumable without writing to the socket.
+    if (channel_initialized_) {
+      SSL_set_quiet_shutdown(ssl_, 1);
+      SSL_shutdown(ssl_);
+    }
+    SSL_free(ssl_);
+    ssl_ = nullptr;
+  }
+}
+
+bool certifier::framework::secure_authenticated_channel::get_peer_id(
+    string *out_peer_id) {
+  out_peer_id->assign((char *)peer_id_.data(), peer_id_.size());
+  return true;
+}
+
+// Plaintext bytes per write when a file can't be sent with SSL_sendfile.
+const int file_copy_size = 16384;
+
+bool certifier::framework::secure_authenticated_channel::send_file(
+    const string &file_name) {
+  if (ssl_ == nullptr)
+    return false;
+  int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("%s() error, line %d, can't open %s\n",
+           __func__,
+           __LINE__,
+           file_name.c_str());
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+
+  frame_stream s(ssl_);
+  uint64_t     size = st.st_size;
+  bool         ret = framed_write_header(s, size);
+  uint64_t     sent = 0;
+
+#ifdef SSL_OP_ENABLE_KTLS
+  if (ret && ktls_send_active()) {
+    while (sent < size) {
+      ossl_ssize_t n = SSL_sendfile(ssl_, fd, sent, size - sent, 0);
+      if (n <= 0)
+        break;
+      sent += n;
+    }
+    // If SSL_sendfile stops early, the copy loop sends the rest.
+  }
+#endif
+
+  byte buf[file_copy_size];
+  while (ret && sent < size) {
+    int want = file_copy_size;
+    if ((uint64_t)want > size - sent)
+      want = size - sent;
+    ssize_t n = pread(fd, buf, want, sent);
+    if (n <= 0) {
+      printf("%s() error, line %d, read of %s failed\n",
+             __func__,
+             __LINE__,
+             file_name.c_str());
+      ret = false;
+      break;
+    }
+    ret = framed_write_data(s, n, buf);
+    sent += n;
+  }
+  ::close(fd);
+  return ret;
+}
+
+static bool write_file_chunk(void *arg, int size, const byte *chunk) {
+  int fd = *(int *)arg;
+  int done = 0;
+  while (done < size) {
+    int n = ::write(fd, chunk + done, size - done);
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+bool certifier::framework::secure_authenticated_channel::receive_file(
+    const string &file_name,
+    uint64_t      max_size) {
+  if (ssl_ == nullptr)
+    return false;
+  frame_stream s(ssl_);
+  uint64_t     size = 0;
+  if (!framed_read_header(s, &size))
+    return false;
+  if (size > max_size) {
+    printf("%s() error, line %d, file too large\n", __func__, __LINE__);
+    return false;
+  }
+  int fd = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    printf("%s() error, line %d, can't create %s\n",
+           __func__,
+           __LINE__,
+           file_name.c_str());
+    return false;
+  }
+  byte buf[file_copy_size];
+  bool ret =
+      framed_read_chunks(s, size, file_copy_size, buf, write_file_chunk, &fd);
+  if (::close(fd) != 0)
+    ret = false;
+  return ret;
+}
+
+// Client connection pool
+// -------------------------------------------------------------------
+
+class certifier::framework::client_channel_pool::idle_channel {
+ public:
+  secure_authenticated_channel *channel_;
+  time_t                        idle_since_;
+};
+
+// An idle channel should have nothing to read except, possibly, TLS
+// records like session tickets.  Peek without blocking to tell these
+// apart from a closed connection or stray application data.
+static bool idle_channel_healthy(secure_authenticated_channel *channel) {
+  if (channel->ssl_ == nullptr || channel->sock_ < 0)
+    return false;
+  if (SSL_pending(channel->ssl_) > 0)
+    return false;
+
+  struct pollfd pfd;
+  pfd.fd = channel->sock_;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  int n = poll(&pfd, 1, 0);
+  if (n < 0)
+    return false;
+  if (n == 0)
+    return true;
+  if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+    return false;
+
+  int flags = fcntl(channel->sock_, F_GETFL, 0);
+  if (flags < 0 || fcntl(channel->sock_, F_SETFL, flags | O_NONBLOCK) != 0)
+    return false;
+  byte b;
+  int  ret = SSL_peek(channel->ssl_, &b, 1);
+  int  err = SSL_get_error(channel->ssl_, ret);
+  fcntl(channel->sock_, F_SETFL, flags);
+  return ret <= 0 && err == SSL_ERROR_WANT_READ;
+}
+
+certifier::framework::client_channel_pool::client_channel_pool(
+    int max_idle_per_peer) {
+  max_idle_per_peer_ = max_idle_per_peer > 0 ? max_idle_per_peer : 1;
+  max_idle_seconds_ = 0;
+  initialized_ = false;
+  session_cache_ = nullptr;
+  connections_opened_ = 0;
+  reuses_ = 0;
+  health_check_failures_ = 0;
+}
+
+certifier::framework::client_channel_pool::~client_channel_pool() {
+  close_idle();
+  // Channels still in use belong to their callers until released.
+  in_use_.clear();
+}
+
+bool certifier::framework::client_channel_pool::init(
+    string &      asn1_root_cert,
+    key_message & private_key,
+    const string &private_key_cert) {
+  asn1_root_cert_ = asn1_root_cert;
+  private_key_.CopyFrom(private_key);
+  private_key_cert_ = private_key_cert;
+  initialized_ = true;
+  return true;
+}
+
+void certifier::framework::client_channel_pool::set_session_cache(
+    client_session_cache *cache) {
+  session_cache_ = cache;
+}
+
+void certifier::framework::client_channel_pool::set_max_idle_seconds(
+    int seconds) {
+  max_idle_seconds_ = seconds;
+}
+
+secure_authenticated_channel *
+certifier::framework::client_channel_pool::acquire(const string &host_name,
+                                                   int           port) {
+  if (!initialized_) {
+    printf("%s() error, line %d, pool not initialized\n", __func__, __LINE__);
+    return nullptr;
+  }
+  string peer(host_name);
+  peer.append(":");
+  peer.append(std::to_string(port));
+
+  for (;;) {
+    idle_channel *ic = nullptr;
+    mtx_.lock();
+    std::map<string, std::deque<idle_channel *>>::iterator it =
+        idle_.find(peer);
+    if (it != idle_.end() && !it->second.empty()) {
+      // Most recently used first; it is the least likely to have timed out.
+      ic = it->second.back();
+      it->second.pop_back();
+    }
+    mtx_.unlock();
+    if (ic == nullptr)
+      break;
+
+    secure_authenticated_channel *channel = ic->channel_;
+
+    bool expired = max_idle_seconds_ > 0
+                   && time(nullptr) - ic->idle_since_ > max_idle_seconds_;
+    delete ic;
+    if (!expired && idle_channel_healthy(channel)) {
+      mtx_.lock();
+      reuses_++;
+      in_use_[channel] = peer;
+      mtx_.unlock();
+      return channel;
+    }
+    mtx_.lock();
+    health_check_failures_++;
+    mtx_.unlock();
+    channel->close();
+    delete channel;
+  }
+
+  string                        role("client");
+  secure_authenticated_channel *channel =
+      new secure_authenticated_channel(role);
+  if (session_cache_ != nullptr)
+    channel->set_session_cache(session_cache_);
+  if (!channel->init_client_ssl(host_name,
+                                port,
+                                asn1_root_cert_,
+                                private_key_,
+                                private_key_cert_)) {
+    printf("%s() error, line %d, Can't connect to %s:%d\n",
+           __func__,
+           __LINE__,
+           host_name.c_str(),
+           port);
+    delete channel;
+    return nullptr;
+  }
+  mtx_.lock();
+  connections_opened_++;
+  in_use_[channel] = peer;
+  mtx_.unlock();
+  return channel;
+}
+
+void certifier::framework::client_channel_pool::release(
+    secure_authenticated_channel *channel,
+    bool                          reusable) {
+  if (channel == nullptr)
+    return;
+
+  mtx_.lock();
+  std::map<secure_authenticated_channel *, string>::iterator it =
+      in_use_.find(channel);
+  if (it == in_use_.end()) {
+    mtx_.unlock();
+    printf("%s() error, line %d, channel not from this pool\n",
+           __func__,
+           __LINE__);
+    return;
+  }
+  string peer = it->second;
+  in_use_.erase(it);
+  std::deque<idle_channel *> &idle = idle_[peer];
+  if (reusable && (int)idle.size() < max_idle_per_peer_) {
+    idle_channel *ic = new idle_channel;
+    ic->channel_ = channel;
+    ic->idle_since_ = time(nullptr);
+    idle.push_back(ic);
+    channel = nullptr;
+  }
+  mtx_.unlock();
+
+  if (channel != nullptr) {
+    channel->close();
+    delete channel;
+  }
+}
+
+void certifier::framework::client_channel_pool::close_idle() {
+  std::deque<idle_channel *> to_close;
+
+  mtx_.lock();
+  for (std::map<string, std::deque<idle_channel *>>::iterator it =
+           idle_.begin();
+       it != idle_.end();
+       ++it) {
+    to_close.insert(to_close.end(), it->second.begin(), it->second.end());
+  }
+  idle_.clear();
+  mtx_.unlock();
+
+  for (size_t i = 0; i < to_close.size(); i++) {
+    to_close[i]->channel_->close();
+    delete to_close[i]->channel_;
+    delete to_close[i];
+  }
+}
+
+int certifier::framework::client_channel_pool::num_idle() {
+  int n = 0;
+  mtx_.lock();
+  for (std::map<string, std::deque<idle_channel *>>::iterator it =
+           idle_.begin();
+       it != idle_.end();
+       ++it) {
+    n += (int)it->second.size();
+  }
+  mtx_.unlock();
+  return n;
+}
+
+int certifier::framework::client_channel_pool::num_in_use() {
+  mtx_.lock();
+  int n = (int)in_use_.size();
+  mtx_.unlock();
+  return n;
+}
+
+uint64_t certifier::framework::client_channel_pool::connections_opened() {
+  mtx_.lock();
+  uint64_t n = connections_opened_;
+  mtx_.unlock();
+  return n;
+}
+
+uint64_t certifier::framework::client_channel_pool::reuses() {
+  mtx_.lock();
+  uint64_t n = reuses_;
+  mtx_.unlock();
+  return n;
+}
+
+uint64_t certifier::framework::client_channel_pool::health_check_failures() {
+  mtx_.lock();
+  uint64_t n = health_check_failures_;
+  mtx_.unlock();
+  return n;
+}
+
+// Asynchronous client channels
+// -------------------------------------------------------------------
+
+class certifier::framework::async_channel_driver::entry {
+ public:
+  enum { connecting, handshaking, open, failed };
+
+  class write_op {
+   public:
+    uint64_t       end_;  // bytes queued on the channel through this message
+    write_callback cb_;
+    void *         arg_;
+  };
+  class read_op {
+   public:
+    read_callback cb_;
+    void *        arg_;
+  };
+
+  secure_authenticated_channel *channel_;
+  int                           state_;
+  bool                          ready_;
+  bool                          closed_;
+  uint32_t                      events_;  // 0 when not in the epoll set
+  connect_callback              connect_cb_;
+  void *                        connect_arg_;
+  string                        in_;
+  string                        out_;
+  size_t                        out_offset_;
+  uint64_t                      queued_;
+  uint64_t                      written_;
+  std::deque<write_op>          writes_;
+  std::deque<read_op>           reads_;
+};
+
+// Like open_client_socket, but returns as soon as the connect is under way.
+static bool start_client_connect(const string &host_name, int port, int *soc) {
+  struct addrinfo  hints;
+  struct addrinfo *result, *rp;
+  int              sfd = -1;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  char port_str[16] = {};
+  sprintf(port_str, "%d", port);
+
+  int s = getaddrinfo(host_name.c_str(), port_str, &hints, &result);
+  if (s != 0) {
+    printf("%s() error, line %d, getaddrinfo: %s\n",
+           __func__,
+           __LINE__,
+           gai_strerror(s));
+    return false;
+  }
+  for (rp = result; rp != NULL; rp = rp->ai_next) {
+    sfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+    if (sfd == -1)
+      continue;
+    if (fcntl(sfd, F_SETFL, O_NONBLOCK) == 0
+        && (connect(sfd, rp->ai_addr, rp->ai_addrlen) == 0
+            || errno == EINPROGRESS))
+      break;
+    ::close(sfd);
+  }
+  freeaddrinfo(result);
+  if (rp == NULL)
+    return false;
+  *soc = sfd;
+  return true;
+}
+
+certifier::framework::async_channel_driver::async_channel_driver() {
+  epoll_fd_ = -1;
+  max_message_size_ = 64 * 1024 * 1024;
+  in_run_ = false;
+  outstanding_ = 0;
+}
+
+certifier::framework::async_channel_driver::~async_channel_driver() {
+  while (!entries_.empty())
+    close(entries_.begin()->first);
+  while (!closed_.empty()) {
+    free_entry(closed_.front());
+    closed_.pop_front();
+  }
+  if (epoll_fd_ >= 0)
+    ::close(epoll_fd_);
+  epoll_fd_ = -1;
+}
+
+bool certifier::framework::async_channel_driver::init() {
+  epoll_fd_ = epoll_create1(0);
+  if (epoll_fd_ < 0) {
+    printf("%s() error, line %d, epoll_create1 failed\n", __func__, __LINE__);
+    return false;
+  }
+  return true;
+}
+
+void certifier::framework::async_channel_driver::set_max_message_size(
+    int size) {
+  max_message_size_ = size;
+}
+
+certifier::framework::secure_authenticated_channel *
+certifier::framework::async_channel_driver::connect(
+    const string &   host_name,
+    int              port,
+    string &         asn1_root_cert,
+    key_message &    private_key,
+    const string &   private_key_cert,
+    connect_callback cb,
+    void *           arg) {
+  if (epoll_fd_ < 0)
+    return nullptr;
+
+  string                        role("client");
+  secure_authenticated_channel *channel =
+      new secure_authenticated_channel(role);
+  int sock = -1;
+  if (!channel->prepare_client_ssl(asn1_root_cert,
+                                   private_key,
+                                   private_key_cert)
+      || !start_client_connect(host_name, port, &sock)) {
+    printf("%s() error, line %d, Can't start connection to %s:%d\n",
+           __func__,
+           __LINE__,
+           host_name.c_str(),
+           port);
+    delete channel;
+    return nullptr;
+  }
+  channel->attach_client_socket(host_name, port, sock);
+  SSL_set_mode(channel->ssl_,
+               SSL_MODE_ENABLE_PARTIAL_WRITE
+                   | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+  entry *e = new entry;
+  e->channel_ = channel;
+  e->state_ = entry::connecting;
+  e->ready_ = false;
+  e->closed_ = false;
+  e->events_ = 0;
+  e->connect_cb_ = cb;
+  e->connect_arg_ = arg;
+  e->out_offset_ = 0;
+  e->queued_ = 0;
+  e->written_ = 0;
+  entries_[channel] = e;
+  outstanding_++;
+  make_ready(e);
+  return channel;
+}
+
+bool certifier::framework::async_channel_driver::write(
+    secure_authenticated_channel *channel,
+    int                           size,
+    byte *                        b,
+    write_callback                cb,
+    void *                        arg) {
+  std::map<secure_authenticated_channel *, entry *>::iterator it =
+      entries_.find(channel);
+  if (it == entries_.end() || size < 0)
+    return false;
+  entry *e = it->second;
+  if (e->closed_ || e->state_ == entry::failed)
+    return false;
+
+  e->out_.append((char *)&size, sizeof(int));
+  e->out_.append((char *)b, size);
+  e->queued_ += sizeof(int) + size;
+  entry::write_op op;
+  op.end_ = e->queued_;
+  op.cb_ = cb;
+  op.arg_ = arg;
+  e->writes_.push_back(op);
+  outstanding_++;
+  make_ready(e);
+  return true;
+}
+
+bool certifier::framework::async_channel_driver::read(
+    secure_authenticated_channel *channel,
+    read_callback                 cb,
+    void *                        arg) {
+  std::map<secure_authenticated_channel *, entry *>::iterator it =
+      entries_.find(channel);
+  if (it == entries_.end())
+    return false;
+  entry *e = it->second;
+  if (e->closed_ || e->state_ == entry::failed)
+    return false;
+
+  entry::read_op op;
+  op.cb_ = cb;
+  op.arg_ = arg;
+  e->reads_.push_back(op);
+  outstanding_++;
+  make_ready(e);
+  return true;
+}
+
+void certifier::framework::async_channel_driver::close(
+    secure_authenticated_channel *channel) {
+  std::map<secure_authenticated_channel *, entry *>::iterator it =
+      entries_.find(channel);
+  if (it == entries_.end())
+    return;
+  entry *e = it->second;
+  if (e->closed_)
+    return;
+  e->closed_ = true;
+  fail(e);
+  entries_.erase(it);
+
+  // Inside run_once, e may still be in this round's events.
+  if (in_run_) {
+    closed_.push_back(e);
+    return;
+  }
+  for (std::deque<entry *>::iterator r = ready_.begin(); r != ready_.end();
+       r++) {
+    if (*r == e) {
+      ready_.erase(r);
+      break;
+    }
+  }
+  free_entry(e);
+}
+
+void certifier::framework::async_channel_driver::free_entry(entry *e) {
+  set_events(e, 0);
+  // The destructor frees the SSL object and closes the socket.
+  delete e->channel_;
+  delete e;
+}
+
+void certifier::framework::async_channel_driver::make_ready(entry *e) {
+  if (e->ready_)
+    return;
+  e->ready_ = true;
+  ready_.push_back(e);
+}
+
+void certifier::framework::async_channel_driver::set_events(entry *  e,
+                                                            uint32_t events) {
+  if (events == e->events_)
+    return;
+  int sock = e->channel_->sock_;
+  if (events == 0) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, sock, nullptr);
+  } else {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = e;
+    int op = (e->events_ == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(epoll_fd_, op, sock, &ev) != 0) {
+      printf("%s() error, line %d, epoll_ctl failed\n", __func__, __LINE__);
+      events = 0;
+    }
+  }
+  e->events_ = events;
+}
+
+// Runs the callbacks of everything outstanding on e with ok false.
+void certifier::framework::async_channel_driver::fail(entry *e) {
+  set_events(e, 0);
+  int state = e->state_;
+  e->state_ = entry::failed;
+  if (state == entry::connecting || state == entry::handshaking) {
+    outstanding_--;
+    if (e->connect_cb_ != nullptr)
+      e->connect_cb_(e->connect_arg_, e->channel_, false);
+  }
+  while (!e->writes_.empty()) {
+    entry::write_op op = e->writes_.front();
+    e->writes_.pop_front();
+    outstanding_--;
+    if (op.cb_ != nullptr)
+      op.cb_(op.arg_, e->channel_, false);
+  }
+  string empty;
+  while (!e->reads_.empty()) {
+    entry::read_op op = e->reads_.front();
+    e->reads_.pop_front();
+    outstanding_--;
+    if (op.cb_ != nullptr)
+      op.cb_(op.arg_, e->channel_, false, empty);
+  }
+}
 
-  // SSL_connect - initiate the TLS/SSL handshake with an TLS/SSL server
-  int ret = SSL_connect(ssl_);
-  if (ret <= 0) {
-    int err = SSL_get_error(ssl_, ret);
-    printf("%s() error, line %d, ssl_connect failed, ret=%d, err=%d: %s\n",
+// Hands the first complete sized message in e->in_ to the oldest read.
+// Returns 1 if it did, 0 if more input is needed and -1 on a bad size.
+int certifier::framework::async_channel_driver::deliver_message(entry *e) {
+  if (e->in_.size() < sizeof(int))
+    return 0;
+  int size = 0;
+  memcpy(&size, e->in_.data(), sizeof(int));
+  if (size < 0 || size > max_message_size_) {
+    printf("%s() error, line %d, bad message size %d\n",
            __func__,
            __LINE__,
-           ret,
-           err,
-           ssl_strerror(err));
-    return false;
+           size);
+    return -1;
+  }
+  if (e->in_.size() - sizeof(int) < (size_t)size)
+    return 0;
+  string message(e->in_.data() + sizeof(int), size);
+  e->in_.erase(0, sizeof(int) + size);
+
+  entry::read_op op = e->reads_.front();
+  e->reads_.pop_front();
+  outstanding_--;
+  if (op.cb_ != nullptr)
+    op.cb_(op.arg_, e->channel_, true, message);
+  return 1;
+}
+
+// Advances e as far as it can go without blocking, running callbacks for
+// what completes, and records which event it is waiting for.
+void certifier::framework::async_channel_driver::advance(entry *e) {
+  if (e->closed_ || e->state_ == entry::failed)
+    return;
+  SSL *    ssl = e->channel_->ssl_;
+  int      sock = e->channel_->sock_;
+  uint32_t want = 0;
+  int      ret;
+
+  if (e->state_ == entry::connecting) {
+    struct sockaddr_in addr;
+    socklen_t          len = sizeof(addr);
+    if (getpeername(sock, (struct sockaddr *)&addr, &len) != 0) {
+      int       err = 0;
+      socklen_t err_len = sizeof(err);
+      if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0
+          || err != 0) {
+        fail(e);
+        return;
+      }
+      set_events(e, EPOLLOUT);
+      return;
+    }
+    e->state_ = entry::handshaking;
   }
 
-  // Verify a server certificate was presented during the negotiation
-  peer_cert_ = SSL_get_peer_certificate(ssl_);
-  if (peer_cert_ != nullptr) {
-    peer_id_.clear();
-    if (!extract_id_from_cert(peer_cert_, &peer_id_)) {
-      printf("%s() error, line %d, Can't extract id\n", __func__, __LINE__);
+  if (e->state_ == entry::handshaking) {
+    ret = SSL_connect(ssl);
+    if (ret != 1) {
+      int err = SSL_get_error(ssl, ret);
+      if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        set_events(e, (err == SSL_ERROR_WANT_READ) ? EPOLLIN : EPOLLOUT);
+        return;
+      }
+      printf("%s() error, line %d, ssl_connect failed, err=%d: %s\n",
+             __func__,
+             __LINE__,
+             err,
+             ssl_strerror(err));
+      fail(e);
+      return;
+    }
+    e->channel_->complete_client_handshake();
+    e->state_ = entry::open;
+    outstanding_--;
+    if (e->connect_cb_ != nullptr)
+      e->connect_cb_(e->connect_arg_, e->channel_, true);
+  }
+
+  for (;;) {
+    if (e->closed_ || e->state_ != entry::open)
+      return;
+
+    // Finish pending output before reading.
+    while (want == 0 && e->out_offset_ < e->out_.size()) {
+      size_t left = e->out_.size() - e->out_offset_;
+      if (left > (size_t)INT_MAX)
+        left = INT_MAX;
+      ret = SSL_write(ssl, e->out_.data() + e->out_offset_, (int)left);
+      if (ret <= 0) {
+        int err = SSL_get_error(ssl, ret);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+          want = (err == SSL_ERROR_WANT_READ) ? EPOLLIN : EPOLLOUT;
+          break;
+        }
+        fail(e);
+        return;
+      }
+      e->out_offset_ += ret;
+      e->written_ += ret;
+      while (!e->writes_.empty() && e->writes_.front().end_ <= e->written_) {
+        entry::write_op op = e->writes_.front();
+        e->writes_.pop_front();
+        outstanding_--;
+        if (op.cb_ != nullptr)
+          op.cb_(op.arg_, e->channel_, true);
+        if (e->closed_ || e->state_ != entry::open)
+          return;
+      }
+    }
+    if (want != 0 || e->reads_.empty())
+      break;
+    if (e->out_offset_ == e->out_.size()) {
+      e->out_.clear();
+      e->out_offset_ = 0;
     }
+
+    int delivered = deliver_message(e);
+    if (delivered < 0) {
+      fail(e);
+      return;
+    }
+    if (delivered > 0)
+      continue;
+
+    byte buf[16384];
+    ret = SSL_read(ssl, buf, sizeof(buf));
+    if (ret <= 0) {
+      int err = SSL_get_error(ssl, ret);
+      if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        want = (err == SSL_ERROR_WANT_READ) ? EPOLLIN : EPOLLOUT;
+        break;
+      }
+      // Peer closed or protocol error.
+      fail(e);
+      return;
+    }
+    e->in_.append((char *)buf, ret);
   }
+  set_events(e, want);
+}
 
-#ifdef DEBUG
-  if (peer_cert_) {
-    printf("Client: Peer cert presented in nego\n");
-  } else {
-    printf("Client: No peer cert presented in nego\n");
+bool certifier::framework::async_channel_driver::run_once(int timeout_ms) {
+  if (epoll_fd_ < 0)
+    return false;
+  if (!ready_.empty())
+    timeout_ms = 0;
+
+  const int          max_events = 64;
+  struct epoll_event events[max_events];
+  int                n = epoll_wait(epoll_fd_, events, max_events, timeout_ms);
+  if (n < 0) {
+    if (errno == EINTR)
+      return true;
+    printf("%s() error, line %d, epoll_wait failed\n", __func__, __LINE__);
+    return false;
+  }
+
+  in_run_ = true;
+  for (int i = 0; i < n; i++)
+    advance((entry *)events[i].data.ptr);
+  while (!ready_.empty()) {
+    entry *e = ready_.front();
+    ready_.pop_front();
+    e->ready_ = false;
+    advance(e);
+  }
+  in_run_ = false;
+
+  while (!closed_.empty()) {
+    free_entry(closed_.front());
+    closed_.pop_front();
   }
-#endif
-  channel_initialized_ = true;
   return true;
 }
 
-// Loads client side certs and keys.  Note: key for private_key is in
-//    the key.
-bool certifier::framework::secure_authenticated_channel::
-    load_client_certs_and_key() {
-  // Todo: Add other key types
-  RSA *r = RSA_new();
-  if (!key_to_RSA(private_key_, r)) {
-    printf("%s() error, line %d, Can't convert to RSA key\n",
+bool certifier::framework::async_channel_driver::run() {
+  while (outstanding_ > 0) {
+    if (!run_once(-1))
+      return false;
+  }
+  return true;
+}
+
+int certifier::framework::async_channel_driver::num_channels() {
+  return (int)entries_.size();
+}
+
+int certifier::framework::async_channel_driver::outstanding() {
+  return outstanding_;
+}
+
+// Stream multiplexing
+// -------------------------------------------------------------------
+
+// Each frame starts with stream id (4), type (1), flags (1),
+// reserved (2) and payload size (4), all big-endian.  A frame with its
+// header fills at most one TLS record.
+const int mux_frame_header_size = 12;
+const int mux_frame_data = 0;
+const int mux_frame_window_update = 1;
+const int mux_frame_fin = 2;
+const int mux_flag_end_message = 1;
+
+// Most output gathered for one pass of the I/O thread.
+const int mux_max_output = 65536;
+
+class certifier::framework::channel_mux::stream {
+ public:
+  int                id_;
+  int64_t            send_window_;
+  int64_t            recv_window_;
+  uint64_t           deferred_credit_;
+  bool               local_closed_;
+  bool               remote_closed_;
+  bool               sending_;
+  bool               scheduled_;
+  string             partial_;
+  std::deque<string> messages_;
+  std::deque<string> out_;
+};
+
+static void put_be32(byte *p, uint32_t v) {
+  p[0] = (byte)(v >> 24);
+  p[1] = (byte)(v >> 16);
+  p[2] = (byte)(v >> 8);
+  p[3] = (byte)v;
+}
+
+static uint32_t get_be32(const byte *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+         | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void make_mux_frame_header(int id,
+                                  int type,
+                                  int flags,
+                                  int size,
+                                  byte *header) {
+  put_be32(header, id);
+  header[4] = (byte)type;
+  header[5] = (byte)flags;
+  header[6] = 0;
+  header[7] = 0;
+  put_be32(header + 8, size);
+}
+
+certifier::framework::channel_mux::channel_mux(
+    secure_authenticated_channel *channel,
+    bool                          initiator) {
+  channel_ = channel;
+  initiator_ = initiator;
+  stream_window_ = 256 * 1024;
+  max_message_size_ = 64 * 1024 * 1024;
+  max_streams_ = 1024;
+  next_stream_ = initiator ? 1 : 2;
+  last_peer_stream_ = 0;
+  wake_fd_ = -1;
+  saved_flags_ = -1;
+  stopping_ = false;
+  failed_ = false;
+  frames_sent_ = 0;
+  frames_received_ = 0;
+  io_thread_ = nullptr;
+}
+
+certifier::framework::channel_mux::~channel_mux() {
+  stop();
+  for (std::map<int, stream *>::iterator it = streams_.begin();
+       it != streams_.end();
+       it++)
+    delete it->second;
+  streams_.clear();
+}
+
+void certifier::framework::channel_mux::set_stream_window(int size) {
+  if (size > 0)
+    stream_window_ = size;
+}
+
+void certifier::framework::channel_mux::set_max_message_size(int size) {
+  if (size >= 0)
+    max_message_size_ = size;
+}
+
+void certifier::framework::channel_mux::set_max_streams(int num) {
+  if (num > 0)
+    max_streams_ = num;
+}
+
+bool certifier::framework::channel_mux::start() {
+  if (channel_ == nullptr || channel_->ssl_ == nullptr
+      || !channel_->channel_initialized_ || io_thread_ != nullptr)
+    return false;
+
+  wake_fd_ = eventfd(0, EFD_NONBLOCK);
+  if (wake_fd_ < 0) {
+    printf("%s() error, line %d, eventfd failed\n", __func__, __LINE__);
+    return false;
+  }
+  saved_flags_ = fcntl(channel_->sock_, F_GETFL);
+  if (saved_flags_ < 0
+      || fcntl(channel_->sock_, F_SETFL, saved_flags_ | O_NONBLOCK) != 0) {
+    printf("%s() error, line %d, can't make socket non-blocking\n",
            __func__,
            __LINE__);
+    saved_flags_ = -1;
     return false;
   }
-  EVP_PKEY *auth_private_key = EVP_PKEY_new();
-  EVP_PKEY_set1_RSA(auth_private_key, r);
+  SSL_set_mode(channel_->ssl_,
+               SSL_MODE_ENABLE_PARTIAL_WRITE
+                   | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  io_thread_ = new std::thread(&channel_mux::io_loop, this);
+  return true;
+}
 
-  X509 *x509_auth_key_cert = X509_new();
-  if (!asn1_to_x509(asn1_my_cert_, x509_auth_key_cert)) {
-    printf("%s() error, line %d, can't translate der to X509 %d\n",
-           __func__,
-           __LINE__,
-           (int)asn1_my_cert_.size());
-    return false;
+void certifier::framework::channel_mux::stop() {
+  mtx_.lock();
+  stopping_ = true;
+  mtx_.unlock();
+  cv_.notify_all();
+  if (io_thread_ != nullptr) {
+    wake();
+    io_thread_->join();
+    delete io_thread_;
+    io_thread_ = nullptr;
+  }
+  if (saved_flags_ >= 0)
+    fcntl(channel_->sock_, F_SETFL, saved_flags_);
+  saved_flags_ = -1;
+  if (wake_fd_ >= 0)
+    ::close(wake_fd_);
+  wake_fd_ = -1;
+}
+
+void certifier::framework::channel_mux::wake() {
+  uint64_t one = 1;
+  if (::write(wake_fd_, &one, sizeof(one)) < 0) {
+    // Already signalled.
   }
+}
 
-  STACK_OF(X509) *stack = sk_X509_new_null();
-#if 0
-  if (sk_X509_push(stack, root_cert_) == 0) {
-    printf("load_client_certs_and_key, error 3\n");
-    return false;
+// Called with mtx_ held.
+certifier::framework::channel_mux::stream *
+certifier::framework::channel_mux::new_stream(int id) {
+  stream *s = new stream;
+  s->id_ = id;
+  s->send_window_ = stream_window_;
+  s->recv_window_ = stream_window_;
+  s->deferred_credit_ = 0;
+  s->local_closed_ = false;
+  s->remote_closed_ = false;
+  s->sending_ = false;
+  s->scheduled_ = false;
+  streams_[id] = s;
+  return s;
+}
+
+// Called with mtx_ held.
+void certifier::framework::channel_mux::queue_frame(stream *    s,
+                                                    int         type,
+                                                    int         flags,
+                                                    int         size,
+                                                    const byte *b) {
+  byte header[mux_frame_header_size];
+  make_mux_frame_header(s->id_, type, flags, size, header);
+  s->out_.push_back(string((char *)header, mux_frame_header_size));
+  if (size > 0)
+    s->out_.back().append((char *)b, size);
+  if (!s->scheduled_) {
+    s->scheduled_ = true;
+    send_order_.push_back(s->id_);
   }
-#endif
+}
 
-  if (!SSL_CTX_use_certificate(ssl_ctx_, x509_auth_key_cert)) {
-    printf("%s() error, line %d, use cert failed\n", __func__, __LINE__);
+// Called with mtx_ held.
+void certifier::framework::channel_mux::queue_window_update(
+    int      id,
+    uint32_t increment) {
+  byte frame[mux_frame_header_size + 4];
+  make_mux_frame_header(id, mux_frame_window_update, 0, 4, frame);
+  put_be32(frame + mux_frame_header_size, increment);
+  control_out_.append((char *)frame, sizeof(frame));
+  frames_sent_++;
+}
+
+// Called with mtx_ held.  Frees a stream both sides are done with.
+void certifier::framework::channel_mux::release_stream(int id) {
+  std::map<int, stream *>::iterator it = streams_.find(id);
+  if (it == streams_.end())
+    return;
+  stream *s = it->second;
+  if (s->local_closed_ && s->remote_closed_ && s->messages_.empty()
+      && !s->scheduled_ && !s->sending_) {
+    streams_.erase(it);
+    delete s;
+  }
+}
+
+// Called with mtx_ held.  Window updates go first, then one frame from
+// each stream with output in turn, so streams share the connection.
+bool certifier::framework::channel_mux::take_output(string *out) {
+  out->clear();
+  out->swap(control_out_);
+  while (!send_order_.empty() && out->size() < (size_t)mux_max_output) {
+    int id = send_order_.front();
+    send_order_.pop_front();
+    std::map<int, stream *>::iterator it = streams_.find(id);
+    if (it == streams_.end())
+      continue;
+    stream *s = it->second;
+    out->append(s->out_.front());
+    s->out_.pop_front();
+    frames_sent_++;
+    if (!s->out_.empty()) {
+      send_order_.push_back(id);
+    } else {
+      s->scheduled_ = false;
+      release_stream(id);
+    }
+  }
+  return !out->empty();
+}
+
+// Called with mtx_ held.  Returns false on a protocol error.
+bool certifier::framework::channel_mux::handle_frame(int         id,
+                                                     int         type,
+                                                     int         flags,
+                                                     int         size,
+                                                     const byte *b) {
+  frames_received_++;
+  std::map<int, stream *>::iterator it = streams_.find(id);
+  stream *s = (it == streams_.end()) ? nullptr : it->second;
+
+  if (type == mux_frame_window_update) {
+    if (size != 4)
+      return false;
+    if (s != nullptr)
+      s->send_window_ += get_be32(b);
+    return true;
+  }
+  if (type != mux_frame_data && type != mux_frame_fin)
     return false;
+
+  if (s == nullptr) {
+    // The peer opens its streams by sending on them.
+    bool peer_stream = ((id % 2) == 1) != initiator_;
+    if (!peer_stream || id <= last_peer_stream_)
+      return false;
+    if ((int)streams_.size() >= max_streams_) {
+      printf("%s() error, line %d, too many streams\n", __func__, __LINE__);
+      return false;
+    }
+    last_peer_stream_ = id;
+    s = new_stream(id);
+    accept_queue_.push_back(id);
   }
-  if (!SSL_CTX_use_PrivateKey(ssl_ctx_, auth_private_key)) {
-    printf("%s() error, line %d, use priv key failed\n", __func__, __LINE__);
+  if (s->remote_closed_)
     return false;
+  if (type == mux_frame_fin) {
+    s->remote_closed_ = true;
+    release_stream(id);
+    return true;
   }
 
-  if (!SSL_CTX_check_private_key(ssl_ctx_)) {
-    printf("%s() error, line %d, private key check failed\n",
+  if (size > s->recv_window_) {
+    printf("%s() error, line %d, stream %d exceeded its window\n",
            __func__,
-           __LINE__);
+           __LINE__,
+           id);
     return false;
   }
-
-#ifdef BORING_SSL
-  SSL_CTX_add1_chain_cert(ssl_ctx_, root_cert_);
-#else
-  if (SSL_CTX_use_cert_and_key(ssl_ctx_,
-                               x509_auth_key_cert,
-                               auth_private_key,
-                               stack,
-                               1)
-      <= 0) {
-    printf("%s() error, line %d, use_cert_and_key failed\n",
+  // Credit can come back before the message ends, so the window alone
+  // doesn't bound it.
+  if (s->partial_.size() + size > (size_t)max_message_size_) {
+    printf("%s() error, line %d, stream %d message too large\n",
            __func__,
-           __LINE__);
+           __LINE__,
+           id);
     return false;
   }
-
-  SSL_CTX_add1_to_CA_list(ssl_ctx_, root_cert_);
-
-#  ifdef DEBUG
-  const STACK_OF(X509_NAME) *ca_list = SSL_CTX_get0_CA_list(ssl_ctx_);
-  printf("CA names to offer\n");
-  if (ca_list != nullptr) {
-    for (int i = 0; i < sk_X509_NAME_num(ca_list); i++) {
-      X509_NAME *name = sk_X509_NAME_value(ca_list, i);
-      print_cn_name(name);
+  s->recv_window_ -= size;
+
+  // A reader that has taken every earlier message may be waiting for
+  // this one, so credit it at once.  Otherwise hold the credit until the
+  // reader catches up.
+  bool credit_now = s->messages_.empty();
+  s->partial_.append((char *)b, size);
+  if (flags & mux_flag_end_message) {
+    s->messages_.push_back(string());
+    s->messages_.back().swap(s->partial_);
+  }
+  if (credit_now) {
+    if (size > 0) {
+      s->recv_window_ += size;
+      queue_window_update(id, size);
     }
+  } else {
+    s->deferred_credit_ += size;
   }
-#  endif  // DEBUG
-#endif    // BORING_SSL
   return true;
 }
 
-void certifier::framework::secure_authenticated_channel::
-    server_channel_accept_and_auth(
-        void (*func)(secure_authenticated_channel &)) {
+void certifier::framework::channel_mux::io_loop() {
+  SSL *  ssl = channel_->ssl_;
+  int    sock = channel_->sock_;
+  string out;
+  size_t out_offset = 0;
+  string in;
+  byte   buf[16384];
+  bool   ok = true;
+
+  while (ok) {
+    bool want_write = false;
+
+    mtx_.lock();
+    if (stopping_) {
+      mtx_.unlock();
+      break;
+    }
+    if (out_offset == out.size()) {
+      out_offset = 0;
+      take_output(&out);
+    }
+    mtx_.unlock();
+
+    while (out_offset < out.size()) {
+      int n = SSL_write(ssl, out.data() + out_offset, out.size() - out_offset);
+      if (n <= 0) {
+        int err = SSL_get_error(ssl, n);
+        if (err == SSL_ERROR_WANT_WRITE)
+          want_write = true;
+        else if (err != SSL_ERROR_WANT_READ)
+          ok = false;
+        break;
+      }
+      out_offset += n;
+    }
+    if (!ok)
+      break;
 
-  // accept and carry out auth
-  int res = SSL_accept(ssl_);
-  if (res != 1) {
-    printf("%s() error, line %d, Can't SSL_accept connection"
-           ", res=%d\n",
-           __func__,
-           __LINE__,
-           res);
-    unsigned long code = ERR_get_error();
-    printf("Accept error: %s\n", ERR_lib_error_string(code));
-    print_ssl_error(SSL_get_error(ssl_, res));
-    if (ssl_ != nullptr) {
-      SSL_free(ssl_);
-      ssl_ = nullptr;
+    for (;;) {
+      int n = SSL_read(ssl, buf, sizeof(buf));
+      if (n > 0) {
+        in.append((char *)buf, n);
+        continue;
+      }
+      int err = SSL_get_error(ssl, n);
+      if (err == SSL_ERROR_WANT_WRITE)
+        want_write = true;
+      else if (err != SSL_ERROR_WANT_READ)
+        ok = false;  // Peer closed or protocol error.
+      break;
     }
-    return;
-  }
-  sock_ = SSL_get_fd(ssl_);
 
-#ifdef DEBUG
-  printf("Accepted ssl connection using %s \n", SSL_get_cipher(ssl_));
-#endif
+    size_t consumed = 0;
+    mtx_.lock();
+    while (ok && in.size() - consumed >= (size_t)mux_frame_header_size) {
+      const byte *h = (const byte *)in.data() + consumed;
+      uint32_t    size = get_be32(h + 8);
+      if (size > (uint32_t)mux_max_frame_payload) {
+        ok = false;
+        break;
+      }
+      if (in.size() - consumed - mux_frame_header_size < size)
+        break;
+      ok = handle_frame(get_be32(h),
+                        h[4],
+                        h[5],
+                        size,
+                        h + mux_frame_header_size);
+      consumed += mux_frame_header_size + size;
+    }
+    bool more_output = !control_out_.empty() || !send_order_.empty();
+    mtx_.unlock();
+    cv_.notify_all();
+    in.erase(0, consumed);
+    if (!ok)
+      break;
 
-  // Verify a client certificate was presented during the negotiation
-  peer_cert_ = SSL_get_peer_certificate(ssl_);
-  if (peer_cert_ != nullptr) {
-    if (!extract_id_from_cert(peer_cert_, &peer_id_)) {
-      printf("%s() error, line %d, Can't extract id\n", __func__, __LINE__);
+    // Go straight round if there is output and nothing in the way.
+    if (out_offset == out.size() && more_output)
+      continue;
+
+    struct pollfd pfd[2];
+    pfd[0].fd = sock;
+    pfd[0].events = POLLIN | (want_write ? POLLOUT : 0);
+    pfd[0].revents = 0;
+    pfd[1].fd = wake_fd_;
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+    if (poll(pfd, 2, -1) < 0 && errno != EINTR) {
+      ok = false;
+      break;
+    }
+    if (pfd[1].revents & POLLIN) {
+      uint64_t count;
+      if (::read(wake_fd_, &count, sizeof(count)) < 0) {
+        // Nothing to clear.
+      }
     }
   }
 
-#ifdef DEBUG
-  if (peer_cert_) {
-    printf("server_channel_accept_and_auth: Peer cert presented in nego\n");
-  } else {
-    printf("server_channel_accept_and_auth: No peer cert presented in nego\n");
-  }
-#endif
+  mtx_.lock();
+  if (!ok)
+    failed_ = true;
+  mtx_.unlock();
+  cv_.notify_all();
+}
 
-  channel_initialized_ = true;
-  func(*this);
-  return;
+int certifier::framework::channel_mux::open_stream() {
+  mtx_.lock();
+  if (failed_ || stopping_ || io_thread_ == nullptr
+      || (int)streams_.size() >= max_streams_) {
+    mtx_.unlock();
+    return -1;
+  }
+  int id = next_stream_;
+  next_stream_ += 2;
+  new_stream(id);
+  mtx_.unlock();
+  return id;
 }
 
-bool certifier::framework::secure_authenticated_channel::init_server_ssl(
-    const string &host_name,
-    int           port,
-    string &      asn1_root_cert,
-    key_message & private_key,
-    const string &auth_cert) {
-  SSL_load_error_strings();
+int certifier::framework::channel_mux::accept_stream() {
+  std::unique_lock<std::mutex> lk(mtx_);
+  while (accept_queue_.empty() && !failed_ && !stopping_)
+    cv_.wait(lk);
+  if (accept_queue_.empty())
+    return -1;
+  int id = accept_queue_.front();
+  accept_queue_.pop_front();
+  return id;
+}
 
-  // set keys and cert
-  private_key_.CopyFrom(private_key);
-  asn1_root_cert_.assign((char *)asn1_root_cert.data(), asn1_root_cert.size());
-  root_cert_ = X509_new();
-  if (!asn1_to_x509(asn1_root_cert, root_cert_)) {
-    printf("%s() error, line %d, Can't translate der to X509\n",
-           __func__,
-           __LINE__);
+bool certifier::framework::channel_mux::send(int stream_id, int size, byte *b) {
+  if (size < 0 || size > max_message_size_)
     return false;
+
+  std::unique_lock<std::mutex> lk(mtx_);
+  stream *                     s = nullptr;
+  // One message at a time on a stream, so its frames stay in order.
+  for (;;) {
+    std::map<int, stream *>::iterator it = streams_.find(stream_id);
+    if (failed_ || stopping_ || it == streams_.end()
+        || it->second->local_closed_)
+      return false;
+    s = it->second;
+    if (!s->sending_)
+      break;
+    cv_.wait(lk);
+  }
+  s->sending_ = true;
+
+  bool ret = true;
+  int  done = 0;
+  for (;;) {
+    int left = size - done;
+    if (left > 0 && s->send_window_ <= 0) {
+      wake();
+      cv_.wait(lk);
+      if (failed_ || stopping_) {
+        ret = false;
+        break;
+      }
+      continue;
+    }
+    int n = left;
+    if (n > mux_max_frame_payload)
+      n = mux_max_frame_payload;
+    if (n > s->send_window_)
+      n = (int)s->send_window_;
+    s->send_window_ -= n;
+    queue_frame(s,
+                mux_frame_data,
+                (done + n == size) ? mux_flag_end_message : 0,
+                n,
+                b + done);
+    done += n;
+    if (done == size)
+      break;
   }
+  s->sending_ = false;
+  lk.unlock();
+  cv_.notify_all();
+  wake();
+  return ret;
+}
+
+bool certifier::framework::channel_mux::receive(int stream_id, string *out) {
+  std::unique_lock<std::mutex> lk(mtx_);
+  stream *                     s = nullptr;
+  for (;;) {
+    std::map<int, stream *>::iterator it = streams_.find(stream_id);
+    if (it == streams_.end())
+      return false;
+    s = it->second;
+    if (!s->messages_.empty())
+      break;
+    if (s->remote_closed_ || failed_ || stopping_)
+      return false;
+    cv_.wait(lk);
+  }
+  out->swap(s->messages_.front());
+  s->messages_.pop_front();
+  bool credit = s->deferred_credit_ > 0;
+  if (credit) {
+    s->recv_window_ += s->deferred_credit_;
+    queue_window_update(stream_id, (uint32_t)s->deferred_credit_);
+    s->deferred_credit_ = 0;
+  }
+  release_stream(stream_id);
+  lk.unlock();
+  if (credit)
+    wake();
   return true;
 }
 
-int certifier::framework::secure_authenticated_channel::read(int   size,
-                                                             byte *b) {
-  return SSL_read(ssl_, b, size);
+void certifier::framework::channel_mux::close_stream(int stream_id) {
+  mtx_.lock();
+  std::map<int, stream *>::iterator it = streams_.find(stream_id);
+  if (it == streams_.end() || it->second->local_closed_) {
+    mtx_.unlock();
+    return;
+  }
+  stream *s = it->second;
+  s->local_closed_ = true;
+  queue_frame(s, mux_frame_fin, 0, 0, nullptr);
+  mtx_.unlock();
+  wake();
 }
 
-int certifier::framework::secure_authenticated_channel::read(string *out) {
-  return sized_ssl_read(ssl_, out);
+bool certifier::framework::channel_mux::failed() {
+  mtx_.lock();
+  bool ret = failed_;
+  mtx_.unlock();
+  return ret;
 }
 
-int certifier::framework::secure_authenticated_channel::write(int   size,
-                                                              byte *b) {
-  return sized_ssl_write(ssl_, size, b);
+int certifier::framework::channel_mux::num_streams() {
+  mtx_.lock();
+  int n = streams_.size();
+  mtx_.unlock();
+  return n;
 }
 
-void certifier::framework::secure_authenticated_channel::close() {
-  ::close(sock_);
-  if (ssl_ != nullptr) {
-    SSL_free(ssl_);
-    ssl_ = nullptr;
-  }
+uint64_t certifier::framework::channel_mux::frames_sent() {
+  mtx_.lock();
+  uint64_t n = frames_sent_;
+  mtx_.unlock();
+  return n;
 }
 
-bool certifier::framework::secure_authenticated_channel::get_peer_id(
-    string *out_peer_id) {
-  out_peer_id->assign((char *)peer_id_.data(), peer_id_.size());
-  return true;
+uint64_t certifier::framework::channel_mux::frames_received() {
+  mtx_.lock();
+  uint64_t n = frames_received_;
+  mtx_.unlock();
+  return n;
 }
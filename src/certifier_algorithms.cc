@@ -26,6 +26,7 @@ const char * Enc_method_aes_256_cbc               = "aes-256-cbc";
 const char * Enc_method_aes_256_cbc_hmac_sha256   = "aes-256-cbc-hmac-sha256";
 const char * Enc_method_aes_256_cbc_hmac_sha384   = "aes-256-cbc-hmac-sha384";
 const char * Enc_method_aes_256_gcm               = "aes-256-gcm";
+const char * Enc_method_ecc_256                   = "ecc-256";
 const char * Enc_method_ecc_256_private           = "ecc-256-private";
 const char * Enc_method_ecc_256_public            = "ecc-256-public";
 const char * Enc_method_ecc_256_sha256_pkcs_sign  = "ecc-256-sha256-pkcs-sign";
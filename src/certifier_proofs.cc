@@ -18,6 +18,12 @@
 #include "simulated_enclave.h"
 #include "application_enclave.h"
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <netdb.h>
 #ifdef SEV_SNP
 #  include "attestation.h"
@@ -35,9 +41,13 @@ using namespace certifier::utilities;
 predicate_dominance::predicate_dominance() {
   first_child_ = nullptr;
   next_ = nullptr;
+  num_ids_ = 0;
+  words_per_row_ = 0;
+  closure_ = nullptr;
 }
 
 predicate_dominance::~predicate_dominance() {
+  clear_compiled();
   predicate_dominance *current = first_child_;
   while (current != nullptr) {
     predicate_dominance *temp = current;
@@ -58,9 +68,8 @@ predicate_dominance *predicate_dominance::find_node(const string &pred) {
 
   // breadth first search
   while (current != nullptr) {
-    t = find_node(pred);
-    if (t != nullptr)
-      return t;
+    if (current->predicate_ == pred)
+      return current;
     current = current->next_;
   }
 
@@ -91,6 +100,7 @@ bool predicate_dominance::insert(const string &parent,
 
   to_add->next_ = t->first_child_;
   t->first_child_ = to_add;
+  clear_compiled();
   return true;
 }
 
@@ -135,11 +145,85 @@ void predicate_dominance::print_descendants(int indent) {
   }
 }
 
+static void intern_predicates(predicate_dominance *node,
+                              std::unordered_map<string, int> *ids) {
+  if (ids->find(node->predicate_) == ids->end()) {
+    int id = (int)ids->size();
+    (*ids)[node->predicate_] = id;
+  }
+  for (predicate_dominance *c = node->first_child_; c != nullptr; c = c->next_)
+    intern_predicates(c, ids);
+}
+
+// Sets the bits of node's descendants in row.
+static void set_descendants(predicate_dominance *                  node,
+                            const std::unordered_map<string, int> &ids,
+                            uint64_t *                             row) {
+  for (predicate_dominance *c = node->first_child_; c != nullptr;
+       c = c->next_) {
+    int id = ids.find(c->predicate_)->second;
+    row[id / 64] |= (uint64_t)1 << (id % 64);
+    set_descendants(c, ids, row);
+  }
+}
+
+static void fill_closure(predicate_dominance *                  node,
+                         const std::unordered_map<string, int> &ids,
+                         int                                    words_per_row,
+                         uint64_t *                             closure) {
+  int       id = ids.find(node->predicate_)->second;
+  uint64_t *row = &closure[id * words_per_row];
+  row[id / 64] |= (uint64_t)1 << (id % 64);
+  set_descendants(node, ids, row);
+  for (predicate_dominance *c = node->first_child_; c != nullptr; c = c->next_)
+    fill_closure(c, ids, words_per_row, closure);
+}
+
+bool predicate_dominance::compile() {
+  clear_compiled();
+  intern_predicates(this, &ids_);
+  num_ids_ = (int)ids_.size();
+  words_per_row_ = (num_ids_ + 63) / 64;
+  closure_ = new uint64_t[num_ids_ * words_per_row_];
+  memset(closure_, 0, num_ids_ * words_per_row_ * sizeof(uint64_t));
+  fill_closure(this, ids_, words_per_row_, closure_);
+  return true;
+}
+
+void predicate_dominance::clear_compiled() {
+  if (closure_ != nullptr)
+    delete[] closure_;
+  closure_ = nullptr;
+  ids_.clear();
+  num_ids_ = 0;
+  words_per_row_ = 0;
+}
+
+int predicate_dominance::predicate_id(const string &pred) const {
+  auto it = ids_.find(pred);
+  if (it == ids_.end())
+    return -1;
+  return it->second;
+}
+
+bool predicate_dominance::dominates_id(int parent, int descendant) const {
+  if (closure_ == nullptr || parent < 0 || parent >= num_ids_
+      || descendant < 0 || descendant >= num_ids_)
+    return false;
+  return (closure_[parent * words_per_row_ + descendant / 64]
+          >> (descendant % 64))
+         & 1;
+}
+
 bool dominates(predicate_dominance &root,
                const string &       parent,
                const string &       descendant) {
   if (parent == descendant)
     return true;
+  if (root.closure_ != nullptr) {
+    return root.dominates_id(root.predicate_id(parent),
+                             root.predicate_id(descendant));
+  }
   predicate_dominance *pn = root.find_node(parent);
   if (pn == nullptr)
     return false;
@@ -159,6 +243,67 @@ bool statement_already_proved(const vse_clause & cl,
   return false;
 }
 
+proved_index::proved_index(proved_statements *are_proved)
+    : are_proved_(are_proved),
+      num_indexed_(0) {
+  sync();
+}
+
+void proved_index::sync() {
+  for (; num_indexed_ < are_proved_->proved_size(); num_indexed_++) {
+    string fp;
+    if (vse_clause_fingerprint(are_proved_->proved(num_indexed_), &fp))
+      fingerprints_.insert(fp);
+  }
+}
+
+void proved_index::add(const vse_clause &cl) {
+  sync();
+  are_proved_->add_proved()->CopyFrom(cl);
+  sync();
+}
+
+// A fingerprint hit is a match.  same_vse_claim is a little looser for
+// platforms, so a miss still falls back to the scan.
+bool proved_index::contains(const vse_clause &cl) {
+  sync();
+  string fp;
+  if (vse_clause_fingerprint(cl, &fp)
+      && fingerprints_.find(fp) != fingerprints_.end())
+    return true;
+  return statement_already_proved(cl, are_proved_);
+}
+
+bool statement_already_proved(const vse_clause &cl, proved_index &index) {
+  return index.contains(cl);
+}
+
+// The vse_clause a parsed claim carries.
+static bool clause_from_claim(const claim_message &claim, vse_clause *cl) {
+  if (!claim.has_claim_format()) {
+    printf("%s() error, line %d, clause_from_claim: no claim format\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (claim.claim_format() != "vse-clause") {
+    printf("%s() error, line %d, clause_from_claim: only vse format "
+           "supported\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (!cl->ParseFromString(claim.serialized_claim())) {
+    printf("%s() error, line %d, clause_from_claim: can't deserialize vse\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return true;
+}
+
+// The claim_message and clause are parsed once, while checking the
+// signature, and kept with the result in claim_cache().
 bool verify_signed_assertion_and_extract_clause(const key_message &         key,
                                                 const signed_claim_message &sc,
                                                 vse_clause *cl) {
@@ -168,52 +313,32 @@ bool verify_signed_assertion_and_extract_clause(const key_message &         key,
     return false;
   }
 
-  // Deserialize claim to get clause
-  string        serialized_claim_string;
   claim_message asserted_claim;
-  serialized_claim_string.assign((char *)sc.serialized_claim_message().data(),
-                                 (int)sc.serialized_claim_message().size());
-  if (!asserted_claim.ParseFromString(serialized_claim_string)) {
-    printf("%s() error, line %d, verify_signed_assertion_and_extract_clause: "
-           "can't deserialize\n",
-           __func__,
-           __LINE__);
-    return false;
-  }
+  return claim_cache().verify(sc, key, &asserted_claim, cl);
+}
 
-  if (!asserted_claim.has_claim_format()) {
-    printf("%s() error, line %d, verify_signed_assertion_and_extract_clause: "
-           "no claim format\n",
+// tcl comes from a claim whose signature k has already checked.
+static bool add_fact_from_verified_clause(const key_message &k,
+                                          const vse_clause & tcl,
+                                          proved_statements *already_proved) {
+  if (tcl.verb() != "says" || tcl.subject().entity_type() != "key") {
+    printf("%s() error, line %d, Add_fact_from_signed_claim: bad subject or "
+           "verb\n",
            __func__,
            __LINE__);
+    print_vse_clause(tcl);
+    printf("\n");
     return false;
   }
-
-  if (asserted_claim.claim_format() == "vse-clause") {
-
-    string     serialized_vse_string;
-    vse_clause asserted_vse;
-    serialized_vse_string.assign(
-        (char *)asserted_claim.serialized_claim().data(),
-        (int)asserted_claim.serialized_claim().size());
-    if (!asserted_vse.ParseFromString(serialized_vse_string)) {
-      printf("%s() error, line %d, verify_signed_assertion_and_extract_clause: "
-             "can't deserialize vse\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    cl->CopyFrom(asserted_vse);
-  } else {
-    printf("%s() error, line %d, verify_signed_assertion_and_extract_clause: "
-           "only vse format supported\n",
+  if (!same_key(k, tcl.subject().key())) {
+    printf("%s() error, line %d, Add_fact_from_signed_claim: Different key\n",
            __func__,
            __LINE__);
     return false;
   }
-
-  // verify signature
-  return verify_signed_claim(sc, key);
+  vse_clause *c = already_proved->add_proved();
+  c->CopyFrom(tcl);
+  return true;
 }
 
 bool add_fact_from_signed_claim(const signed_claim_message &signed_claim,
@@ -221,36 +346,15 @@ bool add_fact_from_signed_claim(const signed_claim_message &signed_claim,
 
   const key_message &k = signed_claim.signing_key();
   vse_clause         tcl;
-  if (verify_signed_assertion_and_extract_clause(k, signed_claim, &tcl)) {
-    if (tcl.verb() != "says" || tcl.subject().entity_type() != "key") {
-      printf("%s() error, line %d, Add_fact_from_signed_claim: bad subject or "
-             "verb\n",
-             __func__,
-             __LINE__);
-      print_vse_clause(tcl);
-      printf("\n");
-      return false;
-    }
-    if (!same_key(k, tcl.subject().key())) {
-      printf("%s() error, line %d, Add_fact_from_signed_claim: Different key\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    vse_clause *c = already_proved->add_proved();
-    c->CopyFrom(tcl);
-    return true;
-  }
-  return false;
+  if (!verify_signed_assertion_and_extract_clause(k, signed_claim, &tcl))
+    return false;
+  return add_fact_from_verified_clause(k, tcl, already_proved);
 }
 
 bool get_vse_clause_from_signed_claim(const signed_claim_message &scm,
                                       vse_clause *                c) {
-  string serialized_cl;
-  serialized_cl.assign((char *)scm.serialized_claim_message().data(),
-                       scm.serialized_claim_message().size());
   claim_message cm;
-  if (!cm.ParseFromString(serialized_cl)) {
+  if (!cm.ParseFromString(scm.serialized_claim_message())) {
     printf("%s() error, line %d, get_vse_clause_from_signed_claim: can't parse "
            "claim\n",
            __func__,
@@ -264,12 +368,7 @@ bool get_vse_clause_from_signed_claim(const signed_claim_message &scm,
            __LINE__);
     return false;
   }
-
-  string vse_cl_str;
-  vse_cl_str.assign((char *)cm.serialized_claim().data(),
-                    cm.serialized_claim().size());
-  vse_clause vse;
-  if (!c->ParseFromString(vse_cl_str)) {
+  if (!c->ParseFromString(cm.serialized_claim())) {
     printf("%s() error, line %d, get_vse_clause_from_signed_claim: can't parse "
            "vse clause\n",
            __func__,
@@ -359,6 +458,114 @@ bool get_signed_platform_claim_from_trusted_list(
   return false;
 }
 
+trusted_policy_index::trusted_policy_index() {}
+
+// "policy-key says measurement is-trusted"
+static const entity_message *trusted_measurement_subject(const vse_clause &c) {
+  if (c.verb() != "says" || !c.has_clause())
+    return nullptr;
+  if (c.clause().verb() != "is-trusted" || !c.clause().has_subject())
+    return nullptr;
+  if (c.clause().subject().entity_type() != "measurement")
+    return nullptr;
+  return &c.clause().subject();
+}
+
+// "policy-key says platform-key is-trusted-for-attestation"
+static const entity_message *trusted_platform_subject(const vse_clause &c) {
+  if (c.verb() != "says" || !c.has_clause() || !c.clause().has_verb())
+    return nullptr;
+  if ((c.clause().verb() != "is-trusted"
+       && c.clause().verb() != "is-trusted-for-attestation")
+      || !c.clause().has_subject())
+    return nullptr;
+  if (c.clause().subject().entity_type() != "key")
+    return nullptr;
+  return &c.clause().subject();
+}
+
+bool trusted_policy_index::build(
+    const signed_claim_sequence &trusted_platforms,
+    const signed_claim_sequence &trusted_measurements) {
+  measurements_.clear();
+  platforms_.clear();
+
+  for (int i = 0; i < trusted_measurements.claims_size(); i++) {
+    vse_clause c;
+    if (!get_vse_clause_from_signed_claim(trusted_measurements.claims(i), &c))
+      continue;
+    const entity_message *m = trusted_measurement_subject(c);
+    if (m == nullptr)
+      continue;
+    // insert keeps the first claim for a measurement, as the scan did
+    measurements_.insert(
+        std::make_pair(m->measurement(), &trusted_measurements.claims(i)));
+  }
+
+  for (int i = 0; i < trusted_platforms.claims_size(); i++) {
+    vse_clause c;
+    if (!get_vse_clause_from_signed_claim(trusted_platforms.claims(i), &c))
+      continue;
+    const entity_message *k = trusted_platform_subject(c);
+    if (k == nullptr)
+      continue;
+    string fp;
+    if (!key_fingerprint(k->key(), &fp))
+      continue;
+    platforms_.insert(std::make_pair(fp, &trusted_platforms.claims(i)));
+  }
+  return true;
+}
+
+const signed_claim_message *trusted_policy_index::find_measurement(
+    const string &m) const {
+  auto it = measurements_.find(m);
+  if (it == measurements_.end())
+    return nullptr;
+  return it->second;
+}
+
+const signed_claim_message *trusted_policy_index::find_platform(
+    const key_message &k) const {
+  string fp;
+  if (!key_fingerprint(k, &fp))
+    return nullptr;
+  auto it = platforms_.find(fp);
+  if (it == platforms_.end())
+    return nullptr;
+  return it->second;
+}
+
+int trusted_policy_index::num_measurements() const {
+  return (int)measurements_.size();
+}
+
+int trusted_policy_index::num_platforms() const {
+  return (int)platforms_.size();
+}
+
+bool get_signed_measurement_claim_from_trusted_list(
+    const string &              expected_measurement,
+    const trusted_policy_index &index,
+    signed_claim_message *      claim) {
+  const signed_claim_message *sc = index.find_measurement(expected_measurement);
+  if (sc == nullptr)
+    return false;
+  claim->CopyFrom(*sc);
+  return true;
+}
+
+bool get_signed_platform_claim_from_trusted_list(
+    const key_message &         expected_key,
+    const trusted_policy_index &index,
+    signed_claim_message *      claim) {
+  const signed_claim_message *sc = index.find_platform(expected_key);
+  if (sc == nullptr)
+    return false;
+  claim->CopyFrom(*sc);
+  return true;
+}
+
 // Statement construction support
 // -------------------------------------------------------------------------
 
@@ -501,8 +708,8 @@ bool sign_report(const string &     type,
              __LINE__);
       return false;
     }
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signing_key, rsa_key)) {
+    RSA *rsa_key = cached_rsa_from_key(signing_key);
+    if (rsa_key == nullptr) {
       printf("%s() error, line %d, sign_report: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -528,8 +735,8 @@ bool sign_report(const string &     type,
              __LINE__);
       return false;
     }
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signing_key, rsa_key)) {
+    RSA *rsa_key = cached_rsa_from_key(signing_key);
+    if (rsa_key == nullptr) {
       printf("%s() error, line %d, sign_report: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -555,8 +762,8 @@ bool sign_report(const string &     type,
              __LINE__);
       return false;
     }
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signing_key, rsa_key)) {
+    RSA *rsa_key = cached_rsa_from_key(signing_key);
+    if (rsa_key == nullptr) {
       printf("%s() error, line %d, sign_report: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -582,7 +789,7 @@ bool sign_report(const string &     type,
              __LINE__);
       return false;
     }
-    EC_KEY *ecc_key = key_to_ECC(signing_key);
+    EC_KEY *ecc_key = cached_ecc_from_key(signing_key);
     if (ecc_key == nullptr) {
       printf("%s() error, line %d, sign_report: key_to_ECC failed\n",
              __func__,
@@ -643,8 +850,8 @@ bool verify_report(string &           type,
 
   bool success = false;
   if (sr.signing_algorithm() == Enc_method_rsa_2048_sha256_pkcs_sign) {
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signer_key, rsa_key)) {
+    RSA *rsa_key = cached_rsa_from_key(signer_key);
+    if (rsa_key == nullptr) {
       printf("%s() error, line %d, verify_report: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -659,8 +866,8 @@ bool verify_report(string &           type,
                          (byte *)sr.signature().data());
     RSA_free(rsa_key);
   } else if (sr.signing_algorithm() == Enc_method_rsa_4096_sha384_pkcs_sign) {
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signer_key, rsa_key)) {
+    RSA *rsa_key = cached_rsa_from_key(signer_key);
+    if (rsa_key == nullptr) {
       printf("%s() error, line %d, verify_report: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -675,8 +882,8 @@ bool verify_report(string &           type,
                          (byte *)sr.signature().data());
     RSA_free(rsa_key);
   } else if (sr.signing_algorithm() == Enc_method_rsa_3072_sha384_pkcs_sign) {
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signer_key, rsa_key)) {
+    RSA *rsa_key = cached_rsa_from_key(signer_key);
+    if (rsa_key == nullptr) {
       printf("%s() error, line %d, verify_report: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -691,7 +898,7 @@ bool verify_report(string &           type,
                          (byte *)sr.signature().data());
     RSA_free(rsa_key);
   } else if (sr.signing_algorithm() == Enc_method_ecc_384_sha384_pkcs_sign) {
-    EC_KEY *ecc_key = key_to_ECC(signer_key);
+    EC_KEY *ecc_key = cached_ecc_from_key(signer_key);
     if (ecc_key == nullptr) {
       printf("%s() error, line %d, verify_report: key_to_RSA failed\n",
              __func__,
@@ -800,6 +1007,12 @@ bool init_dominance_tree(predicate_dominance &root) {
   return true;
 }
 
+predicate_dominance *default_dominance_tree() {
+  static predicate_dominance root;
+  static bool                ok = init_dominance_tree(root) && root.compile();
+  return ok ? &root : nullptr;
+}
+
 #ifdef SEV_SNP
 // policy
 //    byte 0
@@ -1103,31 +1316,27 @@ const int max_key_depth = 30;
 const int max_measurement_size = 512;
 const int max_user_data_size = 4096;
 
-bool init_proved_statements(key_message &      pk,
-                            evidence_package & evp,
-                            proved_statements *already_proved) {
+// The signed claims in evp, in order, are signed_claims; verified[j] says
+// whether signed_claims[j]'s signature checked out and claims[j] is its
+// parsed claim.
+static bool add_proved_statements(key_message &               pk,
+                                  evidence_package &          evp,
+                                  const signed_claim_message *signed_claims,
+                                  const bool *                verified,
+                                  const claim_message *       claims,
+                                  proved_statements *         already_proved) {
 
   cert_keys_seen_list seen_keys_list(max_key_depth);
-  // verify already signed assertions, converting to vse_clause
+  // convert already verified signed assertions to vse_clause
   int nsa = evp.fact_assertion_size();
+  int j = 0;
   for (int i = 0; i < nsa; i++) {
     if (evp.fact_assertion(i).evidence_type() == "signed-claim") {
-      signed_claim_message sc;
-      string               t_str;
-      t_str.assign((char *)evp.fact_assertion(i).serialized_evidence().data(),
-                   evp.fact_assertion(i).serialized_evidence().size());
-      if (!sc.ParseFromString(t_str)) {
-        printf("%s() error, line %d, init_proved_statements: Can't parse "
-               "serialized evidence\n",
-               __func__,
-               __LINE__);
-        return false;
-      }
+      const signed_claim_message &sc = signed_claims[j];
+      vse_clause                  to_add;
+      const key_message &         km = sc.signing_key();
 
-      vse_clause         to_add;
-      const key_message &km = sc.signing_key();
-
-      if (!verify_signed_assertion_and_extract_clause(km, sc, &to_add)) {
+      if (!verified[j] || !clause_from_claim(claims[j], &to_add)) {
         printf("%s() error, line %d, init_proved_statements: signed claim %d "
                "failed\n",
                __func__,
@@ -1162,6 +1371,7 @@ bool init_proved_statements(key_message &      pk,
       }
       vse_clause *cl_to_insert = already_proved->add_proved();
       cl_to_insert->CopyFrom(to_add);
+      j++;
 #ifdef OE_CERTIFIER
     } else if (evp.fact_assertion(i).evidence_type()
                == "oe-attestation-report") {
@@ -1395,7 +1605,7 @@ bool init_proved_statements(key_message &      pk,
         printf("init_proved_statements: Can't find issuer key\n");
         return false;
       }
-      EVP_PKEY *signer_pkey = pkey_from_key(*signer_key);
+      EVP_PKEY *signer_pkey = cached_pkey_from_key(*signer_key);
       if (signer_pkey == nullptr) {
         printf("init_proved_statements: Can't get pkey\n");
         return false;
@@ -1410,6 +1620,8 @@ bool init_proved_statements(key_message &      pk,
                                                  cl)) {
           printf("init_proved_statements: Can't construct vse attestation from "
                  "cert\n");
+          EVP_PKEY_free(signer_pkey);
+          X509_free(x);
           return false;
         }
       }
@@ -1458,7 +1670,7 @@ bool init_proved_statements(key_message &      pk,
       const key_message &vcek_key = last_clause.clause().subject().key();
 
 #  ifndef SEV_DUMMY_GUEST
-      EVP_PKEY *verify_pkey = pkey_from_key(vcek_key);
+      EVP_PKEY *verify_pkey = cached_pkey_from_key(vcek_key);
       if (verify_pkey == nullptr) {
         printf("init_proved_statements: empty dummy verify key\n");
         return false;
@@ -1534,7 +1746,7 @@ bool init_proved_statements(key_message &      pk,
       }
       const key_message &vcek_key = last_clause.clause().subject().key();
 
-      EVP_PKEY *verify_pkey = pkey_from_key(vcek_key);
+      EVP_PKEY *verify_pkey = cached_pkey_from_key(vcek_key);
       if (verify_pkey == nullptr) {
         printf("init_proved_statements: empty verify key\n");
         return false;
@@ -1659,6 +1871,51 @@ bool init_proved_statements(key_message &      pk,
   return true;
 }
 
+bool init_proved_statements(key_message &      pk,
+                            evidence_package & evp,
+                            proved_statements *already_proved) {
+
+  // Check all the signed claims' signatures first, in parallel, keeping
+  // the claims parsed along the way.
+  int                          nsa = evp.fact_assertion_size();
+  signed_claim_message *       signed_claims = new signed_claim_message[nsa];
+  const signed_claim_message **to_verify =
+      new const signed_claim_message *[nsa];
+  claim_message *claims = new claim_message[nsa];
+  bool *         verified = new bool[nsa];
+  int            num_signed = 0;
+  bool           ret = false;
+  for (int i = 0; i < nsa; i++) {
+    if (evp.fact_assertion(i).evidence_type() != "signed-claim")
+      continue;
+    if (!signed_claims[num_signed].ParseFromString(
+            evp.fact_assertion(i).serialized_evidence())) {
+      printf("%s() error, line %d, init_proved_statements: Can't parse "
+             "serialized evidence\n",
+             __func__,
+             __LINE__);
+      goto done;
+    }
+    to_verify[num_signed] = &signed_claims[num_signed];
+    num_signed++;
+  }
+  verify_signed_claims(num_signed, to_verify, nullptr, 0, verified, claims);
+
+  ret = add_proved_statements(pk,
+                              evp,
+                              signed_claims,
+                              verified,
+                              claims,
+                              already_proved);
+
+done:
+  delete[] signed_claims;
+  delete[] to_verify;
+  delete[] claims;
+  delete[] verified;
+  return ret;
+}
+
 // R1: If measurement or environment is-trusted and key1 speaks-for measurement
 // or environment then
 //    key1 is-trusted-for-authentication.
@@ -2026,12 +2283,14 @@ bool verify_proof(key_message &        policy_pk,
                   proved_statements *  are_proved) {
 
   // verify proof
+  proved_index index(are_proved);
   for (int i = 0; i < the_proof->steps_size(); i++) {
     bool success;
-    if (!statement_already_proved(the_proof->steps(i).s1(), are_proved))
-
-      if (!statement_already_proved(the_proof->steps(i).s2(), are_proved))
-        return false;
+    if (!statement_already_proved(the_proof->steps(i).s1(), index)
+        || !statement_already_proved(the_proof->steps(i).s2(), index)) {
+      printf("verify_proof: premise of step %d not already proved\n", i);
+      return false;
+    }
     success = verify_internal_proof_step(dom_tree,
                                          the_proof->steps(i).s1(),
                                          the_proof->steps(i).s2(),
@@ -2045,8 +2304,7 @@ bool verify_proof(key_message &        policy_pk,
       printf("\n");
       return false;
     }
-    vse_clause *to_add = are_proved->add_proved();
-    to_add->CopyFrom(the_proof->steps(i).conclusion());
+    index.add(the_proof->steps(i).conclusion());
   }
 
   int n = are_proved->proved_size();
@@ -2069,6 +2327,14 @@ bool add_newfacts_for_sev_attestation(
     signed_claim_sequence &trusted_platforms,
     signed_claim_sequence &trusted_measurements,
     proved_statements *    already_proved) {
+  trusted_policy_index index;
+  if (!index.build(trusted_platforms, trusted_measurements))
+    return false;
+  return add_newfacts_for_sev_attestation(index, already_proved);
+}
+
+bool add_newfacts_for_sev_attestation(const trusted_policy_index &index,
+                                      proved_statements *already_proved) {
 
   // At this point, the already_proved should be
   //    "policyKey is-trusted"
@@ -2091,7 +2357,7 @@ bool add_newfacts_for_sev_attestation(
   }
   const key_message &expected_key = already_proved->proved(1).subject().key();
   if (!get_signed_platform_claim_from_trusted_list(expected_key,
-                                                   trusted_platforms,
+                                                   index,
                                                    &sc1)) {
     printf("add_newfacts_for_sev_attestation: error 3\n");
     return false;
@@ -2116,7 +2382,7 @@ bool add_newfacts_for_sev_attestation(
 
   signed_claim_message sc2;
   if (!get_signed_measurement_claim_from_trusted_list(expected_measurement,
-                                                      trusted_measurements,
+                                                      index,
                                                       &sc2)) {
     printf("add_newfacts_for_sev_attestation: error 7\n");
     return false;
@@ -2134,6 +2400,15 @@ bool add_newfacts_for_sdk_platform_attestation(
     signed_claim_sequence &trusted_platforms,
     signed_claim_sequence &trusted_measurements,
     proved_statements *    already_proved) {
+  trusted_policy_index index;
+  if (!index.build(trusted_platforms, trusted_measurements))
+    return false;
+  return add_newfacts_for_sdk_platform_attestation(index, already_proved);
+}
+
+bool add_newfacts_for_sdk_platform_attestation(
+    const trusted_policy_index &index,
+    proved_statements *         already_proved) {
   // At this point, the already_proved should be
   //      "policyKey is-trusted"
   //      "platformKey says attestationKey is-trusted
@@ -2159,7 +2434,7 @@ bool add_newfacts_for_sdk_platform_attestation(
 
   signed_claim_message sc;
   if (!get_signed_measurement_claim_from_trusted_list(expected_measurement,
-                                                      trusted_measurements,
+                                                      index,
                                                       &sc)) {
     printf("Add_newfacts_for_sdk_platform__attestation: Can't sign measurement "
            "\n");
@@ -2179,6 +2454,16 @@ bool add_new_facts_for_abbreviatedplatformattestation(
     signed_claim_sequence &trusted_platforms,
     signed_claim_sequence &trusted_measurements,
     proved_statements *    already_proved) {
+  trusted_policy_index index;
+  if (!index.build(trusted_platforms, trusted_measurements))
+    return false;
+  return add_new_facts_for_abbreviatedplatformattestation(index,
+                                                          already_proved);
+}
+
+bool add_new_facts_for_abbreviatedplatformattestation(
+    const trusted_policy_index &index,
+    proved_statements *         already_proved) {
 
   // At this point, the already_proved should be
   //    "policyKey is-trusted"
@@ -2201,7 +2486,7 @@ bool add_new_facts_for_abbreviatedplatformattestation(
                               m_ent.measurement().size());
   signed_claim_message sc;
   if (!get_signed_measurement_claim_from_trusted_list(expected_measurement,
-                                                      trusted_measurements,
+                                                      index,
                                                       &sc)) {
     return false;
   }
@@ -2218,7 +2503,7 @@ bool add_new_facts_for_abbreviatedplatformattestation(
   }
   const key_message &expected_key = already_proved->proved(1).subject().key();
   if (!get_signed_platform_claim_from_trusted_list(expected_key,
-                                                   trusted_platforms,
+                                                   index,
                                                    &sc)) {
     return false;
   }
@@ -2590,23 +2875,28 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
                                   proved_statements *    already_proved,
                                   vse_clause *           to_prove,
                                   proof *                pf) {
+  trusted_policy_index index;
+  if (!index.build(trusted_platforms, trusted_measurements))
+    return false;
+  return construct_proof_from_request(evidence_descriptor,
+                                      policy_pk,
+                                      purpose,
+                                      index,
+                                      evp,
+                                      already_proved,
+                                      to_prove,
+                                      pf);
+}
 
-  if (!init_proved_statements(policy_pk, evp, already_proved)) {
-    printf("%s() error, line %d, init_proved_statements returned false\n",
-           __func__,
-           __LINE__);
-    return false;
-  }
-
-#ifdef PRINT_ALREADY_PROVED
-  printf("construct proof from request, initial proved statements:\n");
-  for (int i = 0; i < already_proved->proved_size(); i++) {
-    print_vse_clause(already_proved->proved(i));
-    printf("\n");
-  }
-  printf("\n");
-#endif
-
+// The proof, once the evidence is in already_proved
+static bool construct_proof_from_proved(
+    const string &              evidence_descriptor,
+    key_message &               policy_pk,
+    const string &              purpose,
+    const trusted_policy_index &index,
+    proved_statements *         already_proved,
+    vse_clause *                to_prove,
+    proof *                     pf) {
   if (evidence_descriptor == "full-vse-support") {
     if (!construct_proof_from_full_vse_evidence(policy_pk,
                                                 purpose,
@@ -2616,9 +2906,7 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
       return false;
     }
   } else if (evidence_descriptor == "platform-attestation-only") {
-    if (!add_new_facts_for_abbreviatedplatformattestation(policy_pk,
-                                                          trusted_platforms,
-                                                          trusted_measurements,
+    if (!add_new_facts_for_abbreviatedplatformattestation(index,
                                                           already_proved)) {
       printf("add_new_facts_for_abbreviatedplatformattestation failed\n");
       return false;
@@ -2635,16 +2923,7 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
       return false;
     }
   } else if (evidence_descriptor == "sev-evidence") {
-    string serialized_ark_cert;
-    string serialized_ask_cert;
-    string serialized_vcek_cert;
-    if (!add_newfacts_for_sev_attestation(policy_pk,
-                                          serialized_ark_cert,
-                                          serialized_ask_cert,
-                                          serialized_vcek_cert,
-                                          trusted_platforms,
-                                          trusted_measurements,
-                                          already_proved)) {
+    if (!add_newfacts_for_sev_attestation(index, already_proved)) {
       printf("construct_proof_from_sev_evidence failed in "
              "add_newfacts_for_sev_attestation\n");
       return false;
@@ -2656,10 +2935,7 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
                                            pf))
       return false;
   } else if (evidence_descriptor == "oe-evidence") {
-    if (!add_newfacts_for_sdk_platform_attestation(policy_pk,
-                                                   trusted_platforms,
-                                                   trusted_measurements,
-                                                   already_proved))
+    if (!add_newfacts_for_sdk_platform_attestation(index, already_proved))
       return false;
     return construct_proof_from_sdk_evidence(policy_pk,
                                              purpose,
@@ -2667,10 +2943,7 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
                                              to_prove,
                                              pf);
   } else if (evidence_descriptor == "asylo-evidence") {
-    if (!add_newfacts_for_sdk_platform_attestation(policy_pk,
-                                                   trusted_platforms,
-                                                   trusted_measurements,
-                                                   already_proved)) {
+    if (!add_newfacts_for_sdk_platform_attestation(index, already_proved)) {
       printf("construct_proof_from_full_vse_evidence in "
              "add_newfacts_for_asyloplatform_evidence failed\n");
       return false;
@@ -2681,10 +2954,7 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
                                              to_prove,
                                              pf);
   } else if (evidence_descriptor == "gramine-evidence") {
-    if (!add_newfacts_for_sdk_platform_attestation(policy_pk,
-                                                   trusted_platforms,
-                                                   trusted_measurements,
-                                                   already_proved)) {
+    if (!add_newfacts_for_sdk_platform_attestation(index, already_proved)) {
       printf("construct_proof_from_full_vse_evidence in "
              "add_newfacts_for_gramineplatform_evidence failed\n");
       return false;
@@ -2701,46 +2971,153 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
   return true;
 }
 
+bool construct_proof_from_request(
+    const string &              evidence_descriptor,
+    key_message &               policy_pk,
+    const string &              purpose,
+    const trusted_policy_index &index,
+    evidence_package &          evp,
+    proved_statements *         already_proved,
+    vse_clause *                to_prove,
+    proof *                     pf) {
+
+  if (!init_proved_statements(policy_pk, evp, already_proved)) {
+    printf("%s() error, line %d, init_proved_statements returned false\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+#ifdef PRINT_ALREADY_PROVED
+  printf("construct proof from request, initial proved statements:\n");
+  for (int i = 0; i < already_proved->proved_size(); i++) {
+    print_vse_clause(already_proved->proved(i));
+    printf("\n");
+  }
+  printf("\n");
+#endif
+
+  return construct_proof_from_proved(evidence_descriptor,
+                                     policy_pk,
+                                     purpose,
+                                     index,
+                                     already_proved,
+                                     to_prove,
+                                     pf);
+}
+
 bool validate_evidence(const string &         evidence_descriptor,
                        signed_claim_sequence &trusted_platforms,
                        signed_claim_sequence &trusted_measurements,
                        const string &         purpose,
                        evidence_package &     evp,
                        key_message &          policy_pk) {
-
-  proved_statements   already_proved;
-  vse_clause          to_prove;
-  proof               pf;
-  predicate_dominance predicate_dominance_root;
-
-  if (!init_dominance_tree(predicate_dominance_root)) {
-    printf("%s() error, line %d, validate_evidence: can't init predicate "
-           "dominance tree\n",
+  trusted_policy_index index;
+  if (!index.build(trusted_platforms, trusted_measurements)) {
+    printf("%s() error, line %d, validate_evidence: can't index policy\n",
            __func__,
            __LINE__);
     return false;
   }
+  return validate_evidence(evidence_descriptor, index, purpose, evp, policy_pk);
+}
 
-  if (!init_axiom(policy_pk, &already_proved)) {
-    printf("%s() error, line %d, validate_evidence: can't init axiom\n",
-           __func__,
-           __LINE__);
-    return false;
+evidence_verdict::evidence_verdict() : valid(false), failed_stage(-1) {
+  for (int i = 0; i < num_validation_stages; i++)
+    stage_ms[i] = 0.0;
+}
+
+const char *validation_stage_name(int stage) {
+  switch (stage) {
+    case validation_stage_setup:
+      return "setup";
+    case validation_stage_evidence:
+      return "evidence";
+    case validation_stage_construct:
+      return "construct";
+    case validation_stage_verify:
+      return "verify";
+    default:
+      return "unknown";
   }
+}
 
-  if (!construct_proof_from_request(evidence_descriptor,
-                                    policy_pk,
-                                    purpose,
-                                    trusted_platforms,
-                                    trusted_measurements,
-                                    evp,
-                                    &already_proved,
-                                    &to_prove,
-                                    &pf)) {
-    printf("%s() error, line %d, validate_evidence: can't construct proof\n",
-           __func__,
-           __LINE__);
-    return false;
+// Times each stage into v->stage_ms and records the one that fails.
+class stage_timer {
+ public:
+  stage_timer(evidence_verdict *v, int stage)
+      : v_(v),
+        stage_(stage),
+        start_(std::chrono::steady_clock::now()) {
+    v_->failed_stage = stage_;
+  }
+  ~stage_timer() {
+    std::chrono::duration<double, std::milli> d =
+        std::chrono::steady_clock::now() - start_;
+    v_->stage_ms[stage_] = d.count();
+  }
+
+ private:
+  evidence_verdict *                    v_;
+  int                                   stage_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+static bool validate_evidence_in_stages(const string &evidence_descriptor,
+                                        const trusted_policy_index &index,
+                                        const string &              purpose,
+                                        evidence_package &          evp,
+                                        key_message &               policy_pk,
+                                        evidence_verdict *          v) {
+  proved_statements    already_proved;
+  vse_clause           to_prove;
+  proof                pf;
+  predicate_dominance *predicate_dominance_root = nullptr;
+
+  {
+    stage_timer t(v, validation_stage_setup);
+    predicate_dominance_root = default_dominance_tree();
+    if (predicate_dominance_root == nullptr) {
+      printf("%s() error, line %d, validate_evidence: can't init predicate "
+             "dominance tree\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+
+    if (!init_axiom(policy_pk, &already_proved)) {
+      printf("%s() error, line %d, validate_evidence: can't init axiom\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+  }
+
+  {
+    stage_timer t(v, validation_stage_evidence);
+    if (!init_proved_statements(policy_pk, evp, &already_proved)) {
+      printf("%s() error, line %d, validate_evidence: init_proved_statements "
+             "returned false\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+  }
+
+  {
+    stage_timer t(v, validation_stage_construct);
+    if (!construct_proof_from_proved(evidence_descriptor,
+                                     policy_pk,
+                                     purpose,
+                                     index,
+                                     &already_proved,
+                                     &to_prove,
+                                     &pf)) {
+      printf("%s() error, line %d, validate_evidence: can't construct proof\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
   }
 
 #ifdef PRINT_ALREADY_PROVED
@@ -2759,13 +3136,16 @@ bool validate_evidence(const string &         evidence_descriptor,
   printf("\n");
 #endif
 
-  if (!verify_proof(policy_pk,
-                    to_prove,
-                    predicate_dominance_root,
-                    &pf,
-                    &already_proved)) {
-    printf("verify_proof failed\n");
-    return false;
+  {
+    stage_timer t(v, validation_stage_verify);
+    if (!verify_proof(policy_pk,
+                      to_prove,
+                      *predicate_dominance_root,
+                      &pf,
+                      &already_proved)) {
+      printf("verify_proof failed\n");
+      return false;
+    }
   }
 
 #ifdef PRINT_ALREADY_PROVED
@@ -2780,9 +3160,101 @@ bool validate_evidence(const string &         evidence_descriptor,
   printf("\n");
 #endif
 
+  v->failed_stage = -1;
   return true;
 }
 
+bool validate_evidence(const string &              evidence_descriptor,
+                       const trusted_policy_index &index,
+                       const string &              purpose,
+                       evidence_package &          evp,
+                       key_message &               policy_pk) {
+  evidence_verdict v;
+  return validate_evidence_in_stages(evidence_descriptor,
+                                     index,
+                                     purpose,
+                                     evp,
+                                     policy_pk,
+                                     &v);
+}
+
+static void validate_evidence_batch_worker(
+    int                         num_packages,
+    const string *              evidence_descriptors,
+    const string *              purposes,
+    evidence_package *          packages,
+    const trusted_policy_index *index,
+    key_message *               policy_pk,
+    std::atomic<int> *          next,
+    evidence_verdict *          verdicts) {
+  for (;;) {
+    int i = (*next)++;
+    if (i >= num_packages)
+      return;
+    verdicts[i].valid = validate_evidence_in_stages(evidence_descriptors[i],
+                                                    *index,
+                                                    purposes[i],
+                                                    packages[i],
+                                                    *policy_pk,
+                                                    &verdicts[i]);
+  }
+}
+
+int validate_evidence_batch(int                         num_packages,
+                            const string *              evidence_descriptors,
+                            const string *              purposes,
+                            evidence_package *          packages,
+                            const trusted_policy_index &index,
+                            key_message &               policy_pk,
+                            int                         num_threads,
+                            evidence_verdict *          verdicts) {
+  if (num_packages <= 0)
+    return 0;
+  if (num_threads <= 0)
+    num_threads = std::thread::hardware_concurrency();
+  if (num_threads > num_packages)
+    num_threads = num_packages;
+  if (num_threads < 1)
+    num_threads = 1;
+
+  // Build the shared dominance tree before any worker needs it.
+  default_dominance_tree();
+
+  std::atomic<int> next(0);
+  std::thread **   threads = new std::thread *[num_threads - 1];
+  for (int i = 0; i < num_threads - 1; i++) {
+    threads[i] = new std::thread(validate_evidence_batch_worker,
+                                 num_packages,
+                                 evidence_descriptors,
+                                 purposes,
+                                 packages,
+                                 &index,
+                                 &policy_pk,
+                                 &next,
+                                 verdicts);
+  }
+  validate_evidence_batch_worker(num_packages,
+                                 evidence_descriptors,
+                                 purposes,
+                                 packages,
+                                 &index,
+                                 &policy_pk,
+                                 &next,
+                                 verdicts);
+  for (int i = 0; i < num_threads - 1; i++) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  delete[] threads;
+
+  int num_valid = 0;
+  for (int i = 0; i < num_packages; i++) {
+    if (verdicts[i].valid)
+      num_valid++;
+  }
+  return num_valid;
+}
+
 //  New style proofs with platform information
 // -------------------------------------------------------------------
 
@@ -2794,15 +3266,16 @@ bool verify_proof_from_array(key_message &        policy_pk,
                              proof_step *         steps) {
 
   // verify proof
+  proved_index index(are_proved);
   for (int i = 0; i < num_steps; i++) {
     bool success;
-    if (!statement_already_proved(steps[i].s1(), are_proved)) {
+    if (!statement_already_proved(steps[i].s1(), index)) {
       printf("verify_proof_from_array: S1 not already proved\n");
       return false;
     }
 
-    if (!statement_already_proved(steps[i].s2(), are_proved)) {
-      printf("verify_proof_from_array: S1 not already proved\n");
+    if (!statement_already_proved(steps[i].s2(), index)) {
+      printf("verify_proof_from_array: S2 not already proved\n");
       return false;
     }
     success = verify_internal_proof_step(dom_tree,
@@ -2818,8 +3291,7 @@ bool verify_proof_from_array(key_message &        policy_pk,
       printf("\n");
       return false;
     }
-    vse_clause *to_add = are_proved->add_proved();
-    to_add->CopyFrom(steps[i].conclusion());
+    index.add(steps[i].conclusion());
   }
 
   int n = are_proved->proved_size();
@@ -3148,39 +3620,49 @@ bool init_policy(signed_claim_sequence &policy,
                  key_message &          policy_pk,
                  proved_statements *    already_proved) {
 
-  for (int i = 0; i < policy.claims_size(); i++) {
-#if 1
-    // This is a little wasteful since we parse it in
-    // add_fact_from_signed_claim. Remove this when filter policy is
-    // implemented.
-    claim_message cm;
-    if (!cm.ParseFromString(policy.claims(i).serialized_claim_message())) {
-      printf("init_policy: Can't parse serialized claim in policy\n");
-      return false;
+  // Check the signatures in parallel first; a policy can have thousands of
+  // claims.  Each claim is parsed once, while it's verified.
+  int            n = policy.claims_size();
+  bool *         verified = new bool[n];
+  claim_message *claims = new claim_message[n];
+  verify_signed_claim_sequence(policy, nullptr, 0, verified, claims);
+
+  bool ret = false;
+  for (int i = 0; i < n; i++) {
+    if (!verified[i]) {
+      printf("init_policy: Can't add claim %d\n", i);
+      printf("\n");
+      goto done;
     }
+    const claim_message &cm = claims[i];
     if (cm.claim_format() != "vse-clause") {
       printf("init_policy: policy must be a vse-clause\n");
-      return false;
+      goto done;
     }
     vse_clause cl;
     if (!cl.ParseFromString(cm.serialized_claim())) {
       printf("init_policy: Can't parse serialized policy\n");
-      return false;
+      goto done;
     }
     const entity_message &em = cl.subject();
     if (em.entity_type() != "key" || !same_key(policy_pk, em.key())) {
       printf("init_policy: the policy key does the saying\n");
-      return false;
+      goto done;
     }
-#endif
-    if (!add_fact_from_signed_claim(policy.claims(i), already_proved)) {
+    if (!add_fact_from_verified_clause(policy.claims(i).signing_key(),
+                                       cl,
+                                       already_proved)) {
       printf("init_policy: Can't add claim %d\n", i);
       printf("\n");
-      return false;
+      goto done;
     }
   }
+  ret = true;
 
-  return true;
+done:
+  delete[] verified;
+  delete[] claims;
+  return ret;
 }
 
 bool is_measurement(const vse_clause &cl) {
@@ -3215,79 +3697,787 @@ bool right_platform(const vse_clause &cl, const platform &p) {
   return satisfying_platform(cl.subject().platform_ent(), p);
 }
 
-#ifdef SEV_SNP
-// Exactly one satisfying platform and one satisfying measurement should
-// be in the filtered policy.  It there are none or more than one each,
-// it's an error.  Also check the policy key is doing the saying.
-bool filter_sev_policy(const sev_attestation_message &sev_att,
-                       const key_message &            policy_pk,
-                       const signed_claim_sequence &  policy,
-                       signed_claim_sequence *        filtered_policy) {
+platform_policy_matcher::platform_policy_matcher()
+    : policy_(nullptr), num_measurement_rules_(0) {}
+
+// Platform type, property name, type and value
+static string property_value_key(const string &  platform_type,
+                                 const property &p) {
+  string key = platform_type + '\0' + p.property_name() + '\0' + p.value_type()
+               + '\0';
+  if (p.value_type() == "int")
+    key.append(std::to_string(p.int_value()));
+  else if (p.value_type() == "string")
+    key.append(p.string_value());
+  return key;
+}
 
-  entity_message m_ent;
-  if (!get_measurement_from_sev_attest(sev_att, &m_ent)) {
-    printf("filter_sev_policy: Can't get measurement from attestation\n");
-    return false;
-  }
-  entity_message p_ent;
-  if (!get_platform_from_sev_attest(sev_att, &p_ent)) {
-    printf("filter_sev_policy: Can't get platform from attestation\n");
-    return false;
-  }
+static string property_name_key(const string &  platform_type,
+                                const property &p) {
+  return platform_type + '\0' + p.property_name();
+}
 
-  bool found_measurement = false;
-  bool found_platform = false;
+bool platform_policy_matcher::compile(const key_message &          policy_pk,
+                                      const signed_claim_sequence &policy) {
+  policy_ = nullptr;
+  rules_.clear();
+  other_claims_.clear();
+  num_measurement_rules_ = 0;
+  measurements_.clear();
+  equal_.clear();
+  at_least_.clear();
+  unconstrained_.clear();
 
   for (int i = 0; i < policy.claims_size(); i++) {
     claim_message cm;
     if (!cm.ParseFromString(policy.claims(i).serialized_claim_message())) {
-      printf("filter_sev_policy: Can't parse serialized claim in policy\n");
+      printf("%s() error, line: %d, Can't parse serialized claim in policy\n",
+             __func__,
+             __LINE__);
       return false;
     }
     if (cm.claim_format() != "vse-clause") {
-      printf("filter_sev_policy: policy must be a vse-clause\n");
+      printf("%s() error, line: %d, policy must be a vse-clause\n",
+             __func__,
+             __LINE__);
       return false;
     }
     vse_clause cl;
     if (!cl.ParseFromString(cm.serialized_claim())) {
-      printf("filter_sev_policy: Can't parse serialized policy\n");
+      printf("%s() error, line: %d, Can't parse serialized policy\n",
+             __func__,
+             __LINE__);
       return false;
     }
     if (!cl.has_subject()) {
-      printf("filter_sev_policy: policy rule misformatted (1)\n");
+      printf("%s() error, line: %d, policy rule misformatted (1)\n",
+             __func__,
+             __LINE__);
       return false;
     }
     const entity_message &em = cl.subject();
     if (em.entity_type() != "key" || !same_key(policy_pk, em.key())) {
-      printf("filter_sev_policy: the policy key does the saying\n");
+      printf("%s() error, line: %d, the policy key does the saying\n",
+             __func__,
+             __LINE__);
       return false;
     }
-    // In cl, look for: policy_key says measurement is_trusted and
-    // policy-key says platform[] has trusted-platform-properties.
-    // If match, keep them.  If not, don't.
     if (!cl.has_clause()) {
-      printf("filter_sev_policy: policy rule misformatted (2)\n");
+      printf("%s() error, line: %d, policy rule misformatted (2)\n",
+             __func__,
+             __LINE__);
       return false;
     }
+
     if (is_measurement(cl.clause())) {
-      if (found_measurement)
-        continue;
-      if (!right_measurement(cl.clause(), m_ent.measurement()))
-        continue;
-      found_measurement = true;
+      // insert keeps the first claim for a measurement
+      measurements_.insert(
+          std::make_pair(cl.clause().subject().measurement(), i));
+      num_measurement_rules_++;
+      continue;
+    }
+    if (!is_platform(cl.clause())) {
+      other_claims_.push_back(i);
+      continue;
+    }
+
+    int           r = (int)rules_.size();
+    platform_rule rule;
+    rule.claim = i;
+    rule.plat.CopyFrom(cl.clause().subject().platform_ent());
+    rules_.push_back(rule);
+
+    // A rule can only be satisfied if its anchoring property is, so it
+    // need only be filed under that property.
+    const platform &plat = rules_.back().plat;
+    const property *eq = nullptr;
+    const property *ge = nullptr;
+    for (int j = 0; j < plat.props().props_size(); j++) {
+      const property &pr = plat.props().props(j);
+      if (pr.comparator() == "=") {
+        eq = &pr;
+        break;
+      }
+      if (ge == nullptr && pr.comparator() == ">=" && pr.value_type() == "int")
+        ge = &pr;
+    }
+    if (eq != nullptr) {
+      equal_[property_value_key(plat.platform_type(), *eq)].push_back(r);
+    } else if (ge != nullptr) {
+      at_least_[property_name_key(plat.platform_type(), *ge)].push_back(
+          std::make_pair((uint64_t)ge->int_value(), r));
+    } else {
+      unconstrained_[plat.platform_type()].push_back(r);
+    }
+  }
+
+  for (auto &t : at_least_)
+    std::sort(t.second.begin(), t.second.end());
+  policy_ = &policy;
+  return true;
+}
+
+// satisfying_platform, without the mismatch reports
+bool platform_policy_matcher::rule_satisfied(int             rule,
+                                             const platform &p) const {
+  const platform &r = rules_[rule].plat;
+  if (r.platform_type() != p.platform_type())
+    return false;
+  if (r.has_key() && p.has_key() && !same_key(r.attest_key(), p.attest_key()))
+    return false;
+  for (int i = 0; i < r.props().props_size(); i++) {
+    const property *pp = find_property(r.props().props(i).property_name(),
+                                       p.props());
+    if (pp == nullptr || !satisfying_property(r.props().props(i), *pp))
+      return false;
+  }
+  return true;
+}
+
+int platform_policy_matcher::match_platform(const platform &p) const {
+  int  best = -1;
+  auto consider = [&](int r) {
+    if ((best < 0 || r < best) && rule_satisfied(r, p))
+      best = r;
+  };
+
+  auto u = unconstrained_.find(p.platform_type());
+  if (u != unconstrained_.end()) {
+    for (int r : u->second)
+      consider(r);
+  }
+  for (int i = 0; i < p.props().props_size(); i++) {
+    const property &pr = p.props().props(i);
+    // Rules are checked against the first property with a name
+    if (find_property(pr.property_name(), p.props()) != &pr)
+      continue;
+    auto e = equal_.find(property_value_key(p.platform_type(), pr));
+    if (e != equal_.end()) {
+      for (int r : e->second)
+        consider(r);
+    }
+    if (pr.value_type() != "int")
+      continue;
+    auto a = at_least_.find(property_name_key(p.platform_type(), pr));
+    if (a == at_least_.end())
+      continue;
+    for (size_t k = 0; k < a->second.size()
+                       && a->second[k].first <= (uint64_t)pr.int_value();
+         k++)
+      consider(a->second[k].second);
+  }
+
+  if (best < 0)
+    return -1;
+  return rules_[best].claim;
+}
+
+int platform_policy_matcher::match_measurement(const string &m) const {
+  auto it = measurements_.find(m);
+  if (it == measurements_.end())
+    return -1;
+  return it->second;
+}
+
+bool platform_policy_matcher::filter(
+    const string &         measurement,
+    const platform &       p,
+    signed_claim_sequence *filtered_policy) const {
+  if (policy_ == nullptr)
+    return false;
+
+  int              m = match_measurement(measurement);
+  int              pl = match_platform(p);
+  std::vector<int> keep(other_claims_);
+  if (m >= 0)
+    keep.push_back(m);
+  if (pl >= 0)
+    keep.push_back(pl);
+  std::sort(keep.begin(), keep.end());
+  for (int i : keep)
+    filtered_policy->add_claims()->CopyFrom(policy_->claims(i));
+
+  return m >= 0 && pl >= 0;
+}
+
+int platform_policy_matcher::num_platform_rules() const {
+  return (int)rules_.size();
+}
+
+int platform_policy_matcher::num_measurement_rules() const {
+  return num_measurement_rules_;
+}
+
+// Policy snapshot layout.  Integers are in the writer's byte order, which
+// the loader checks, and every table is 8 byte aligned.
+//   header
+//   clauses, in policy order
+//   fingerprint index: uint32 clause numbers sorted by fingerprint
+//   measurement index, sorted by measurement
+//   data: serialized clauses and signed claims, measurements, expiry
+//   signature over everything before it, to the end of the file
+static const char snapshot_magic[8] =
+    {'C', 'F', 'P', 'O', 'L', 'S', 'N', 'P'};
+static const uint32_t snapshot_byte_order = 0x01020304;
+
+struct snapshot_header {
+  char     magic[8];
+  uint32_t format_version;
+  uint32_t byte_order;
+  uint64_t policy_version;
+  uint32_t num_clauses;
+  uint32_t num_measurements;
+  uint64_t clauses_offset;
+  uint64_t fingerprint_index_offset;
+  uint64_t measurements_offset;
+  uint64_t data_offset;
+  uint64_t data_size;
+  uint64_t expiry_offset;  // in data
+  uint64_t expiry_size;
+  uint64_t signature_offset;
+  byte     policy_key_fingerprint[fingerprint_size];
+};
+
+struct snapshot_clause {
+  byte     fingerprint[fingerprint_size];
+  uint64_t clause_offset;  // in data
+  uint64_t clause_size;
+  uint64_t claim_offset;
+  uint64_t claim_size;
+};
+
+struct snapshot_measurement {
+  uint64_t offset;  // in data
+  uint32_t size;
+  uint32_t clause;
+};
+
+static uint64_t align8(uint64_t n) {
+  return (n + 7) & ~(uint64_t)7;
+}
+
+static bool snapshot_sign(const key_message &key,
+                          const string &     body,
+                          string *           sig) {
+  EVP_PKEY *pkey = cached_pkey_from_key(key);
+  if (pkey == nullptr)
+    return false;
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  size_t      len = 0;
+  bool        ret = ctx != nullptr
+             && EVP_DigestSignInit(ctx, nullptr, EVP_sha256(), nullptr, pkey)
+                    == 1
+             && EVP_DigestSignUpdate(ctx, body.data(), body.size()) == 1
+             && EVP_DigestSignFinal(ctx, nullptr, &len) == 1;
+  if (ret) {
+    sig->resize(len);
+    ret = EVP_DigestSignFinal(ctx, (byte *)&(*sig)[0], &len) == 1;
+    sig->resize(len);
+  }
+  if (ctx != nullptr)
+    EVP_MD_CTX_free(ctx);
+  EVP_PKEY_free(pkey);
+  return ret;
+}
+
+static bool snapshot_verify(const key_message &key,
+                            const byte *       body,
+                            size_t             body_size,
+                            const byte *       sig,
+                            size_t             sig_size) {
+  EVP_PKEY *pkey = cached_pkey_from_key(key);
+  if (pkey == nullptr)
+    return false;
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  bool        ret = ctx != nullptr
+             && EVP_DigestVerifyInit(ctx, nullptr, EVP_sha256(), nullptr, pkey)
+                    == 1
+             && EVP_DigestVerifyUpdate(ctx, body, body_size) == 1
+             && EVP_DigestVerifyFinal(ctx, sig, sig_size) == 1;
+  if (ctx != nullptr)
+    EVP_MD_CTX_free(ctx);
+  EVP_PKEY_free(pkey);
+  return ret;
+}
+
+// Loaders map snapshots and check them once, so a snapshot file must never
+// change in place.  Write a new file beside it and rename it over the old
+// one; mappings of the old file keep its inode until they're unmapped.
+static bool replace_snapshot_file(const string &file_name,
+                                  const string &contents) {
+  string tmp_name = file_name + ".XXXXXX";
+  int    fd = mkstemp(&tmp_name[0]);
+  if (fd < 0)
+    return false;
+
+  bool   ret = true;
+  size_t written = 0;
+  while (ret && written < contents.size()) {
+    ssize_t n =
+        write(fd, contents.data() + written, contents.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      ret = false;
+    else
+      written += n;
+  }
+  ret = ret && fchmod(fd, 0644) == 0 && fsync(fd) == 0;
+  ret = close(fd) == 0 && ret;
+  ret = ret && rename(tmp_name.c_str(), file_name.c_str()) == 0;
+  if (!ret) {
+    unlink(tmp_name.c_str());
+    return false;
+  }
+
+  // Make the rename itself durable.
+  size_t slash = file_name.rfind('/');
+  string dir = slash == string::npos ? string(".")
+                                     : file_name.substr(0, slash + 1);
+  int    dir_fd = open(dir.c_str(), O_RDONLY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return true;
+}
+
+bool write_policy_snapshot(const signed_claim_sequence &policy,
+                           const key_message &          policy_key,
+                           uint64_t                     policy_version,
+                           const string &               file_name) {
+  key_message policy_pk;
+  string      key_fp;
+  if (!private_key_to_public_key(policy_key, &policy_pk)
+      || !key_fingerprint(policy_pk, &key_fp)) {
+    printf("%s() error, line: %d, bad policy key\n", __func__, __LINE__);
+    return false;
+  }
+
+  int            n = policy.claims_size();
+  bool *         verified = new bool[n];
+  claim_message *claims = new claim_message[n];
+  string *       clauses = new string[n];
+  string *       fps = new string[n];
+  std::vector<std::pair<string, uint32_t>> measurements;
+  std::vector<uint32_t>                    by_fingerprint;
+  string                                   expiry;
+  time_point                               t_expiry;
+  string                                   data;
+  string                                   out;
+  string                                   sig;
+  snapshot_header                          h;
+  uint64_t                                 clauses_offset;
+  uint64_t                                 fp_offset;
+  uint64_t                                 m_offset;
+  uint64_t                                 data_offset;
+  bool                                     ret = false;
+
+  if (verify_signed_claim_sequence(policy, &policy_pk, 0, verified, claims)
+      != n) {
+    printf("%s() error, line: %d, policy claims don't verify\n",
+           __func__,
+           __LINE__);
+    goto done;
+  }
+  for (int i = 0; i < n; i++) {
+    vse_clause cl;
+    if (!clause_from_claim(claims[i], &cl) || cl.verb() != "says"
+        || cl.subject().entity_type() != "key"
+        || !same_key(policy_pk, cl.subject().key())) {
+      printf("%s() error, line: %d, claim %d isn't said by the policy key\n",
+             __func__,
+             __LINE__,
+             i);
+      goto done;
+    }
+    if (!vse_clause_fingerprint(cl, &fps[i])) {
+      printf("%s() error, line: %d, can't fingerprint claim %d\n",
+             __func__,
+             __LINE__,
+             i);
+      goto done;
     }
-    if (is_platform(cl.clause())) {
-      if (found_platform)
-        continue;
-      if (!right_platform(cl.clause(), p_ent.platform_ent()))
-        continue;
-      found_platform = true;
+    cl.SerializeToString(&clauses[i]);
+    if (cl.has_clause() && is_measurement(cl.clause()))
+      measurements.push_back(
+          std::make_pair(cl.clause().subject().measurement(), (uint32_t)i));
+    time_point t_na;
+    if (!string_to_time(claims[i].not_after(), &t_na))
+      goto done;
+    if (expiry.empty() || compare_time(t_na, t_expiry) < 0) {
+      expiry = claims[i].not_after();
+      t_expiry.CopyFrom(t_na);
     }
-    signed_claim_message *sc = filtered_policy->add_claims();
-    sc->CopyFrom(policy.claims(i));
+    by_fingerprint.push_back((uint32_t)i);
+  }
+  std::sort(by_fingerprint.begin(),
+            by_fingerprint.end(),
+            [&](uint32_t a, uint32_t b) { return fps[a] < fps[b]; });
+  // pairs sort by measurement, then policy order
+  std::sort(measurements.begin(), measurements.end());
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, snapshot_magic, sizeof(h.magic));
+  h.format_version = policy_snapshot_format_version;
+  h.byte_order = snapshot_byte_order;
+  h.policy_version = policy_version;
+  h.num_clauses = (uint32_t)n;
+  h.num_measurements = (uint32_t)measurements.size();
+  clauses_offset = sizeof(snapshot_header);
+  fp_offset = clauses_offset + n * sizeof(snapshot_clause);
+  m_offset = align8(fp_offset + n * sizeof(uint32_t));
+  data_offset = m_offset + measurements.size() * sizeof(snapshot_measurement);
+  h.clauses_offset = clauses_offset;
+  h.fingerprint_index_offset = fp_offset;
+  h.measurements_offset = m_offset;
+  h.data_offset = data_offset;
+  memcpy(h.policy_key_fingerprint, key_fp.data(), fingerprint_size);
+
+  out.resize(data_offset);
+  for (int i = 0; i < n; i++) {
+    snapshot_clause c;
+    memcpy(c.fingerprint, fps[i].data(), fingerprint_size);
+    c.clause_offset = data.size();
+    c.clause_size = clauses[i].size();
+    data.append(clauses[i]);
+    c.claim_offset = data.size();
+    c.claim_size = policy.claims(i).ByteSizeLong();
+    data.append(policy.claims(i).SerializeAsString());
+    memcpy(&out[clauses_offset + i * sizeof(c)], &c, sizeof(c));
+  }
+  memcpy(&out[fp_offset], by_fingerprint.data(), n * sizeof(uint32_t));
+  for (size_t i = 0; i < measurements.size(); i++) {
+    snapshot_measurement m;
+    m.offset = data.size();
+    m.size = (uint32_t)measurements[i].first.size();
+    m.clause = measurements[i].second;
+    data.append(measurements[i].first);
+    memcpy(&out[m_offset + i * sizeof(m)], &m, sizeof(m));
+  }
+  h.expiry_offset = data.size();
+  h.expiry_size = expiry.size();
+  data.append(expiry);
+  h.data_size = data.size();
+  h.signature_offset = data_offset + data.size();
+  memcpy(&out[0], &h, sizeof(h));
+  out.append(data);
+
+  if (!snapshot_sign(policy_key, out, &sig)) {
+    printf("%s() error, line: %d, can't sign snapshot\n", __func__, __LINE__);
+    goto done;
+  }
+  out.append(sig);
+  if (!replace_snapshot_file(file_name, out)) {
+    printf("%s() error, line: %d, can't write %s\n",
+           __func__,
+           __LINE__,
+           file_name.c_str());
+    goto done;
+  }
+  ret = true;
+
+done:
+  delete[] verified;
+  delete[] claims;
+  delete[] clauses;
+  delete[] fps;
+  return ret;
+}
+
+policy_snapshot::policy_snapshot() : base_(nullptr), size_(0) {}
+
+policy_snapshot::~policy_snapshot() {
+  unload();
+}
+
+void policy_snapshot::unload() {
+  if (base_ != nullptr)
+    munmap((void *)base_, size_);
+  base_ = nullptr;
+  size_ = 0;
+}
+
+bool policy_snapshot::load(const string &     file_name,
+                           const key_message &policy_pk,
+                           uint64_t           min_policy_version) {
+  unload();
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("%s() error, line: %d, can't open %s\n",
+           __func__,
+           __LINE__,
+           file_name.c_str());
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(snapshot_header)) {
+    printf("%s() error, line: %d, %s is too short\n",
+           __func__,
+           __LINE__,
+           file_name.c_str());
+    close(fd);
+    return false;
+  }
+  void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    printf("%s() error, line: %d, can't map %s\n",
+           __func__,
+           __LINE__,
+           file_name.c_str());
+    return false;
+  }
+  base_ = (const byte *)p;
+  size_ = st.st_size;
+
+  if (!check(policy_pk, min_policy_version)) {
+    unload();
+    return false;
   }
+  return true;
+}
+
+// offset + size <= limit, without overflow
+static bool in_bounds(uint64_t offset, uint64_t size, uint64_t limit) {
+  return size <= limit && offset <= limit - size;
+}
+
+bool policy_snapshot::check(const key_message &policy_pk,
+                            uint64_t           min_policy_version) const {
+  const snapshot_header *h = (const snapshot_header *)base_;
+  if (memcmp(h->magic, snapshot_magic, sizeof(h->magic)) != 0
+      || h->format_version != policy_snapshot_format_version
+      || h->byte_order != snapshot_byte_order) {
+    printf("%s() error, line: %d, not a policy snapshot this loader reads\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  uint64_t n = h->num_clauses;
+  uint64_t num_m = h->num_measurements;
+  if (h->clauses_offset != sizeof(snapshot_header)
+      || h->fingerprint_index_offset
+             != h->clauses_offset + n * sizeof(snapshot_clause)
+      || h->measurements_offset
+             != align8(h->fingerprint_index_offset + n * sizeof(uint32_t))
+      || h->data_offset
+             != h->measurements_offset + num_m * sizeof(snapshot_measurement)
+      || !in_bounds(h->data_offset, h->data_size, size_)
+      || h->signature_offset != h->data_offset + h->data_size
+      || h->signature_offset >= size_) {
+    printf("%s() error, line: %d, bad snapshot layout\n", __func__, __LINE__);
+    return false;
+  }
+
+  if (!snapshot_verify(policy_pk,
+                       base_,
+                       h->signature_offset,
+                       base_ + h->signature_offset,
+                       size_ - h->signature_offset)) {
+    printf("%s() error, line: %d, bad snapshot signature\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  string key_fp;
+  if (!key_fingerprint(policy_pk, &key_fp)
+      || memcmp(key_fp.data(), h->policy_key_fingerprint, fingerprint_size)
+             != 0) {
+    printf("%s() error, line: %d, snapshot is for another policy key\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (h->policy_version < min_policy_version) {
+    printf("%s() error, line: %d, snapshot policy version %llu is older than "
+           "%llu\n",
+           __func__,
+           __LINE__,
+           (unsigned long long)h->policy_version,
+           (unsigned long long)min_policy_version);
+    return false;
+  }
+
+  // Signed by the policy key, but check the tables before trusting them.
+  const snapshot_clause *c =
+      (const snapshot_clause *)(base_ + h->clauses_offset);
+  const uint32_t *idx = (const uint32_t *)(base_ + h->fingerprint_index_offset);
+  const snapshot_measurement *m =
+      (const snapshot_measurement *)(base_ + h->measurements_offset);
+  for (uint64_t i = 0; i < n; i++) {
+    if (!in_bounds(c[i].clause_offset, c[i].clause_size, h->data_size)
+        || !in_bounds(c[i].claim_offset, c[i].claim_size, h->data_size)
+        || idx[i] >= n) {
+      printf("%s() error, line: %d, bad clause table\n", __func__, __LINE__);
+      return false;
+    }
+  }
+  for (uint64_t i = 0; i < num_m; i++) {
+    if (!in_bounds(m[i].offset, m[i].size, h->data_size) || m[i].clause >= n) {
+      printf("%s() error, line: %d, bad measurement table\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+  }
+  if (!in_bounds(h->expiry_offset, h->expiry_size, h->data_size)) {
+    printf("%s() error, line: %d, bad expiry\n", __func__, __LINE__);
+    return false;
+  }
+  if (!valid_now()) {
+    printf("%s() error, line: %d, snapshot has expired\n", __func__, __LINE__);
+    return false;
+  }
+  return true;
+}
 
-  return found_measurement && found_platform;
+uint64_t policy_snapshot::policy_version() const {
+  if (base_ == nullptr)
+    return 0;
+  return ((const snapshot_header *)base_)->policy_version;
+}
+
+int policy_snapshot::num_clauses() const {
+  if (base_ == nullptr)
+    return 0;
+  return (int)((const snapshot_header *)base_)->num_clauses;
+}
+
+bool policy_snapshot::clause(int i, vse_clause *cl) const {
+  if (i < 0 || i >= num_clauses())
+    return false;
+  const snapshot_header *h = (const snapshot_header *)base_;
+  const snapshot_clause *c =
+      (const snapshot_clause *)(base_ + h->clauses_offset) + i;
+  return cl->ParseFromArray(base_ + h->data_offset + c->clause_offset,
+                            (int)c->clause_size);
+}
+
+bool policy_snapshot::signed_claim(int i, signed_claim_message *sc) const {
+  if (i < 0 || i >= num_clauses())
+    return false;
+  const snapshot_header *h = (const snapshot_header *)base_;
+  const snapshot_clause *c =
+      (const snapshot_clause *)(base_ + h->clauses_offset) + i;
+  return sc->ParseFromArray(base_ + h->data_offset + c->claim_offset,
+                            (int)c->claim_size);
+}
+
+bool policy_snapshot::valid_now() const {
+  if (base_ == nullptr)
+    return false;
+  const snapshot_header *h = (const snapshot_header *)base_;
+  if (h->num_clauses == 0)
+    return true;
+  string expiry((const char *)base_ + h->data_offset + h->expiry_offset,
+                h->expiry_size);
+  time_point t_now;
+  time_point t_expiry;
+  if (!time_now(&t_now) || !string_to_time(expiry, &t_expiry))
+    return false;
+  return compare_time(t_expiry, t_now) >= 0;
+}
+
+int policy_snapshot::find_clause(const vse_clause &cl) const {
+  string fp;
+  if (base_ == nullptr || !vse_clause_fingerprint(cl, &fp))
+    return -1;
+  const snapshot_header *h = (const snapshot_header *)base_;
+  const snapshot_clause *c =
+      (const snapshot_clause *)(base_ + h->clauses_offset);
+  const uint32_t *idx = (const uint32_t *)(base_ + h->fingerprint_index_offset);
+
+  int lo = 0;
+  int hi = (int)h->num_clauses;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    int cmp = memcmp(c[idx[mid]].fingerprint, fp.data(), fingerprint_size);
+    if (cmp == 0)
+      return (int)idx[mid];
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -1;
+}
+
+int policy_snapshot::find_measurement(const string &m) const {
+  if (base_ == nullptr)
+    return -1;
+  const snapshot_header *     h = (const snapshot_header *)base_;
+  const snapshot_measurement *t =
+      (const snapshot_measurement *)(base_ + h->measurements_offset);
+  const char *data = (const char *)base_ + h->data_offset;
+
+  // First entry not less than m, so duplicates give the earliest claim
+  int lo = 0;
+  int hi = (int)h->num_measurements;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (string(data + t[mid].offset, t[mid].size) < m)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < (int)h->num_measurements
+      && string(data + t[lo].offset, t[lo].size) == m)
+    return (int)t[lo].clause;
+  return -1;
+}
+
+bool init_policy(const policy_snapshot &snapshot,
+                 proved_statements *    already_proved) {
+  if (!snapshot.valid_now()) {
+    printf("%s() error, line: %d, snapshot has expired\n", __func__, __LINE__);
+    return false;
+  }
+  for (int i = 0; i < snapshot.num_clauses(); i++) {
+    if (!snapshot.clause(i, already_proved->add_proved())) {
+      printf("%s() error, line: %d, can't parse clause %d\n",
+             __func__,
+             __LINE__,
+             i);
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef SEV_SNP
+// Exactly one satisfying platform and one satisfying measurement should
+// be in the filtered policy.  It there are none or more than one each,
+// it's an error.  Also check the policy key is doing the saying.
+bool filter_sev_policy(const sev_attestation_message &sev_att,
+                       const key_message &            policy_pk,
+                       const signed_claim_sequence &  policy,
+                       signed_claim_sequence *        filtered_policy) {
+  platform_policy_matcher matcher;
+  if (!matcher.compile(policy_pk, policy)) {
+    printf("filter_sev_policy: Can't compile policy\n");
+    return false;
+  }
+  return filter_sev_policy(sev_att, matcher, filtered_policy);
+}
+
+bool filter_sev_policy(const sev_attestation_message &sev_att,
+                       const platform_policy_matcher &matcher,
+                       signed_claim_sequence *        filtered_policy) {
+  entity_message m_ent;
+  if (!get_measurement_from_sev_attest(sev_att, &m_ent)) {
+    printf("filter_sev_policy: Can't get measurement from attestation\n");
+    return false;
+  }
+  entity_message p_ent;
+  if (!get_platform_from_sev_attest(sev_att, &p_ent)) {
+    printf("filter_sev_policy: Can't get platform from attestation\n");
+    return false;
+  }
+  return matcher.filter(m_ent.measurement(),
+                        p_ent.platform_ent(),
+                        filtered_policy);
 }
 
 // Use policy statements for init
@@ -3296,12 +4486,30 @@ bool validate_evidence_from_policy(const string &         evidence_descriptor,
                                    const string &         purpose,
                                    evidence_package &     evp,
                                    key_message &          policy_pk) {
+  platform_policy_matcher matcher;
+  if (!matcher.compile(policy_pk, policy)) {
+    printf("validate_evidence: can't compile policy\n");
+    return false;
+  }
+  return validate_evidence_from_policy(evidence_descriptor,
+                                       matcher,
+                                       purpose,
+                                       evp,
+                                       policy_pk);
+}
+
+// As above, with the policy compiled once for many attestations.
+bool validate_evidence_from_policy(const string &evidence_descriptor,
+                                   const platform_policy_matcher &matcher,
+                                   const string &                 purpose,
+                                   evidence_package &             evp,
+                                   key_message &                  policy_pk) {
 
-  proved_statements   already_proved;
-  vse_clause          to_prove;
-  predicate_dominance predicate_dominance_root;
+  proved_statements    already_proved;
+  vse_clause           to_prove;
+  predicate_dominance *predicate_dominance_root = default_dominance_tree();
 
-  if (!init_dominance_tree(predicate_dominance_root)) {
+  if (predicate_dominance_root == nullptr) {
     printf("validate_evidence: can't init predicate dominance tree\n");
     return false;
   }
@@ -3335,7 +4543,7 @@ bool validate_evidence_from_policy(const string &         evidence_descriptor,
   }
 
   signed_claim_sequence filtered_policy;
-  if (!filter_sev_policy(sev_att, policy_pk, policy, &filtered_policy)) {
+  if (!filter_sev_policy(sev_att, matcher, &filtered_policy)) {
     printf("validate_evidence: can't filter policy\n");
     return false;
   }
@@ -3394,7 +4602,7 @@ bool validate_evidence_from_policy(const string &         evidence_descriptor,
 
   if (!verify_proof_from_array(policy_pk,
                                to_prove,
-                               predicate_dominance_root,
+                               *predicate_dominance_root,
                                &already_proved,
                                num_steps,
                                steps)) {
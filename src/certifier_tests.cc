@@ -61,6 +61,18 @@ TEST(test_authenticated_encrypt, test_authenticated_encrypt) {
   EXPECT_TRUE(test_authenticated_encrypt(FLAGS_print_all));
 }
 
+TEST(crypto_context, test_crypto_context) {
+  EXPECT_TRUE(test_crypto_context(FLAGS_print_all));
+}
+
+TEST(streaming_encrypt, test_streaming_encrypt) {
+  EXPECT_TRUE(test_streaming_encrypt(FLAGS_print_all));
+}
+
+TEST(aead_in_place, test_aead_in_place) {
+  EXPECT_TRUE(test_aead_in_place(FLAGS_print_all));
+}
+
 TEST(public_keys, test_public_keys) {
   EXPECT_TRUE(test_public_keys(FLAGS_print_all));
 }
@@ -73,6 +85,10 @@ TEST(key_translation, test_key_translation) {
   EXPECT_TRUE(test_key_translation(FLAGS_print_all));
 }
 
+TEST(pkey_cache, test_pkey_cache) {
+  EXPECT_TRUE(test_pkey_cache(FLAGS_print_all));
+}
+
 TEST(time, test_time) {
   EXPECT_TRUE(test_time(FLAGS_print_all));
 }
@@ -114,6 +130,38 @@ TEST(signed_claims, test_signed_claims) {
   EXPECT_TRUE(test_signed_claims(FLAGS_print_all));
 }
 
+TEST(signed_claims, test_verify_signed_claims) {
+  EXPECT_TRUE(test_verify_signed_claims(FLAGS_print_all));
+}
+
+TEST(signed_claims, test_verify_and_parse_claim) {
+  EXPECT_TRUE(test_verify_and_parse_claim(FLAGS_print_all));
+}
+
+TEST(signed_claims, test_verified_claim_cache) {
+  EXPECT_TRUE(test_verified_claim_cache(FLAGS_print_all));
+}
+
+TEST(fingerprints, test_fingerprints) {
+  EXPECT_TRUE(test_fingerprints(FLAGS_print_all));
+}
+
+TEST(fingerprints, test_proved_index) {
+  EXPECT_TRUE(test_proved_index(FLAGS_print_all));
+}
+
+TEST(fingerprints, test_trusted_policy_index) {
+  EXPECT_TRUE(test_trusted_policy_index(FLAGS_print_all));
+}
+
+TEST(fingerprints, test_platform_policy_matcher) {
+  EXPECT_TRUE(test_platform_policy_matcher(FLAGS_print_all));
+}
+
+TEST(fingerprints, test_policy_snapshot) {
+  EXPECT_TRUE(test_policy_snapshot(FLAGS_print_all));
+}
+
 extern bool test__local_certify(string &, bool, string &, string &);
 TEST(local_certify, test_local_certify) {
   string enclave_type("simulated-enclave");
@@ -133,6 +181,10 @@ TEST(local_certify, test_partial_local_certify) {
                                   evidence_descriptor));
 }
 
+TEST(local_certify, test_validate_evidence_batch) {
+  EXPECT_TRUE(test_validate_evidence_batch(FLAGS_print_all));
+}
+
 extern bool test__new_local_certify(string &, bool, string &, string &);
 TEST(local_certify, test_new_local_certify) {
   string enclave_type("simulated-enclave");
@@ -155,6 +207,10 @@ TEST(test_predicate_dominance, test_predicate_dominance) {
   EXPECT_TRUE(test_predicate_dominance(FLAGS_print_all));
 }
 
+TEST(test_predicate_dominance, test_dominance_table) {
+  EXPECT_TRUE(test_dominance_table(FLAGS_print_all));
+}
+
 // The following tests will only work if there is initialized
 // policy data in test_data
 
@@ -166,6 +222,59 @@ TEST(test_x_509_sign, test_x_509_sign) {
   EXPECT_TRUE(test_x_509_sign(FLAGS_print_all));
 }
 
+// Channel tests
+
+TEST(server_dispatch_pool, test_server_dispatch_pool) {
+  EXPECT_TRUE(test_server_dispatch_pool(FLAGS_print_all));
+}
+
+TEST(event_dispatch_server, test_event_dispatch_server) {
+  EXPECT_TRUE(test_event_dispatch_server(FLAGS_print_all));
+}
+
+TEST(event_dispatch_server, test_event_dispatch_accept_backoff) {
+  EXPECT_TRUE(test_event_dispatch_accept_backoff(FLAGS_print_all));
+}
+
+TEST(server_connection_setup, test_server_connection_setup) {
+  EXPECT_TRUE(test_server_connection_setup(FLAGS_print_all));
+}
+
+TEST(session_resumption, test_session_resumption) {
+  EXPECT_TRUE(test_session_resumption(FLAGS_print_all));
+}
+
+TEST(client_channel_pool, test_client_channel_pool) {
+  EXPECT_TRUE(test_client_channel_pool(FLAGS_print_all));
+}
+
+TEST(sized_io, test_sized_io) {
+  EXPECT_TRUE(test_sized_io(FLAGS_print_all));
+}
+
+TEST(framed_io, test_framed_io) {
+  EXPECT_TRUE(test_framed_io(FLAGS_print_all));
+}
+
+TEST(ktls, test_ktls_send_file) {
+  EXPECT_TRUE(test_ktls_send_file(FLAGS_print_all));
+}
+
+TEST(async_channel, test_async_channel_driver) {
+  EXPECT_TRUE(test_async_channel_driver(FLAGS_print_all));
+}
+
+TEST(channel_mux, test_channel_mux) {
+  EXPECT_TRUE(test_channel_mux(FLAGS_print_all));
+}
+TEST(channel_mux, test_channel_mux_limits) {
+  EXPECT_TRUE(test_channel_mux_limits(FLAGS_print_all));
+}
+
+TEST(channel_auth_keys, test_channel_auth_key_types) {
+  EXPECT_TRUE(test_channel_auth_key_types(FLAGS_print_all));
+}
+
 // sev tests
 #ifdef RUN_SEV_TESTS
 
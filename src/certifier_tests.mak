@@ -83,7 +83,8 @@ common_objs = $(O)/certifier.pb.o $(O)/certifier.o      \
 dobj = $(O)/certifier_tests.o $(common_objs) \
        $(O)/cc_helpers.o $(O)/cc_useful.o \
        $(O)/claims_tests.o $(O)/primitive_tests.o $(O)/certificate_tests.o       \
-       $(O)/store_tests.o $(O)/support_tests.o $(O)/x509_tests.o
+       $(O)/store_tests.o $(O)/support_tests.o $(O)/x509_tests.o \
+       $(O)/channel_tests.o
 
 # Objs needed to build Certifer tests shared lib for use by Python module
 cftests_sl_dobj := $(dobj) $(O)/certifier_tests_wrap.o
@@ -152,6 +153,10 @@ $(O)/x509_tests.o: $(S)/x509_tests.cc $(I)/certifier.pb.h $(I)/certifier.h
 	@echo "\ncompiling $<"
 	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
 
+$(O)/channel_tests.o: $(S)/channel_tests.cc $(I)/certifier.pb.h $(I)/certifier.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
 $(O)/certificate_tests.o: $(S)/certificate_tests.cc $(I)/certifier.pb.h $(I)/certifier.h
 	@echo "\ncompiling $<"
 	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
@@ -0,0 +1,1653 @@
+//  Copyright (c) 2021-23, VMware Inc, and the Certifier Authors.  All rights
+//  reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "certifier.h"
+#include "support.h"
+#include "certifier_framework.h"
+#include "certifier_utilities.h"
+#include "cc_helpers.h"
+
+using namespace certifier::framework;
+using namespace certifier::utilities;
+
+// Loopback channel tests.  Servers run on an ephemeral port on localhost.
+
+static string      channel_test_host("127.0.0.1");
+static key_message channel_policy_key;
+static string      channel_policy_cert;
+static key_message channel_server_key;
+static string      channel_server_cert;
+static key_message channel_client_key;
+static string      channel_client_cert;
+static bool        channel_keys_initialized = false;
+
+static bool make_channel_admissions_cert(const string &role,
+                                         key_message & policy_key,
+                                         key_message & auth_key,
+                                         string *      out) {
+  string issuer_name("policyAuthority");
+  string issuer_organization("root");
+  string subject_name(role);
+  string subject_organization("1234567890");
+
+  X509 *x509_cert = X509_new();
+  if (!produce_artifact(policy_key,
+                        issuer_name,
+                        issuer_organization,
+                        auth_key,
+                        subject_name,
+                        subject_organization,
+                        23,
+                        365.26 * 86400.0,
+                        x509_cert,
+                        false)) {
+    X509_free(x509_cert);
+    return false;
+  }
+  bool ret = x509_to_asn1(x509_cert, out);
+  X509_free(x509_cert);
+  return ret;
+}
+
+// key_type is Enc_method_rsa_2048, Enc_method_ecc_256 or Enc_method_ecc_384.
+static bool make_channel_auth_key(const string &role,
+                                  const string &key_type,
+                                  key_message * key,
+                                  string *      cert) {
+  bool made = false;
+  if (key_type == Enc_method_ecc_256) {
+    made = make_certifier_ecc_key(256, key);
+  } else if (key_type == Enc_method_ecc_384) {
+    made = make_certifier_ecc_key(384, key);
+  } else {
+    made = make_certifier_rsa_key(2048, key);
+  }
+  if (!made) {
+    printf("%s() error, line %d, can't make key\n", __func__, __LINE__);
+    return false;
+  }
+  key->set_key_name(role);
+  key->set_key_format("vse-key");
+  if (!make_channel_admissions_cert(role, channel_policy_key, *key, cert)) {
+    printf("%s() error, line %d, can't make cert\n", __func__, __LINE__);
+    return false;
+  }
+  key->set_certificate(*cert);
+  return true;
+}
+
+static bool init_channel_test_keys() {
+  if (channel_keys_initialized)
+    return true;
+
+  string type(Enc_method_rsa_2048_private);
+  string name("policyKey");
+  string issuer("policyAuthority");
+  if (!make_root_key_with_cert(type, name, issuer, &channel_policy_key)) {
+    printf("%s() error, line %d, can't make policy key\n", __func__, __LINE__);
+    return false;
+  }
+  channel_policy_cert.assign(
+      (char *)channel_policy_key.certificate().data(),
+      channel_policy_key.certificate().size());
+
+  if (!make_channel_auth_key("server",
+                             Enc_method_rsa_2048,
+                             &channel_server_key,
+                             &channel_server_cert))
+    return false;
+  if (!make_channel_auth_key("client",
+                             Enc_method_rsa_2048,
+                             &channel_client_key,
+                             &channel_client_cert))
+    return false;
+  channel_keys_initialized = true;
+  return true;
+}
+
+// Server side: echo one message back.
+static void echo_service(secure_authenticated_channel &channel) {
+  string in;
+  int    n = channel.read(&in);
+  if (n >= 0)
+    channel.write(in.size(), (byte *)in.data());
+  channel.close();
+}
+
+static bool echo_client(int port, int client_num, bool print_all) {
+  string                       role("client");
+  secure_authenticated_channel channel(role);
+  if (!channel.init_client_ssl(channel_test_host,
+                               port,
+                               channel_policy_cert,
+                               channel_client_key,
+                               channel_client_cert)) {
+    printf("%s() error, line %d, client %d can't init channel\n",
+           __func__,
+           __LINE__,
+           client_num);
+    return false;
+  }
+
+  string msg("Hello from client ");
+  msg.append(std::to_string(client_num));
+  if (channel.write(msg.size(), (byte *)msg.data()) <= 0) {
+    printf("%s() error, line %d, write failed\n", __func__, __LINE__);
+    return false;
+  }
+  string reply;
+  if (channel.read(&reply) < 0) {
+    printf("%s() error, line %d, read failed\n", __func__, __LINE__);
+    return false;
+  }
+  channel.close();
+  if (print_all) {
+    printf("client %d got: %s\n", client_num, reply.c_str());
+  }
+  return reply == msg;
+}
+
+static void run_pool(server_dispatch_pool *pool) {
+  pool->run();
+}
+
+static void run_echo_client(int port, int client_num, bool *ok) {
+  *ok = echo_client(port, client_num, false);
+}
+
+bool test_server_dispatch_pool(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  const int num_workers = 4;
+  const int num_clients = 16;
+
+  server_dispatch_pool pool(num_workers, 2);
+  if (!pool.init(channel_test_host,
+                 0,
+                 channel_policy_cert,
+                 channel_server_key,
+                 channel_server_cert,
+                 echo_service)) {
+    printf("%s() error, line %d, can't init pool\n", __func__, __LINE__);
+    return false;
+  }
+  if (pool.port() <= 0) {
+    printf("%s() error, line %d, no ephemeral port\n", __func__, __LINE__);
+    return false;
+  }
+  std::thread server(run_pool, &pool);
+
+  bool         client_ok[num_clients];
+  std::thread *clients[num_clients];
+  for (int i = 0; i < num_clients; i++) {
+    client_ok[i] = false;
+    clients[i] =
+        new std::thread(run_echo_client, pool.port(), i, &client_ok[i]);
+  }
+  for (int i = 0; i < num_clients; i++) {
+    clients[i]->join();
+    delete clients[i];
+  }
+
+  // A sequential client after the burst must still be served.
+  bool ret = echo_client(pool.port(), num_clients, print_all);
+
+  pool.stop();
+  server.join();
+
+  for (int i = 0; i < num_clients; i++) {
+    if (!client_ok[i]) {
+      printf("%s() error, line %d, client %d failed\n", __func__, __LINE__, i);
+      ret = false;
+    }
+  }
+
+  uint64_t handled = 0;
+  for (int i = 0; i < pool.num_workers(); i++) {
+    server_worker_stats st;
+    if (!pool.get_worker_stats(i, &st))
+      return false;
+    if (print_all) {
+      printf("worker %d: connections %lu, handshake failures %lu, busy %lu "
+             "usec\n",
+             st.worker_id_,
+             (unsigned long)st.connections_handled_,
+             (unsigned long)st.handshake_failures_,
+             (unsigned long)st.busy_usec_);
+    }
+    handled += st.connections_handled_;
+  }
+  if (print_all) {
+    printf("queue full waits: %lu\n", (unsigned long)pool.queue_full_waits());
+  }
+  if (handled != (uint64_t)(num_clients + 1)) {
+    printf("%s() error, line %d, handled %lu connections, expected %d\n",
+           __func__,
+           __LINE__,
+           (unsigned long)handled,
+           num_clients + 1);
+    return false;
+  }
+  return ret;
+}
+
+static bool echo_request(secure_authenticated_channel &channel,
+                         const string &                request,
+                         string *                      response) {
+  response->assign(request);
+  return true;
+}
+
+static void run_event_server(event_dispatch_server *server) {
+  server->run();
+}
+
+bool test_event_dispatch_server(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  const int num_clients = 32;
+  const int num_messages = 3;
+
+  event_dispatch_server server(2);
+  if (!server.init(channel_test_host,
+                   0,
+                   channel_policy_cert,
+                   channel_server_key,
+                   channel_server_cert,
+                   echo_request)) {
+    printf("%s() error, line %d, can't init server\n", __func__, __LINE__);
+    return false;
+  }
+  std::thread server_thread(run_event_server, &server);
+
+  // Hold all the connections open at once; none of them gets a thread.
+  bool                          ret = true;
+  string                        role("client");
+  secure_authenticated_channel *clients[num_clients];
+  for (int i = 0; i < num_clients; i++) {
+    clients[i] = new secure_authenticated_channel(role);
+    if (!clients[i]->init_client_ssl(channel_test_host,
+                                     server.port(),
+                                     channel_policy_cert,
+                                     channel_client_key,
+                                     channel_client_cert)) {
+      printf("%s() error, line %d, client %d can't connect\n",
+             __func__,
+             __LINE__,
+             i);
+      ret = false;
+    }
+  }
+
+  for (int j = 0; ret && j < num_messages; j++) {
+    for (int i = 0; ret && i < num_clients; i++) {
+      string msg("message ");
+      msg.append(std::to_string(j));
+      msg.append(" from client ");
+      msg.append(std::to_string(i));
+      string reply;
+      if (clients[i]->write(msg.size(), (byte *)msg.data()) <= 0
+          || clients[i]->read(&reply) < 0 || reply != msg) {
+        printf("%s() error, line %d, client %d bad echo\n",
+               __func__,
+               __LINE__,
+               i);
+        ret = false;
+      }
+    }
+  }
+
+  if (print_all) {
+    printf("open: %d, accepted: %lu, messages: %lu, handshake failures: %lu\n",
+           server.connections_open(),
+           (unsigned long)server.connections_accepted(),
+           (unsigned long)server.messages_handled(),
+           (unsigned long)server.handshake_failures());
+  }
+  if (ret && server.connections_open() != num_clients) {
+    printf("%s() error, line %d, %d connections open, expected %d\n",
+           __func__,
+           __LINE__,
+           server.connections_open(),
+           num_clients);
+    ret = false;
+  }
+  if (ret && server.messages_handled() != num_clients * num_messages) {
+    printf("%s() error, line %d, wrong message count\n", __func__, __LINE__);
+    ret = false;
+  }
+
+  for (int i = 0; i < num_clients; i++) {
+    clients[i]->close();
+    delete clients[i];
+  }
+  server.stop();
+  server_thread.join();
+  return ret;
+}
+
+static double process_cpu_seconds() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+         + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+}
+
+// Runs the process out of descriptors while a connection is waiting to
+// be accepted.  The loop must not spin on the listen socket, and must
+// pick the connection up once descriptors are free again.
+bool test_event_dispatch_accept_backoff(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  event_dispatch_server server(1);
+  if (!server.init(channel_test_host,
+                   0,
+                   channel_policy_cert,
+                   channel_server_key,
+                   channel_server_cert,
+                   echo_request)) {
+    printf("%s() error, line %d, can't init server\n", __func__, __LINE__);
+    return false;
+  }
+  std::thread server_thread(run_event_server, &server);
+
+  // The client socket is made before the table fills up; connecting
+  // doesn't need another descriptor.
+  int                client = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(server.port());
+  inet_pton(AF_INET, channel_test_host.c_str(), &addr.sin_addr);
+
+  struct rlimit old_limit;
+  getrlimit(RLIMIT_NOFILE, &old_limit);
+  struct rlimit limit = old_limit;
+  limit.rlim_cur = 256;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  std::vector<int> filler;
+  for (;;) {
+    int fd = dup(0);
+    if (fd < 0)
+      break;
+    filler.push_back(fd);
+  }
+
+  bool ret = true;
+  if (client < 0
+      || connect(client, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    printf("%s() error, line %d, can't connect\n", __func__, __LINE__);
+    ret = false;
+  }
+  double start_cpu = process_cpu_seconds();
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  double busy = process_cpu_seconds() - start_cpu;
+  uint64_t accepted_while_full = server.connections_accepted();
+
+  for (size_t i = 0; i < filler.size(); i++)
+    ::close(filler[i]);
+  setrlimit(RLIMIT_NOFILE, &old_limit);
+
+  for (int i = 0; i < 100 && server.connections_accepted() == 0; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  if (print_all) {
+    printf("cpu while out of descriptors: %.3f sec over 0.5 sec, accepted "
+           "after: %lu\n",
+           busy,
+           (unsigned long)server.connections_accepted());
+  }
+  if (ret && accepted_while_full != 0) {
+    printf("%s() error, line %d, accepted with no descriptors\n",
+           __func__,
+           __LINE__);
+    ret = false;
+  }
+  if (ret && busy > 0.25) {
+    printf("%s() error, line %d, loop spun: %.3f sec cpu\n",
+           __func__,
+           __LINE__,
+           busy);
+    ret = false;
+  }
+  if (ret && server.connections_accepted() != 1) {
+    printf("%s() error, line %d, connection never accepted\n",
+           __func__,
+           __LINE__);
+    ret = false;
+  }
+
+  if (client >= 0)
+    ::close(client);
+  server.stop();
+  server_thread.join();
+  return ret;
+}
+
+static bool make_benchmark_server_ctx(SSL_CTX **out) {
+  X509 *root_cert = X509_new();
+  if (!asn1_to_x509(channel_policy_cert, root_cert)) {
+    X509_free(root_cert);
+    return false;
+  }
+  SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+  bool     ret = load_server_certs_and_key(root_cert,
+                                       channel_server_key,
+                                       channel_server_cert,
+                                       ctx);
+  X509_free(root_cert);
+  if (!ret) {
+    SSL_CTX_free(ctx);
+    return false;
+  }
+  *out = ctx;
+  return true;
+}
+
+// Server side connection setup cost, without the handshake itself.  Both
+// loops use one SSL_CTX built up front, as the accept loop always did.
+// "per connection" is what it used to do for every client:
+// init_server_ssl, which parses the root cert and copies the key, and
+// then SSL_new.  "shared" is the SSL_new alone.
+bool test_server_connection_setup(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  const int num_connections = 50;
+  string    role("server");
+  SSL_CTX * shared_ctx = nullptr;
+  if (!make_benchmark_server_ctx(&shared_ctx)) {
+    printf("%s() error, line %d, can't make ctx\n", __func__, __LINE__);
+    return false;
+  }
+
+  bool ret = true;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int i = 0; ret && i < num_connections; i++) {
+    secure_authenticated_channel nc(role);
+    if (!nc.init_server_ssl(channel_test_host,
+                            0,
+                            channel_policy_cert,
+                            channel_server_key,
+                            channel_server_cert)) {
+      printf("%s() error, line %d, init_server_ssl failed\n",
+             __func__,
+             __LINE__);
+      ret = false;
+    }
+    nc.ssl_ = SSL_new(shared_ctx);
+    if (nc.ssl_ == nullptr)
+      ret = false;
+  }
+  double per_connection_usec =
+      (double)std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; ret && i < num_connections; i++) {
+    secure_authenticated_channel nc(role);
+    nc.ssl_ = SSL_new(shared_ctx);
+    if (nc.ssl_ == nullptr)
+      ret = false;
+  }
+  double shared_usec =
+      (double)std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+  SSL_CTX_free(shared_ctx);
+  if (!ret)
+    return false;
+
+  if (print_all) {
+    printf("Server connection setup, %d connections:\n", num_connections);
+    printf("  init_server_ssl + SSL_new: %10.2f usec/connection\n",
+           per_connection_usec / num_connections);
+    printf("  SSL_new:                   %10.2f usec/connection\n",
+           shared_usec / num_connections);
+  }
+  return true;
+}
+
+static bool resumption_client(int port, client_session_cache *cache) {
+  string                       role("client");
+  secure_authenticated_channel channel(role);
+  channel.set_session_cache(cache);
+  if (!channel.init_client_ssl(channel_test_host,
+                               port,
+                               channel_policy_cert,
+                               channel_client_key,
+                               channel_client_cert)) {
+    return false;
+  }
+  // Reading the reply also picks up the new session tickets.
+  string msg("resume");
+  string reply;
+  if (channel.write(msg.size(), (byte *)msg.data()) <= 0
+      || channel.read(&reply) < 0) {
+    return false;
+  }
+  string peer_id;
+  if (!channel.get_peer_id(&peer_id) || peer_id.empty()) {
+    return false;
+  }
+  channel.close();
+  return reply == msg;
+}
+
+bool test_session_resumption(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  // A full cache drops the ticket stored longest ago, not the one whose
+  // key sorts first; storing "a" again makes "b" the oldest.  Fresh
+  // sessions aren't resumable, so taking one just removes it.
+  client_session_cache small(2);
+  small.put_session("a", SSL_SESSION_new());
+  small.put_session("b", SSL_SESSION_new());
+  small.put_session("a", SSL_SESSION_new());
+  small.put_session("c", SSL_SESSION_new());
+  int before = small.num_entries();
+  small.take_session("b");
+  int after_b = small.num_entries();
+  small.take_session("a");
+  if (before != 2 || after_b != 2 || small.num_entries() != 1) {
+    printf("%s() error, line %d, evicted the wrong session\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  const int            max_keys = 2;
+  const int            num_connections = 5;
+  session_ticket_keys  keys(max_keys);
+  client_session_cache cache(16);
+
+  server_dispatch_pool pool(2, 4);
+  pool.set_ticket_keys(&keys);
+  if (!pool.init(channel_test_host,
+                 0,
+                 channel_policy_cert,
+                 channel_server_key,
+                 channel_server_cert,
+                 echo_service)) {
+    printf("%s() error, line %d, can't init pool\n", __func__, __LINE__);
+    return false;
+  }
+  std::thread server(run_pool, &pool);
+
+  bool ret = true;
+  for (int i = 0; ret && i < num_connections; i++) {
+    if (!resumption_client(pool.port(), &cache)) {
+      printf("%s() error, line %d, connection %d failed\n",
+             __func__,
+             __LINE__,
+             i);
+      ret = false;
+    }
+  }
+  // Only the first connection should need a full handshake.
+  if (ret
+      && (cache.full_handshakes() != 1
+          || cache.resumptions() != num_connections - 1)) {
+    printf("%s() error, line %d, %lu full handshakes, %lu resumptions\n",
+           __func__,
+           __LINE__,
+           (unsigned long)cache.full_handshakes(),
+           (unsigned long)cache.resumptions());
+    ret = false;
+  }
+
+  // A ticket under the previous key is still good.
+  keys.rotate();
+  if (ret && (!resumption_client(pool.port(), &cache)
+              || cache.resumptions() != num_connections)) {
+    printf("%s() error, line %d, no resumption after rotate\n",
+           __func__,
+           __LINE__);
+    ret = false;
+  }
+
+  // Once its key has been rotated out, it is not.
+  for (int i = 0; i < max_keys; i++)
+    keys.rotate();
+  if (ret && (!resumption_client(pool.port(), &cache)
+              || cache.full_handshakes() != 2)) {
+    printf("%s() error, line %d, stale ticket accepted\n", __func__, __LINE__);
+    ret = false;
+  }
+
+  pool.stop();
+  server.join();
+
+  if (print_all) {
+    printf("lookups: %lu, resumptions: %lu, full handshakes: %lu, hit rate: "
+           "%.2f\n",
+           (unsigned long)cache.lookups(),
+           (unsigned long)cache.resumptions(),
+           (unsigned long)cache.full_handshakes(),
+           (double)cache.resumptions() / (double)cache.lookups());
+    printf("tickets issued: %lu, accepted: %lu, rejected: %lu\n",
+           (unsigned long)keys.tickets_issued(),
+           (unsigned long)keys.tickets_accepted(),
+           (unsigned long)keys.tickets_rejected());
+  }
+  return ret;
+}
+
+// Echoes requests, except "bye", which closes the connection.
+static bool echo_until_bye(secure_authenticated_channel &channel,
+                           const string &                request,
+                           string *                      response) {
+  if (request == "bye")
+    return false;
+  response->assign(request);
+  return true;
+}
+
+static void pooled_client(client_channel_pool *pool,
+                          int                  port,
+                          int                  client_num,
+                          int                  num_requests,
+                          bool *               ok) {
+  *ok = true;
+  for (int i = 0; i < num_requests; i++) {
+    secure_authenticated_channel *channel =
+        pool->acquire(channel_test_host, port);
+    if (channel == nullptr) {
+      *ok = false;
+      return;
+    }
+    string msg("request ");
+    msg.append(std::to_string(i));
+    msg.append(" from thread ");
+    msg.append(std::to_string(client_num));
+    string reply;
+    bool   good = channel->write(msg.size(), (byte *)msg.data()) > 0
+                && channel->read(&reply) >= 0 && reply == msg;
+    pool->release(channel, good);
+    if (!good) {
+      *ok = false;
+      return;
+    }
+  }
+}
+
+static bool pooled_client_once(client_channel_pool *pool, int port) {
+  bool ok = false;
+  pooled_client(pool, port, 0, 1, &ok);
+  return ok;
+}
+
+bool test_client_channel_pool(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  const int num_threads = 4;
+  const int num_requests = 10;
+
+  event_dispatch_server server(1);
+  if (!server.init(channel_test_host,
+                   0,
+                   channel_policy_cert,
+                   channel_server_key,
+                   channel_server_cert,
+                   echo_until_bye)) {
+    printf("%s() error, line %d, can't init server\n", __func__, __LINE__);
+    return false;
+  }
+  std::thread server_thread(run_event_server, &server);
+
+  client_channel_pool pool(num_threads);
+  pool.init(channel_policy_cert, channel_client_key, channel_client_cert);
+
+  bool         thread_ok[num_threads];
+  std::thread *threads[num_threads];
+  for (int i = 0; i < num_threads; i++) {
+    threads[i] = new std::thread(pooled_client,
+                                 &pool,
+                                 server.port(),
+                                 i,
+                                 num_requests,
+                                 &thread_ok[i]);
+  }
+  bool ret = true;
+  for (int i = 0; i < num_threads; i++) {
+    threads[i]->join();
+    delete threads[i];
+    if (!thread_ok[i]) {
+      printf("%s() error, line %d, thread %d failed\n", __func__, __LINE__, i);
+      ret = false;
+    }
+  }
+
+  // Never more connections than concurrent users.
+  if (ret
+      && (pool.connections_opened() > (uint64_t)num_threads
+          || pool.connections_opened() + pool.reuses()
+                 != (uint64_t)(num_threads * num_requests)
+          || pool.num_in_use() != 0)) {
+    printf("%s() error, line %d, opened %lu, reused %lu, in use %d\n",
+           __func__,
+           __LINE__,
+           (unsigned long)pool.connections_opened(),
+           (unsigned long)pool.reuses(),
+           pool.num_in_use());
+    ret = false;
+  }
+
+  // Have the server close an idle channel; the pool must not hand it out.
+  pool.close_idle();
+  secure_authenticated_channel *channel =
+      pool.acquire(channel_test_host, server.port());
+  string bye("bye");
+  if (channel == nullptr || channel->write(bye.size(), (byte *)bye.data()) <= 0)
+    ret = false;
+  pool.release(channel, true);
+  for (int i = 0; i < 100 && server.connections_open() > 0; i++)
+    usleep(10000);
+  if (ret) {
+    uint64_t failures = pool.health_check_failures();
+    ret = pooled_client_once(&pool, server.port())
+          && pool.health_check_failures() == failures + 1;
+    if (!ret) {
+      printf("%s() error, line %d, closed channel reused\n",
+             __func__,
+             __LINE__);
+    }
+  }
+
+  if (print_all) {
+    printf("opened: %lu, reused: %lu, health check failures: %lu, idle: %d\n",
+           (unsigned long)pool.connections_opened(),
+           (unsigned long)pool.reuses(),
+           (unsigned long)pool.health_check_failures(),
+           pool.num_idle());
+  }
+  pool.close_idle();
+  server.stop();
+  server_thread.join();
+  return ret;
+}
+
+// Sizes around the point where a message no longer fits in one record,
+// and one read in several growing pieces.
+static const int sized_io_test_sizes[] =
+    {0, 1, 100, 16379, 16380, 16381, 100000, 300000};
+static const int num_sized_io_test_sizes =
+    sizeof(sized_io_test_sizes) / sizeof(sized_io_test_sizes[0]);
+
+static void fill_test_message(int size, string *msg) {
+  msg->resize(size);
+  for (int i = 0; i < size; i++)
+    (*msg)[i] = (char)(i * 7 + size);
+}
+
+static void sized_socket_writer(int fd, bool *ok) {
+  *ok = true;
+  for (int i = 0; *ok && i < num_sized_io_test_sizes; i++) {
+    string msg;
+    fill_test_message(sized_io_test_sizes[i], &msg);
+    if (sized_socket_write(fd, msg.size(), (byte *)msg.data())
+        != (int)msg.size())
+      *ok = false;
+  }
+}
+
+bool test_sized_io(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  // Sockets
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    printf("%s() error, line %d, socketpair failed\n", __func__, __LINE__);
+    return false;
+  }
+  bool        write_ok = false;
+  std::thread writer(sized_socket_writer, fds[0], &write_ok);
+  bool        ret = true;
+  for (int i = 0; ret && i < num_sized_io_test_sizes; i++) {
+    string msg;
+    string got;
+    fill_test_message(sized_io_test_sizes[i], &msg);
+    if (sized_socket_read(fds[1], &got) != (int)msg.size() || got != msg) {
+      printf("%s() error, line %d, socket size %d failed\n",
+             __func__,
+             __LINE__,
+             (int)msg.size());
+      ret = false;
+    }
+  }
+  close(fds[1]);
+  writer.join();
+  close(fds[0]);
+  if (!ret || !write_ok)
+    return false;
+
+  // A size over the limit is refused before anything is allocated.
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    printf("%s() error, line %d, socketpair failed\n", __func__, __LINE__);
+    return false;
+  }
+  int  too_big = max_sized_message_size + 1;
+  byte some[16];
+  memset(some, 0, sizeof(some));
+  string got;
+  if (write(fds[0], (byte *)&too_big, sizeof(int)) != (int)sizeof(int)
+      || write(fds[0], some, sizeof(some)) != (int)sizeof(some)
+      || sized_socket_read(fds[1], &got) >= 0 || !got.empty()
+      || sized_socket_write(fds[0], too_big, some) >= 0) {
+    printf("%s() error, line %d, oversized message accepted\n",
+           __func__,
+           __LINE__);
+    ret = false;
+  }
+  close(fds[1]);
+  close(fds[0]);
+  if (!ret)
+    return false;
+
+  // TLS, against the event server's own frame parser.  An empty message
+  // gets no reply from it, so start at 1 byte.
+  event_dispatch_server server(1);
+  if (!server.init(channel_test_host,
+                   0,
+                   channel_policy_cert,
+                   channel_server_key,
+                   channel_server_cert,
+                   echo_request)) {
+    printf("%s() error, line %d, can't init server\n", __func__, __LINE__);
+    return false;
+  }
+  std::thread server_thread(run_event_server, &server);
+
+  string                       role("client");
+  secure_authenticated_channel channel(role);
+  if (!channel.init_client_ssl(channel_test_host,
+                               server.port(),
+                               channel_policy_cert,
+                               channel_client_key,
+                               channel_client_cert)) {
+    ret = false;
+  }
+  for (int i = 1; ret && i < num_sized_io_test_sizes; i++) {
+    string msg;
+    string got;
+    fill_test_message(sized_io_test_sizes[i], &msg);
+    if (channel.write(msg.size(), (byte *)msg.data()) != (int)msg.size()
+        || channel.read(&got) != (int)msg.size() || got != msg) {
+      printf("%s() error, line %d, ssl size %d failed\n",
+             __func__,
+             __LINE__,
+             (int)msg.size());
+      ret = false;
+    }
+    if (print_all && ret) {
+      printf("sized ssl round trip of %d bytes ok\n", (int)msg.size());
+    }
+  }
+  channel.close();
+  server.stop();
+  server_thread.join();
+  return ret;
+}
+
+// Frame sizes around the first record boundary and well past the old
+// 64 KB pipe limit.
+static const int framed_io_test_sizes[] =
+    {0, 1, 16367, 16368, 16369, 300000};
+static const int num_framed_io_test_sizes =
+    sizeof(framed_io_test_sizes) / sizeof(framed_io_test_sizes[0]);
+const int framed_io_test_chunk_size = 1000;
+
+static void framed_pipe_writer(int fd, bool *ok) {
+  *ok = true;
+  frame_stream s(fd);
+
+  // Legacy format, past the old 64 KB limit.
+  string msg;
+  fill_test_message(100000, &msg);
+  if (sized_pipe_write(fd, msg.size(), (byte *)msg.data()) != (int)msg.size())
+    *ok = false;
+
+  // Whole frames, then the same frames in pieces.
+  for (int i = 0; *ok && i < num_framed_io_test_sizes; i++) {
+    fill_test_message(framed_io_test_sizes[i], &msg);
+    if (!framed_write(s, msg.size(), (byte *)msg.data()))
+      *ok = false;
+  }
+  for (int i = 0; *ok && i < num_framed_io_test_sizes; i++) {
+    fill_test_message(framed_io_test_sizes[i], &msg);
+    if (!framed_write_header(s, msg.size()))
+      *ok = false;
+    for (int done = 0; *ok && done < (int)msg.size();) {
+      int n = (int)msg.size() - done;
+      if (n > 777)
+        n = 777;
+      if (!framed_write_data(s, n, (byte *)msg.data() + done))
+        *ok = false;
+      done += n;
+    }
+  }
+}
+
+static bool append_chunk(void *arg, int size, const byte *chunk) {
+  ((string *)arg)->append((const char *)chunk, size);
+  return true;
+}
+
+bool test_framed_io(bool print_all) {
+  byte     header[frame_header_size];
+  uint64_t size = 0;
+  if (!encode_frame_header(0x0102030405060708ULL, header)
+      || memcmp(header, "CFRM", 4) != 0 || header[4] != frame_version
+      || header[8] != 0x01 || header[15] != 0x08
+      || !decode_frame_header(header, &size) || size != 0x0102030405060708ULL) {
+    printf("%s() error, line %d, bad frame header\n", __func__, __LINE__);
+    return false;
+  }
+  header[4] = frame_version + 1;
+  if (decode_frame_header(header, &size)) {
+    printf("%s() error, line %d, accepted unknown version\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  int fds[2];
+  if (pipe(fds) != 0) {
+    printf("%s() error, line %d, pipe failed\n", __func__, __LINE__);
+    return false;
+  }
+  bool         write_ok = false;
+  std::thread  writer(framed_pipe_writer, fds[1], &write_ok);
+  frame_stream s(fds[0]);
+  bool         ret = true;
+
+  string msg;
+  string got;
+  fill_test_message(100000, &msg);
+  if (sized_pipe_read(fds[0], &got) != (int)msg.size() || got != msg) {
+    printf("%s() error, line %d, sized pipe read failed\n", __func__, __LINE__);
+    ret = false;
+  }
+
+  for (int i = 0; ret && i < num_framed_io_test_sizes; i++) {
+    fill_test_message(framed_io_test_sizes[i], &msg);
+    if (!framed_read(s, msg.size(), &got) || got != msg) {
+      printf("%s() error, line %d, frame size %d failed\n",
+             __func__,
+             __LINE__,
+             (int)msg.size());
+      ret = false;
+    }
+  }
+
+  // Alternate between a caller buffer and a chunk callback.
+  byte chunk[framed_io_test_chunk_size];
+  for (int i = 0; ret && i < num_framed_io_test_sizes; i++) {
+    fill_test_message(framed_io_test_sizes[i], &msg);
+    got.clear();
+    if (!framed_read_header(s, &size) || size != msg.size()) {
+      ret = false;
+    } else if (i % 2 == 0) {
+      got.resize(size);
+      ret = framed_read_data(s, size, (byte *)&got[0]);
+    } else {
+      ret = framed_read_chunks(s,
+                               size,
+                               framed_io_test_chunk_size,
+                               chunk,
+                               append_chunk,
+                               &got);
+    }
+    if (!ret || got != msg) {
+      printf("%s() error, line %d, streamed frame size %d failed\n",
+             __func__,
+             __LINE__,
+             (int)msg.size());
+      ret = false;
+    }
+    if (print_all && ret) {
+      printf("streamed frame of %d bytes ok\n", (int)msg.size());
+    }
+  }
+  close(fds[0]);
+  writer.join();
+  close(fds[1]);
+  if (!ret || !write_ok)
+    return false;
+
+  // A frame that claims to be large but stops short only costs what
+  // actually arrived.
+  if (pipe(fds) != 0) {
+    printf("%s() error, line %d, pipe failed\n", __func__, __LINE__);
+    return false;
+  }
+  byte short_frame[frame_header_size + 100];
+  encode_frame_header(200 * 1024 * 1024, short_frame);
+  memset(short_frame + frame_header_size, 1, 100);
+  frame_stream short_s(fds[0]);
+  string       short_got;
+  if (write(fds[1], short_frame, sizeof(short_frame))
+          != (int)sizeof(short_frame)
+      || close(fds[1]) != 0
+      || framed_read(short_s, 256 * 1024 * 1024, &short_got)
+      || short_got.capacity() > 1024 * 1024) {
+    printf("%s() error, line %d, short frame allocated %lu bytes\n",
+           __func__,
+           __LINE__,
+           (unsigned long)short_got.capacity());
+    ret = false;
+  }
+  close(fds[0]);
+  if (!ret)
+    return false;
+
+  // Legacy messages past max_sized_message_size are refused.
+  if (pipe(fds) != 0) {
+    printf("%s() error, line %d, pipe failed\n", __func__, __LINE__);
+    return false;
+  }
+  int too_big = max_sized_message_size + 1;
+  if (write(fds[1], (byte *)&too_big, sizeof(int)) != (int)sizeof(int)
+      || sized_pipe_read(fds[0], &got) >= 0
+      || sized_pipe_write(fds[1], too_big, chunk) >= 0) {
+    printf("%s() error, line %d, oversized pipe message accepted\n",
+           __func__,
+           __LINE__);
+    ret = false;
+  }
+  close(fds[0]);
+  close(fds[1]);
+  return ret;
+}
+
+const uint64_t ktls_test_max_file_size = 16 * 1024 * 1024;
+
+// Sends each file it receives straight back.
+static void file_echo_service(secure_authenticated_channel &channel) {
+  string file_name("ktls_test_server.bin");
+  while (channel.receive_file(file_name, ktls_test_max_file_size)) {
+    if (!channel.send_file(file_name))
+      break;
+  }
+  unlink(file_name.c_str());
+}
+
+bool test_ktls_send_file(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  server_dispatch_pool pool(1, 1);
+  pool.set_ktls(true);
+  if (!pool.init(channel_test_host,
+                 0,
+                 channel_policy_cert,
+                 channel_server_key,
+                 channel_server_cert,
+                 file_echo_service)) {
+    printf("%s() error, line %d, can't init pool\n", __func__, __LINE__);
+    return false;
+  }
+  std::thread server(run_pool, &pool);
+
+  // Not a multiple of the copy size, so the last piece is short.
+  string src_name("ktls_test_src.bin");
+  string dst_name("ktls_test_dst.bin");
+  string src;
+  fill_test_message(1000003, &src);
+  bool ret = write_file(src_name, src.size(), (byte *)src.data());
+
+  string                       role("client");
+  secure_authenticated_channel channel(role);
+  channel.set_ktls(true);
+  if (ret
+      && !channel.init_client_ssl(channel_test_host,
+                                  pool.port(),
+                                  channel_policy_cert,
+                                  channel_client_key,
+                                  channel_client_cert)) {
+    printf("%s() error, line %d, can't connect\n", __func__, __LINE__);
+    ret = false;
+  }
+  string got;
+  if (ret
+      && (!channel.send_file(src_name)
+          || !channel.receive_file(dst_name, ktls_test_max_file_size)
+          || !read_file_into_string(dst_name, &got) || got != src)) {
+    printf("%s() error, line %d, file round trip failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+  }
+  if (print_all) {
+    printf("kTLS send: %s, receive: %s\n",
+           channel.ktls_send_active() ? "on" : "off",
+           channel.ktls_recv_active() ? "on" : "off");
+  }
+
+  // An empty file is still a frame.
+  if (ret
+      && (!write_file(src_name, 0, (byte *)src.data())
+          || !channel.send_file(src_name)
+          || !channel.receive_file(dst_name, ktls_test_max_file_size)
+          || !read_file_into_string(dst_name, &got) || !got.empty())) {
+    printf("%s() error, line %d, empty file failed\n", __func__, __LINE__);
+    ret = false;
+  }
+  channel.close();
+  unlink(src_name.c_str());
+  unlink(dst_name.c_str());
+  pool.stop();
+  server.join();
+  return ret;
+}
+
+// One client of test_async_channel_driver.  All its requests are queued
+// as soon as it connects; the echoes must come back in order.
+class async_test_client {
+ public:
+  async_channel_driver *driver_;
+  int                   id_;
+  int                   writes_done_;
+  int                   received_;
+  bool                  connected_;
+  bool                  ok_;
+};
+
+const int async_test_messages = 5;
+
+// Never empty: the event server doesn't answer empty requests.
+static void async_test_message(int id, int n, string *msg) {
+  fill_test_message(n * 9000 + id + 1, msg);
+}
+
+static void async_test_written(void *                        arg,
+                               secure_authenticated_channel *channel,
+                               bool                          ok) {
+  async_test_client *c = (async_test_client *)arg;
+  if (ok)
+    c->writes_done_++;
+  else
+    c->ok_ = false;
+}
+
+static void async_test_read(void *                        arg,
+                            secure_authenticated_channel *channel,
+                            bool                          ok,
+                            const string &                message) {
+  async_test_client *c = (async_test_client *)arg;
+  string             expected;
+  async_test_message(c->id_, c->received_, &expected);
+  if (!ok || message != expected) {
+    c->ok_ = false;
+    c->driver_->close(channel);
+    return;
+  }
+  if (++c->received_ == async_test_messages)
+    c->driver_->close(channel);
+}
+
+static void async_test_connected(void *                        arg,
+                                 secure_authenticated_channel *channel,
+                                 bool                          ok) {
+  async_test_client *c = (async_test_client *)arg;
+  c->connected_ = ok;
+  if (!ok) {
+    c->ok_ = false;
+    return;
+  }
+  for (int i = 0; i < async_test_messages; i++) {
+    string msg;
+    async_test_message(c->id_, i, &msg);
+    if (!c->driver_->write(channel,
+                           msg.size(),
+                           (byte *)msg.data(),
+                           async_test_written,
+                           c)
+        || !c->driver_->read(channel, async_test_read, c)) {
+      c->ok_ = false;
+    }
+  }
+}
+
+bool test_async_channel_driver(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  event_dispatch_server server(1);
+  if (!server.init(channel_test_host,
+                   0,
+                   channel_policy_cert,
+                   channel_server_key,
+                   channel_server_cert,
+                   echo_request)) {
+    printf("%s() error, line %d, can't init server\n", __func__, __LINE__);
+    return false;
+  }
+  std::thread server_thread(run_event_server, &server);
+
+  const int            num_clients = 16;
+  async_channel_driver driver;
+  async_test_client    clients[num_clients];
+  bool                 ret = driver.init();
+  for (int i = 0; ret && i < num_clients; i++) {
+    clients[i].driver_ = &driver;
+    clients[i].id_ = i;
+    clients[i].writes_done_ = 0;
+    clients[i].received_ = 0;
+    clients[i].connected_ = false;
+    clients[i].ok_ = true;
+    if (driver.connect(channel_test_host,
+                       server.port(),
+                       channel_policy_cert,
+                       channel_client_key,
+                       channel_client_cert,
+                       async_test_connected,
+                       &clients[i])
+        == nullptr)
+      ret = false;
+  }
+  if (ret && !driver.run())
+    ret = false;
+
+  for (int i = 0; ret && i < num_clients; i++) {
+    if (!clients[i].ok_ || !clients[i].connected_
+        || clients[i].writes_done_ != async_test_messages
+        || clients[i].received_ != async_test_messages) {
+      printf("%s() error, line %d, client %d failed\n", __func__, __LINE__, i);
+      ret = false;
+    }
+  }
+  if (ret && (driver.num_channels() != 0 || driver.outstanding() != 0)) {
+    printf("%s() error, line %d, driver not drained\n", __func__, __LINE__);
+    ret = false;
+  }
+  if (print_all) {
+    printf("%d async clients, %lu messages handled by server\n",
+           num_clients,
+           (unsigned long)server.messages_handled());
+  }
+  server.stop();
+  server_thread.join();
+
+  // Nobody listens on a destroyed server's port, so connecting must fail
+  // through the callback.
+  int closed_port = 0;
+  {
+    event_dispatch_server closed(1);
+    if (closed.init(channel_test_host,
+                    0,
+                    channel_policy_cert,
+                    channel_server_key,
+                    channel_server_cert,
+                    echo_request))
+      closed_port = closed.port();
+  }
+  async_test_client refused;
+  refused.driver_ = &driver;
+  refused.id_ = 0;
+  refused.writes_done_ = 0;
+  refused.received_ = 0;
+  refused.connected_ = true;
+  refused.ok_ = true;
+  secure_authenticated_channel *channel = nullptr;
+  if (ret && closed_port > 0) {
+    channel = driver.connect(channel_test_host,
+                             closed_port,
+                             channel_policy_cert,
+                             channel_client_key,
+                             channel_client_cert,
+                             async_test_connected,
+                             &refused);
+  }
+  if (channel != nullptr) {
+    if (!driver.run() || refused.connected_ || refused.ok_) {
+      printf("%s() error, line %d, refused connect succeeded\n",
+             __func__,
+             __LINE__);
+      ret = false;
+    }
+    driver.close(channel);
+  }
+  return ret;
+}
+
+// Small enough that the larger messages need several window updates.
+const int mux_test_window = 64 * 1024;
+const int mux_test_streams = 8;
+const int mux_test_messages = 10;
+
+static void mux_echo_stream(channel_mux *mux, int id) {
+  string msg;
+  while (mux->receive(id, &msg)) {
+    if (!mux->send(id, msg.size(), (byte *)msg.data()))
+      break;
+  }
+  mux->close_stream(id);
+}
+
+// Echoes every message on every stream the client opens, one thread per
+// stream, until the client goes away.
+static void run_mux_echo(secure_authenticated_channel &channel,
+                         int                           max_message_size,
+                         int                           max_streams) {
+  channel_mux mux(&channel, false);
+  mux.set_stream_window(mux_test_window);
+  if (max_message_size > 0)
+    mux.set_max_message_size(max_message_size);
+  if (max_streams > 0)
+    mux.set_max_streams(max_streams);
+  if (!mux.start())
+    return;
+  std::vector<std::thread *> threads;
+  for (;;) {
+    int id = mux.accept_stream();
+    if (id < 0)
+      break;
+    threads.push_back(new std::thread(mux_echo_stream, &mux, id));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  mux.stop();
+}
+
+static void mux_echo_service(secure_authenticated_channel &channel) {
+  run_mux_echo(channel, 0, 0);
+}
+
+// Limits for the limited echo service, well under the client's defaults.
+const int mux_test_max_message = 3 * mux_test_window;
+const int mux_test_max_streams = 4;
+
+static void mux_limited_echo_service(secure_authenticated_channel &channel) {
+  run_mux_echo(channel, mux_test_max_message, mux_test_max_streams);
+}
+
+static void mux_client_stream(channel_mux *mux, int n, bool *ok) {
+  *ok = false;
+  int id = mux->open_stream();
+  if (id < 0)
+    return;
+  for (int i = 0; i < mux_test_messages; i++) {
+    // Sizes from empty to several windows.
+    string msg;
+    string got;
+    fill_test_message((i * 37 + n) * 1000 % (5 * mux_test_window), &msg);
+    if (!mux->send(id, msg.size(), (byte *)msg.data())
+        || !mux->receive(id, &got) || got != msg) {
+      printf("%s() error, line %d, stream %d message %d failed\n",
+             __func__,
+             __LINE__,
+             id,
+             i);
+      return;
+    }
+  }
+  mux->close_stream(id);
+  string got;
+  *ok = !mux->receive(id, &got);
+}
+
+bool test_channel_mux(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  server_dispatch_pool pool(1, 1);
+  if (!pool.init(channel_test_host,
+                 0,
+                 channel_policy_cert,
+                 channel_server_key,
+                 channel_server_cert,
+                 mux_echo_service)) {
+    printf("%s() error, line %d, can't init pool\n", __func__, __LINE__);
+    return false;
+  }
+  std::thread server(run_pool, &pool);
+
+  string                       role("client");
+  secure_authenticated_channel channel(role);
+  bool                         ret = true;
+  if (!channel.init_client_ssl(channel_test_host,
+                               pool.port(),
+                               channel_policy_cert,
+                               channel_client_key,
+                               channel_client_cert)) {
+    printf("%s() error, line %d, can't connect\n", __func__, __LINE__);
+    ret = false;
+  }
+
+  channel_mux mux(&channel, true);
+  mux.set_stream_window(mux_test_window);
+  if (ret && !mux.start())
+    ret = false;
+  if (ret) {
+    bool         stream_ok[mux_test_streams];
+    std::thread *threads[mux_test_streams];
+    for (int i = 0; i < mux_test_streams; i++)
+      threads[i] = new std::thread(mux_client_stream, &mux, i, &stream_ok[i]);
+    for (int i = 0; i < mux_test_streams; i++) {
+      threads[i]->join();
+      delete threads[i];
+      if (!stream_ok[i]) {
+        printf("%s() error, line %d, stream %d failed\n",
+               __func__,
+               __LINE__,
+               i);
+        ret = false;
+      }
+    }
+  }
+  if (ret && (mux.failed() || mux.num_streams() != 0)) {
+    printf("%s() error, line %d, mux failed or streams left: %d\n",
+           __func__,
+           __LINE__,
+           mux.num_streams());
+    ret = false;
+  }
+  if (print_all) {
+    printf("mux frames sent: %lu, received: %lu\n",
+           (unsigned long)mux.frames_sent(),
+           (unsigned long)mux.frames_received());
+  }
+  mux.stop();
+  channel.close();
+  pool.stop();
+  server.join();
+  return ret;
+}
+
+// Connects to the limited echo service and echoes one message on each of
+// num_streams streams, every stream staying open until the end.
+static bool mux_limit_round(int port, int num_streams, int message_size) {
+  string                       role("client");
+  secure_authenticated_channel channel(role);
+  if (!channel.init_client_ssl(channel_test_host,
+                               port,
+                               channel_policy_cert,
+                               channel_client_key,
+                               channel_client_cert))
+    return false;
+  channel_mux mux(&channel, true);
+  mux.set_stream_window(mux_test_window);
+  bool ret = mux.start();
+  for (int i = 0; ret && i < num_streams; i++) {
+    string msg;
+    string got;
+    fill_test_message(message_size, &msg);
+    int id = mux.open_stream();
+    ret = id >= 0 && mux.send(id, msg.size(), (byte *)msg.data())
+          && mux.receive(id, &got) && got == msg;
+  }
+  mux.stop();
+  channel.close();
+  return ret;
+}
+
+bool test_channel_mux_limits(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  server_dispatch_pool pool(1, 1);
+  if (!pool.init(channel_test_host,
+                 0,
+                 channel_policy_cert,
+                 channel_server_key,
+                 channel_server_cert,
+                 mux_limited_echo_service)) {
+    printf("%s() error, line %d, can't init pool\n", __func__, __LINE__);
+    return false;
+  }
+  std::thread server(run_pool, &pool);
+
+  // At the limits, then one stream and one byte past them.  A message
+  // with no end yet counts against the limit too, since window credit
+  // comes back as soon as its frames arrive.  The service's mux fails and
+  // drops the connection, so the client's last receive fails.
+  bool ret = true;
+  if (!mux_limit_round(pool.port(),
+                       mux_test_max_streams,
+                       mux_test_max_message)) {
+    printf("%s() error, line %d, round at the limits failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+  }
+  if (ret
+      && (mux_limit_round(pool.port(), mux_test_max_streams + 1, 1)
+          || mux_limit_round(pool.port(), 1, mux_test_max_message + 1))) {
+    printf("%s() error, line %d, round past the limits passed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+  }
+  pool.stop();
+  server.join();
+  return ret;
+}
+
+// Handshake rate for each kind of auth key.  Both ends use the same kind of
+// key; the policy key that signs the admissions certs stays RSA-2048.
+static bool time_auth_key_handshakes(const string &key_type,
+                                     int           num_handshakes,
+                                     bool          print_all) {
+  key_message server_key;
+  string      server_cert;
+  key_message client_key;
+  string      client_cert;
+  if (!make_channel_auth_key("server", key_type, &server_key, &server_cert))
+    return false;
+  if (!make_channel_auth_key("client", key_type, &client_key, &client_cert))
+    return false;
+
+  server_dispatch_pool pool(1, 2);
+  if (!pool.init(channel_test_host,
+                 0,
+                 channel_policy_cert,
+                 server_key,
+                 server_cert,
+                 echo_service)) {
+    printf("%s() error, line %d, can't init pool\n", __func__, __LINE__);
+    return false;
+  }
+  std::thread server(run_pool, &pool);
+
+  bool ret = true;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_handshakes && ret; i++) {
+    string                       role("client");
+    secure_authenticated_channel channel(role);
+    if (!channel.init_client_ssl(channel_test_host,
+                                 pool.port(),
+                                 channel_policy_cert,
+                                 client_key,
+                                 client_cert)) {
+      printf("%s() error, line %d, %s handshake %d failed\n",
+             __func__,
+             __LINE__,
+             key_type.c_str(),
+             i);
+      ret = false;
+      break;
+    }
+    string msg("ping");
+    string reply;
+    if (channel.write(msg.size(), (byte *)msg.data()) <= 0
+        || channel.read(&reply) < 0 || reply != msg) {
+      printf("%s() error, line %d, %s echo failed\n",
+             __func__,
+             __LINE__,
+             key_type.c_str());
+      ret = false;
+    }
+    string peer_id;
+    if (ret && (!channel.get_peer_id(&peer_id) || peer_id.empty())) {
+      printf("%s() error, line %d, %s bad peer id\n",
+             __func__,
+             __LINE__,
+             key_type.c_str());
+      ret = false;
+    }
+    channel.close();
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                              - start)
+                    .count();
+
+  pool.stop();
+  server.join();
+  if (ret && print_all && secs > 0.0) {
+    printf("%s: %d handshakes in %.3f sec, %.1f handshakes/sec\n",
+           key_type.c_str(),
+           num_handshakes,
+           secs,
+           num_handshakes / secs);
+  }
+  return ret;
+}
+
+bool test_channel_auth_key_types(bool print_all) {
+  if (!init_channel_test_keys())
+    return false;
+
+  const int    num_handshakes = 20;
+  const string key_types[] = {
+      Enc_method_rsa_2048,
+      Enc_method_ecc_256,
+      Enc_method_ecc_384,
+  };
+  for (const string &key_type : key_types) {
+    if (!time_auth_key_handshakes(key_type, num_handshakes, print_all))
+      return false;
+  }
+  return true;
+}
@@ -13,6 +13,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 #include "certifier.h"
 #include "support.h"
 
@@ -426,6 +430,1237 @@ bool init_top_level_is_trusted(predicate_dominance &root) {
   return true;
 }
 
+// policy_key says measurement i is-trusted, for i < n.
+static bool make_measurement_policy(const key_message &    policy_key,
+                                    const key_message &    policy_public_key,
+                                    int                    n,
+                                    signed_claim_sequence *policy) {
+  entity_message policy_ent;
+  if (!make_key_entity(policy_public_key, &policy_ent))
+    return false;
+
+  time_point t_nb;
+  time_point t_na;
+  time_now(&t_nb);
+  add_interval_to_time_point(t_nb, 24.0, &t_na);
+  string nb;
+  string na;
+  time_to_string(t_nb, &nb);
+  time_to_string(t_na, &na);
+
+  string it_verb("is-trusted");
+  string says_verb("says");
+  string format("vse-clause");
+  string descriptor("measurement policy");
+  for (int i = 0; i < n; i++) {
+    string measurement(32, (char)i);
+    measurement[0] = (char)(i >> 8);
+    entity_message m_ent;
+    vse_clause     is_trusted;
+    vse_clause     says;
+    if (!make_measurement_entity(measurement, &m_ent)
+        || !make_unary_vse_clause(m_ent, it_verb, &is_trusted)
+        || !make_indirect_vse_clause(policy_ent, says_verb, is_trusted, &says))
+      return false;
+    string serialized_says;
+    says.SerializeToString(&serialized_says);
+    claim_message claim;
+    if (!make_claim(serialized_says.size(),
+                    (byte *)serialized_says.data(),
+                    format,
+                    descriptor,
+                    nb,
+                    na,
+                    &claim))
+      return false;
+    if (!make_signed_claim(Enc_method_ecc_256_sha256_pkcs_sign,
+                           claim,
+                           policy_key,
+                           policy->add_claims()))
+      return false;
+  }
+  return true;
+}
+
+bool test_verify_signed_claims(bool print_all) {
+  key_message policy_key;
+  key_message policy_public_key;
+  key_message other_key;
+  if (!make_certifier_ecc_key(256, &policy_key)
+      || !private_key_to_public_key(policy_key, &policy_public_key)
+      || !make_certifier_ecc_key(256, &other_key)) {
+    printf("%s() error, line: %d, can't make keys\n", __func__, __LINE__);
+    return false;
+  }
+
+  const int             n = 256;
+  signed_claim_sequence policy;
+  if (!make_measurement_policy(policy_key, policy_public_key, n, &policy)) {
+    printf("%s() error, line: %d, can't make policy\n", __func__, __LINE__);
+    return false;
+  }
+
+  bool results[n];
+  auto start = std::chrono::steady_clock::now();
+  int  num_verified = verify_signed_claim_sequence(policy, nullptr, 1, results);
+  auto serial_time = std::chrono::steady_clock::now() - start;
+  if (num_verified != n) {
+    printf("%s() error, line: %d, %d of %d verified\n",
+           __func__,
+           __LINE__,
+           num_verified,
+           n);
+    return false;
+  }
+  start = std::chrono::steady_clock::now();
+  num_verified = verify_signed_claim_sequence(policy, nullptr, 0, results);
+  auto parallel_time = std::chrono::steady_clock::now() - start;
+  if (num_verified != n) {
+    printf("%s() error, line: %d, %d of %d verified in parallel\n",
+           __func__,
+           __LINE__,
+           num_verified,
+           n);
+    return false;
+  }
+  if (print_all) {
+    printf("%d claims verified: %.3f ms on one thread, %.3f ms on all cores\n",
+           n,
+           std::chrono::duration<double, std::milli>(serial_time).count(),
+           std::chrono::duration<double, std::milli>(parallel_time).count());
+  }
+
+  proved_statements proved;
+  if (!init_policy(policy, policy_public_key, &proved)
+      || proved.proved_size() != n) {
+    printf("%s() error, line: %d, init_policy failed\n", __func__, __LINE__);
+    return false;
+  }
+
+  // Results are per claim.
+  const int bad_sig = 17;
+  string    sig = policy.claims(bad_sig).signature();
+  sig[sig.size() / 2] ^= 1;
+  policy.mutable_claims(bad_sig)->set_signature(sig);
+  const signed_claim_message *claims[n];
+  for (int i = 0; i < n; i++)
+    claims[i] = &policy.claims(i);
+  num_verified = verify_signed_claims(n, claims, nullptr, 4, results);
+  if (num_verified != n - 1 || results[bad_sig]) {
+    printf("%s() error, line: %d, bad signature verified\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  num_verified = verify_signed_claims(n, claims, &other_key, 4, results);
+  if (num_verified != 0) {
+    printf("%s() error, line: %d, wrong key verified\n", __func__, __LINE__);
+    return false;
+  }
+
+  proved_statements rejected;
+  if (init_policy(policy, policy_public_key, &rejected)) {
+    printf("%s() error, line: %d, tampered policy accepted\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return true;
+}
+
+bool test_verify_and_parse_claim(bool print_all) {
+  key_message policy_key;
+  key_message policy_public_key;
+  if (!make_certifier_ecc_key(256, &policy_key)
+      || !private_key_to_public_key(policy_key, &policy_public_key)) {
+    printf("%s() error, line: %d, can't make keys\n", __func__, __LINE__);
+    return false;
+  }
+  signed_claim_sequence policy;
+  if (!make_measurement_policy(policy_key, policy_public_key, 2, &policy)) {
+    printf("%s() error, line: %d, can't make policy\n", __func__, __LINE__);
+    return false;
+  }
+
+  const signed_claim_message &sc = policy.claims(1);
+  claim_message               claim;
+  if (!verify_signed_claim_and_parse(sc, policy_public_key, &claim)) {
+    printf("%s() error, line: %d, verify failed\n", __func__, __LINE__);
+    return false;
+  }
+  string serialized_claim;
+  claim.SerializeToString(&serialized_claim);
+  if (serialized_claim != sc.serialized_claim_message()) {
+    printf("%s() error, line: %d, wrong claim\n", __func__, __LINE__);
+    return false;
+  }
+
+  vse_clause extracted;
+  vse_clause unverified;
+  if (!verify_signed_assertion_and_extract_clause(policy_public_key,
+                                                  sc,
+                                                  &extracted)
+      || !get_vse_clause_from_signed_claim(sc, &unverified)
+      || !same_vse_claim(extracted, unverified)) {
+    printf("%s() error, line: %d, wrong clause\n", __func__, __LINE__);
+    return false;
+  }
+  if (print_all) {
+    print_vse_clause(extracted);
+    printf("\n");
+  }
+
+  // A claim signed for a different statement doesn't verify.
+  signed_claim_message swapped(sc);
+  swapped.set_serialized_claim_message(
+      policy.claims(0).serialized_claim_message());
+  if (verify_signed_claim_and_parse(swapped, policy_public_key, &claim)
+      || verify_signed_assertion_and_extract_clause(policy_public_key,
+                                                    swapped,
+                                                    &extracted)) {
+    printf("%s() error, line: %d, swapped claim verified\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return true;
+}
+
+static bool make_test_platform(const key_message *attest_key,
+                               bool               reversed,
+                               platform *         plat) {
+  string   names[2] = {"api-major", "debug"};
+  string   types[2] = {"int", "string"};
+  string   cmps[2] = {">=", "="};
+  uint64_t ints[2] = {3, 0};
+  string   strs[2] = {"", "no"};
+
+  properties props;
+  for (int j = 0; j < 2; j++) {
+    int i = reversed ? 1 - j : j;
+    if (!make_property(names[i],
+                       types[i],
+                       cmps[i],
+                       ints[i],
+                       strs[i],
+                       props.add_props()))
+      return false;
+  }
+  string type("amd-sev-snp");
+  return make_platform(type, props, attest_key, plat);
+}
+
+bool test_fingerprints(bool print_all) {
+  key_message k1;
+  key_message k1_public;
+  key_message k2;
+  key_message k3;
+  if (!make_certifier_ecc_key(256, &k1)
+      || !private_key_to_public_key(k1, &k1_public)
+      || !make_certifier_ecc_key(256, &k2)
+      || !make_certifier_rsa_key(2048, &k3)) {
+    printf("%s() error, line: %d, can't make keys\n", __func__, __LINE__);
+    return false;
+  }
+
+  // Keys: names don't matter, key material and type do.
+  key_message k1_renamed(k1);
+  k1_renamed.set_key_name("another-name");
+  string fp1, fp1_renamed, fp1_public, fp2, fp3;
+  if (!key_fingerprint(k1, &fp1) || !key_fingerprint(k1_renamed, &fp1_renamed)
+      || !key_fingerprint(k1_public, &fp1_public)
+      || !key_fingerprint(k2, &fp2) || !key_fingerprint(k3, &fp3)) {
+    printf("%s() error, line: %d, key_fingerprint failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if ((int)fp1.size() != fingerprint_size || fp1 != fp1_renamed
+      || fp1 == fp1_public || fp1 == fp2 || fp1 == fp3) {
+    printf("%s() error, line: %d, bad key fingerprints\n", __func__, __LINE__);
+    return false;
+  }
+  if (!same_key(k1, k1_renamed) || same_key(k1, k2)) {
+    printf("%s() error, line: %d, same_key disagrees\n", __func__, __LINE__);
+    return false;
+  }
+  key_message unknown;
+  unknown.set_key_type("no-such-key-type");
+  if (key_fingerprint(unknown, &fp2)) {
+    printf("%s() error, line: %d, fingerprinted bad key\n", __func__, __LINE__);
+    return false;
+  }
+
+  // Platforms: property order doesn't matter.
+  platform       p1;
+  platform       p2;
+  entity_message pe1;
+  entity_message pe2;
+  string         pfp1, pfp2;
+  if (!make_test_platform(&k1_public, false, &p1)
+      || !make_test_platform(&k1_public, true, &p2)
+      || !make_platform_entity(p1, &pe1) || !make_platform_entity(p2, &pe2)
+      || !entity_fingerprint(pe1, &pfp1) || !entity_fingerprint(pe2, &pfp2)
+      || pfp1 != pfp2 || !same_entity(pe1, pe2)) {
+    printf("%s() error, line: %d, bad platform fingerprints\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // Properties sharing a name all count: {a=1, a=2} isn't {a=2}, and an
+  // index over one mustn't find the other.
+  platform   dup_plat;
+  platform   single_plat;
+  properties dup_props;
+  properties single_props;
+  string     a("a"), int_type("int"), eq("="), none;
+  string     dup_type("amd-sev-snp");
+  if (!make_property(a, int_type, eq, 1, none, dup_props.add_props())
+      || !make_property(a, int_type, eq, 2, none, dup_props.add_props())
+      || !make_property(a, int_type, eq, 2, none, single_props.add_props())
+      || !make_platform(dup_type, dup_props, nullptr, &dup_plat)
+      || !make_platform(dup_type, single_props, nullptr, &single_plat)) {
+    printf("%s() error, line: %d, can't make platforms\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  entity_message    dup_ent, single_ent;
+  vse_clause        dup_trusted, single_trusted;
+  string            trusted("is-trusted");
+  string            dup_fp, single_fp;
+  proved_statements dup_proved;
+  if (!make_platform_entity(dup_plat, &dup_ent)
+      || !make_platform_entity(single_plat, &single_ent)
+      || !make_unary_vse_clause(dup_ent, trusted, &dup_trusted)
+      || !make_unary_vse_clause(single_ent, trusted, &single_trusted)
+      || !entity_fingerprint(dup_ent, &dup_fp)
+      || !entity_fingerprint(single_ent, &single_fp)) {
+    printf("%s() error, line: %d, can't make clauses\n", __func__, __LINE__);
+    return false;
+  }
+  dup_proved.add_proved()->CopyFrom(dup_trusted);
+  proved_index dup_index(&dup_proved);
+  if (dup_fp == single_fp
+      || dup_index.contains(single_trusted)
+             != statement_already_proved(single_trusted, &dup_proved)) {
+    printf("%s() error, line: %d, duplicate properties ignored\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // Clauses: k1 says k2 is-trusted, built twice, and with k3.
+  entity_message e1, e2, e3;
+  string         says("says");
+  string         it("is-trusted");
+  vse_clause     inner, inner3, c1, c2, c3;
+  if (!make_key_entity(k1_public, &e1) || !make_key_entity(k2, &e2)
+      || !make_key_entity(k3, &e3) || !make_unary_vse_clause(e2, it, &inner)
+      || !make_unary_vse_clause(e3, it, &inner3)
+      || !make_indirect_vse_clause(e1, says, inner, &c1)
+      || !make_indirect_vse_clause(e1, says, inner, &c2)
+      || !make_indirect_vse_clause(e1, says, inner3, &c3)) {
+    printf("%s() error, line: %d, can't make clauses\n", __func__, __LINE__);
+    return false;
+  }
+  string cfp1, cfp2, cfp3, ifp;
+  if (!vse_clause_fingerprint(c1, &cfp1) || !vse_clause_fingerprint(c2, &cfp2)
+      || !vse_clause_fingerprint(c3, &cfp3)
+      || !vse_clause_fingerprint(inner, &ifp)) {
+    printf("%s() error, line: %d, vse_clause_fingerprint failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (cfp1 != cfp2 || cfp1 == cfp3 || cfp1 == ifp) {
+    printf("%s() error, line: %d, bad clause fingerprints\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // The memo computes each part once and agrees with the free functions.
+  fingerprint_memo memo;
+  const string *   m1 = memo.clause(c1);
+  if (m1 == nullptr || *m1 != cfp1 || memo.clause(c1) != m1
+      || *memo.clause(c1.clause()) != ifp) {
+    printf("%s() error, line: %d, bad memo\n", __func__, __LINE__);
+    return false;
+  }
+  // c1, its nested clause, two entities and two keys.
+  if (memo.size() != 6) {
+    printf("%s() error, line: %d, memo has %d entries\n",
+           __func__,
+           __LINE__,
+           memo.size());
+    return false;
+  }
+
+  if (print_all) {
+    const int rounds = 10000;
+    int       num_same = 0;
+    auto      start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+      if (same_vse_claim(c1, c2))
+        num_same++;
+    }
+    auto compare_time = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+      if (*memo.clause(c1) == *memo.clause(c2))
+        num_same++;
+    }
+    auto fp_time = std::chrono::steady_clock::now() - start;
+    printf("%d clause compares: %.3f ms same_vse_claim, %.3f ms memoized "
+           "fingerprints (%d same)\n",
+           rounds,
+           std::chrono::duration<double, std::milli>(compare_time).count(),
+           std::chrono::duration<double, std::milli>(fp_time).count(),
+           num_same);
+  }
+  return true;
+}
+
+bool test_proved_index(bool print_all) {
+  key_message policy_key;
+  key_message policy_public_key;
+  if (!make_certifier_ecc_key(256, &policy_key)
+      || !private_key_to_public_key(policy_key, &policy_public_key)) {
+    printf("%s() error, line: %d, can't make keys\n", __func__, __LINE__);
+    return false;
+  }
+  const int             n = 1000;
+  signed_claim_sequence policy;
+  proved_statements     proved;
+  if (!make_measurement_policy(policy_key, policy_public_key, n, &policy)
+      || !init_policy(policy, policy_public_key, &proved)) {
+    printf("%s() error, line: %d, can't make policy\n", __func__, __LINE__);
+    return false;
+  }
+
+  // policy-key is-trusted goes in after the index is built, directly.
+  proved_index   index(&proved);
+  entity_message policy_ent;
+  vse_clause     policy_key_is_trusted;
+  string         it("is-trusted");
+  if (!make_key_entity(policy_public_key, &policy_ent)
+      || !make_unary_vse_clause(policy_ent, it, &policy_key_is_trusted)) {
+    printf("%s() error, line: %d, can't make clause\n", __func__, __LINE__);
+    return false;
+  }
+  if (index.contains(policy_key_is_trusted)) {
+    printf("%s() error, line: %d, unproved clause found\n", __func__, __LINE__);
+    return false;
+  }
+  proved.add_proved()->CopyFrom(policy_key_is_trusted);
+  if (!index.contains(policy_key_is_trusted)) {
+    printf("%s() error, line: %d, appended clause missed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  for (int i = 0; i < n; i++) {
+    vse_clause copy(proved.proved(i));
+    if (!index.contains(copy)) {
+      printf("%s() error, line: %d, clause %d missed\n", __func__, __LINE__, i);
+      return false;
+    }
+  }
+
+  // One rule 3 step: policy-key is-trusted and policy-key says
+  // measurement is-trusted, so the measurement is-trusted.
+  predicate_dominance dom_tree;
+  if (!init_top_level_is_trusted(dom_tree)) {
+    printf("%s() error, line: %d, can't make tree\n", __func__, __LINE__);
+    return false;
+  }
+  const vse_clause &says = proved.proved(n - 1);
+  vse_clause        to_prove(says.clause());
+  proof             pf;
+  proof_step *      ps = pf.add_steps();
+  ps->mutable_s1()->CopyFrom(policy_key_is_trusted);
+  ps->mutable_s2()->CopyFrom(says);
+  ps->mutable_conclusion()->CopyFrom(to_prove);
+  ps->set_rule_applied(3);
+
+  proved_statements with_trust(proved);
+  if (!verify_proof(policy_public_key, to_prove, dom_tree, &pf, &with_trust)
+      || with_trust.proved_size() != n + 2) {
+    printf("%s() error, line: %d, verify_proof failed\n", __func__, __LINE__);
+    return false;
+  }
+  proved_statements with_trust2(proved);
+  if (!verify_proof_from_array(policy_public_key,
+                               to_prove,
+                               dom_tree,
+                               &with_trust2,
+                               1,
+                               ps)) {
+    printf("%s() error, line: %d, verify_proof_from_array failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // Both premises must already be proved.
+  proved_statements without_trust;
+  for (int i = 0; i < n; i++)
+    without_trust.add_proved()->CopyFrom(proved.proved(i));
+  if (verify_proof(policy_public_key,
+                   to_prove,
+                   dom_tree,
+                   &pf,
+                   &without_trust)) {
+    printf("%s() error, line: %d, unproved premise accepted\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  if (print_all) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++)
+      statement_already_proved(proved.proved(i), &proved);
+    auto scan_time = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++)
+      statement_already_proved(proved.proved(i), index);
+    auto index_time = std::chrono::steady_clock::now() - start;
+    printf("%d lookups in %d facts: %.3f ms scanning, %.3f ms indexed\n",
+           n,
+           n + 1,
+           std::chrono::duration<double, std::milli>(scan_time).count(),
+           std::chrono::duration<double, std::milli>(index_time).count());
+  }
+  return true;
+}
+
+// policy_key says platform_key is-trusted-for-attestation
+static bool make_platform_claim(const key_message &   policy_key,
+                                const key_message &   policy_public_key,
+                                const key_message &   platform_key,
+                                signed_claim_message *out) {
+  entity_message policy_ent;
+  entity_message platform_ent;
+  vse_clause     is_trusted;
+  vse_clause     says;
+  string         it_verb("is-trusted-for-attestation");
+  string         says_verb("says");
+  if (!make_key_entity(policy_public_key, &policy_ent)
+      || !make_key_entity(platform_key, &platform_ent)
+      || !make_unary_vse_clause(platform_ent, it_verb, &is_trusted)
+      || !make_indirect_vse_clause(policy_ent, says_verb, is_trusted, &says))
+    return false;
+
+  time_point t_nb;
+  time_point t_na;
+  time_now(&t_nb);
+  add_interval_to_time_point(t_nb, 24.0, &t_na);
+  string nb;
+  string na;
+  time_to_string(t_nb, &nb);
+  time_to_string(t_na, &na);
+  string format("vse-clause");
+  string descriptor("platform policy");
+  string serialized_says;
+  says.SerializeToString(&serialized_says);
+  claim_message claim;
+  if (!make_claim(serialized_says.size(),
+                  (byte *)serialized_says.data(),
+                  format,
+                  descriptor,
+                  nb,
+                  na,
+                  &claim))
+    return false;
+  return make_signed_claim(Enc_method_ecc_256_sha256_pkcs_sign,
+                           claim,
+                           policy_key,
+                           out);
+}
+
+bool test_trusted_policy_index(bool print_all) {
+  key_message policy_key;
+  key_message policy_public_key;
+  if (!make_certifier_ecc_key(256, &policy_key)
+      || !private_key_to_public_key(policy_key, &policy_public_key)) {
+    printf("%s() error, line: %d, can't make keys\n", __func__, __LINE__);
+    return false;
+  }
+
+  const int             num_measurements = 2000;
+  const int             num_platforms = 4;
+  signed_claim_sequence trusted_measurements;
+  signed_claim_sequence trusted_platforms;
+  key_message           platform_keys[num_platforms];
+  if (!make_measurement_policy(policy_key,
+                               policy_public_key,
+                               num_measurements,
+                               &trusted_measurements)) {
+    printf("%s() error, line: %d, can't make policy\n", __func__, __LINE__);
+    return false;
+  }
+  for (int i = 0; i < num_platforms; i++) {
+    if (!make_certifier_ecc_key(256, &platform_keys[i])
+        || !make_platform_claim(policy_key,
+                                policy_public_key,
+                                platform_keys[i],
+                                trusted_platforms.add_claims())) {
+      printf("%s() error, line: %d, can't make platform claim\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+  }
+  // Platform claims in the measurement list are skipped, and vice versa.
+  trusted_measurements.add_claims()->CopyFrom(trusted_platforms.claims(0));
+
+  trusted_policy_index index;
+  if (!index.build(trusted_platforms, trusted_measurements)
+      || index.num_measurements() != num_measurements
+      || index.num_platforms() != num_platforms) {
+    printf("%s() error, line: %d, build failed\n", __func__, __LINE__);
+    return false;
+  }
+
+  // The index finds what the scan finds.
+  for (int i = 0; i < num_measurements; i += 97) {
+    vse_clause c;
+    if (!get_vse_clause_from_signed_claim(trusted_measurements.claims(i), &c))
+      return false;
+    string               m = c.clause().subject().measurement();
+    signed_claim_message scanned;
+    signed_claim_message indexed;
+    if (!get_signed_measurement_claim_from_trusted_list(m,
+                                                        trusted_measurements,
+                                                        &scanned)
+        || !get_signed_measurement_claim_from_trusted_list(m,
+                                                           index,
+                                                           &indexed)
+        || scanned.signature() != indexed.signature()) {
+      printf("%s() error, line: %d, measurement %d\n", __func__, __LINE__, i);
+      return false;
+    }
+  }
+  string unknown(32, 'x');
+  if (index.find_measurement(unknown) != nullptr) {
+    printf("%s() error, line: %d, unknown measurement found\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  for (int i = 0; i < num_platforms; i++) {
+    key_message renamed(platform_keys[i]);
+    renamed.set_key_name("renamed");
+    signed_claim_message scanned;
+    signed_claim_message indexed;
+    if (!get_signed_platform_claim_from_trusted_list(renamed,
+                                                     trusted_platforms,
+                                                     &scanned)
+        || !get_signed_platform_claim_from_trusted_list(renamed,
+                                                        index,
+                                                        &indexed)
+        || scanned.signature() != indexed.signature()) {
+      printf("%s() error, line: %d, platform %d\n", __func__, __LINE__, i);
+      return false;
+    }
+  }
+  if (index.find_platform(policy_public_key) != nullptr) {
+    printf("%s() error, line: %d, unknown platform found\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  if (print_all) {
+    const int            lookups = 100;
+    signed_claim_message sc;
+    string               last(32, (char)(num_measurements - 1));
+    last[0] = (char)((num_measurements - 1) >> 8);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; i++) {
+      get_signed_measurement_claim_from_trusted_list(last,
+                                                     trusted_measurements,
+                                                     &sc);
+    }
+    auto scan_time = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; i++)
+      get_signed_measurement_claim_from_trusted_list(last, index, &sc);
+    auto index_time = std::chrono::steady_clock::now() - start;
+    printf("%d lookups in %d measurements: %.3f ms scanning, %.3f ms "
+           "indexed\n",
+           lookups,
+           num_measurements,
+           std::chrono::duration<double, std::milli>(scan_time).count(),
+           std::chrono::duration<double, std::milli>(index_time).count());
+  }
+  return true;
+}
+
+// Signs "policy_ent says cl" and appends it to policy.
+static bool add_policy_rule(const key_message &    policy_key,
+                            const entity_message & policy_ent,
+                            const vse_clause &     cl,
+                            signed_claim_sequence *policy) {
+  string     says_verb("says");
+  vse_clause says;
+  if (!make_indirect_vse_clause(policy_ent, says_verb, cl, &says))
+    return false;
+
+  time_point t_nb;
+  time_point t_na;
+  time_now(&t_nb);
+  add_interval_to_time_point(t_nb, 24.0, &t_na);
+  string nb;
+  string na;
+  time_to_string(t_nb, &nb);
+  time_to_string(t_na, &na);
+  string format("vse-clause");
+  string descriptor("platform policy");
+  string serialized_says;
+  says.SerializeToString(&serialized_says);
+  claim_message claim;
+  if (!make_claim(serialized_says.size(),
+                  (byte *)serialized_says.data(),
+                  format,
+                  descriptor,
+                  nb,
+                  na,
+                  &claim))
+    return false;
+  return make_signed_claim(Enc_method_ecc_256_sha256_pkcs_sign,
+                           claim,
+                           policy_key,
+                           policy->add_claims());
+}
+
+static void add_int_property(const string &name,
+                             const string &cmp,
+                             uint64_t      value,
+                             properties *  props) {
+  property *p = props->add_props();
+  p->set_property_name(name);
+  p->set_value_type("int");
+  p->set_comparator(cmp);
+  p->set_int_value(value);
+}
+
+static void add_string_property(const string &name,
+                                const string &cmp,
+                                const string &value,
+                                properties *  props) {
+  property *p = props->add_props();
+  p->set_property_name(name);
+  p->set_value_type("string");
+  p->set_comparator(cmp);
+  p->set_string_value(value);
+}
+
+// Reference for the matcher: satisfying_platform, without the reports.
+static bool reference_satisfies(const platform &rule, const platform &p) {
+  if (rule.platform_type() != p.platform_type())
+    return false;
+  for (int i = 0; i < rule.props().props_size(); i++) {
+    const property *pp =
+        find_property(rule.props().props(i).property_name(), p.props());
+    if (pp == nullptr || !satisfying_property(rule.props().props(i), *pp))
+      return false;
+  }
+  return true;
+}
+
+bool test_platform_policy_matcher(bool print_all) {
+  key_message policy_key;
+  key_message policy_public_key;
+  key_message other_key;
+  if (!make_certifier_ecc_key(256, &policy_key)
+      || !private_key_to_public_key(policy_key, &policy_public_key)
+      || !make_certifier_ecc_key(256, &other_key)) {
+    printf("%s() error, line: %d, can't make keys\n", __func__, __LINE__);
+    return false;
+  }
+  entity_message policy_ent;
+  if (!make_key_entity(policy_public_key, &policy_ent))
+    return false;
+
+  string                sev_type("amd-sev-snp");
+  string                other_type("other-platform");
+  string                plat_verb("has-trusted-platform-property");
+  string                it_verb("is-trusted");
+  const int             num_rules = 300;
+  signed_claim_sequence policy;
+  platform              rules[num_rules + 3];
+  int                   rule_claims[num_rules + 3];
+  int                   n = 0;
+
+  // A claim that is neither a platform nor a measurement rule
+  entity_message other_ent;
+  vse_clause     other_clause;
+  string         ift_verb("is-trusted-for-attestation");
+  if (!make_key_entity(other_key, &other_ent)
+      || !make_unary_vse_clause(other_ent, ift_verb, &other_clause)
+      || !add_policy_rule(policy_key, policy_ent, other_clause, &policy))
+    return false;
+
+  for (int i = 0; i < num_rules + 3; i++) {
+    properties props;
+    string     type(sev_type);
+    if (i < num_rules) {
+      add_int_property("api-major", "=", i % 10, &props);
+      add_int_property("tcb-version", ">=", i / 10, &props);
+      if (i % 2 == 0)
+        add_string_property("debug", "=", "no", &props);
+    } else if (i == num_rules) {
+      add_int_property("tcb-version", ">=", 25, &props);
+    } else if (i == num_rules + 1) {
+      type = other_type;
+    } else {
+      // never satisfied
+      add_string_property("debug", ">=", "no", &props);
+    }
+    entity_message p_ent;
+    vse_clause     cl;
+    if (!make_platform(type, props, nullptr, &rules[n])
+        || !make_platform_entity(rules[n], &p_ent)
+        || !make_unary_vse_clause(p_ent, plat_verb, &cl)
+        || !add_policy_rule(policy_key, policy_ent, cl, &policy)) {
+      printf("%s() error, line: %d, can't make rule\n", __func__, __LINE__);
+      return false;
+    }
+    rule_claims[n++] = policy.claims_size() - 1;
+
+    if (i % 100 == 50) {
+      string         measurement(32, (char)i);
+      entity_message m_ent;
+      vse_clause     m_clause;
+      if (!make_measurement_entity(measurement, &m_ent)
+          || !make_unary_vse_clause(m_ent, it_verb, &m_clause)
+          || !add_policy_rule(policy_key, policy_ent, m_clause, &policy))
+        return false;
+    }
+  }
+
+  platform_policy_matcher matcher;
+  if (!matcher.compile(policy_public_key, policy)
+      || matcher.num_platform_rules() != n
+      || matcher.num_measurement_rules() != 3) {
+    printf("%s() error, line: %d, compile failed\n", __func__, __LINE__);
+    return false;
+  }
+
+  // Attested platforms, each checked against a scan of the rules
+  const int num_queries = 12 * 4 * 2 * 2;
+  platform  queries[num_queries];
+  int       expected[num_queries];
+  uint64_t  tcbs[4] = {0, 5, 29, 40};
+  int       q = 0;
+  for (int api = 0; api < 12; api++) {
+    for (int t = 0; t < 4; t++) {
+      for (int d = 0; d < 2; d++) {
+        for (int ty = 0; ty < 2; ty++) {
+          properties props;
+          add_int_property("api-major", "=", api, &props);
+          add_int_property("tcb-version", "=", tcbs[t], &props);
+          add_string_property("debug", "=", d == 0 ? "no" : "yes", &props);
+          make_platform(ty == 0 ? sev_type : other_type,
+                        props,
+                        nullptr,
+                        &queries[q]);
+          expected[q] = -1;
+          for (int r = 0; r < n; r++) {
+            if (reference_satisfies(rules[r], queries[q])) {
+              expected[q] = rule_claims[r];
+              break;
+            }
+          }
+          q++;
+        }
+      }
+    }
+  }
+  int num_matched = 0;
+  for (int i = 0; i < num_queries; i++) {
+    int got = matcher.match_platform(queries[i]);
+    if (got != expected[i]) {
+      printf("%s() error, line: %d, query %d: got %d, expected %d\n",
+             __func__,
+             __LINE__,
+             i,
+             got,
+             expected[i]);
+      return false;
+    }
+    if (got >= 0)
+      num_matched++;
+  }
+  if (num_matched == 0 || num_matched == num_queries) {
+    printf("%s() error, line: %d, degenerate queries\n", __func__, __LINE__);
+    return false;
+  }
+
+  string known(32, (char)150);
+  string unknown(32, (char)151);
+  if (matcher.match_measurement(known) < 0
+      || matcher.match_measurement(unknown) >= 0) {
+    printf("%s() error, line: %d, measurement match\n", __func__, __LINE__);
+    return false;
+  }
+
+  // The filtered policy keeps the other claim and the two matches, in order.
+  int i_plat = 0;
+  while (expected[i_plat] < 0)
+    i_plat++;
+  signed_claim_sequence filtered;
+  if (!matcher.filter(known, queries[i_plat], &filtered)
+      || filtered.claims_size() != 3
+      || filtered.claims(0).signature() != policy.claims(0).signature()) {
+    printf("%s() error, line: %d, filter failed\n", __func__, __LINE__);
+    return false;
+  }
+  int m_claim = matcher.match_measurement(known);
+  int first = m_claim < expected[i_plat] ? m_claim : expected[i_plat];
+  int second = m_claim < expected[i_plat] ? expected[i_plat] : m_claim;
+  if (filtered.claims(1).signature() != policy.claims(first).signature()
+      || filtered.claims(2).signature() != policy.claims(second).signature()) {
+    printf("%s() error, line: %d, filter order\n", __func__, __LINE__);
+    return false;
+  }
+  signed_claim_sequence unmatched;
+  if (matcher.filter(unknown, queries[i_plat], &unmatched)) {
+    printf("%s() error, line: %d, filter should fail\n", __func__, __LINE__);
+    return false;
+  }
+
+  // Only the policy key may say the rules.
+  platform_policy_matcher wrong_key;
+  if (wrong_key.compile(other_key, policy)) {
+    printf("%s() error, line: %d, compiled with wrong key\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  if (print_all) {
+    const int rounds = 20;
+    int       sink = 0;
+    auto      start = std::chrono::steady_clock::now();
+    for (int k = 0; k < rounds; k++) {
+      for (int i = 0; i < num_queries; i++) {
+        for (int r = 0; r < n; r++) {
+          if (reference_satisfies(rules[r], queries[i])) {
+            sink += r;
+            break;
+          }
+        }
+      }
+    }
+    auto scan_time = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (int k = 0; k < rounds; k++) {
+      for (int i = 0; i < num_queries; i++)
+        sink += matcher.match_platform(queries[i]);
+    }
+    auto match_time = std::chrono::steady_clock::now() - start;
+    printf("%d platform matches against %d rules: %.3f ms scanning, %.3f ms "
+           "compiled (%d)\n",
+           rounds * num_queries,
+           n,
+           std::chrono::duration<double, std::milli>(scan_time).count(),
+           std::chrono::duration<double, std::milli>(match_time).count(),
+           sink);
+  }
+  return true;
+}
+
+bool test_verified_claim_cache(bool print_all) {
+  key_message policy_key;
+  key_message policy_public_key;
+  key_message other_key;
+  if (!make_certifier_ecc_key(256, &policy_key)
+      || !private_key_to_public_key(policy_key, &policy_public_key)
+      || !make_certifier_ecc_key(256, &other_key)) {
+    printf("%s() error, line: %d, can't make keys\n", __func__, __LINE__);
+    return false;
+  }
+  const int             num_claims = 8;
+  signed_claim_sequence policy;
+  if (!make_measurement_policy(policy_key,
+                               policy_public_key,
+                               num_claims,
+                               &policy)) {
+    printf("%s() error, line: %d, can't make policy\n", __func__, __LINE__);
+    return false;
+  }
+
+  verified_claim_cache cache(num_claims / 2);
+  claim_message        c1;
+  claim_message        c2;
+  vse_clause           cl;
+  vse_clause           expected;
+  if (!cache.verify(policy.claims(0), policy_public_key, &c1)
+      || cache.misses() != 1 || cache.hits() != 0
+      || !cache.verify(policy.claims(0), policy_public_key, &c2, &cl)
+      || cache.misses() != 1 || cache.hits() != 1) {
+    printf("%s() error, line: %d, first verifies\n", __func__, __LINE__);
+    return false;
+  }
+  if (!get_vse_clause_from_signed_claim(policy.claims(0), &expected)
+      || c1.SerializeAsString() != c2.SerializeAsString()
+      || cl.SerializeAsString() != expected.SerializeAsString()) {
+    printf("%s() error, line: %d, cached claim differs\n", __func__, __LINE__);
+    return false;
+  }
+
+  // A hit needs the same claim, signature and key.
+  signed_claim_message tampered(policy.claims(0));
+  tampered.set_signature(policy.claims(1).signature());
+  if (cache.verify(policy.claims(0), other_key, &c1)
+      || cache.verify(tampered, policy_public_key, &c1)
+      || cache.num_entries() != 1) {
+    printf("%s() error, line: %d, bad claim verified\n", __func__, __LINE__);
+    return false;
+  }
+
+  // Bounded, and dropped when the policy key is withdrawn.
+  for (int i = 0; i < num_claims; i++) {
+    if (!cache.verify(policy.claims(i), policy_public_key, &c1))
+      return false;
+  }
+  if (cache.num_entries() != num_claims / 2
+      || cache.invalidate_key(other_key) != 0
+      || cache.invalidate_key(policy_public_key) != num_claims / 2
+      || cache.num_entries() != 0) {
+    printf("%s() error, line: %d, bound or invalidation\n", __func__, __LINE__);
+    return false;
+  }
+  if (!cache.verify(policy.claims(0), policy_public_key, &c1)
+      || cache.num_entries() != 1) {
+    printf("%s() error, line: %d, reverify\n", __func__, __LINE__);
+    return false;
+  }
+  cache.clear();
+  if (cache.num_entries() != 0) {
+    printf("%s() error, line: %d, clear\n", __func__, __LINE__);
+    return false;
+  }
+
+  // The key's format counts too: an RSA key that key_to_RSA would refuse
+  // mustn't hit on the entry its well formed twin left.
+  key_message          rsa_key;
+  key_message          rsa_public_key;
+  claim_message        rsa_claim;
+  signed_claim_message rsa_sc;
+  if (!make_certifier_rsa_key(2048, &rsa_key)
+      || !private_key_to_public_key(rsa_key, &rsa_public_key)
+      || !rsa_claim.ParseFromString(policy.claims(0).serialized_claim_message())
+      || !make_signed_claim(Enc_method_rsa_2048_sha256_pkcs_sign,
+                            rsa_claim,
+                            rsa_key,
+                            &rsa_sc)) {
+    printf("%s() error, line: %d, can't make rsa claim\n", __func__, __LINE__);
+    return false;
+  }
+  key_message reformatted(rsa_public_key);
+  reformatted.set_key_format("not-a-vse-key");
+  if (!cache.verify(rsa_sc, rsa_public_key, &c1)
+      || cache.verify(rsa_sc, reformatted, &c1)) {
+    printf("%s() error, line: %d, bad key format verified\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  cache.clear();
+
+  // Facts from signed claims go through the shared cache.
+  proved_statements already_proved;
+  uint64_t          hits = claim_cache().hits();
+  if (!add_fact_from_signed_claim(policy.claims(1), &already_proved)
+      || !add_fact_from_signed_claim(policy.claims(1), &already_proved)
+      || claim_cache().hits() < hits + 1 || already_proved.proved_size() != 2) {
+    printf("%s() error, line: %d, add_fact_from_signed_claim\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  if (print_all) {
+    const int rounds = 200;
+    cache.set_max_entries(default_verified_claim_cache_size);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+      cache.verify(policy.claims(2), policy_public_key, &c1);
+    auto cached_time = std::chrono::steady_clock::now() - start;
+    cache.set_max_entries(0);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+      cache.verify(policy.claims(2), policy_public_key, &c1);
+    auto uncached_time = std::chrono::steady_clock::now() - start;
+    printf("%d verifies of one claim: %.3f ms cached, %.3f ms uncached\n",
+           rounds,
+           std::chrono::duration<double, std::milli>(cached_time).count(),
+           std::chrono::duration<double, std::milli>(uncached_time).count());
+  }
+  return true;
+}
+
+bool test_policy_snapshot(bool print_all) {
+  key_message policy_key;
+  key_message policy_public_key;
+  key_message other_key;
+  key_message other_public_key;
+  if (!make_certifier_ecc_key(256, &policy_key)
+      || !private_key_to_public_key(policy_key, &policy_public_key)
+      || !make_certifier_ecc_key(256, &other_key)
+      || !private_key_to_public_key(other_key, &other_public_key)) {
+    printf("%s() error, line: %d, can't make keys\n", __func__, __LINE__);
+    return false;
+  }
+  const int             num_measurements = 200;
+  signed_claim_sequence policy;
+  if (!make_measurement_policy(policy_key,
+                               policy_public_key,
+                               num_measurements,
+                               &policy)
+      || !make_platform_claim(policy_key,
+                              policy_public_key,
+                              other_public_key,
+                              policy.add_claims())) {
+    printf("%s() error, line: %d, can't make policy\n", __func__, __LINE__);
+    return false;
+  }
+
+  string name("policy_snapshot_test.bin");
+  string bad_name("policy_snapshot_test_bad.bin");
+  bool   ret = false;
+  {
+    policy_snapshot snapshot;
+    if (!write_policy_snapshot(policy, policy_key, 7, name)
+        || !snapshot.load(name, policy_public_key)
+        || snapshot.num_clauses() != policy.claims_size()
+        || snapshot.policy_version() != 7 || !snapshot.valid_now()) {
+      printf("%s() error, line: %d, can't write or load\n", __func__, __LINE__);
+      goto done;
+    }
+
+    // The snapshot proves what init_policy proves.
+    proved_statements from_snapshot;
+    proved_statements from_claims;
+    if (!init_policy(snapshot, &from_snapshot)
+        || !init_policy(policy, policy_public_key, &from_claims)
+        || from_snapshot.proved_size() != from_claims.proved_size()) {
+      printf("%s() error, line: %d, init_policy differs\n", __func__, __LINE__);
+      goto done;
+    }
+    for (int i = 0; i < from_claims.proved_size(); i++) {
+      signed_claim_message sc;
+      if (from_snapshot.proved(i).SerializeAsString()
+              != from_claims.proved(i).SerializeAsString()
+          || snapshot.find_clause(from_claims.proved(i)) != i
+          || !snapshot.signed_claim(i, &sc)
+          || sc.signature() != policy.claims(i).signature()) {
+        printf("%s() error, line: %d, clause %d\n", __func__, __LINE__, i);
+        goto done;
+      }
+    }
+    vse_clause unknown_clause(from_claims.proved(0));
+    unknown_clause.mutable_clause()->set_verb("is-not-trusted");
+    string known(32, (char)17);
+    string unknown(32, (char)0xff);
+    known[0] = 0;
+    if (snapshot.find_clause(unknown_clause) != -1
+        || snapshot.find_measurement(known) != 17
+        || snapshot.find_measurement(unknown) != -1) {
+      printf("%s() error, line: %d, lookups\n", __func__, __LINE__);
+      goto done;
+    }
+
+    // Rewriting the snapshot replaces the file; the mapped one is unchanged.
+    policy_snapshot newer;
+    if (!write_policy_snapshot(policy, policy_key, 9, name)
+        || !newer.load(name, policy_public_key, 8)
+        || newer.policy_version() != 9 || snapshot.policy_version() != 7
+        || snapshot.find_measurement(known) != 17
+        || snapshot.num_clauses() != policy.claims_size()) {
+      printf("%s() error, line: %d, rewrite changed a loaded snapshot\n",
+             __func__,
+             __LINE__);
+      goto done;
+    }
+    if (!write_policy_snapshot(policy, policy_key, 7, name))
+      goto done;
+
+    // Older versions, other keys and altered files are refused.
+    policy_snapshot refused;
+    if (refused.load(name, policy_public_key, 8)
+        || refused.load(name, other_public_key)) {
+      printf("%s() error, line: %d, loaded bad snapshot\n", __func__, __LINE__);
+      goto done;
+    }
+    string contents;
+    if (!read_file_into_string(name, &contents))
+      goto done;
+    string altered(contents);
+    altered[altered.size() / 2] ^= 1;
+    if (!write_file(bad_name, altered.size(), (byte *)altered.data())
+        || refused.load(bad_name, policy_public_key)) {
+      printf("%s() error, line: %d, loaded altered snapshot\n",
+             __func__,
+             __LINE__);
+      goto done;
+    }
+    string truncated(contents, 0, contents.size() - 10);
+    if (!write_file(bad_name, truncated.size(), (byte *)truncated.data())
+        || refused.load(bad_name, policy_public_key)) {
+      printf("%s() error, line: %d, loaded truncated snapshot\n",
+             __func__,
+             __LINE__);
+      goto done;
+    }
+
+    // Only claims the policy key says can be compiled.
+    signed_claim_sequence mixed(policy);
+    if (!make_platform_claim(other_key,
+                             other_public_key,
+                             policy_public_key,
+                             mixed.add_claims())
+        || write_policy_snapshot(mixed, policy_key, 8, bad_name)) {
+      printf("%s() error, line: %d, compiled foreign claim\n",
+             __func__,
+             __LINE__);
+      goto done;
+    }
+
+    if (print_all) {
+      claim_cache().clear();
+      auto              start = std::chrono::steady_clock::now();
+      proved_statements cold;
+      init_policy(policy, policy_public_key, &cold);
+      auto            claims_time = std::chrono::steady_clock::now() - start;
+      policy_snapshot timed;
+      proved_statements from_file;
+      start = std::chrono::steady_clock::now();
+      timed.load(name, policy_public_key);
+      init_policy(timed, &from_file);
+      auto snapshot_time = std::chrono::steady_clock::now() - start;
+      printf("policy of %d claims: %.3f ms from claims, %.3f ms from "
+             "snapshot\n",
+             policy.claims_size(),
+             std::chrono::duration<double, std::milli>(claims_time).count(),
+             std::chrono::duration<double, std::milli>(snapshot_time).count());
+    }
+    ret = true;
+  }
+
+done:
+  unlink(name.c_str());
+  unlink(bad_name.c_str());
+  return ret;
+}
+
 bool test_predicate_dominance(bool print_all) {
   predicate_dominance root;
 
@@ -451,3 +1686,112 @@ bool test_predicate_dominance(bool print_all) {
 
   return true;
 }
+
+static void check_default_dominance(int rounds, std::atomic<int> *failures) {
+  predicate_dominance *tree = default_dominance_tree();
+  string               it("is-trusted");
+  string               it1("is-trusted-for-attestation");
+  string               it3("is-trusted-for-crap");
+  for (int i = 0; i < rounds; i++) {
+    if (tree == nullptr || !dominates(*tree, it, it1)
+        || dominates(*tree, it, it3) || dominates(*tree, it1, it))
+      (*failures)++;
+  }
+}
+
+bool test_dominance_table(bool print_all) {
+  predicate_dominance root;
+  if (!init_top_level_is_trusted(root)) {
+    return false;
+  }
+
+  // A deeper tree, so lookups below the root get exercised.
+  const int num_preds = 6;
+  string    preds[num_preds] = {
+      "is-trusted",
+      "is-trusted-for-attestation",
+      "is-trusted-for-authentication",
+      "is-trusted-for-attestation-of-sev",
+      "is-trusted-for-attestation-of-sgx",
+      "is-trusted-for-crap",
+  };
+  if (!root.insert(preds[1], preds[3]) || !root.insert(preds[1], preds[4])) {
+    printf("%s() error, line: %d, insert failed\n", __func__, __LINE__);
+    return false;
+  }
+  if (root.find_node(preds[3]) == nullptr
+      || root.find_node(preds[5]) != nullptr) {
+    printf("%s() error, line: %d, find_node failed\n", __func__, __LINE__);
+    return false;
+  }
+
+  bool expected[num_preds][num_preds];
+  for (int i = 0; i < num_preds; i++) {
+    for (int j = 0; j < num_preds; j++)
+      expected[i][j] = dominates(root, preds[i], preds[j]);
+  }
+  if (!expected[0][3] || !expected[1][4] || expected[2][3] || expected[3][1]
+      || expected[0][5]) {
+    printf("%s() error, line: %d, tree walk is wrong\n", __func__, __LINE__);
+    return false;
+  }
+
+  if (!root.compile()) {
+    printf("%s() error, line: %d, compile failed\n", __func__, __LINE__);
+    return false;
+  }
+  for (int i = 0; i < num_preds; i++) {
+    for (int j = 0; j < num_preds; j++) {
+      if (dominates(root, preds[i], preds[j]) != expected[i][j]) {
+        printf("%s() error, line: %d, table disagrees on %s, %s\n",
+               __func__,
+               __LINE__,
+               preds[i].c_str(),
+               preds[j].c_str());
+        return false;
+      }
+    }
+  }
+
+  // Inserting drops the table.
+  if (!root.insert(preds[2], preds[5]) || root.closure_ != nullptr
+      || !dominates(root, preds[0], preds[5])) {
+    printf("%s() error, line: %d, insert kept a stale table\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  const int        num_threads = 4;
+  const int        rounds = 10000;
+  std::atomic<int> failures(0);
+  std::thread *    threads[num_threads];
+  for (int i = 0; i < num_threads; i++)
+    threads[i] = new std::thread(check_default_dominance, rounds, &failures);
+  for (int i = 0; i < num_threads; i++) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  if (failures != 0) {
+    printf("%s() error, line: %d, shared tree failed\n", __func__, __LINE__);
+    return false;
+  }
+
+  if (print_all) {
+    root.print_tree(0);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+      dominates(root, preds[1], preds[5]);
+    auto walk_time = std::chrono::steady_clock::now() - start;
+    root.compile();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+      dominates(root, preds[1], preds[5]);
+    auto table_time = std::chrono::steady_clock::now() - start;
+    printf("%d dominates(): %.3f ms walking, %.3f ms compiled\n",
+           rounds,
+           std::chrono::duration<double, std::milli>(walk_time).count(),
+           std::chrono::duration<double, std::milli>(table_time).count());
+  }
+  return true;
+}
@@ -32,7 +32,11 @@
 
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include "certifier_algorithms.cc"
 
@@ -546,62 +550,33 @@ void certifier::utilities::print_environment(const environment &env) {
 
 // -----------------------------------------------------------------------
 
-// Encryption is ssl
-//    Set up a context
-//    Initialize the encryption operation
-//    Providing plaintext bytes to be encrypted
-//    Finalizing the encryption operation
-//    During initialization we will provide an EVP_CIPHER object.
-//      In this case we are using EVP_aes_256_cbc(),
-//      which uses the AES algorithm with a 256-bit key in
-//      CBC mode.
+// When off, calls that use the thread's crypto contexts clear them on
+// the way out.
+static std::atomic<bool> thread_crypto_caching(true);
 
+static void release_thread_crypto_contexts() {
+  if (!thread_crypto_caching)
+    certifier::utilities::clear_thread_crypto_contexts();
+}
+
+void certifier::utilities::set_thread_crypto_caching(bool cache) {
+  thread_crypto_caching = cache;
+  if (!cache)
+    clear_thread_crypto_contexts();
+}
+
+// Plain aes-256-cbc with the calling thread's cached key schedule.
 bool encrypt(byte *in,
              int   in_len,
              byte *key,
              byte *iv,
              byte *out,
              int * out_size) {
-  EVP_CIPHER_CTX *ctx = nullptr;
-  int             len = 0;
-  int             out_len = 0;
-  bool            ret = true;
-
-  if (!(ctx = EVP_CIPHER_CTX_new())) {
-    printf("%s() error, line: %d, EVP_CIPHER_CTX_new() failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
-  }
-  if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv)) {
-    printf("%s() error, line: %d, EVP_EncryptInit_ex() failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
-  }
-  if (1 != EVP_EncryptUpdate(ctx, out, &len, in, in_len)) {
-    printf("%s() error, line: %d, EVP_EncryptUpdate() failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
-  }
-  out_len = len;
-  if (1 != EVP_EncryptFinal_ex(ctx, out + len, &len)) {
-    printf("%s() error, line: %d, EVP_EncryptFinal_ex() failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
-  }
-  out_len += len;
-
-done:
-  if (ctx != nullptr)
-    EVP_CIPHER_CTX_free(ctx);
-  *out_size = out_len;
+  crypto_context *c = thread_crypto_context(Enc_method_aes_256, key);
+  if (c == nullptr)
+    return false;
+  bool ret = c->encrypt(in, in_len, iv, out, out_size);
+  release_thread_crypto_contexts();
   return ret;
 }
 
@@ -611,46 +586,11 @@ bool decrypt(byte *in,
              byte *iv,
              byte *out,
              int * size_out) {
-  EVP_CIPHER_CTX *ctx = nullptr;
-  int             len = 0;
-  int             out_len = 0;
-  bool            ret = true;
-
-  if (!(ctx = EVP_CIPHER_CTX_new())) {
-    printf("%s() error, line: %d, EVP_CIPHER_CTX_new() failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
-  }
-  if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv)) {
-    printf("%s() error, line: %d, EVP_DecryptInit failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
-  }
-  if (1 != EVP_DecryptUpdate(ctx, out, &len, in, in_len)) {
-    printf("%s() error, line: %d, EVP_DecryptUpdate failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
-  }
-  out_len = len;
-  if (1 != EVP_DecryptFinal_ex(ctx, out + len, &len)) {
-    printf("%s() error, line: %d, EVP_DecryptFinal failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
-  }
-  out_len += len;
-
-done:
-  if (ctx != nullptr)
-    EVP_CIPHER_CTX_free(ctx);
-  *size_out = out_len;
+  crypto_context *c = thread_crypto_context(Enc_method_aes_256, key);
+  if (c == nullptr)
+    return false;
+  bool ret = c->decrypt(in, in_len, iv, out, size_out);
+  release_thread_crypto_contexts();
   return ret;
 }
 
@@ -736,377 +676,803 @@ bool certifier::utilities::digest_message(const char * alg,
   return true;
 }
 
-bool aes_256_cbc_sha256_encrypt(byte *in,
-                                int   in_len,
-                                byte *key,
-                                byte *iv,
-                                byte *out,
-                                int * out_size) {
-  int blk_size = cipher_block_byte_size(Enc_method_aes_256_cbc_hmac_sha256);
-  int key_size = cipher_key_byte_size(Enc_method_aes_256_cbc_hmac_sha256);
-  int mac_size = mac_output_byte_size(Enc_method_aes_256_cbc_hmac_sha256);
-  int cipher_size = *out_size - blk_size;
+// -----------------------------------------------------------------------
+
+// Cipher contexts
+
+certifier::utilities::crypto_context::crypto_context()
+    : gcm_(false),
+      blk_size_(0),
+      key_size_(0),
+      mac_size_(0),
+      md_(nullptr),
+      enc_ctx_(nullptr),
+      dec_ctx_(nullptr),
+      hmac_ctx_(nullptr),
+      stream_op_(0),
+      stream_aad_len_(0),
+      stream_iv_len_(0),
+      pending_len_(0) {}
+
+certifier::utilities::crypto_context::~crypto_context() {
+  clear();
+}
+
+void certifier::utilities::crypto_context::clear() {
+  if (enc_ctx_ != nullptr) {
+    EVP_CIPHER_CTX_free(enc_ctx_);
+    enc_ctx_ = nullptr;
+  }
+  if (dec_ctx_ != nullptr) {
+    EVP_CIPHER_CTX_free(dec_ctx_);
+    dec_ctx_ = nullptr;
+  }
+  if (hmac_ctx_ != nullptr) {
+    HMAC_CTX_free(hmac_ctx_);
+    hmac_ctx_ = nullptr;
+  }
+  OPENSSL_cleanse(key_, sizeof(key_));
+  OPENSSL_cleanse(pending_, sizeof(pending_));
+  stream_op_ = 0;
+  stream_aad_.clear();
+  stream_aad_len_ = 0;
+  stream_iv_len_ = 0;
+  pending_len_ = 0;
+  alg_.clear();
+  gcm_ = false;
+  md_ = nullptr;
+  blk_size_ = 0;
+  key_size_ = 0;
+  mac_size_ = 0;
+}
+
+bool certifier::utilities::crypto_context::init(const char *alg_name,
+                                                const byte *key) {
+  clear();
 
-  memset(out, 0, *out_size);
+  const EVP_CIPHER *cipher = nullptr;
+  if (strcmp(alg_name, Enc_method_aes_256) == 0) {
+    cipher = EVP_aes_256_cbc();
+  } else if (strcmp(alg_name, Enc_method_aes_256_cbc_hmac_sha256) == 0) {
+    cipher = EVP_aes_256_cbc();
+    md_ = EVP_sha256();
+  } else if (strcmp(alg_name, Enc_method_aes_256_cbc_hmac_sha384) == 0) {
+    cipher = EVP_aes_256_cbc();
+    md_ = EVP_sha384();
+  } else if (strcmp(alg_name, Enc_method_aes_256_gcm) == 0) {
+    cipher = EVP_aes_256_gcm();
+    gcm_ = true;
+  } else {
+    printf("%s() error, line: %d, unsupported algorithm %s\n",
+           __func__,
+           __LINE__,
+           alg_name);
+    return false;
+  }
+  blk_size_ = cipher_block_byte_size(alg_name);
+  key_size_ = cipher_key_byte_size(alg_name);
+  if (md_ != nullptr)
+    mac_size_ = mac_output_byte_size(alg_name);
+  else if (gcm_)
+    mac_size_ = blk_size_;
+  if (blk_size_ <= 0 || key_size_ <= 0 || key_size_ > max_symmetric_key_size
+      || mac_size_ < 0) {
+    printf("%s() error, line: %d, bad sizes for %s\n",
+           __func__,
+           __LINE__,
+           alg_name);
+    clear();
+    return false;
+  }
+  memcpy(key_, key, key_size_);
 
-  if (!encrypt(in, in_len, key, iv, out + block_size, &cipher_size)) {
-    printf("%s() error, line: %d, aes_256_cbc_sha256_encrypt: encrypt failed\n",
+  // The key schedule is expanded here; each operation only resets the iv.
+  enc_ctx_ = EVP_CIPHER_CTX_new();
+  dec_ctx_ = EVP_CIPHER_CTX_new();
+  if (enc_ctx_ == nullptr || dec_ctx_ == nullptr) {
+    printf("%s() error, line: %d, EVP_CIPHER_CTX_new failed\n",
            __func__,
            __LINE__);
+    clear();
+    return false;
+  }
+  if (1 != EVP_EncryptInit_ex(enc_ctx_, cipher, nullptr, nullptr, nullptr)
+      || 1 != EVP_DecryptInit_ex(dec_ctx_, cipher, nullptr, nullptr, nullptr)) {
+    printf("%s() error, line: %d, cipher init failed\n", __func__, __LINE__);
+    clear();
+    return false;
+  }
+  if (gcm_) {
+    if (1
+            != EVP_CIPHER_CTX_ctrl(enc_ctx_,
+                                   EVP_CTRL_GCM_SET_IVLEN,
+                                   blk_size_,
+                                   nullptr)
+        || 1
+               != EVP_CIPHER_CTX_ctrl(dec_ctx_,
+                                      EVP_CTRL_GCM_SET_IVLEN,
+                                      blk_size_,
+                                      nullptr)) {
+      printf("%s() error, line: %d, EVP_CIPHER_CTX_ctrl failed\n",
+             __func__,
+             __LINE__);
+      clear();
+      return false;
+    }
+  }
+  if (1 != EVP_EncryptInit_ex(enc_ctx_, nullptr, nullptr, key_, nullptr)
+      || 1 != EVP_DecryptInit_ex(dec_ctx_, nullptr, nullptr, key_, nullptr)) {
+    printf("%s() error, line: %d, key setup failed\n", __func__, __LINE__);
+    clear();
     return false;
   }
-  memcpy(out, iv, block_size);
-  cipher_size += block_size;
-  unsigned int hmac_size = mac_size;
-  HMAC(EVP_sha256(),
-       &key[key_size / 2],
-       mac_size,
-       out,
-       cipher_size,
-       out + cipher_size,
-       &hmac_size);
-  *out_size = cipher_size + hmac_size;
 
+  // The mac key is the second half of the key.
+  if (md_ != nullptr) {
+    hmac_ctx_ = HMAC_CTX_new();
+    if (hmac_ctx_ == nullptr
+        || 1
+               != HMAC_Init_ex(hmac_ctx_,
+                               &key_[key_size_ / 2],
+                               mac_size_,
+                               md_,
+                               nullptr)) {
+      printf("%s() error, line: %d, HMAC init failed\n", __func__, __LINE__);
+      clear();
+      return false;
+    }
+  }
+  alg_.assign(alg_name);
   return true;
 }
 
-bool aes_256_cbc_sha256_decrypt(byte *in,
-                                int   in_len,
-                                byte *key,
-                                byte *out,
-                                int * out_size) {
-  int blk_size = cipher_block_byte_size(Enc_method_aes_256_cbc_hmac_sha256);
-  int key_size = cipher_key_byte_size(Enc_method_aes_256_cbc_hmac_sha256);
-  int mac_size = mac_output_byte_size(Enc_method_aes_256_cbc_hmac_sha256);
-  int cipher_size = *out_size - blk_size;
-
-  int          plain_size = *out_size - blk_size - mac_size;
-  int          msg_with_iv_size = in_len - mac_size;
-  unsigned int hmac_size = mac_size;
-
-  byte hmac_out[hmac_size];
-  HMAC(EVP_sha256(),
-       &key[key_size / 2],
-       mac_size,
-       in,
-       msg_with_iv_size,
-       (byte *)hmac_out,
-       &hmac_size);
-  if (memcmp(hmac_out, in + msg_with_iv_size, mac_size) != 0) {
-    printf("%s() error, line: %d, aes_256_cbc_sha256_decrypt: HMAC failed\n",
+bool certifier::utilities::crypto_context::authenticated() const {
+  return !alg_.empty() && alg_ != Enc_method_aes_256;
+}
+
+bool certifier::utilities::crypto_context::same_key(const char *alg_name,
+                                                    const byte *key) const {
+  if (alg_.empty() || alg_ != alg_name)
+    return false;
+  return CRYPTO_memcmp(key_, key, key_size_) == 0;
+}
+
+bool certifier::utilities::crypto_context::encrypt(byte *in,
+                                                   int   in_len,
+                                                   byte *iv,
+                                                   byte *out,
+                                                   int * out_size) {
+  int len = 0;
+  int out_len = 0;
+
+  if (enc_ctx_ == nullptr || gcm_) {
+    printf("%s() error, line: %d, not a cbc context\n", __func__, __LINE__);
+    return false;
+  }
+  if (1 != EVP_EncryptInit_ex(enc_ctx_, nullptr, nullptr, nullptr, iv)) {
+    printf("%s() error, line: %d, EVP_EncryptInit_ex() failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (1 != EVP_EncryptUpdate(enc_ctx_, out, &len, in, in_len)) {
+    printf("%s() error, line: %d, EVP_EncryptUpdate() failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  out_len = len;
+  if (1 != EVP_EncryptFinal_ex(enc_ctx_, out + out_len, &len)) {
+    printf("%s() error, line: %d, EVP_EncryptFinal_ex() failed\n",
            __func__,
            __LINE__);
     return false;
   }
+  *out_size = out_len + len;
+  return true;
+}
+
+bool certifier::utilities::crypto_context::decrypt(byte *in,
+                                                   int   in_len,
+                                                   byte *iv,
+                                                   byte *out,
+                                                   int * out_size) {
+  int len = 0;
+  int out_len = 0;
 
-  if (!decrypt(in + block_size,
-               msg_with_iv_size - block_size,
-               key,
-               in,
-               out,
-               &plain_size)) {
-    printf("%s() error, line: %d, aes_256_cbc_sha256_decrypt: decrypt failed\n",
+  if (dec_ctx_ == nullptr || gcm_) {
+    printf("%s() error, line: %d, not a cbc context\n", __func__, __LINE__);
+    return false;
+  }
+  if (1 != EVP_DecryptInit_ex(dec_ctx_, nullptr, nullptr, nullptr, iv)) {
+    printf("%s() error, line: %d, EVP_DecryptInit failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (1 != EVP_DecryptUpdate(dec_ctx_, out, &len, in, in_len)) {
+    printf("%s() error, line: %d, EVP_DecryptUpdate failed\n",
            __func__,
            __LINE__);
     return false;
   }
-  *out_size = plain_size;
-  return (memcmp(hmac_out, in + msg_with_iv_size, mac_size) == 0);
+  out_len = len;
+  if (1 != EVP_DecryptFinal_ex(dec_ctx_, out + out_len, &len)) {
+    printf("%s() error, line: %d, EVP_DecryptFinal failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  *out_size = out_len + len;
+  return true;
 }
 
-bool aes_256_cbc_sha384_encrypt(byte *in,
-                                int   in_len,
-                                byte *key,
-                                byte *iv,
-                                byte *out,
-                                int * out_size) {
-  int blk_size = cipher_block_byte_size(Enc_method_aes_256_cbc_hmac_sha384);
-  int key_size = cipher_key_byte_size(Enc_method_aes_256_cbc_hmac_sha384);
-  int mac_size = mac_output_byte_size(Enc_method_aes_256_cbc_hmac_sha384);
-  int cipher_size = *out_size - blk_size;
+// With associated data the cbc mac covers aad, iv, ciphertext and the aad
+// length in bits as a 64 bit big endian number, as in RFC 7518.  Without
+// it the mac is just over iv and ciphertext, as it always was.
+bool certifier::utilities::crypto_context::start_mac(const byte *aad,
+                                                     int         aad_len) {
+  if (1 != HMAC_Init_ex(hmac_ctx_, nullptr, 0, nullptr, nullptr)) {
+    printf("%s() error, line: %d, HMAC failed\n", __func__, __LINE__);
+    return false;
+  }
+  if (aad_len > 0 && 1 != HMAC_Update(hmac_ctx_, aad, aad_len)) {
+    printf("%s() error, line: %d, HMAC failed\n", __func__, __LINE__);
+    return false;
+  }
+  return true;
+}
 
-  memset(out, 0, *out_size);
+bool certifier::utilities::crypto_context::finish_mac(int           aad_len,
+                                                      byte *        mac,
+                                                      unsigned int *mac_size) {
+  if (aad_len > 0) {
+    byte     al[8];
+    uint64_t bits = ((uint64_t)aad_len) * num_bits_in_byte;
+    for (int i = 7; i >= 0; i--) {
+      al[i] = (byte)(bits & 0xff);
+      bits >>= 8;
+    }
+    if (1 != HMAC_Update(hmac_ctx_, al, sizeof(al))) {
+      printf("%s() error, line: %d, HMAC failed\n", __func__, __LINE__);
+      return false;
+    }
+  }
+  if (1 != HMAC_Final(hmac_ctx_, mac, mac_size)) {
+    printf("%s() error, line: %d, HMAC failed\n", __func__, __LINE__);
+    return false;
+  }
+  return true;
+}
 
-  if (!encrypt(in, in_len, key, iv, out + block_size, &cipher_size)) {
-    printf("%s() error, line: %d, aes_256_cbc_sha384_encrypt: encrypt failed\n",
+// Output is iv, ciphertext, mac (or 128 bit gcm tag).  in may be exactly
+// out + block_size.
+bool certifier::utilities::crypto_context::authenticated_encrypt(
+    byte *      in,
+    int         in_len,
+    byte *      iv,
+    byte *      out,
+    int *       out_size,
+    const byte *aad,
+    int         aad_len) {
+  if (!authenticated()) {
+    printf("%s() error, line: %d, not an authenticated context\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (in_len < 0 || aad_len < 0) {
+    printf("%s() error, line: %d, bad input size\n", __func__, __LINE__);
+    return false;
+  }
+  int max_cipher_size = gcm_ ? in_len : in_len + blk_size_;
+  if (*out_size < blk_size_ + max_cipher_size + mac_size_) {
+    printf("%s() error, line: %d, output buffer too small\n",
            __func__,
            __LINE__);
     return false;
   }
-  memcpy(out, iv, block_size);
-  cipher_size += block_size;
-  unsigned int hmac_size = mac_size;
-  HMAC(EVP_sha384(),
-       &key[key_size / 2],
-       mac_size,
-       out,
-       cipher_size,
-       out + cipher_size,
-       &hmac_size);
-  *out_size = cipher_size + hmac_size;
 
+  int n = 0;
+  int total = 0;
+  if (!encrypt_init(iv, out, &n, aad, aad_len))
+    return false;
+  total = n;
+  if (!encrypt_update(in, in_len, out + total, &n)) {
+    stream_op_ = 0;
+    return false;
+  }
+  total += n;
+  if (!encrypt_final(out + total, &n))
+    return false;
+  *out_size = total + n;
   return true;
 }
 
-bool aes_256_cbc_sha384_decrypt(byte *in,
-                                int   in_len,
-                                byte *key,
-                                byte *out,
-                                int * out_size) {
-  int blk_size = cipher_block_byte_size(Enc_method_aes_256_cbc_hmac_sha384);
-  int key_size = cipher_key_byte_size(Enc_method_aes_256_cbc_hmac_sha384);
-  int mac_size = mac_output_byte_size(Enc_method_aes_256_cbc_hmac_sha384);
-  int cipher_size = *out_size - blk_size;
-
-  int          plain_size = *out_size - blk_size - mac_size;
-  int          msg_with_iv_size = in_len - mac_size;
-  unsigned int hmac_size = mac_size;
-
-  byte hmac_out[hmac_size];
-  HMAC(EVP_sha384(),
-       &key[key_size / 2],
-       mac_size,
-       in,
-       msg_with_iv_size,
-       (byte *)hmac_out,
-       &hmac_size);
-  if (memcmp(hmac_out, in + msg_with_iv_size, mac_size) != 0) {
-    printf("%s() error, line: %d, aes_256_cbc_sha384_decrypt: HMAC failed\n",
+// The mac or tag is checked before any plaintext is released.  out may
+// be exactly in + block_size.
+bool certifier::utilities::crypto_context::authenticated_decrypt(
+    byte *      in,
+    int         in_len,
+    byte *      out,
+    int *       out_size,
+    const byte *aad,
+    int         aad_len) {
+  if (!authenticated()) {
+    printf("%s() error, line: %d, not an authenticated context\n",
            __func__,
            __LINE__);
     return false;
   }
+  if (in_len < blk_size_ + mac_size_ || aad_len < 0) {
+    printf("%s() error, line: %d, input too short\n", __func__, __LINE__);
+    return false;
+  }
+  int msg_with_iv_size = in_len - mac_size_;
+
+  if (!gcm_) {
+    unsigned int hmac_size = mac_size_;
+    byte         hmac_out[EVP_MAX_MD_SIZE];
+    if (!start_mac(aad, aad_len)
+        || 1 != HMAC_Update(hmac_ctx_, in, msg_with_iv_size)
+        || !finish_mac(aad_len, hmac_out, &hmac_size)) {
+      return false;
+    }
+    if (CRYPTO_memcmp(hmac_out, in + msg_with_iv_size, mac_size_) != 0) {
+      printf("%s() error, line: %d, HMAC mismatch\n", __func__, __LINE__);
+      return false;
+    }
+    int plain_size = 0;
+    if (!decrypt(in + blk_size_,
+                 msg_with_iv_size - blk_size_,
+                 in,
+                 out,
+                 &plain_size)) {
+      printf("%s() error, line: %d, decrypt failed\n", __func__, __LINE__);
+      return false;
+    }
+    *out_size = plain_size;
+    return true;
+  }
 
-  if (!decrypt(in + block_size,
-               msg_with_iv_size - block_size,
-               key,
-               in,
-               out,
-               &plain_size)) {
-    printf("%s() error, line: %d, aes_256_cbc_sha384_decrypt: decrypt failed\n",
+  int len = 0;
+  int plaintext_len = 0;
+  if (1 != EVP_DecryptInit_ex(dec_ctx_, nullptr, nullptr, nullptr, in)) {
+    printf("%s() error, line: %d, EVP_DecryptInit_ex failed\n",
            __func__,
            __LINE__);
     return false;
   }
-  *out_size = plain_size;
-  return (memcmp(hmac_out, in + msg_with_iv_size, mac_size) == 0);
-}
-
-// We use 128 bit tag
-bool aes_256_gcm_encrypt(byte *in,
-                         int   in_len,
-                         byte *key,
-                         byte *iv,
-                         byte *out,
-                         int * out_size) {
-  EVP_CIPHER_CTX *ctx = nullptr;
-  int             len;
-  int             ciphertext_len;
-  int             blk_size = cipher_block_byte_size(Enc_method_aes_256);
-  int             key_size = cipher_key_byte_size(Enc_method_aes_256);
-  int             tag_len = 0;
-  byte            tag[16];
-  int             aad_len = 0;
-  byte *          aad = nullptr;
-  bool            ret = true;
-
-  if (!(ctx = EVP_CIPHER_CTX_new())) {
-    printf("%s() error, line: %d, EVP_CIPHER_CTX_new failed\n",
+  if (aad_len > 0
+      && 1 != EVP_DecryptUpdate(dec_ctx_, nullptr, &len, aad, aad_len)) {
+    printf("%s() error, line: %d, EVP_DecryptUpdate failed\n",
            __func__,
            __LINE__);
     return false;
   }
-
   if (1
-      != EVP_EncryptInit_ex(ctx,
-                            EVP_aes_256_gcm(),
-                            nullptr,
-                            nullptr,
-                            nullptr)) {
-    printf("%s() error, line: %d, EVP_EncryptInit_ex failed\n",
+      != EVP_CIPHER_CTX_ctrl(dec_ctx_,
+                             EVP_CTRL_GCM_SET_TAG,
+                             mac_size_,
+                             in + msg_with_iv_size)) {
+    printf("%s() error, line: %d, EVP_CIPHER_CTX_ctrl failed\n",
            __func__,
            __LINE__);
-    ret = false;
-    goto done;
+    return false;
   }
-
-  // set IV length
   if (1
-      != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, blk_size, nullptr)) {
-    printf("%s() error, line: %d, EVP_CIPHER_CTX_ctrl failed\n",
+      != EVP_DecryptUpdate(dec_ctx_,
+                           out,
+                           &len,
+                           in + blk_size_,
+                           msg_with_iv_size - blk_size_)) {
+    printf("%s() error, line: %d, EVP_DecryptUpdate failed\n",
            __func__,
            __LINE__);
-    ret = false;
-    goto done;
+    return false;
   }
-  if (1 != EVP_EncryptInit_ex(ctx, nullptr, nullptr, key, iv)) {
-    printf("%s() error, line: %d, EVP_EncryptInit_ex failed\n",
+  plaintext_len = len;
+  if (EVP_DecryptFinal_ex(dec_ctx_, out + plaintext_len, &len) <= 0) {
+    printf("%s() error, line: %d, EVP_DecryptFinal failed\n",
            __func__,
            __LINE__);
-    ret = false;
-    goto done;
+    OPENSSL_cleanse(out, plaintext_len);
+    return false;
   }
+  *out_size = plaintext_len + len;
+  return true;
+}
+
+bool certifier::utilities::crypto_context::authenticated_encrypt_in_place(
+    byte *      iv,
+    byte *      buf,
+    int         in_len,
+    int         buf_size,
+    int *       out_size,
+    const byte *aad,
+    int         aad_len) {
+  *out_size = buf_size;
+  return authenticated_encrypt(buf + block_size,
+                               in_len,
+                               iv,
+                               buf,
+                               out_size,
+                               aad,
+                               aad_len);
+}
 
-  memcpy(out, iv, blk_size);
+bool certifier::utilities::crypto_context::authenticated_decrypt_in_place(
+    byte *      buf,
+    int         in_len,
+    int *       out_size,
+    const byte *aad,
+    int         aad_len) {
+  return authenticated_decrypt(buf,
+                               in_len,
+                               buf + block_size,
+                               out_size,
+                               aad,
+                               aad_len);
+}
 
-  if (1 != EVP_EncryptUpdate(ctx, nullptr, &len, aad, aad_len)) {
-    printf("%s() error, line: %d, EVP_EncryptUpdate failed\n",
+const int encrypt_stream = 1;
+const int decrypt_stream = 2;
+
+bool certifier::utilities::crypto_context::encrypt_init(byte *      iv,
+                                                        byte *      out,
+                                                        int *       out_size,
+                                                        const byte *aad,
+                                                        int         aad_len) {
+  if (!authenticated()) {
+    printf("%s() error, line: %d, not an authenticated context\n",
            __func__,
            __LINE__);
-    ret = false;
-    goto done;
+    return false;
+  }
+  stream_op_ = 0;
+  if (1 != EVP_EncryptInit_ex(enc_ctx_, nullptr, nullptr, nullptr, iv)) {
+    printf("%s() error, line: %d, EVP_EncryptInit_ex failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  int len = 0;
+  if (gcm_) {
+    if (aad_len > 0
+        && 1 != EVP_EncryptUpdate(enc_ctx_, nullptr, &len, aad, aad_len)) {
+      printf("%s() error, line: %d, EVP_EncryptUpdate failed\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+  } else if (!start_mac(aad, aad_len)
+             || 1 != HMAC_Update(hmac_ctx_, iv, blk_size_)) {
+    printf("%s() error, line: %d, HMAC failed\n", __func__, __LINE__);
+    return false;
+  }
+  memcpy(out, iv, blk_size_);
+  *out_size = blk_size_;
+  stream_aad_len_ = aad_len;
+  stream_op_ = encrypt_stream;
+  return true;
+}
+
+bool certifier::utilities::crypto_context::encrypt_update(const byte *in,
+                                                          int         in_len,
+                                                          byte *      out,
+                                                          int *out_size) {
+  if (stream_op_ != encrypt_stream || in_len < 0) {
+    printf("%s() error, line: %d, no encrypt stream\n", __func__, __LINE__);
+    return false;
   }
-  if (1 != EVP_EncryptUpdate(ctx, out + blk_size, &len, in, in_len)) {
+  int len = 0;
+  if (1 != EVP_EncryptUpdate(enc_ctx_, out, &len, in, in_len)) {
     printf("%s() error, line: %d, EVP_EncryptUpdate failed\n",
            __func__,
            __LINE__);
-    ret = false;
-    goto done;
+    stream_op_ = 0;
+    return false;
+  }
+  if (!gcm_ && 1 != HMAC_Update(hmac_ctx_, out, len)) {
+    printf("%s() error, line: %d, HMAC failed\n", __func__, __LINE__);
+    stream_op_ = 0;
+    return false;
   }
-  ciphertext_len = len + blk_size;
+  *out_size = len;
+  return true;
+}
 
-  // Finalize
-  if (1 != EVP_EncryptFinal_ex(ctx, out + len, &len)) {
+bool certifier::utilities::crypto_context::encrypt_final(byte *out,
+                                                         int * out_size) {
+  if (stream_op_ != encrypt_stream) {
+    printf("%s() error, line: %d, no encrypt stream\n", __func__, __LINE__);
+    return false;
+  }
+  stream_op_ = 0;
+  int len = 0;
+  if (1 != EVP_EncryptFinal_ex(enc_ctx_, out, &len)) {
     printf("%s() error, line: %d, EVP_EncryptFinal_ex failed\n",
            __func__,
            __LINE__);
-    ret = false;
-    goto done;
+    return false;
+  }
+  if (gcm_) {
+    if (1
+        != EVP_CIPHER_CTX_ctrl(enc_ctx_,
+                               EVP_CTRL_GCM_GET_TAG,
+                               mac_size_,
+                               out + len)) {
+      printf("%s() error, line: %d, EVP_CIPHER_CTX_ctrl failed\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+    *out_size = len + mac_size_;
+    return true;
   }
-  ciphertext_len += len;
+  unsigned int hmac_size = mac_size_;
+  if (1 != HMAC_Update(hmac_ctx_, out, len)) {
+    printf("%s() error, line: %d, HMAC failed\n", __func__, __LINE__);
+    return false;
+  }
+  if (!finish_mac(stream_aad_len_, out + len, &hmac_size))
+    return false;
+  *out_size = len + hmac_size;
+  return true;
+}
 
-  tag_len = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, blk_size, tag);
-  if (tag_len <= 0) {
-    printf("%s() error, line: %d, EVP_CIPHER_CTX_ctrl failed\n",
+bool certifier::utilities::crypto_context::decrypt_init(const byte *aad,
+                                                        int         aad_len) {
+  if (!authenticated() || aad_len < 0) {
+    printf("%s() error, line: %d, not an authenticated context\n",
            __func__,
            __LINE__);
-    ret = false;
-    goto done;
+    return false;
   }
+  // gcm can only take the aad once the iv is in.
+  if (aad_len > 0)
+    stream_aad_.assign((const char *)aad, aad_len);
+  else
+    stream_aad_.clear();
+  stream_aad_len_ = aad_len;
+  stream_iv_len_ = 0;
+  pending_len_ = 0;
+  stream_op_ = decrypt_stream;
+  return true;
+}
 
-  // append tag
-  memcpy(out + ciphertext_len, tag, blk_size);
-  *out_size = ciphertext_len + blk_size;
+bool certifier::utilities::crypto_context::decrypt_update(const byte *in,
+                                                          int         in_len,
+                                                          byte *      out,
+                                                          int *out_size) {
+  if (stream_op_ != decrypt_stream || in_len < 0) {
+    printf("%s() error, line: %d, no decrypt stream\n", __func__, __LINE__);
+    return false;
+  }
+  *out_size = 0;
+
+  // The iv comes first.
+  if (stream_iv_len_ < blk_size_) {
+    int n = blk_size_ - stream_iv_len_;
+    if (n > in_len)
+      n = in_len;
+    memcpy(stream_iv_ + stream_iv_len_, in, n);
+    stream_iv_len_ += n;
+    in += n;
+    in_len -= n;
+    if (stream_iv_len_ < blk_size_)
+      return true;
+    if (1
+        != EVP_DecryptInit_ex(dec_ctx_, nullptr, nullptr, nullptr, stream_iv_)) {
+      printf("%s() error, line: %d, EVP_DecryptInit_ex failed\n",
+             __func__,
+             __LINE__);
+      stream_op_ = 0;
+      return false;
+    }
+    const byte *aad = (const byte *)stream_aad_.data();
+    int         len = 0;
+    if (gcm_) {
+      if (stream_aad_len_ > 0
+          && 1
+                 != EVP_DecryptUpdate(dec_ctx_,
+                                      nullptr,
+                                      &len,
+                                      aad,
+                                      stream_aad_len_)) {
+        printf("%s() error, line: %d, EVP_DecryptUpdate failed\n",
+               __func__,
+               __LINE__);
+        stream_op_ = 0;
+        return false;
+      }
+    } else if (!start_mac(aad, stream_aad_len_)
+               || 1 != HMAC_Update(hmac_ctx_, stream_iv_, blk_size_)) {
+      printf("%s() error, line: %d, HMAC failed\n", __func__, __LINE__);
+      stream_op_ = 0;
+      return false;
+    }
+  }
 
-done:
-  if (ctx != nullptr) {
-    EVP_CIPHER_CTX_free(ctx);
-    ctx = nullptr;
+  // Everything but the last mac_size_ bytes seen so far is ciphertext:
+  // first whatever is pending, then the front of in.
+  int ready = pending_len_ + in_len - mac_size_;
+  if (ready <= 0) {
+    memcpy(pending_ + pending_len_, in, in_len);
+    pending_len_ += in_len;
+    return true;
   }
-  return ret;
+  int from_pending = ready < pending_len_ ? ready : pending_len_;
+  int from_in = ready - from_pending;
+  int len = 0;
+  int total = 0;
+  if (from_pending > 0) {
+    if ((!gcm_ && 1 != HMAC_Update(hmac_ctx_, pending_, from_pending))
+        || 1
+               != EVP_DecryptUpdate(dec_ctx_,
+                                    out,
+                                    &len,
+                                    pending_,
+                                    from_pending)) {
+      printf("%s() error, line: %d, decrypt failed\n", __func__, __LINE__);
+      stream_op_ = 0;
+      return false;
+    }
+    total = len;
+  }
+  if (from_in > 0) {
+    if ((!gcm_ && 1 != HMAC_Update(hmac_ctx_, in, from_in))
+        || 1 != EVP_DecryptUpdate(dec_ctx_, out + total, &len, in, from_in)) {
+      printf("%s() error, line: %d, decrypt failed\n", __func__, __LINE__);
+      stream_op_ = 0;
+      return false;
+    }
+    total += len;
+  }
+  memmove(pending_, pending_ + from_pending, pending_len_ - from_pending);
+  pending_len_ -= from_pending;
+  memcpy(pending_ + pending_len_, in + from_in, in_len - from_in);
+  pending_len_ += in_len - from_in;
+  *out_size = total;
+  return true;
 }
 
-// We use 128 bit tag
-bool aes_256_gcm_decrypt(byte *in,
-                         int   in_len,
-                         byte *key,
-                         byte *out,
-                         int * out_size) {
-  EVP_CIPHER_CTX *ctx = nullptr;
-  int             blk_size = cipher_block_byte_size(Enc_method_aes_256);
-  int             key_size = cipher_key_byte_size(Enc_method_aes_256);
-  byte *          iv = in;
-  bool            ret = true;
-  byte *          tag = in + in_len - blk_size;
-  int             aad_len = 0;
-  byte *          aad = nullptr;
-  int             len;
-  int             plaintext_len;
-  int             stream_len = in_len - 2 * blk_size;
-  int             err = 0;
-
-  if (!(ctx = EVP_CIPHER_CTX_new())) {
-    printf("%s() error, line: %d, EVP_CIPHER_CTX_new failed\n",
-           __func__,
-           __LINE__);
+bool certifier::utilities::crypto_context::decrypt_final(byte *out,
+                                                         int * out_size) {
+  if (stream_op_ != decrypt_stream) {
+    printf("%s() error, line: %d, no decrypt stream\n", __func__, __LINE__);
     return false;
   }
-  if (!EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, nullptr, nullptr)) {
-    printf("%s() error, line: %d, EVP_DecryptInit_ex failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
+  stream_op_ = 0;
+  if (stream_iv_len_ < blk_size_ || pending_len_ < mac_size_) {
+    printf("%s() error, line: %d, input too short\n", __func__, __LINE__);
+    return false;
   }
-  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, blk_size, nullptr)) {
-    printf("%s() error, line: %d, EVP_CIPHER_CTX_ctrl failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
+
+  // pending_ now holds exactly the mac or tag.
+  int len = 0;
+  if (gcm_) {
+    if (1
+        != EVP_CIPHER_CTX_ctrl(dec_ctx_,
+                               EVP_CTRL_GCM_SET_TAG,
+                               mac_size_,
+                               pending_)) {
+      printf("%s() error, line: %d, EVP_CIPHER_CTX_ctrl failed\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+    if (EVP_DecryptFinal_ex(dec_ctx_, out, &len) <= 0) {
+      printf("%s() error, line: %d, EVP_DecryptFinal failed\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+    *out_size = len;
+    return true;
   }
-  if (!EVP_DecryptInit_ex(ctx, nullptr, nullptr, key, iv)) {
-    printf("%s() error, line: %d, EVP_DecryptInit_ex failed\n",
+
+  unsigned int hmac_size = mac_size_;
+  byte         hmac_out[EVP_MAX_MD_SIZE];
+  if (!finish_mac(stream_aad_len_, hmac_out, &hmac_size))
+    return false;
+  if (CRYPTO_memcmp(hmac_out, pending_, mac_size_) != 0) {
+    printf("%s() error, line: %d, HMAC mismatch\n", __func__, __LINE__);
+    return false;
+  }
+  if (1 != EVP_DecryptFinal_ex(dec_ctx_, out, &len)) {
+    printf("%s() error, line: %d, EVP_DecryptFinal failed\n",
            __func__,
            __LINE__);
-    ret = false;
-    goto done;
+    return false;
   }
+  *out_size = len;
+  return true;
+}
 
-  if (!EVP_DecryptUpdate(ctx, nullptr, &len, aad, aad_len)) {
-    printf("%s() error, line: %d, EVP_DecryptUpdate failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
+// Per thread, most recently used first.
+const int thread_crypto_cache_size = 4;
+
+class thread_crypto_cache {
+ public:
+  crypto_context *entries_[thread_crypto_cache_size];
+
+  thread_crypto_cache() {
+    for (int i = 0; i < thread_crypto_cache_size; i++)
+      entries_[i] = nullptr;
   }
-  if (!EVP_DecryptUpdate(ctx, out, &len, in + blk_size, stream_len)) {
-    printf("%s() error, line: %d, EVP_DecryptUpdate failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
+  ~thread_crypto_cache() {
+    for (int i = 0; i < thread_crypto_cache_size; i++)
+      delete entries_[i];
   }
-  plaintext_len = len;
+};
 
-  if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, blk_size, tag)) {
-    printf("%s() error, line: %d, EVP_CIPHER_CTX_ctrl failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
+static thread_local thread_crypto_cache crypto_cache;
+
+void certifier::utilities::clear_thread_crypto_contexts() {
+  for (int i = 0; i < thread_crypto_cache_size; i++) {
+    delete crypto_cache.entries_[i];
+    crypto_cache.entries_[i] = nullptr;
   }
+}
 
-  // Finalize
-  err = EVP_DecryptFinal_ex(ctx, in + in_len - blk_size, &len);
-  if (err <= 0) {
-    printf("%s() error, line: %d, EVP_DecryptFinal failed\n",
-           __func__,
-           __LINE__);
-    ret = false;
-    goto done;
+int certifier::utilities::num_thread_crypto_contexts() {
+  int n = 0;
+  for (int i = 0; i < thread_crypto_cache_size; i++) {
+    if (crypto_cache.entries_[i] != nullptr)
+      n++;
   }
+  return n;
+}
 
-  *out_size = plaintext_len;
+crypto_context *certifier::utilities::thread_crypto_context(
+    const char *alg_name,
+    const byte *key) {
+  crypto_context **e = crypto_cache.entries_;
+  int              i = 0;
+  for (i = 0; i < thread_crypto_cache_size; i++) {
+    if (e[i] == nullptr || e[i]->same_key(alg_name, key))
+      break;
+  }
 
-done:
-  if (ctx != nullptr)
-    EVP_CIPHER_CTX_free(ctx);
-  return ret;
+  crypto_context *c = nullptr;
+  if (i < thread_crypto_cache_size && e[i] != nullptr) {
+    c = e[i];
+  } else {
+    // Reuse the least recently used slot.
+    if (i == thread_crypto_cache_size)
+      i--;
+    c = e[i];
+    if (c == nullptr)
+      c = new crypto_context();
+    if (!c->init(alg_name, key)) {
+      delete c;
+      e[i] = nullptr;
+      return nullptr;
+    }
+  }
+  for (; i > 0; i--)
+    e[i] = e[i - 1];
+  e[0] = c;
+  return c;
 }
 
 bool certifier::utilities::authenticated_encrypt(const char *alg_name,
                                                  byte *      in,
                                                  int         in_len,
-                                                 byte *      key,
-                                                 byte *      iv,
-                                                 byte *      out,
-                                                 int *       out_size) {
-
-  if (strcmp(alg_name, Enc_method_aes_256_cbc_hmac_sha256) == 0) {
-    return aes_256_cbc_sha256_encrypt(in, in_len, key, iv, out, out_size);
-  } else if (strcmp(alg_name, Enc_method_aes_256_cbc_hmac_sha384) == 0) {
-    return aes_256_cbc_sha384_encrypt(in, in_len, key, iv, out, out_size);
-  } else if (strcmp(alg_name, Enc_method_aes_256_gcm) == 0) {
-    return aes_256_gcm_encrypt(in, in_len, key, iv, out, out_size);
-  } else {
-    printf("%s() error, line: %d, authenticated_decrypt: unsupported algorithm "
-           "%s\n",
-           __func__,
-           __LINE__,
-           alg_name);
-    return false;
-  }
+                                                 byte *      key,
+                                                 byte *      iv,
+                                                 byte *      out,
+                                                 int *       out_size) {
+  return authenticated_encrypt_with_aad(alg_name,
+                                        in,
+                                        in_len,
+                                        nullptr,
+                                        0,
+                                        key,
+                                        iv,
+                                        out,
+                                        out_size);
 }
 
 bool certifier::utilities::authenticated_decrypt(const char *alg_name,
@@ -1115,21 +1481,98 @@ bool certifier::utilities::authenticated_decrypt(const char *alg_name,
                                                  byte *      key,
                                                  byte *      out,
                                                  int *       out_size) {
+  return authenticated_decrypt_with_aad(alg_name,
+                                        in,
+                                        in_len,
+                                        nullptr,
+                                        0,
+                                        key,
+                                        out,
+                                        out_size);
+}
 
-  if (strcmp(alg_name, Enc_method_aes_256_cbc_hmac_sha256) == 0) {
-    return aes_256_cbc_sha256_decrypt(in, in_len, key, out, out_size);
-  } else if (strcmp(alg_name, Enc_method_aes_256_cbc_hmac_sha384) == 0) {
-    return aes_256_cbc_sha384_decrypt(in, in_len, key, out, out_size);
-  } else if (strcmp(alg_name, Enc_method_aes_256_gcm) == 0) {
-    return aes_256_gcm_decrypt(in, in_len, key, out, out_size);
-  } else {
-    printf("%s() error, line: %d, authenticated_decrypt: unsupported algorithm "
-           "%s\n",
+static crypto_context *context_for(const char *alg_name, const byte *key) {
+  crypto_context *c = thread_crypto_context(alg_name, key);
+  if (c == nullptr) {
+    printf("%s() error, line: %d, unsupported algorithm %s\n",
            __func__,
            __LINE__,
            alg_name);
-    return false;
   }
+  return c;
+}
+
+bool certifier::utilities::authenticated_encrypt_with_aad(const char *alg_name,
+                                                          byte *      in,
+                                                          int         in_len,
+                                                          const byte *aad,
+                                                          int         aad_len,
+                                                          byte *      key,
+                                                          byte *      iv,
+                                                          byte *      out,
+                                                          int *out_size) {
+  crypto_context *c = context_for(alg_name, key);
+  if (c == nullptr)
+    return false;
+  bool ret =
+      c->authenticated_encrypt(in, in_len, iv, out, out_size, aad, aad_len);
+  release_thread_crypto_contexts();
+  return ret;
+}
+
+bool certifier::utilities::authenticated_decrypt_with_aad(const char *alg_name,
+                                                          byte *      in,
+                                                          int         in_len,
+                                                          const byte *aad,
+                                                          int         aad_len,
+                                                          byte *      key,
+                                                          byte *      out,
+                                                          int *out_size) {
+  crypto_context *c = context_for(alg_name, key);
+  if (c == nullptr)
+    return false;
+  bool ret = c->authenticated_decrypt(in, in_len, out, out_size, aad, aad_len);
+  release_thread_crypto_contexts();
+  return ret;
+}
+
+bool certifier::utilities::authenticated_encrypt_in_place(const char *alg_name,
+                                                          byte *      key,
+                                                          byte *      iv,
+                                                          const byte *aad,
+                                                          int         aad_len,
+                                                          byte *      buf,
+                                                          int         in_len,
+                                                          int   buf_size,
+                                                          int * out_size) {
+  crypto_context *c = context_for(alg_name, key);
+  if (c == nullptr)
+    return false;
+  bool ret = c->authenticated_encrypt_in_place(iv,
+                                               buf,
+                                               in_len,
+                                               buf_size,
+                                               out_size,
+                                               aad,
+                                               aad_len);
+  release_thread_crypto_contexts();
+  return ret;
+}
+
+bool certifier::utilities::authenticated_decrypt_in_place(const char *alg_name,
+                                                          byte *      key,
+                                                          const byte *aad,
+                                                          int         aad_len,
+                                                          byte *      buf,
+                                                          int         in_len,
+                                                          int *out_size) {
+  crypto_context *c = context_for(alg_name, key);
+  if (c == nullptr)
+    return false;
+  bool ret =
+      c->authenticated_decrypt_in_place(buf, in_len, out_size, aad, aad_len);
+  release_thread_crypto_contexts();
+  return ret;
 }
 
 const int rsa_alg_type = 1;
@@ -1306,7 +1749,19 @@ bool rsa_sign(const char *alg,
               byte *      msg,
               int *       sig_size,
               byte *      sig) {
+  const EVP_MD *md = nullptr;
+  if (strcmp(Digest_method_sha_256, alg) == 0) {
+    md = EVP_sha256();
+  } else if (strcmp(Digest_method_sha_384, alg) == 0) {
+    md = EVP_sha384();
+  } else {
+    printf("%s() error, line: %d, rsa_sign: unsuported digest\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
 
+  // The caller keeps its reference to key.
   EVP_PKEY *private_key = EVP_PKEY_new();
   if (private_key == nullptr) {
     printf("%s() error, line: %d, rsa_sign: EVP_PKEY_new failed\n",
@@ -1314,78 +1769,44 @@ bool rsa_sign(const char *alg,
            __LINE__);
     return false;
   }
+  RSA_up_ref(key);
   EVP_PKEY_assign_RSA(private_key, key);
 
+  bool        ret = false;
+  size_t      t = *sig_size;
   EVP_MD_CTX *sign_ctx = EVP_MD_CTX_create();
   if (sign_ctx == nullptr) {
     printf("%s() error, line: %d, rsa_sign: EVP_MD_CTX_create() failed\n",
            __func__,
            __LINE__);
-    return false;
+    goto done;
   }
-
-  unsigned int size_digest = 0;
-  if (strcmp(Digest_method_sha_256, alg) == 0) {
-    if (EVP_DigestSignInit(sign_ctx,
-                           nullptr,
-                           EVP_sha256(),
-                           nullptr,
-                           private_key)
-        <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignInit() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    if (EVP_DigestSignUpdate(sign_ctx, msg, size) <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignUpdate() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    size_t t = *sig_size;
-    if (EVP_DigestSignFinal(sign_ctx, sig, &t) <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignFinal() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    *sig_size = t;
-  } else if (strcmp(Digest_method_sha_384, alg) == 0) {
-    if (EVP_DigestSignInit(sign_ctx,
-                           nullptr,
-                           EVP_sha384(),
-                           nullptr,
-                           private_key)
-        <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignInit() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    if (EVP_DigestSignUpdate(sign_ctx, msg, size) <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignUpdate() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    size_t t = *sig_size;
-    if (EVP_DigestSignFinal(sign_ctx, sig, &t) <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignFinal() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    *sig_size = t;
-  } else {
-    printf("%s() error, line: %d, rsa_sign: unsuported digest\n",
+  if (EVP_DigestSignInit(sign_ctx, nullptr, md, nullptr, private_key) <= 0) {
+    printf("%s() error, line: %d, rsa_sign: EVP_DigestSignInit() failed\n",
            __func__,
            __LINE__);
-    return false;
+    goto done;
+  }
+  if (EVP_DigestSignUpdate(sign_ctx, msg, size) <= 0) {
+    printf("%s() error, line: %d, rsa_sign: EVP_DigestSignUpdate() failed\n",
+           __func__,
+           __LINE__);
+    goto done;
+  }
+  if (EVP_DigestSignFinal(sign_ctx, sig, &t) <= 0) {
+    printf("%s() error, line: %d, rsa_sign: EVP_DigestSignFinal() failed\n",
+           __func__,
+           __LINE__);
+    goto done;
   }
-  EVP_MD_CTX_destroy(sign_ctx);
+  *sig_size = t;
+  ret = true;
 
-  return true;
+done:
+  if (sign_ctx != nullptr)
+    EVP_MD_CTX_destroy(sign_ctx);
+  EVP_PKEY_free(private_key);
+  return ret;
 }
 
 bool rsa_verify(const char *alg,
@@ -2333,10 +2754,10 @@ bool same_point(const point_message &pt1, const point_message &pt2) {
   if (pt1.y().size() != pt2.y().size()) {
     return false;
   }
-  if (memcmp(pt1.x().data(), pt1.x().data(), pt1.x().size()) != 0) {
+  if (memcmp(pt1.x().data(), pt2.x().data(), pt1.x().size()) != 0) {
     return false;
   }
-  if (memcmp(pt1.y().data(), pt1.y().data(), pt1.y().size()) != 0) {
+  if (memcmp(pt1.y().data(), pt2.y().data(), pt1.y().size()) != 0) {
     return false;
   }
   return true;
@@ -2396,15 +2817,15 @@ bool same_key(const key_message &k1, const key_message &k2) {
     }
     if (em1.curve_a().size() != em2.curve_a().size()
         || memcmp(em1.curve_a().data(),
-                  em1.curve_a().data(),
-                  em2.curve_a().size())
+                  em2.curve_a().data(),
+                  em1.curve_a().size())
                != 0) {
       return false;
     }
     if (em1.curve_b().size() != em2.curve_b().size()
         || memcmp(em1.curve_b().data(),
-                  em1.curve_b().data(),
-                  em2.curve_b().size())
+                  em2.curve_b().data(),
+                  em1.curve_b().size())
                != 0) {
       return false;
     }
@@ -2428,15 +2849,15 @@ bool same_key(const key_message &k1, const key_message &k2) {
     }
     if (em1.curve_a().size() != em2.curve_a().size()
         || memcmp(em1.curve_a().data(),
-                  em1.curve_a().data(),
-                  em2.curve_a().size())
+                  em2.curve_a().data(),
+                  em1.curve_a().size())
                != 0) {
       return false;
     }
     if (em1.curve_b().size() != em2.curve_b().size()
         || memcmp(em1.curve_b().data(),
-                  em1.curve_b().data(),
-                  em2.curve_b().size())
+                  em2.curve_b().data(),
+                  em1.curve_b().size())
                != 0) {
       return false;
     }
@@ -2609,6 +3030,270 @@ bool same_vse_claim(const vse_clause &c1, const vse_clause &c2) {
   return true;
 }
 
+// SHA-256 over a tag naming what's hashed, then length prefixed fields.
+// Used for fingerprints, where parts that are themselves fingerprinted go
+// in by fingerprint, and for key_cache() digests.
+class fingerprint_hash {
+ public:
+  fingerprint_hash(const char *tag) {
+    ctx_ = EVP_MD_CTX_new();
+    ok_ = ctx_ != nullptr
+          && EVP_DigestInit_ex(ctx_, EVP_sha256(), nullptr) == 1;
+    add(tag, strlen(tag));
+  }
+  ~fingerprint_hash() {
+    if (ctx_ != nullptr)
+      EVP_MD_CTX_free(ctx_);
+  }
+
+  void add(const char *data, size_t n) {
+    byte len[8];
+    for (int i = 0; i < 8; i++)
+      len[i] = (byte)((uint64_t)n >> (56 - 8 * i));
+    if (ok_) {
+      ok_ = EVP_DigestUpdate(ctx_, len, sizeof(len)) == 1
+            && EVP_DigestUpdate(ctx_, data, n) == 1;
+    }
+  }
+  void add(const string &s) { add(s.data(), s.size()); }
+  void add(uint64_t v) {
+    byte b[8];
+    for (int i = 0; i < 8; i++)
+      b[i] = (byte)(v >> (56 - 8 * i));
+    add((const char *)b, sizeof(b));
+  }
+
+  bool finish(string *fp) {
+    byte         digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    if (!ok_ || EVP_DigestFinal_ex(ctx_, digest, &digest_len) != 1)
+      return false;
+    fp->assign((char *)digest, digest_len);
+    return true;
+  }
+
+ private:
+  EVP_MD_CTX *ctx_;
+  bool        ok_;
+};
+
+static bool is_rsa_key_type(const string &t) {
+  return t == Enc_method_rsa_1024_private || t == Enc_method_rsa_1024_public
+         || t == Enc_method_rsa_2048_private || t == Enc_method_rsa_2048_public
+         || t == Enc_method_rsa_3072_private || t == Enc_method_rsa_3072_public
+         || t == Enc_method_rsa_4096_private || t == Enc_method_rsa_4096_public;
+}
+
+static bool is_ecc_key_type(const string &t) {
+  return t == Enc_method_ecc_384_private || t == Enc_method_ecc_384_public
+         || t == Enc_method_ecc_256_private || t == Enc_method_ecc_256_public;
+}
+
+static bool is_secret_key_type(const string &t) {
+  return t == Enc_method_aes_256_cbc_hmac_sha256 || t == Enc_method_aes_256_cbc
+         || t == Enc_method_aes_256;
+}
+
+static bool fingerprint_key(const key_message &k, string *fp) {
+  fingerprint_hash h("key");
+  h.add(k.key_type());
+  if (is_rsa_key_type(k.key_type())) {
+    if (!k.has_rsa_key())
+      return false;
+    h.add(k.rsa_key().public_modulus());
+    h.add(k.rsa_key().public_exponent());
+  } else if (is_ecc_key_type(k.key_type())) {
+    const ecc_message &em = k.ecc_key();
+    h.add(em.curve_p());
+    h.add(em.curve_a());
+    h.add(em.curve_b());
+    h.add(em.base_point().x());
+    h.add(em.base_point().y());
+    h.add(em.public_point().x());
+    h.add(em.public_point().y());
+  } else if (is_secret_key_type(k.key_type())) {
+    if (!k.has_secret_key_bits())
+      return false;
+    h.add(k.secret_key_bits());
+  } else {
+    return false;
+  }
+  return h.finish(fp);
+}
+
+static bool fingerprint_key(const key_message &k,
+                            fingerprint_memo * memo,
+                            string *           fp) {
+  if (memo == nullptr)
+    return fingerprint_key(k, fp);
+  const string *m = memo->key(k);
+  if (m == nullptr)
+    return false;
+  fp->assign(*m);
+  return true;
+}
+
+static bool property_name_less(const property *a, const property *b) {
+  return a->property_name() < b->property_name();
+}
+
+// Properties go in sorted by name, so the order of differently named ones
+// doesn't matter.  Properties sharing a name all go in, in their original
+// order, since find_property and same_properties only see the first.
+static bool fingerprint_platform(const platform &  p,
+                                 fingerprint_memo *memo,
+                                 fingerprint_hash *h) {
+  h->add(p.platform_type());
+  if (p.has_key()) {
+    string key_fp;
+    if (!fingerprint_key(p.attest_key(), memo, &key_fp))
+      return false;
+    h->add(key_fp);
+  } else {
+    h->add(string());
+  }
+  std::vector<const property *> sorted;
+  for (int i = 0; i < p.props().props_size(); i++)
+    sorted.push_back(&p.props().props(i));
+  std::stable_sort(sorted.begin(), sorted.end(), property_name_less);
+  h->add((uint64_t)sorted.size());
+  for (const property *prop : sorted) {
+    h->add(prop->property_name());
+    h->add(prop->value_type());
+    h->add(prop->comparator());
+    if (prop->value_type() == "int")
+      h->add((uint64_t)prop->int_value());
+    else if (prop->value_type() == "string")
+      h->add(prop->string_value());
+  }
+  return true;
+}
+
+static bool fingerprint_entity(const entity_message &e,
+                               fingerprint_memo *    memo,
+                               string *              fp) {
+  fingerprint_hash h("entity");
+  h.add(e.entity_type());
+  if (e.entity_type() == "key") {
+    string key_fp;
+    if (!fingerprint_key(e.key(), memo, &key_fp))
+      return false;
+    h.add(key_fp);
+  } else if (e.entity_type() == "measurement") {
+    h.add(e.measurement());
+  } else if (e.entity_type() == "platform") {
+    if (!fingerprint_platform(e.platform_ent(), memo, &h))
+      return false;
+  } else if (e.entity_type() == "environment") {
+    h.add(e.environment_ent().the_measurement());
+    if (!fingerprint_platform(e.environment_ent().the_platform(), memo, &h))
+      return false;
+  } else {
+    return false;
+  }
+  return h.finish(fp);
+}
+
+static bool fingerprint_clause(const vse_clause &c,
+                               fingerprint_memo *memo,
+                               string *          fp) {
+  fingerprint_hash h("vse-clause");
+  string           part;
+  if (c.has_subject()) {
+    if (memo != nullptr) {
+      const string *m = memo->entity(c.subject());
+      if (m == nullptr)
+        return false;
+      part = *m;
+    } else if (!fingerprint_entity(c.subject(), nullptr, &part)) {
+      return false;
+    }
+    h.add("s", 1);
+    h.add(part);
+  }
+  if (c.has_verb()) {
+    h.add("v", 1);
+    h.add(c.verb());
+  }
+  if (c.has_object()) {
+    if (memo != nullptr) {
+      const string *m = memo->entity(c.object());
+      if (m == nullptr)
+        return false;
+      part = *m;
+    } else if (!fingerprint_entity(c.object(), nullptr, &part)) {
+      return false;
+    }
+    h.add("o", 1);
+    h.add(part);
+  }
+  if (c.has_clause()) {
+    if (memo != nullptr) {
+      const string *m = memo->clause(c.clause());
+      if (m == nullptr)
+        return false;
+      part = *m;
+    } else if (!fingerprint_clause(c.clause(), nullptr, &part)) {
+      return false;
+    }
+    h.add("c", 1);
+    h.add(part);
+  }
+  return h.finish(fp);
+}
+
+bool key_fingerprint(const key_message &k, string *fp) {
+  return fingerprint_key(k, fp);
+}
+
+bool entity_fingerprint(const entity_message &e, string *fp) {
+  return fingerprint_entity(e, nullptr, fp);
+}
+
+bool vse_clause_fingerprint(const vse_clause &c, string *fp) {
+  return fingerprint_clause(c, nullptr, fp);
+}
+
+const string *fingerprint_memo::key(const key_message &k) {
+  auto it = keys_.find(&k);
+  if (it != keys_.end())
+    return &it->second;
+  string fp;
+  if (!fingerprint_key(k, &fp))
+    return nullptr;
+  return &(keys_[&k] = fp);
+}
+
+const string *fingerprint_memo::entity(const entity_message &e) {
+  auto it = entities_.find(&e);
+  if (it != entities_.end())
+    return &it->second;
+  string fp;
+  if (!fingerprint_entity(e, this, &fp))
+    return nullptr;
+  return &(entities_[&e] = fp);
+}
+
+const string *fingerprint_memo::clause(const vse_clause &c) {
+  auto it = clauses_.find(&c);
+  if (it != clauses_.end())
+    return &it->second;
+  string fp;
+  if (!fingerprint_clause(c, this, &fp))
+    return nullptr;
+  return &(clauses_[&c] = fp);
+}
+
+void fingerprint_memo::clear() {
+  keys_.clear();
+  entities_.clear();
+  clauses_.clear();
+}
+
+int fingerprint_memo::size() {
+  return (int)(keys_.size() + entities_.size() + clauses_.size());
+}
+
 bool make_key_entity(const key_message &key, entity_message *ent) {
   ent->set_entity_type("key");
   key_message *k = new (key_message);
@@ -3044,8 +3729,8 @@ bool make_signed_claim(const char *          alg,
   int  sig_size = 0;
   bool success = false;
   if (strcmp(alg, Enc_method_rsa_2048_sha256_pkcs_sign) == 0) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
+    RSA *r = cached_rsa_from_key(key);
+    if (r == nullptr) {
       printf("%s() error, line: %d, make_signed_claim: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -3074,8 +3759,8 @@ bool make_signed_claim(const char *          alg,
     out->set_signing_algorithm(alg);
     out->set_signature((void *)sig, sig_size);
   } else if (strcmp(alg, Enc_method_rsa_3072_sha384_pkcs_sign) == 0) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
+    RSA *r = cached_rsa_from_key(key);
+    if (r == nullptr) {
       printf("%s() error, line: %d, make_signed_claim: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -3090,13 +3775,13 @@ bool make_signed_claim(const char *          alg,
                        (byte *)serialized_claim.data(),
                        &sig_size,
                        sig);
+    RSA_free(r);
     if (!success) {
       printf("%s() error, line: %d, make_signed_claim: rsa_sign failed\n",
              __func__,
              __LINE__);
       return false;
     }
-    RSA_free(r);
 
     // sign serialized claim
     key_message *psk = new key_message;
@@ -3108,8 +3793,8 @@ bool make_signed_claim(const char *          alg,
     out->set_signing_algorithm(alg);
     out->set_signature((void *)sig, sig_size);
   } else if (strcmp(alg, Enc_method_rsa_4096_sha384_pkcs_sign) == 0) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
+    RSA *r = cached_rsa_from_key(key);
+    if (r == nullptr) {
       printf("%s() error, line: %d, make_signed_claim: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -3144,7 +3829,7 @@ bool make_signed_claim(const char *          alg,
     out->set_signing_algorithm(alg);
     out->set_signature((void *)sig, sig_size);
   } else if (strcmp(alg, Enc_method_ecc_384_sha384_pkcs_sign) == 0) {
-    EC_KEY *k = key_to_ECC(key);
+    EC_KEY *k = cached_ecc_from_key(key);
     if (k == nullptr) {
       printf("%s() error, line: %d, make_signed_claim: to_ECC failed\n",
              __func__,
@@ -3174,7 +3859,7 @@ bool make_signed_claim(const char *          alg,
     out->set_allocated_signing_key(psk);
     out->set_signature((void *)sig, sig_size);
   } else if (strcmp(alg, Enc_method_ecc_256_sha256_pkcs_sign) == 0) {
-    EC_KEY *k = key_to_ECC(key);
+    EC_KEY *k = cached_ecc_from_key(key);
     if (k == nullptr) {
       printf("%s() error, line: %d, make_signed_claim: to_ECC failed\n",
              __func__,
@@ -3206,6 +3891,20 @@ bool make_signed_claim(const char *          alg,
 
 bool verify_signed_claim(const signed_claim_message &signed_claim,
                          const key_message &         key) {
+  claim_message c;
+  return verify_signed_claim_and_parse(signed_claim, key, &c);
+}
+
+bool verify_signed_claim_and_parse(const signed_claim_message &signed_claim,
+                                   const key_message &         key,
+                                   claim_message *             c) {
+  return claim_cache().verify(signed_claim, key, c);
+}
+
+// The checks behind claim_cache()
+static bool verify_and_parse_uncached(const signed_claim_message &signed_claim,
+                                      const key_message &         key,
+                                      claim_message *             c) {
 
   if (!signed_claim.has_serialized_claim_message()) {
     printf("%s() error, line: %d, verify_signed_claim: no serialized claim\n",
@@ -3232,12 +3931,7 @@ bool verify_signed_claim(const signed_claim_message &signed_claim,
     return false;
   }
 
-  string serialized_claim;
-  serialized_claim.assign(
-      (char *)signed_claim.serialized_claim_message().data(),
-      signed_claim.serialized_claim_message().size());
-  claim_message c;
-  if (!c.ParseFromString(serialized_claim)) {
+  if (!c->ParseFromString(signed_claim.serialized_claim_message())) {
     printf("%s() error, line: %d, verify_signed_claim: can't deserialize "
            "signed claim\n",
            __func__,
@@ -3245,19 +3939,19 @@ bool verify_signed_claim(const signed_claim_message &signed_claim,
     return false;
   }
 
-  if (!c.has_claim_format()) {
+  if (!c->has_claim_format()) {
     printf("%s() error, line: %d, verify_signed_claim: not claim format\n",
            __func__,
            __LINE__);
     return false;
   }
-  if (c.claim_format() != "vse-clause"
-      && c.claim_format() != "vse-attestation") {
+  if (c->claim_format() != "vse-clause"
+      && c->claim_format() != "vse-attestation") {
     printf("%s() error, line: %d, verify_signed_claim: %s should be vse-clause "
            "or vse-attestation\n",
            __func__,
            __LINE__,
-           c.claim_format().c_str());
+           c->claim_format().c_str());
     return false;
   }
 
@@ -3271,13 +3965,13 @@ bool verify_signed_claim(const signed_claim_message &signed_claim,
            __LINE__);
     return false;
   }
-  if (!string_to_time(c.not_before(), &t_nb)) {
+  if (!string_to_time(c->not_before(), &t_nb)) {
     printf("%s() error, line: %d, verify_signed_claim: string_to_time failed\n",
            __func__,
            __LINE__);
     return false;
   }
-  if (!string_to_time(c.not_after(), &t_na)) {
+  if (!string_to_time(c->not_after(), &t_na)) {
     printf("%s() error, line: %d, verify_signed_claim: string_to_time failed\n",
            __func__,
            __LINE__);
@@ -3300,8 +3994,8 @@ bool verify_signed_claim(const signed_claim_message &signed_claim,
   bool success = false;
   if (signed_claim.signing_algorithm()
       == Enc_method_rsa_2048_sha256_pkcs_sign) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
+    RSA *r = cached_rsa_from_key(key);
+    if (r == nullptr) {
       printf("%s() error, line: %d, verify_signed_claim: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -3316,8 +4010,8 @@ bool verify_signed_claim(const signed_claim_message &signed_claim,
     RSA_free(r);
   } else if (signed_claim.signing_algorithm()
              == Enc_method_rsa_3072_sha384_pkcs_sign) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
+    RSA *r = cached_rsa_from_key(key);
+    if (r == nullptr) {
       printf("%s() error, line: %d, verify_signed_claim: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -3332,8 +4026,8 @@ bool verify_signed_claim(const signed_claim_message &signed_claim,
     RSA_free(r);
   } else if (signed_claim.signing_algorithm()
              == Enc_method_rsa_4096_sha384_pkcs_sign) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
+    RSA *r = cached_rsa_from_key(key);
+    if (r == nullptr) {
       printf("%s() error, line: %d, verify_signed_claim: key_to_RSA failed\n",
              __func__,
              __LINE__);
@@ -3348,7 +4042,7 @@ bool verify_signed_claim(const signed_claim_message &signed_claim,
     RSA_free(r);
   } else if (signed_claim.signing_algorithm()
              == Enc_method_ecc_384_sha384_pkcs_sign) {
-    EC_KEY *k = key_to_ECC(key);
+    EC_KEY *k = cached_ecc_from_key(key);
     if (k == nullptr) {
       printf("%s() error, line: %d, verify_signed_claim: key_to_ECC failed\n",
              __func__,
@@ -3364,7 +4058,7 @@ bool verify_signed_claim(const signed_claim_message &signed_claim,
     EC_KEY_free(k);
   } else if (signed_claim.signing_algorithm()
              == Enc_method_ecc_256_sha256_pkcs_sign) {
-    EC_KEY *k = key_to_ECC(key);
+    EC_KEY *k = cached_ecc_from_key(key);
     if (k == nullptr) {
       return false;
     }
@@ -3386,6 +4080,83 @@ bool verify_signed_claim(const signed_claim_message &signed_claim,
   return success;
 }
 
+static void verify_signed_claims_worker(
+    const signed_claim_message *const *claims,
+    int                                num_claims,
+    const key_message *                key,
+    std::atomic<int> *                 next,
+    bool *                             results,
+    claim_message *                    parsed) {
+  for (;;) {
+    int i = (*next)++;
+    if (i >= num_claims)
+      return;
+    const key_message &k = key != nullptr ? *key : claims[i]->signing_key();
+    if (parsed != nullptr) {
+      results[i] = verify_signed_claim_and_parse(*claims[i], k, &parsed[i]);
+    } else {
+      results[i] = verify_signed_claim(*claims[i], k);
+    }
+  }
+}
+
+int verify_signed_claims(int                                num_claims,
+                         const signed_claim_message *const *claims,
+                         const key_message *                key,
+                         int                                num_threads,
+                         bool *                             results,
+                         claim_message *                    parsed) {
+  if (num_claims <= 0)
+    return 0;
+  if (num_threads <= 0)
+    num_threads = std::thread::hardware_concurrency();
+  // Not worth starting threads for a handful of signatures.
+  if (num_threads > num_claims / min_claims_per_verify_thread)
+    num_threads = num_claims / min_claims_per_verify_thread;
+  if (num_threads < 1)
+    num_threads = 1;
+
+  std::atomic<int> next(0);
+  std::thread **   threads = new std::thread *[num_threads - 1];
+  for (int i = 0; i < num_threads - 1; i++) {
+    threads[i] = new std::thread(verify_signed_claims_worker,
+                                 claims,
+                                 num_claims,
+                                 key,
+                                 &next,
+                                 results,
+                                 parsed);
+  }
+  verify_signed_claims_worker(claims, num_claims, key, &next, results, parsed);
+  for (int i = 0; i < num_threads - 1; i++) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  delete[] threads;
+
+  int num_verified = 0;
+  for (int i = 0; i < num_claims; i++) {
+    if (results[i])
+      num_verified++;
+  }
+  return num_verified;
+}
+
+int verify_signed_claim_sequence(const signed_claim_sequence &seq,
+                                 const key_message *          key,
+                                 int                          num_threads,
+                                 bool *                       results,
+                                 claim_message *              parsed) {
+  int                          n = seq.claims_size();
+  const signed_claim_message **claims = new const signed_claim_message *[n];
+  for (int i = 0; i < n; i++)
+    claims[i] = &seq.claims(i);
+  int num_verified =
+      verify_signed_claims(n, claims, key, num_threads, results, parsed);
+  delete[] claims;
+  return num_verified;
+}
+
 // -----------------------------------------------------------------------
 
 void print_protected_blob(protected_blob_message &pb) {
@@ -3566,9 +4337,10 @@ bool certifier::utilities::produce_artifact(key_message &signing_key,
       || signing_key.key_type() == Enc_method_rsa_2048_private
       || signing_key.key_type() == Enc_method_rsa_3072_private
       || signing_key.key_type() == Enc_method_rsa_4096_private) {
-    RSA *signing_rsa_key = RSA_new();
-    if (!key_to_RSA(signing_key, signing_rsa_key)) {
+    RSA *signing_rsa_key = cached_rsa_from_key(signing_key);
+    if (signing_rsa_key == nullptr) {
       printf("produce_artifact: can't get rsa signing key\n");
+      EVP_PKEY_free(signing_pkey);
       return false;
     }
     EVP_PKEY_set1_RSA(signing_pkey, signing_rsa_key);
@@ -3583,12 +4355,15 @@ bool certifier::utilities::produce_artifact(key_message &signing_key,
         || subject_key.key_type() == Enc_method_rsa_2048_private
         || subject_key.key_type() == Enc_method_rsa_3072_private
         || subject_key.key_type() == Enc_method_rsa_4096_private) {
-      RSA *subject_rsa_key = RSA_new();
-      if (!key_to_RSA(subject_key, subject_rsa_key)) {
+      RSA *subject_rsa_key = cached_rsa_from_key(subject_key);
+      if (subject_rsa_key == nullptr) {
         printf("%s() error, line: %d, produce_artifact: can't get rsa subject "
                "key\n",
                __func__,
                __LINE__);
+        EVP_PKEY_free(subject_pkey);
+        EVP_PKEY_free(signing_pkey);
+        RSA_free(signing_rsa_key);
         return false;
       }
       EVP_PKEY_set1_RSA(subject_pkey, subject_rsa_key);
@@ -3598,12 +4373,15 @@ bool certifier::utilities::produce_artifact(key_message &signing_key,
                || subject_key.key_type() == Enc_method_ecc_384_private
                || subject_key.key_type() == Enc_method_ecc_256_public
                || subject_key.key_type() == Enc_method_ecc_256_private) {
-      EC_KEY *subject_ecc_key = key_to_ECC(subject_key);
+      EC_KEY *subject_ecc_key = cached_ecc_from_key(subject_key);
       if (subject_ecc_key == nullptr) {
         printf(
             "%s() error, line: %d, produce_artifact: can't get subject key\n",
             __func__,
             __LINE__);
+        EVP_PKEY_free(subject_pkey);
+        EVP_PKEY_free(signing_pkey);
+        RSA_free(signing_rsa_key);
         return false;
       }
       EVP_PKEY_set1_EC_KEY(subject_pkey, subject_ecc_key);
@@ -3615,6 +4393,9 @@ bool certifier::utilities::produce_artifact(key_message &signing_key,
              __func__,
              __LINE__,
              subject_key.key_type().c_str());
+      EVP_PKEY_free(subject_pkey);
+      EVP_PKEY_free(signing_pkey);
+      RSA_free(signing_rsa_key);
       return false;
     }
     if (signing_key.key_type() == Enc_method_rsa_4096_private
@@ -3628,7 +4409,7 @@ bool certifier::utilities::produce_artifact(key_message &signing_key,
     RSA_free(signing_rsa_key);
   } else if (signing_key.key_type() == Enc_method_ecc_384_private
              || signing_key.key_type() == Enc_method_ecc_256_private) {
-    EC_KEY *signing_ecc_key = key_to_ECC(signing_key);
+    EC_KEY *signing_ecc_key = cached_ecc_from_key(signing_key);
     if (signing_ecc_key == nullptr) {
       printf("%s() error, line: %d, produce_artifact: can't get signing key\n",
              __func__,
@@ -3648,12 +4429,15 @@ bool certifier::utilities::produce_artifact(key_message &signing_key,
         || subject_key.key_type() == Enc_method_rsa_2048_private
         || subject_key.key_type() == Enc_method_rsa_3072_private
         || subject_key.key_type() == Enc_method_rsa_4096_private) {
-      RSA *subject_rsa_key = RSA_new();
-      if (!key_to_RSA(subject_key, subject_rsa_key)) {
+      RSA *subject_rsa_key = cached_rsa_from_key(subject_key);
+      if (subject_rsa_key == nullptr) {
         printf("%s() error, line: %d, produce_artifact: can't get rsa subject "
                "key\n",
                __func__,
                __LINE__);
+        EVP_PKEY_free(subject_pkey);
+        EVP_PKEY_free(signing_pkey);
+        EC_KEY_free(signing_ecc_key);
         return false;
       }
       EVP_PKEY_set1_RSA(subject_pkey, subject_rsa_key);
@@ -3663,12 +4447,15 @@ bool certifier::utilities::produce_artifact(key_message &signing_key,
                || subject_key.key_type() == Enc_method_ecc_384_private
                || subject_key.key_type() == Enc_method_ecc_256_public
                || subject_key.key_type() == Enc_method_ecc_256_private) {
-      EC_KEY *subject_ecc_key = key_to_ECC(subject_key);
+      EC_KEY *subject_ecc_key = cached_ecc_from_key(subject_key);
       if (subject_ecc_key == nullptr) {
         printf(
             "%s() error, line: %d, produce_artifact: can't get subject key\n",
             __func__,
             __LINE__);
+        EVP_PKEY_free(subject_pkey);
+        EVP_PKEY_free(signing_pkey);
+        EC_KEY_free(signing_ecc_key);
         return false;
       }
       EVP_PKEY_set1_EC_KEY(subject_pkey, subject_ecc_key);
@@ -3680,11 +4467,15 @@ bool certifier::utilities::produce_artifact(key_message &signing_key,
              __func__,
              __LINE__,
              subject_key.key_type().c_str());
+      EVP_PKEY_free(subject_pkey);
+      EVP_PKEY_free(signing_pkey);
+      EC_KEY_free(signing_ecc_key);
       return false;
     }
     X509_sign(x509, signing_pkey, EVP_sha384());
     EVP_PKEY_free(signing_pkey);
     EVP_PKEY_free(subject_pkey);
+    EC_KEY_free(signing_ecc_key);
   } else {
     printf("%s() error, line: %d, produce_artifact: Unsupported algorithm\n",
            __func__,
@@ -3719,14 +4510,20 @@ bool certifier::utilities::verify_artifact(X509 &       cert,
       || verify_key.key_type() == Enc_method_rsa_4096_public
       || verify_key.key_type() == Enc_method_rsa_4096_private) {
     EVP_PKEY *verify_pkey = EVP_PKEY_new();
-    RSA *     verify_rsa_key = RSA_new();
-    if (!key_to_RSA(verify_key, verify_rsa_key))
+    RSA *     verify_rsa_key = cached_rsa_from_key(verify_key);
+    if (verify_rsa_key == nullptr) {
+      EVP_PKEY_free(verify_pkey);
       return false;
+    }
     EVP_PKEY_set1_RSA(verify_pkey, verify_rsa_key);
 
     EVP_PKEY *subject_pkey = X509_get_pubkey(&cert);
     RSA *     subject_rsa_key = EVP_PKEY_get1_RSA(subject_pkey);
     if (!RSA_to_key(subject_rsa_key, subject_key)) {
+      RSA_free(verify_rsa_key);
+      RSA_free(subject_rsa_key);
+      EVP_PKEY_free(verify_pkey);
+      EVP_PKEY_free(subject_pkey);
       return false;
     }
     success = (X509_verify(&cert, verify_pkey) == 1);
@@ -3740,8 +4537,9 @@ bool certifier::utilities::verify_artifact(X509 &       cert,
              || verify_key.key_type() == Enc_method_ecc_256_public
              || verify_key.key_type() == Enc_method_ecc_256_private) {
     EVP_PKEY *verify_pkey = EVP_PKEY_new();
-    EC_KEY *  verify_ecc_key = key_to_ECC(verify_key);
+    EC_KEY *  verify_ecc_key = cached_ecc_from_key(verify_key);
     if (verify_ecc_key == nullptr) {
+      EVP_PKEY_free(verify_pkey);
       return false;
     }
     EVP_PKEY_set1_EC_KEY(verify_pkey, verify_ecc_key);
@@ -3749,6 +4547,10 @@ bool certifier::utilities::verify_artifact(X509 &       cert,
     EVP_PKEY *subject_pkey = X509_get_pubkey(&cert);
     EC_KEY *  subject_ecc_key = EVP_PKEY_get1_EC_KEY(subject_pkey);
     if (!ECC_to_key(subject_ecc_key, subject_key)) {
+      EC_KEY_free(verify_ecc_key);
+      EC_KEY_free(subject_ecc_key);
+      EVP_PKEY_free(verify_pkey);
+      EVP_PKEY_free(subject_pkey);
       return false;
     }
     success = (X509_verify(&cert, verify_pkey) == 1);
@@ -3790,136 +4592,483 @@ bool certifier::utilities::asn1_to_x509(const string &in, X509 *x) {
   return true;
 }
 
-bool certifier::utilities::x509_to_asn1(X509 *x, string *out) {
-  int   len = i2d_X509(x, nullptr);
-  byte  buf[len];
-  byte *p = buf;
+bool certifier::utilities::x509_to_asn1(X509 *x, string *out) {
+  int   len = i2d_X509(x, nullptr);
+  byte  buf[len];
+  byte *p = buf;
+
+  i2d_X509(x, (byte **)&p);
+  out->assign((char *)buf, len);
+  return true;
+}
+
+// -----------------------------------------------------------------------
+
+//  Blocking read of pipe, socket, SSL connection with
+//  size prefix
+
+static bool fd_read_all(int fd, byte *buf, int size) {
+  int total = 0;
+  while (total < size) {
+    int n = read(fd, buf + total, size - total);
+    if (n <= 0)
+      return false;
+    total += n;
+  }
+  return true;
+}
+
+static bool fd_write_all(int fd, const byte *buf, int size) {
+  int total = 0;
+  while (total < size) {
+    int n = write(fd, buf + total, size - total);
+    if (n <= 0)
+      return false;
+    total += n;
+  }
+  return true;
+}
+
+// Payloads of sized messages and frames are read in pieces that start at
+// this size and double, so the buffer never gets far ahead of what has
+// arrived.
+const int min_sized_read_size = 64 * 1024;
+
+static bool sized_read_payload(frame_stream &s, int size, string *out) {
+  int done = 0;
+  while (done < size) {
+    int n = size - done;
+    if (n > done && n > min_sized_read_size)
+      n = done > min_sized_read_size ? done : min_sized_read_size;
+    out->resize(done + n);
+    if (!s.read_all((byte *)&(*out)[done], n)) {
+      out->clear();
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+// little endian only
+int sized_pipe_write(int fd, int size, byte *buf) {
+  if (size < 0 || size > max_sized_message_size)
+    return -1;
+  if (!fd_write_all(fd, (byte *)&size, sizeof(int)))
+    return -1;
+  if (!fd_write_all(fd, buf, size))
+    return -1;
+  return size;
+}
+
+// little endian only
+int sized_pipe_read(int fd, string *out) {
+  out->clear();
+  int size = 0;
+  if (!fd_read_all(fd, (byte *)&size, sizeof(int)) || size < 0) {
+    printf("%s() error, line: %d, sized_pipe_read: bad read size\n",
+           __func__,
+           __LINE__);
+    return -1;
+  }
+  if (size > max_sized_message_size) {
+    printf("%s() error, line: %d, sized_pipe_read: message too large\n",
+           __func__,
+           __LINE__);
+    return -1;
+  }
+
+  frame_stream s(fd);
+  if (!sized_read_payload(s, size, out)) {
+    printf("%s() error, line: %d, sized_pipe_read: read failed\n",
+           __func__,
+           __LINE__);
+    return -1;
+  }
+  return size;
+}
+
+// A TLS record carries at most this much plaintext.
+const int max_ssl_record_size = 16384;
+
+static bool ssl_write_all(SSL *ssl, byte *buf, int size) {
+  int total = 0;
+  while (total < size) {
+    int n = SSL_write(ssl, buf + total, size - total);
+    if (n <= 0)
+      return false;
+    total += n;
+  }
+  return true;
+}
+
+static bool ssl_read_all(SSL *ssl, byte *buf, int size) {
+  int total = 0;
+  while (total < size) {
+    int n = SSL_read(ssl, buf + total, size - total);
+    if (n <= 0)
+      return false;
+    total += n;
+  }
+  return true;
+}
+
+// little endian only
+// The size goes in the same record as the start of the payload, so a
+// small message is a single record and usually a single TCP segment.
+int sized_ssl_write(SSL *ssl, int size, byte *buf) {
+  if (size < 0 || size > max_sized_message_size)
+    return -1;
 
-  i2d_X509(x, (byte **)&p);
-  out->assign((char *)buf, len);
-  return true;
+  byte first[max_ssl_record_size];
+  int  first_payload = size;
+  if (first_payload > max_ssl_record_size - (int)sizeof(int))
+    first_payload = max_ssl_record_size - (int)sizeof(int);
+  memcpy(first, (byte *)&size, sizeof(int));
+  if (first_payload > 0)
+    memcpy(first + sizeof(int), buf, first_payload);
+  if (!ssl_write_all(ssl, first, sizeof(int) + first_payload))
+    return -1;
+  if (!ssl_write_all(ssl, buf + first_payload, size - first_payload))
+    return -1;
+  return size;
 }
 
-// -----------------------------------------------------------------------
-
-//  Blocking read of pipe, socket, SSL connection with
-//  size prefix
-
 // little endian only
-const int max_pipe_size = 65536;
-int       sized_pipe_write(int fd, int size, byte *buf) {
-  if (size > max_pipe_size)
-    return -1;
-  if (write(fd, (byte *)&size, sizeof(int)) < (int)sizeof(int))
+int sized_ssl_read(SSL *ssl, string *out) {
+  out->clear();
+  int size = 0;
+  if (!ssl_read_all(ssl, (byte *)&size, sizeof(int)) || size < 0
+      || size > max_sized_message_size)
     return -1;
-  if (write(fd, buf, size) < size)
+
+  // Read straight into the result.
+  frame_stream s(ssl);
+  if (!sized_read_payload(s, size, out))
     return -1;
   return size;
 }
 
 // little endian only
-int sized_pipe_read(int fd, string *out) {
+int certifier::utilities::sized_socket_read(int fd, string *out) {
+  out->clear();
   int size = 0;
-  if (read(fd, (byte *)&size, sizeof(int)) < (int)sizeof(int)) {
-    printf("sized_pipe_read: bad read size \n");
+  if (!fd_read_all(fd, (byte *)&size, sizeof(int)) || size < 0
+      || size > max_sized_message_size)
     return -1;
-  }
-  if (size > max_pipe_size) {
-    printf("%s() error, line: %d, sized_pipe_read: larger than pipe buffer\n",
-           __func__,
-           __LINE__);
+
+  frame_stream s(fd);
+  if (!sized_read_payload(s, size, out))
     return -1;
-  }
+  return size;
+}
 
-  byte buf[size];
-  int  cur_size = 0;
-  int  n = 0;
-  while (cur_size < size) {
-    n = read(fd, &buf[cur_size], size - cur_size);
-    if (n < 0) {
-      printf("%s() error, line: %d, sized_pipe_read: read failed\n",
-             __func__,
-             __LINE__);
+// little endian only
+// Size and payload go out in one writev.
+int certifier::utilities::sized_socket_write(int fd, int size, byte *buf) {
+  if (size < 0 || size > max_sized_message_size)
+    return -1;
+
+  struct iovec iov[2];
+  iov[0].iov_base = (byte *)&size;
+  iov[0].iov_len = sizeof(int);
+  iov[1].iov_base = buf;
+  iov[1].iov_len = size;
+  int     cur = 0;
+  ssize_t left = sizeof(int) + size;
+  while (left > 0) {
+    ssize_t n = writev(fd, &iov[cur], 2 - cur);
+    if (n <= 0)
       return -1;
+    left -= n;
+    while (cur < 2 && n >= (ssize_t)iov[cur].iov_len) {
+      n -= iov[cur].iov_len;
+      cur++;
+    }
+    if (cur < 2) {
+      iov[cur].iov_base = (byte *)iov[cur].iov_base + n;
+      iov[cur].iov_len -= n;
     }
-    cur_size += n;
   }
+  return size;
+}
 
-  out->clear();
-  out->assign((char *)buf, size);
-  return n;
+// -----------------------------------------------------------------------
+
+//  Framed messages
+
+static const byte frame_magic[4] = {'C', 'F', 'R', 'M'};
+
+// Largest piece handed to a single read or write call.
+const int max_frame_io_size = 1 << 30;
+
+bool encode_frame_header(uint64_t size, byte *header) {
+  memcpy(header, frame_magic, sizeof(frame_magic));
+  header[4] = frame_version;
+  header[5] = 0;
+  header[6] = 0;
+  header[7] = 0;
+  for (int i = 0; i < 8; i++)
+    header[8 + i] = (byte)(size >> (8 * (7 - i)));
+  return true;
 }
 
-// little endian only
-int sized_ssl_write(SSL *ssl, int size, byte *buf) {
-  if (SSL_write(ssl, (byte *)&size, sizeof(int)) < (int)sizeof(int))
-    return -1;
-  if (SSL_write(ssl, buf, size) < size)
-    return -1;
-  return size;
+bool decode_frame_header(const byte *header, uint64_t *size) {
+  if (memcmp(header, frame_magic, sizeof(frame_magic)) != 0) {
+    printf("%s() error, line: %d, not a frame\n", __func__, __LINE__);
+    return false;
+  }
+  if (header[4] != frame_version) {
+    printf("%s() error, line: %d, unsupported frame version %d\n",
+           __func__,
+           __LINE__,
+           (int)header[4]);
+    return false;
+  }
+  if (header[5] != 0 || header[6] != 0 || header[7] != 0) {
+    printf("%s() error, line: %d, unknown frame flags\n", __func__, __LINE__);
+    return false;
+  }
+  uint64_t n = 0;
+  for (int i = 0; i < 8; i++)
+    n = (n << 8) | header[8 + i];
+  *size = n;
+  return true;
 }
 
-// little endian only
-int sized_ssl_read(SSL *ssl, string *out) {
+frame_stream::frame_stream(int fd) : fd_(fd), ssl_(nullptr) {}
+
+frame_stream::frame_stream(SSL *ssl) : fd_(-1), ssl_(ssl) {}
+
+bool frame_stream::read_all(byte *buf, int size) {
+  if (ssl_ != nullptr)
+    return ssl_read_all(ssl_, buf, size);
+  return fd_read_all(fd_, buf, size);
+}
+
+bool frame_stream::write_all(const byte *buf, int size) {
+  if (ssl_ != nullptr)
+    return ssl_write_all(ssl_, (byte *)buf, size);
+  return fd_write_all(fd_, buf, size);
+}
+
+bool framed_write_header(frame_stream &s, uint64_t size) {
+  byte header[frame_header_size];
+  encode_frame_header(size, header);
+  return s.write_all(header, frame_header_size);
+}
+
+bool framed_write_data(frame_stream &s, int size, const byte *buf) {
+  if (size < 0)
+    return false;
+  return s.write_all(buf, size);
+}
+
+bool framed_read_header(frame_stream &s, uint64_t *size) {
+  byte header[frame_header_size];
+  if (!s.read_all(header, frame_header_size))
+    return false;
+  return decode_frame_header(header, size);
+}
+
+bool framed_read_data(frame_stream &s, int size, byte *buf) {
+  if (size < 0)
+    return false;
+  return s.read_all(buf, size);
+}
+
+// As with sized_ssl_write, the header shares a write, and so a TLS
+// record, with the start of the payload.
+bool framed_write(frame_stream &s, uint64_t size, const byte *buf) {
+  byte     first[max_ssl_record_size];
+  uint64_t first_payload = size;
+  if (first_payload > (uint64_t)(max_ssl_record_size - frame_header_size))
+    first_payload = max_ssl_record_size - frame_header_size;
+  encode_frame_header(size, first);
+  if (first_payload > 0)
+    memcpy(first + frame_header_size, buf, first_payload);
+  if (!s.write_all(first, frame_header_size + (int)first_payload))
+    return false;
+
+  uint64_t done = first_payload;
+  while (done < size) {
+    uint64_t n = size - done;
+    if (n > (uint64_t)max_frame_io_size)
+      n = max_frame_io_size;
+    if (!s.write_all(buf + done, (int)n))
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+bool framed_read(frame_stream &s, uint64_t max_size, string *out) {
   out->clear();
-  int size = 0;
-  int n = SSL_read(ssl, (byte *)&size, sizeof(int));
-  if (n < 0)
-    return n;
+  uint64_t size = 0;
+  if (!framed_read_header(s, &size))
+    return false;
+  if (size > max_size || size > out->max_size()) {
+    printf("%s() error, line: %d, frame too large\n", __func__, __LINE__);
+    return false;
+  }
 
-  int       total = 0;
-  const int read_stride = 8192;
-  byte      buf[read_stride];
+  // As with sized messages, grow the buffer as the payload arrives.
+  uint64_t done = 0;
+  while (done < size) {
+    uint64_t n = size - done;
+    if (n > done && n > (uint64_t)min_sized_read_size)
+      n = done > (uint64_t)min_sized_read_size ? done : min_sized_read_size;
+    if (n > (uint64_t)max_frame_io_size)
+      n = max_frame_io_size;
+    out->resize(done + n);
+    if (!s.read_all((byte *)&(*out)[done], (int)n)) {
+      out->clear();
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
 
-  while (total < size) {
-    if ((size - total) > read_stride)
-      n = SSL_read(ssl, buf, read_stride);
-    else
-      n = SSL_read(ssl, buf, size - total);
+bool framed_read_chunks(frame_stream &   s,
+                        uint64_t         size,
+                        int              chunk_size,
+                        byte *           chunk,
+                        frame_chunk_func func,
+                        void *           arg) {
+  if (chunk_size <= 0)
+    return false;
+  uint64_t done = 0;
+  while (done < size) {
+    uint64_t n = size - done;
+    if (n > (uint64_t)chunk_size)
+      n = chunk_size;
+    if (!s.read_all(chunk, (int)n))
+      return false;
+    if (!func(arg, (int)n, chunk))
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------
+
+// Streaming file encryption
+
+// Plaintext bytes read per update.
+const int crypt_file_chunk_size = 65536;
+
+// Streams in_fd through c.  Output per chunk is at most the chunk plus a
+// block; final output is at most two blocks plus a mac.
+static bool crypt_file_stream(crypto_context &c,
+                              bool            encrypting,
+                              int             in_fd,
+                              int             out_fd) {
+  int   buf_size = crypt_file_chunk_size + 2 * block_size + EVP_MAX_MD_SIZE;
+  byte *in_buf = new byte[crypt_file_chunk_size];
+  byte *out_buf = new byte[buf_size];
+  bool  ret = false;
+  int   n = 0;
+  int   out_size = 0;
+
+  for (;;) {
+    n = read(in_fd, in_buf, crypt_file_chunk_size);
     if (n < 0) {
-      return n;
-    } else {
-      out->append((char *)buf, n);
-      total += n;
+      printf("%s() error, line: %d, read failed\n", __func__, __LINE__);
+      goto done;
     }
+    if (n == 0)
+      break;
+    if (encrypting ? !c.encrypt_update(in_buf, n, out_buf, &out_size)
+                   : !c.decrypt_update(in_buf, n, out_buf, &out_size))
+      goto done;
+    if (!fd_write_all(out_fd, out_buf, out_size)) {
+      printf("%s() error, line: %d, write failed\n", __func__, __LINE__);
+      goto done;
+    }
+  }
+  if (encrypting ? !c.encrypt_final(out_buf, &out_size)
+                 : !c.decrypt_final(out_buf, &out_size))
+    goto done;
+  if (!fd_write_all(out_fd, out_buf, out_size)) {
+    printf("%s() error, line: %d, write failed\n", __func__, __LINE__);
+    goto done;
   }
-  return total;
+  ret = true;
+
+done:
+  OPENSSL_cleanse(in_buf, crypt_file_chunk_size);
+  OPENSSL_cleanse(out_buf, buf_size);
+  delete[] in_buf;
+  delete[] out_buf;
+  return ret;
 }
 
-// little endian only
-int certifier::utilities::sized_socket_read(int fd, string *out) {
-  out->clear();
-  int       n = 0;
-  int       size = 0;
-  int       total = 0;
-  const int read_stride = 8192;
-  byte      buf[read_stride];
+static bool crypt_file(const char *  alg_name,
+                       const byte *  key,
+                       byte *        iv,
+                       const string &in_file_name,
+                       const string &out_file_name) {
+  crypto_context c;
+  if (!c.init(alg_name, key))
+    return false;
 
-  if (read(fd, (byte *)&size, sizeof(int)) < (int)sizeof(int))
-    return -1;
+  int in_fd = open(in_file_name.c_str(), O_RDONLY);
+  if (in_fd < 0) {
+    printf("%s() error, line: %d, can't open %s\n",
+           __func__,
+           __LINE__,
+           in_file_name.c_str());
+    return false;
+  }
+  int out_fd = open(out_file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (out_fd < 0) {
+    printf("%s() error, line: %d, can't create %s\n",
+           __func__,
+           __LINE__,
+           out_file_name.c_str());
+    close(in_fd);
+    return false;
+  }
 
-  while (total < size) {
-    if ((size - total) > read_stride)
-      n = read(fd, buf, read_stride);
-    else
-      n = read(fd, buf, size - total);
-    if (n <= 0) {
-      return -1;
-    } else {
-      out->append((char *)buf, n);
-      total += n;
-    }
+  bool encrypting = iv != nullptr;
+  bool ret = true;
+  if (encrypting) {
+    byte iv_out[block_size];
+    int  iv_size = 0;
+    ret = c.encrypt_init(iv, iv_out, &iv_size)
+          && fd_write_all(out_fd, iv_out, iv_size);
+  } else {
+    ret = c.decrypt_init();
   }
-  return total;
+  if (ret)
+    ret = crypt_file_stream(c, encrypting, in_fd, out_fd);
+  close(in_fd);
+  if (close(out_fd) != 0)
+    ret = false;
+  if (!ret && !encrypting)
+    unlink(out_file_name.c_str());
+  return ret;
 }
 
-// little endian only
-int certifier::utilities::sized_socket_write(int fd, int size, byte *buf) {
-  if (write(fd, (byte *)&size, sizeof(int)) < (int)sizeof(int))
-    return -1;
-  if (write(fd, buf, size) < size)
-    return -1;
-  return size;
+bool certifier::utilities::authenticated_encrypt_file(
+    const char *  alg_name,
+    const byte *  key,
+    byte *        iv,
+    const string &in_file_name,
+    const string &out_file_name) {
+  if (iv == nullptr)
+    return false;
+  return crypt_file(alg_name, key, iv, in_file_name, out_file_name);
+}
+
+bool certifier::utilities::authenticated_decrypt_file(
+    const char *  alg_name,
+    const byte *  key,
+    const string &in_file_name,
+    const string &out_file_name) {
+  return crypt_file(alg_name, key, nullptr, in_file_name, out_file_name);
 }
 
 // -----------------------------------------------------------------------
@@ -4080,6 +5229,333 @@ EVP_PKEY *pkey_from_key(const key_message &k) {
   }
 }
 
+// Digest of the key type and format and every key component.  The format
+// goes in because key_to_RSA checks it, and a hit mustn't skip that.
+static bool key_material_digest(const key_message &k, string *out) {
+  const string *fields[] = {
+      &k.key_type(),
+      &k.key_format(),
+      &k.rsa_key().public_modulus(),
+      &k.rsa_key().public_exponent(),
+      &k.rsa_key().private_exponent(),
+      &k.rsa_key().private_p(),
+      &k.rsa_key().private_q(),
+      &k.rsa_key().private_dp(),
+      &k.rsa_key().private_dq(),
+      &k.rsa_key().private_iqmp(),
+      &k.ecc_key().curve_name(),
+      &k.ecc_key().public_point().x(),
+      &k.ecc_key().public_point().y(),
+      &k.ecc_key().private_multiplier(),
+  };
+  fingerprint_hash h("key-material");
+  for (const string *f : fields)
+    h.add(*f);
+  return h.finish(out);
+}
+
+static bool has_private_key(const key_message &k) {
+  return !k.rsa_key().private_exponent().empty()
+         || !k.ecc_key().private_multiplier().empty();
+}
+
+pkey_cache::pkey_cache(int max_entries)
+    : max_entries_(max_entries),
+      cache_private_keys_(true),
+      hits_(0),
+      misses_(0) {}
+
+pkey_cache::~pkey_cache() {
+  clear();
+}
+
+void pkey_cache::evict_to(int n) {
+  while ((int)lru_.size() > n) {
+    index_.erase(lru_.back().digest_);
+    EVP_PKEY_free(lru_.back().pkey_);
+    lru_.pop_back();
+  }
+}
+
+void pkey_cache::clear() {
+  std::lock_guard<std::mutex> l(mtx_);
+  evict_to(0);
+}
+
+void pkey_cache::set_max_entries(int max_entries) {
+  std::lock_guard<std::mutex> l(mtx_);
+  max_entries_ = max_entries;
+  evict_to(max_entries_ > 0 ? max_entries_ : 0);
+}
+
+void pkey_cache::set_cache_private_keys(bool cache) {
+  std::lock_guard<std::mutex> l(mtx_);
+  cache_private_keys_ = cache;
+  if (cache)
+    return;
+  for (auto it = lru_.begin(); it != lru_.end();) {
+    if (it->private_) {
+      index_.erase(it->digest_);
+      EVP_PKEY_free(it->pkey_);
+      it = lru_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+int pkey_cache::num_entries() {
+  std::lock_guard<std::mutex> l(mtx_);
+  return (int)lru_.size();
+}
+
+uint64_t pkey_cache::hits() {
+  std::lock_guard<std::mutex> l(mtx_);
+  return hits_;
+}
+
+uint64_t pkey_cache::misses() {
+  std::lock_guard<std::mutex> l(mtx_);
+  return misses_;
+}
+
+EVP_PKEY *pkey_cache::get(const key_message &k) {
+  bool is_private = has_private_key(k);
+  mtx_.lock();
+  bool skip = is_private && !cache_private_keys_;
+  if (skip)
+    misses_++;
+  mtx_.unlock();
+  if (skip)
+    return pkey_from_key(k);
+
+  string digest;
+  if (!key_material_digest(k, &digest)) {
+    printf("%s() error, line: %d, can't digest key\n", __func__, __LINE__);
+    return nullptr;
+  }
+
+  mtx_.lock();
+  auto it = index_.find(digest);
+  if (it != index_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second);
+    EVP_PKEY *pkey = lru_.front().pkey_;
+    EVP_PKEY_up_ref(pkey);
+    hits_++;
+    mtx_.unlock();
+    return pkey;
+  }
+  misses_++;
+  mtx_.unlock();
+
+  // Parse outside the lock; if another thread got there first, use its
+  // copy.
+  EVP_PKEY *pkey = pkey_from_key(k);
+  if (pkey == nullptr)
+    return nullptr;
+
+  std::lock_guard<std::mutex> l(mtx_);
+  if (max_entries_ <= 0 || (is_private && !cache_private_keys_))
+    return pkey;
+  it = index_.find(digest);
+  if (it != index_.end()) {
+    EVP_PKEY_free(pkey);
+    lru_.splice(lru_.begin(), lru_, it->second);
+    pkey = lru_.front().pkey_;
+  } else {
+    entry e;
+    e.digest_ = digest;
+    e.pkey_ = pkey;
+    e.private_ = is_private;
+    lru_.push_front(e);
+    index_[digest] = lru_.begin();
+    evict_to(max_entries_);
+  }
+  EVP_PKEY_up_ref(pkey);
+  return pkey;
+}
+
+pkey_cache &key_cache() {
+  static pkey_cache cache(default_pkey_cache_size);
+  return cache;
+}
+
+EVP_PKEY *cached_pkey_from_key(const key_message &k) {
+  return key_cache().get(k);
+}
+
+RSA *cached_rsa_from_key(const key_message &k) {
+  EVP_PKEY *pkey = cached_pkey_from_key(k);
+  if (pkey == nullptr)
+    return nullptr;
+  RSA *r = nullptr;
+  if (EVP_PKEY_base_id(pkey) == EVP_PKEY_RSA)
+    r = EVP_PKEY_get1_RSA(pkey);
+  EVP_PKEY_free(pkey);
+  return r;
+}
+
+EC_KEY *cached_ecc_from_key(const key_message &k) {
+  EVP_PKEY *pkey = cached_pkey_from_key(k);
+  if (pkey == nullptr)
+    return nullptr;
+  EC_KEY *e = nullptr;
+  if (EVP_PKEY_base_id(pkey) == EVP_PKEY_EC)
+    e = EVP_PKEY_get1_EC_KEY(pkey);
+  EVP_PKEY_free(pkey);
+  return e;
+}
+
+verified_claim_cache::verified_claim_cache(int max_entries)
+    : max_entries_(max_entries),
+      hits_(0),
+      misses_(0) {}
+
+void verified_claim_cache::evict_to(int n) {
+  while ((int)lru_.size() > n) {
+    index_.erase(lru_.back().digest_);
+    lru_.pop_back();
+  }
+}
+
+void verified_claim_cache::clear() {
+  std::lock_guard<std::mutex> l(mtx_);
+  evict_to(0);
+}
+
+// Returns the number of claims dropped.
+int verified_claim_cache::invalidate_key(const key_message &key) {
+  string fp;
+  if (!key_fingerprint(key, &fp))
+    return 0;
+
+  std::lock_guard<std::mutex> l(mtx_);
+  int                         n = 0;
+  auto                        it = lru_.begin();
+  while (it != lru_.end()) {
+    if (it->key_fingerprint_ != fp) {
+      it++;
+      continue;
+    }
+    index_.erase(it->digest_);
+    it = lru_.erase(it);
+    n++;
+  }
+  return n;
+}
+
+void verified_claim_cache::set_max_entries(int max_entries) {
+  std::lock_guard<std::mutex> l(mtx_);
+  max_entries_ = max_entries;
+  evict_to(max_entries_ > 0 ? max_entries_ : 0);
+}
+
+int verified_claim_cache::num_entries() {
+  std::lock_guard<std::mutex> l(mtx_);
+  return (int)lru_.size();
+}
+
+uint64_t verified_claim_cache::hits() {
+  std::lock_guard<std::mutex> l(mtx_);
+  return hits_;
+}
+
+uint64_t verified_claim_cache::misses() {
+  std::lock_guard<std::mutex> l(mtx_);
+  return misses_;
+}
+
+// Everything but the clock that verifying sc with key depends on
+static bool signed_claim_digest(const signed_claim_message &sc,
+                                const key_message &         key,
+                                string *                    digest,
+                                string *                    key_fp) {
+  if (!key_fingerprint(key, key_fp))
+    return false;
+  // The fingerprint leaves out the key format, which key_to_RSA checks;
+  // a hit mustn't skip that.
+  fingerprint_hash h("verified-claim");
+  h.add(*key_fp);
+  h.add(key.key_format());
+  h.add(sc.signing_algorithm());
+  h.add(sc.serialized_claim_message());
+  h.add(sc.signature());
+  return h.finish(digest);
+}
+
+bool verified_claim_cache::lookup(const string &digest, entry *found) {
+  time_point now;
+  if (!time_now(&now))
+    return false;
+
+  std::lock_guard<std::mutex> l(mtx_);
+  auto                        it = index_.find(digest);
+  if (it == index_.end()) {
+    misses_++;
+    return false;
+  }
+  entry &e = *it->second;
+  if (compare_time(e.not_after_, now) < 0) {
+    // Expired for good; the full check reports it.
+    lru_.erase(it->second);
+    index_.erase(it);
+    misses_++;
+    return false;
+  }
+  if (compare_time(now, e.not_before_) < 0) {
+    misses_++;
+    return false;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  *found = lru_.front();
+  hits_++;
+  return true;
+}
+
+bool verified_claim_cache::verify(const signed_claim_message &sc,
+                                  const key_message &         key,
+                                  claim_message *             c,
+                                  vse_clause *                cl) {
+  string digest;
+  string key_fp;
+  bool   cacheable = signed_claim_digest(sc, key, &digest, &key_fp);
+  entry  e;
+  if (!cacheable || !lookup(digest, &e)) {
+    if (!verify_and_parse_uncached(sc, key, &e.claim_))
+      return false;
+    e.has_clause_ = e.claim_.claim_format() == "vse-clause"
+                    && e.clause_.ParseFromString(e.claim_.serialized_claim());
+    if (cacheable && string_to_time(e.claim_.not_before(), &e.not_before_)
+        && string_to_time(e.claim_.not_after(), &e.not_after_)) {
+      e.digest_ = digest;
+      e.key_fingerprint_ = key_fp;
+      std::lock_guard<std::mutex> l(mtx_);
+      if (max_entries_ > 0 && index_.find(digest) == index_.end()) {
+        lru_.push_front(e);
+        index_[digest] = lru_.begin();
+        evict_to(max_entries_);
+      }
+    }
+  }
+
+  if (cl != nullptr) {
+    if (!e.has_clause_) {
+      printf("%s() error, line: %d, claim isn't a vse-clause\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+    cl->Swap(&e.clause_);
+  }
+  c->Swap(&e.claim_);
+  return true;
+}
+
+verified_claim_cache &claim_cache() {
+  static verified_claim_cache cache(default_verified_claim_cache_size);
+  return cache;
+}
+
 // make a public key from the X509 cert's subject key
 bool x509_to_public_key(X509 *x, key_message *k) {
   EVP_PKEY *subject_pkey = X509_get_pubkey(x);
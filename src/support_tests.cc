@@ -13,6 +13,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 #include "certifier.h"
 #include "support.h"
 
@@ -105,7 +109,7 @@ bool test_encrypt(bool print_all) {
 bool test_authenticated_encrypt(bool print_all) {
   const int in_size = 2 * block_size;
   const int out_size = in_size + 256;
-  const int key_size = 64;
+  const int key_size = max_symmetric_key_size;
   byte      key[key_size];
   const int iv_size = block_size;
   byte      iv[block_size];
@@ -307,6 +311,537 @@ bool test_authenticated_encrypt(bool print_all) {
   return true;
 }
 
+// Messages sealed by a reused context must open with a fresh one, and
+// the other way around, for every iv and size.
+bool test_crypto_context(bool print_all) {
+  const char *algs[] = {
+      Enc_method_aes_256_cbc_hmac_sha256,
+      Enc_method_aes_256_cbc_hmac_sha384,
+      Enc_method_aes_256_gcm,
+  };
+  const int msg_sizes[] = {0, 1, 15, 16, 17, 100, 4096};
+  const int num_msg_sizes = sizeof(msg_sizes) / sizeof(msg_sizes[0]);
+  const int max_msg_size = 4096;
+
+  byte key[max_symmetric_key_size];
+  for (int i = 0; i < max_symmetric_key_size; i++)
+    key[i] = (byte)(3 * i + 1);
+  byte plain[max_msg_size];
+  for (int i = 0; i < max_msg_size; i++)
+    plain[i] = (byte)(i % 251);
+  byte cipher[max_msg_size + 256];
+  byte decrypted[max_msg_size + 256];
+  byte iv[block_size];
+
+  for (const char *alg : algs) {
+    crypto_context reused;
+    if (!reused.init(alg, key)) {
+      printf("%s() error, line: %d, can't init %s\n", __func__, __LINE__, alg);
+      return false;
+    }
+    for (int i = 0; i < num_msg_sizes; i++) {
+      memset(iv, i + 1, block_size);
+      int size = msg_sizes[i];
+
+      int cipher_size = sizeof(cipher);
+      if (!reused.authenticated_encrypt(plain, size, iv, cipher, &cipher_size)) {
+        printf("%s() error, line: %d, %s encrypt of %d failed\n",
+               __func__,
+               __LINE__,
+               alg,
+               size);
+        return false;
+      }
+      crypto_context fresh;
+      int            decrypted_size = sizeof(decrypted);
+      if (!fresh.init(alg, key)
+          || !fresh.authenticated_decrypt(cipher,
+                                          cipher_size,
+                                          decrypted,
+                                          &decrypted_size)
+          || decrypted_size != size || memcmp(plain, decrypted, size) != 0) {
+        printf("%s() error, line: %d, %s round trip of %d failed\n",
+               __func__,
+               __LINE__,
+               alg,
+               size);
+        return false;
+      }
+
+      // Same message from the per-thread context must match byte for byte.
+      byte other[max_msg_size + 256];
+      int  other_size = sizeof(other);
+      if (!authenticated_encrypt(alg, plain, size, key, iv, other, &other_size)
+          || other_size != cipher_size
+          || memcmp(other, cipher, cipher_size) != 0) {
+        printf("%s() error, line: %d, %s contexts disagree\n",
+               __func__,
+               __LINE__,
+               alg);
+        return false;
+      }
+
+      decrypted_size = sizeof(decrypted);
+      if (!reused.authenticated_decrypt(cipher,
+                                        cipher_size,
+                                        decrypted,
+                                        &decrypted_size)
+          || decrypted_size != size || memcmp(plain, decrypted, size) != 0) {
+        printf("%s() error, line: %d, %s reused decrypt of %d failed\n",
+               __func__,
+               __LINE__,
+               alg,
+               size);
+        return false;
+      }
+
+      // A flipped bit anywhere must be rejected.
+      cipher[cipher_size / 2] ^= 1;
+      decrypted_size = sizeof(decrypted);
+      if (reused.authenticated_decrypt(cipher,
+                                       cipher_size,
+                                       decrypted,
+                                       &decrypted_size)) {
+        printf("%s() error, line: %d, %s accepted tampered input\n",
+               __func__,
+               __LINE__,
+               alg);
+        return false;
+      }
+    }
+  }
+
+  // The calling thread's cached keys can be wiped, and with caching off
+  // they don't outlast the call.
+  int cipher_size = sizeof(cipher);
+  int decrypted_size = sizeof(decrypted);
+  if (!authenticated_encrypt(algs[0], plain, 100, key, iv, cipher, &cipher_size)
+      || num_thread_crypto_contexts() == 0) {
+    printf("%s() error, line: %d, context not cached\n", __func__, __LINE__);
+    return false;
+  }
+  clear_thread_crypto_contexts();
+  if (num_thread_crypto_contexts() != 0) {
+    printf("%s() error, line: %d, contexts not cleared\n", __func__, __LINE__);
+    return false;
+  }
+  set_thread_crypto_caching(false);
+  cipher_size = sizeof(cipher);
+  bool uncached_ok =
+      authenticated_encrypt(algs[0], plain, 100, key, iv, cipher, &cipher_size)
+      && num_thread_crypto_contexts() == 0
+      && authenticated_decrypt(algs[0],
+                               cipher,
+                               cipher_size,
+                               key,
+                               decrypted,
+                               &decrypted_size)
+      && decrypted_size == 100 && memcmp(plain, decrypted, 100) == 0
+      && num_thread_crypto_contexts() == 0;
+  set_thread_crypto_caching(true);
+  if (!uncached_ok) {
+    printf("%s() error, line: %d, uncached contexts failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  if (print_all) {
+    const int num_ops = 10000;
+    const int size = 256;
+    for (const char *alg : algs) {
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < num_ops; i++) {
+        int cipher_size = sizeof(cipher);
+        if (!authenticated_encrypt(alg,
+                                   plain,
+                                   size,
+                                   key,
+                                   iv,
+                                   cipher,
+                                   &cipher_size))
+          return false;
+      }
+      double secs =
+          std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                        - start)
+              .count();
+      printf("%s: %d seals of %d bytes, %.0f seals/sec\n",
+             alg,
+             num_ops,
+             size,
+             num_ops / secs);
+    }
+  }
+  return true;
+}
+
+// Feeds in to a stream chunk_size bytes at a time.
+static bool stream_crypt(crypto_context &c,
+                         bool            encrypting,
+                         byte *          iv,
+                         const string &  in,
+                         int             chunk_size,
+                         string *        out) {
+  byte buf[2 * 4096 + 256];
+  int  n = 0;
+  out->clear();
+  if (encrypting) {
+    if (!c.encrypt_init(iv, buf, &n))
+      return false;
+    out->append((char *)buf, n);
+  } else if (!c.decrypt_init()) {
+    return false;
+  }
+  for (size_t done = 0; done < in.size(); done += chunk_size) {
+    int len = chunk_size;
+    if (done + len > in.size())
+      len = in.size() - done;
+    const byte *p = (const byte *)in.data() + done;
+    if (encrypting ? !c.encrypt_update(p, len, buf, &n)
+                   : !c.decrypt_update(p, len, buf, &n))
+      return false;
+    out->append((char *)buf, n);
+  }
+  if (encrypting ? !c.encrypt_final(buf, &n) : !c.decrypt_final(buf, &n))
+    return false;
+  out->append((char *)buf, n);
+  return true;
+}
+
+// Streamed output must be byte for byte what the one shot functions
+// produce, for any way of chunking the input.
+bool test_streaming_encrypt(bool print_all) {
+  const char *algs[] = {
+      Enc_method_aes_256_cbc_hmac_sha256,
+      Enc_method_aes_256_cbc_hmac_sha384,
+      Enc_method_aes_256_gcm,
+  };
+  const int msg_sizes[] = {0, 1, 16, 1000, 100003};
+  const int chunk_sizes[] = {1, 7, 16, 4096};
+
+  byte key[max_symmetric_key_size];
+  for (int i = 0; i < max_symmetric_key_size; i++)
+    key[i] = (byte)(5 * i + 2);
+  byte iv[block_size];
+  for (int i = 0; i < block_size; i++)
+    iv[i] = (byte)(i + 40);
+
+  for (const char *alg : algs) {
+    crypto_context c;
+    if (!c.init(alg, key))
+      return false;
+    for (int size : msg_sizes) {
+      string plain;
+      for (int i = 0; i < size; i++)
+        plain.append(1, (char)(i % 253));
+
+      int   one_shot_size = size + 256;
+      byte *one_shot = new byte[one_shot_size];
+      bool  ok = authenticated_encrypt(alg,
+                                      (byte *)plain.data(),
+                                      size,
+                                      key,
+                                      iv,
+                                      one_shot,
+                                      &one_shot_size);
+      string expected((char *)one_shot, one_shot_size);
+      delete[] one_shot;
+      if (!ok)
+        return false;
+
+      for (int chunk_size : chunk_sizes) {
+        if (size > 20000 && chunk_size < 16)
+          continue;
+        string cipher;
+        string decrypted;
+        if (!stream_crypt(c, true, iv, plain, chunk_size, &cipher)
+            || cipher != expected) {
+          printf("%s() error, line: %d, %s, size %d, chunk %d: stream "
+                 "encrypt differs\n",
+                 __func__,
+                 __LINE__,
+                 alg,
+                 size,
+                 chunk_size);
+          return false;
+        }
+        if (!stream_crypt(c, false, nullptr, cipher, chunk_size, &decrypted)
+            || decrypted != plain) {
+          printf("%s() error, line: %d, %s, size %d, chunk %d: stream "
+                 "decrypt failed\n",
+                 __func__,
+                 __LINE__,
+                 alg,
+                 size,
+                 chunk_size);
+          return false;
+        }
+      }
+
+      // Tampered and truncated streams fail at final.
+      string bad(expected);
+      bad[bad.size() / 2] ^= 1;
+      string decrypted;
+      if (stream_crypt(c, false, nullptr, bad, 4096, &decrypted)) {
+        printf("%s() error, line: %d, %s accepted tampered stream\n",
+               __func__,
+               __LINE__,
+               alg);
+        return false;
+      }
+      bad.assign(expected, 0, expected.size() - 1);
+      if (stream_crypt(c, false, nullptr, bad, 4096, &decrypted)) {
+        printf("%s() error, line: %d, %s accepted truncated stream\n",
+               __func__,
+               __LINE__,
+               alg);
+        return false;
+      }
+    }
+  }
+
+  // Whole files.
+  string plain_name("stream_test_plain.bin");
+  string cipher_name("stream_test_cipher.bin");
+  string out_name("stream_test_out.bin");
+  string plain;
+  for (int i = 0; i < 300007; i++)
+    plain.append(1, (char)(i % 249));
+  bool ret = write_file(plain_name, plain.size(), (byte *)plain.data());
+  for (const char *alg : algs) {
+    string cipher;
+    string out;
+    if (!ret)
+      break;
+    if (!authenticated_encrypt_file(alg, key, iv, plain_name, cipher_name)
+        || !authenticated_decrypt_file(alg, key, cipher_name, out_name)
+        || !read_file_into_string(out_name, &out) || out != plain) {
+      printf("%s() error, line: %d, %s file round trip failed\n",
+             __func__,
+             __LINE__,
+             alg);
+      ret = false;
+      break;
+    }
+    if (!read_file_into_string(cipher_name, &cipher)) {
+      ret = false;
+      break;
+    }
+    if (print_all) {
+      printf("%s: %d byte file, %d bytes encrypted\n",
+             alg,
+             (int)plain.size(),
+             (int)cipher.size());
+    }
+    cipher[cipher.size() - 1] ^= 1;
+    if (!write_file(cipher_name, cipher.size(), (byte *)cipher.data())
+        || authenticated_decrypt_file(alg, key, cipher_name, out_name)
+        || file_size(out_name) >= 0) {
+      printf("%s() error, line: %d, %s tampered file not rejected\n",
+             __func__,
+             __LINE__,
+             alg);
+      ret = false;
+      break;
+    }
+  }
+  unlink(plain_name.c_str());
+  unlink(cipher_name.c_str());
+  unlink(out_name.c_str());
+  return ret;
+}
+
+// aad must be bound into the mac or tag, and the in place and streaming
+// forms must produce exactly what the two buffer form does.
+bool test_aead_in_place(bool print_all) {
+  const char *algs[] = {
+      Enc_method_aes_256_cbc_hmac_sha256,
+      Enc_method_aes_256_cbc_hmac_sha384,
+      Enc_method_aes_256_gcm,
+  };
+  const int   msg_size = 1000;
+  const int   buf_size = msg_size + 256;
+  const char *aad_str = "simulated-enclave/policy-store/v1";
+  const byte *aad = (const byte *)aad_str;
+  int         aad_len = strlen(aad_str);
+  const char *other_aad_str = "simulated-enclave/policy-store/v2";
+
+  byte key[max_symmetric_key_size];
+  for (int i = 0; i < max_symmetric_key_size; i++)
+    key[i] = (byte)(7 * i + 5);
+  byte iv[block_size];
+  for (int i = 0; i < block_size; i++)
+    iv[i] = (byte)(i + 9);
+  byte plain[msg_size];
+  for (int i = 0; i < msg_size; i++)
+    plain[i] = (byte)(i % 241);
+
+  for (const char *alg : algs) {
+    byte cipher[buf_size];
+    byte decrypted[buf_size];
+    int  cipher_size = buf_size;
+    int  decrypted_size = buf_size;
+
+    if (!authenticated_encrypt_with_aad(alg,
+                                        plain,
+                                        msg_size,
+                                        aad,
+                                        aad_len,
+                                        key,
+                                        iv,
+                                        cipher,
+                                        &cipher_size)
+        || !authenticated_decrypt_with_aad(alg,
+                                           cipher,
+                                           cipher_size,
+                                           aad,
+                                           aad_len,
+                                           key,
+                                           decrypted,
+                                           &decrypted_size)
+        || decrypted_size != msg_size
+        || memcmp(plain, decrypted, msg_size) != 0) {
+      printf("%s() error, line: %d, %s aad round trip failed\n",
+             __func__,
+             __LINE__,
+             alg);
+      return false;
+    }
+
+    // Wrong or missing aad is rejected.
+    decrypted_size = buf_size;
+    if (authenticated_decrypt_with_aad(alg,
+                                       cipher,
+                                       cipher_size,
+                                       (const byte *)other_aad_str,
+                                       aad_len,
+                                       key,
+                                       decrypted,
+                                       &decrypted_size)
+        || authenticated_decrypt(alg,
+                                 cipher,
+                                 cipher_size,
+                                 key,
+                                 decrypted,
+                                 &decrypted_size)) {
+      printf("%s() error, line: %d, %s accepted wrong aad\n",
+             __func__,
+             __LINE__,
+             alg);
+      return false;
+    }
+
+    // No aad is the old format.
+    byte plain_cipher[buf_size];
+    byte no_aad_cipher[buf_size];
+    int  plain_cipher_size = buf_size;
+    int  no_aad_cipher_size = buf_size;
+    if (!authenticated_encrypt(alg,
+                               plain,
+                               msg_size,
+                               key,
+                               iv,
+                               plain_cipher,
+                               &plain_cipher_size)
+        || !authenticated_encrypt_with_aad(alg,
+                                           plain,
+                                           msg_size,
+                                           nullptr,
+                                           0,
+                                           key,
+                                           iv,
+                                           no_aad_cipher,
+                                           &no_aad_cipher_size)
+        || plain_cipher_size != no_aad_cipher_size
+        || memcmp(plain_cipher, no_aad_cipher, plain_cipher_size) != 0) {
+      printf("%s() error, line: %d, %s empty aad changed the format\n",
+             __func__,
+             __LINE__,
+             alg);
+      return false;
+    }
+
+    // In place.
+    byte buf[buf_size];
+    int  out_size = 0;
+    memcpy(buf + block_size, plain, msg_size);
+    if (!authenticated_encrypt_in_place(alg,
+                                        key,
+                                        iv,
+                                        aad,
+                                        aad_len,
+                                        buf,
+                                        msg_size,
+                                        buf_size,
+                                        &out_size)
+        || out_size != cipher_size || memcmp(buf, cipher, cipher_size) != 0) {
+      printf("%s() error, line: %d, %s in place encrypt differs\n",
+             __func__,
+             __LINE__,
+             alg);
+      return false;
+    }
+    if (!authenticated_decrypt_in_place(alg,
+                                        key,
+                                        aad,
+                                        aad_len,
+                                        buf,
+                                        out_size,
+                                        &out_size)
+        || out_size != msg_size
+        || memcmp(buf + block_size, plain, msg_size) != 0) {
+      printf("%s() error, line: %d, %s in place decrypt failed\n",
+             __func__,
+             __LINE__,
+             alg);
+      return false;
+    }
+
+    // Streaming with aad.
+    crypto_context c;
+    string         streamed;
+    byte           chunk[buf_size];
+    int            n = 0;
+    if (!c.init(alg, key) || !c.encrypt_init(iv, chunk, &n, aad, aad_len))
+      return false;
+    streamed.append((char *)chunk, n);
+    for (int done = 0; done < msg_size; done += 100) {
+      if (!c.encrypt_update(plain + done, 100, chunk, &n))
+        return false;
+      streamed.append((char *)chunk, n);
+    }
+    if (!c.encrypt_final(chunk, &n))
+      return false;
+    streamed.append((char *)chunk, n);
+    if (streamed != string((char *)cipher, cipher_size)) {
+      printf("%s() error, line: %d, %s streamed aad output differs\n",
+             __func__,
+             __LINE__,
+             alg);
+      return false;
+    }
+    string opened;
+    if (!c.decrypt_init(aad, aad_len)
+        || !c.decrypt_update(cipher, cipher_size, chunk, &n))
+      return false;
+    opened.append((char *)chunk, n);
+    if (!c.decrypt_final(chunk, &n))
+      return false;
+    opened.append((char *)chunk, n);
+    if (opened != string((char *)plain, msg_size)) {
+      printf("%s() error, line: %d, %s streamed aad decrypt failed\n",
+             __func__,
+             __LINE__,
+             alg);
+      return false;
+    }
+    if (print_all)
+      printf("%s: aad, in place and streaming agree\n", alg);
+  }
+  return true;
+}
+
 bool test_public_keys(bool print_all) {
 
   RSA *r1 = RSA_new();
@@ -561,9 +1096,8 @@ bool test_public_keys(bool print_all) {
     printf("\n");
   }
 #if 1
-  // TODO: sometimes this faults
   if (!ecc_verify(Digest_method_sha_256,
-                  ecc_key,
+                  ecc_key2,
                   size_data,
                   data,
                   size_out,
@@ -852,6 +1386,212 @@ bool test_key_translation(bool print_all) {
   return true;
 }
 
+static void pkey_cache_getter(pkey_cache *      cache,
+                              key_message *     keys,
+                              int               num_keys,
+                              int               rounds,
+                              std::atomic<int> *failures) {
+  for (int i = 0; i < rounds; i++) {
+    EVP_PKEY *pkey = cache->get(keys[i % num_keys]);
+    if (pkey == nullptr) {
+      (*failures)++;
+      continue;
+    }
+    EVP_PKEY_free(pkey);
+  }
+}
+
+static bool sign_and_verify_claims(const key_message &key,
+                                   const key_message &public_key,
+                                   int                rounds) {
+  entity_message subj;
+  if (!make_key_entity(public_key, &subj))
+    return false;
+  string     verb("is-trusted");
+  vse_clause cl;
+  if (!make_unary_vse_clause(subj, verb, &cl))
+    return false;
+  string serialized_cl;
+  cl.SerializeToString(&serialized_cl);
+
+  time_point t_nb;
+  time_point t_na;
+  time_now(&t_nb);
+  add_interval_to_time_point(t_nb, 24.0, &t_na);
+  string nb;
+  string na;
+  time_to_string(t_nb, &nb);
+  time_to_string(t_na, &na);
+  string        format("vse-clause");
+  string        descriptor("pkey cache test");
+  claim_message claim;
+  if (!make_claim(serialized_cl.size(),
+                  (byte *)serialized_cl.data(),
+                  format,
+                  descriptor,
+                  nb,
+                  na,
+                  &claim))
+    return false;
+
+  for (int i = 0; i < rounds; i++) {
+    signed_claim_message sc;
+    if (!make_signed_claim(Enc_method_ecc_256_sha256_pkcs_sign,
+                           claim,
+                           key,
+                           &sc))
+      return false;
+    if (!verify_signed_claim(sc, public_key))
+      return false;
+  }
+  return true;
+}
+
+bool test_pkey_cache(bool print_all) {
+  const int   num_keys = 3;
+  key_message keys[num_keys];
+  if (!make_certifier_rsa_key(2048, &keys[0])
+      || !make_certifier_ecc_key(256, &keys[1])
+      || !private_key_to_public_key(keys[1], &keys[2])) {
+    printf("%s() error, line: %d, can't make keys\n", __func__, __LINE__);
+    return false;
+  }
+  keys[0].set_key_name("cache-rsa-key");
+  keys[1].set_key_name("cache-ecc-key");
+  keys[2].set_key_name("cache-ecc-public-key");
+
+  pkey_cache cache(2);
+  EVP_PKEY * p1 = cache.get(keys[0]);
+  EVP_PKEY * p2 = cache.get(keys[0]);
+  if (p1 == nullptr || p1 != p2 || cache.hits() != 1 || cache.misses() != 1) {
+    printf("%s() error, line: %d, repeated get didn't hit\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  EVP_PKEY_free(p2);
+
+  // The name isn't part of the key.
+  key_message renamed(keys[0]);
+  renamed.set_key_name("another-name");
+  p2 = cache.get(renamed);
+  if (p2 != p1 || cache.hits() != 2) {
+    printf("%s() error, line: %d, renamed key missed\n", __func__, __LINE__);
+    return false;
+  }
+  EVP_PKEY_free(p2);
+
+  // The format is part of the key too, so a hit can't skip the format
+  // check.
+  key_message reformatted(keys[0]);
+  reformatted.set_key_format("not-a-vse-key");
+  if (cache.get(reformatted) != nullptr) {
+    printf("%s() error, line: %d, bad format hit\n", __func__, __LINE__);
+    return false;
+  }
+
+  // Private and public halves are different entries, and the third key
+  // evicts the least recently used one.
+  EVP_PKEY *p3 = cache.get(keys[1]);
+  EVP_PKEY *p4 = cache.get(keys[2]);
+  if (p3 == nullptr || p4 == nullptr || p3 == p4 || cache.num_entries() != 2) {
+    printf("%s() error, line: %d, bad entries\n", __func__, __LINE__);
+    return false;
+  }
+  EVP_PKEY_free(p3);
+  EVP_PKEY_free(p4);
+  uint64_t misses = cache.misses();
+  p2 = cache.get(keys[0]);
+  if (p2 == nullptr || cache.misses() != misses + 1) {
+    printf("%s() error, line: %d, evicted key hit\n", __func__, __LINE__);
+    return false;
+  }
+  // p1 outlives its eviction.
+  if (EVP_PKEY_get_bits(p1) != 2048) {
+    printf("%s() error, line: %d, evicted key freed\n", __func__, __LINE__);
+    return false;
+  }
+  EVP_PKEY_free(p1);
+  EVP_PKEY_free(p2);
+
+  // Without private keys, keys[0] goes and keys[1] isn't kept.
+  cache.set_cache_private_keys(false);
+  int public_entries = cache.num_entries();
+  p3 = cache.get(keys[1]);
+  if (public_entries != 1 || p3 == nullptr || cache.num_entries() != 1) {
+    printf("%s() error, line: %d, private key cached\n", __func__, __LINE__);
+    return false;
+  }
+  EVP_PKEY_free(p3);
+  cache.set_cache_private_keys(true);
+
+  key_message bad;
+  bad.set_key_type("no-such-key-type");
+  if (cache.get(bad) != nullptr) {
+    printf("%s() error, line: %d, bad key translated\n", __func__, __LINE__);
+    return false;
+  }
+
+  const int        num_threads = 4;
+  const int        rounds = 1000;
+  std::atomic<int> failures(0);
+  std::thread *    threads[num_threads];
+  cache.clear();
+  for (int i = 0; i < num_threads; i++) {
+    threads[i] = new std::thread(pkey_cache_getter,
+                                 &cache,
+                                 keys,
+                                 num_keys,
+                                 rounds,
+                                 &failures);
+  }
+  for (int i = 0; i < num_threads; i++) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  if (failures != 0) {
+    printf("%s() error, line: %d, %d concurrent gets failed\n",
+           __func__,
+           __LINE__,
+           (int)failures);
+    return false;
+  }
+
+  // Claims go through the shared cache.
+  const int claim_rounds = 200;
+  uint64_t  hits = key_cache().hits();
+  auto      start = std::chrono::steady_clock::now();
+  if (!sign_and_verify_claims(keys[1], keys[2], claim_rounds)) {
+    printf("%s() error, line: %d, cached claims failed\n", __func__, __LINE__);
+    return false;
+  }
+  auto cached_time = std::chrono::steady_clock::now() - start;
+  if (key_cache().hits() < hits + 2 * (claim_rounds - 1)) {
+    printf("%s() error, line: %d, claims didn't use the cache\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  key_cache().set_max_entries(0);
+  start = std::chrono::steady_clock::now();
+  bool uncached_ok = sign_and_verify_claims(keys[1], keys[2], claim_rounds);
+  auto uncached_time = std::chrono::steady_clock::now() - start;
+  key_cache().set_max_entries(default_pkey_cache_size);
+  if (!uncached_ok || key_cache().num_entries() != 0) {
+    printf("%s() error, line: %d, uncached claims failed\n", __func__, __LINE__);
+    return false;
+  }
+
+  if (print_all) {
+    printf("%d ecc-256 sign and verify: %.3f ms cached, %.3f ms uncached\n",
+           claim_rounds,
+           std::chrono::duration<double, std::milli>(cached_time).count(),
+           std::chrono::duration<double, std::milli>(uncached_time).count());
+  }
+  return true;
+}
+
 bool test_time(bool print_all) {
   time_point t_now;
   time_point t_test;
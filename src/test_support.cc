@@ -13,6 +13,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <chrono>
+
 #include "certifier.h"
 #include "support.h"
 #ifdef SEV_SNP
@@ -651,6 +653,123 @@ bool test_partial_local_certify(bool print_all) {
   return test__local_certify(enclave_type, false, unused, evidence_descriptor);
 }
 
+bool test_validate_evidence_batch(bool print_all) {
+  string enclave_type("simulated-enclave");
+  string evidence_descriptor("full-vse-support");
+  string unused("Unused-file-name");
+  string purpose("authentication");
+
+  signed_claim_sequence trusted_measurements;
+  signed_claim_sequence trusted_platforms;
+  key_message           policy_key;
+  key_message           policy_pk;
+  evidence_package      evp;
+  evp.set_prover_type("vse-verifier");
+  if (!construct_standard_evidence_package(enclave_type,
+                                           false,
+                                           unused,
+                                           evidence_descriptor,
+                                           &trusted_platforms,
+                                           &trusted_measurements,
+                                           &policy_key,
+                                           &policy_pk,
+                                           &evp))
+    return false;
+  trusted_policy_index index;
+  if (!index.build(trusted_platforms, trusted_measurements))
+    return false;
+
+  // Mostly good packages, one with altered evidence and one with a
+  // descriptor no proof is constructed for.
+  const int        n = 16;
+  const int        altered = 5;
+  const int        unknown = 11;
+  string           descriptors[n];
+  string           purposes[n];
+  evidence_package packages[n];
+  for (int i = 0; i < n; i++) {
+    descriptors[i] = evidence_descriptor;
+    purposes[i] = purpose;
+    packages[i].CopyFrom(evp);
+  }
+  string *ev = packages[altered].mutable_fact_assertion(0)
+                   ->mutable_serialized_evidence();
+  (*ev)[ev->size() - 1] ^= 1;
+  descriptors[unknown] = "no-such-evidence";
+
+  bool *expected = new bool[n];
+  for (int i = 0; i < n; i++) {
+    evidence_package p(packages[i]);
+    expected[i] =
+        validate_evidence(descriptors[i], index, purposes[i], p, policy_pk);
+  }
+
+  bool              ret = false;
+  const int         num_runs = 2;
+  int               threads[num_runs] = {1, 0};
+  evidence_verdict *verdicts = new evidence_verdict[n];
+  for (int r = 0; r < num_runs; r++) {
+    for (int i = 0; i < n; i++)
+      verdicts[i] = evidence_verdict();
+    auto start = std::chrono::steady_clock::now();
+    int  num_valid = validate_evidence_batch(n,
+                                            descriptors,
+                                            purposes,
+                                            packages,
+                                            index,
+                                            policy_pk,
+                                            threads[r],
+                                            verdicts);
+    std::chrono::duration<double, std::milli> wall =
+        std::chrono::steady_clock::now() - start;
+    if (num_valid != n - 2) {
+      printf("%s() error, line: %d, %d of %d valid\n",
+             __func__,
+             __LINE__,
+             num_valid,
+             n);
+      goto done;
+    }
+    double totals[num_validation_stages] = {0.0};
+    for (int i = 0; i < n; i++) {
+      if (verdicts[i].valid != expected[i]
+          || (verdicts[i].valid && verdicts[i].failed_stage != -1)) {
+        printf("%s() error, line: %d, verdict %d\n", __func__, __LINE__, i);
+        goto done;
+      }
+      for (int s = 0; s < num_validation_stages; s++) {
+        if (verdicts[i].stage_ms[s] < 0.0)
+          goto done;
+        totals[s] += verdicts[i].stage_ms[s];
+      }
+    }
+    if (verdicts[altered].failed_stage != validation_stage_evidence
+        || verdicts[unknown].failed_stage != validation_stage_construct) {
+      printf("%s() error, line: %d, wrong failing stages %s, %s\n",
+             __func__,
+             __LINE__,
+             validation_stage_name(verdicts[altered].failed_stage),
+             validation_stage_name(verdicts[unknown].failed_stage));
+      goto done;
+    }
+    if (print_all) {
+      printf("%d packages on %s: %.3f ms;",
+             n,
+             threads[r] == 1 ? "one thread" : "all cores",
+             wall.count());
+      for (int s = 0; s < num_validation_stages; s++)
+        printf(" %s %.3f ms", validation_stage_name(s), totals[s]);
+      printf("\n");
+    }
+  }
+  ret = true;
+
+done:
+  delete[] expected;
+  delete[] verdicts;
+  return ret;
+}
+
 // constrained delegation test
 
 bool construct_standard_constrained_evidence_package(
@@ -0,0 +1,115 @@
+//  Copyright (c) 2021-22, VMware Inc, and the Certifier Authors.  All rights
+//  reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// make_policy_snapshot.exe --input=policy.bin
+//     --policy_key_file=policy_key_file.bin --policy_version=1
+//     --output=policy_snapshot.bin
+//
+// input is packaged claims, as made by package_claims.exe or
+// policy_generator.exe.
+
+#include <gflags/gflags.h>
+#include "certifier.h"
+#include "support.h"
+
+using namespace certifier::utilities;
+
+DEFINE_bool(print_all, false, "verbose");
+DEFINE_string(input, "policy.bin", "packaged policy claims");
+DEFINE_string(policy_key_file, "policy_key_file.bin", "policy private key");
+DEFINE_uint64(policy_version, 1, "policy version");
+DEFINE_string(output, "policy_snapshot.bin", "output file");
+
+bool get_key_from_file(const string &in, key_message *k) {
+  string k_str;
+  if (!read_file_into_string(in, &k_str)) {
+    printf("Can't read %s\n", in.c_str());
+    return false;
+  }
+  if (!k->ParseFromString(k_str)) {
+    printf("Can't parse key\n");
+    return false;
+  }
+  return true;
+}
+
+bool get_policy_from_file(const string &in, signed_claim_sequence *policy) {
+  string          all_bufs;
+  buffer_sequence seq;
+  if (!read_file_into_string(in, &all_bufs)) {
+    printf("Can't read %s\n", in.c_str());
+    return false;
+  }
+  if (!seq.ParseFromString(all_bufs)) {
+    printf("Can't deserialize %s\n", in.c_str());
+    return false;
+  }
+  for (int i = 0; i < seq.block_size(); i++) {
+    if (!policy->add_claims()->ParseFromString(seq.block(i))) {
+      printf("Can't parse claim %d\n", i);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int an, char **av) {
+  gflags::ParseCommandLineFlags(&an, &av, true);
+  an = 1;
+
+  key_message policy_key;
+  if (!get_key_from_file(FLAGS_policy_key_file, &policy_key)) {
+    printf("Can't get policy key\n");
+    return 1;
+  }
+  signed_claim_sequence policy;
+  if (!get_policy_from_file(FLAGS_input, &policy)) {
+    printf("Can't get policy\n");
+    return 1;
+  }
+
+  if (!write_policy_snapshot(policy,
+                             policy_key,
+                             FLAGS_policy_version,
+                             FLAGS_output)) {
+    printf("Can't make snapshot\n");
+    return 1;
+  }
+
+  // Check it loads as a verifier would load it.
+  key_message     policy_pk;
+  policy_snapshot snapshot;
+  if (!private_key_to_public_key(policy_key, &policy_pk)
+      || !snapshot.load(FLAGS_output, policy_pk)) {
+    printf("Can't load %s\n", FLAGS_output.c_str());
+    return 1;
+  }
+  printf("%s: %d claims, policy version %llu\n",
+         FLAGS_output.c_str(),
+         snapshot.num_clauses(),
+         (unsigned long long)snapshot.policy_version());
+  if (FLAGS_print_all) {
+    for (int i = 0; i < snapshot.num_clauses(); i++) {
+      vse_clause cl;
+      if (!snapshot.clause(i, &cl))
+        return 1;
+      printf("%d: ", i + 1);
+      print_vse_clause(cl);
+      printf("\n");
+    }
+  }
+
+  return 0;
+}
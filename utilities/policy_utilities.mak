@@ -76,6 +76,8 @@ package_claims_obj = $(O)/package_claims.o $(common_objs)
 
 print_packaged_claims_obj = $(O)/print_packaged_claims.o $(common_objs)
 
+make_policy_snapshot_obj = $(O)/make_policy_snapshot.o $(common_objs)
+
 embed_policy_key_obj=$(O)/embed_policy_key.o
 
 make_platform_obj = $(O)/make_platform.o $(common_objs)
@@ -102,6 +104,7 @@ all:	$(EXE_DIR)/measurement_utility.exe \
 	    $(EXE_DIR)/make_environment.exe \
 	    $(EXE_DIR)/package_claims.exe \
 	    $(EXE_DIR)/print_packaged_claims.exe \
+	    $(EXE_DIR)/make_policy_snapshot.exe \
 	    $(EXE_DIR)/embed_policy_key.exe \
 	    $(EXE_DIR)/combine_properties.exe \
 	    $(EXE_DIR)/sample_sev_key_generation.exe \
@@ -225,6 +228,14 @@ print_packaged_claims.o: $(S)/print_packaged_claims.cc $(INC_DIR)/certifier.pb.h
 	@echo "\ncompiling $<"
 	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
 
+$(EXE_DIR)/make_policy_snapshot.exe: $(make_policy_snapshot_obj)
+	@echo "\nlinking executable $@"
+	$(LINK) -o $(EXE_DIR)/make_policy_snapshot.exe $(make_policy_snapshot_obj) $(LDFLAGS)
+
+$(O)/make_policy_snapshot.o: $(S)/make_policy_snapshot.cc $(INC_DIR)/certifier.pb.h $(INC_DIR)/certifier.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
 $(EXE_DIR)/embed_policy_key.exe: $(embed_policy_key_obj)
 	@echo "\nlinking executable $@"
 	$(LINK) -o $(EXE_DIR)/embed_policy_key.exe $(embed_policy_key_obj) $(LDFLAGS)